@@ -0,0 +1,289 @@
+/*  open2300 - bench2300.c
+ *
+ *  Version 1.11
+ *
+ *  Benchmark of the open2300 protocol stack against emu2300
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#include "rw2300.h"
+
+#define BENCH_ADDRESS 0x0346     // temperatures, read by every tool
+#define WRITE_ADDRESS WS2300_MEMSIZE  // not station memory, see main
+
+static double seconds_per_test = 2;
+
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("bench2300 - Time the protocol stack against the station emulator\n");
+	printf("emu2300. Do not run it against a real station, it writes nibbles.\n");
+	printf("Version %s (C)2003-2006 Kenneth Lavrsen.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("bench2300 config_filename [seconds_per_test]\n");
+	printf("Prints one \"metric value unit\" line per result.\n");
+	exit(0);
+}
+
+
+/********************************************************************
+ * now returns a monotonic time in seconds
+ ********************************************************************/
+double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/********************************************************************
+ * bench_read times read_safe of 'bytes' bytes until the time for
+ * one test is up and prints the transactions per second
+ ********************************************************************/
+void bench_read(WEATHERSTATION ws2300, int bytes)
+{
+	unsigned char data[MAXREADBYTES];
+	unsigned char command[25];
+	double start = now(), elapsed;
+	long count = 0;
+
+	do
+	{
+		if (read_safe(ws2300, BENCH_ADDRESS, bytes, data, command) != bytes)
+			read_error_exit();
+		count++;
+	} while ((elapsed = now() - start) < seconds_per_test);
+
+	printf("read_safe_%d %.1f tx/s\n", bytes, count / elapsed);
+}
+
+
+/********************************************************************
+ * bench_write times write_safe of single nibbles
+ ********************************************************************/
+void bench_write(WEATHERSTATION ws2300)
+{
+	unsigned char data[1];
+	unsigned char command[25];
+	double start = now(), elapsed;
+	long count = 0;
+
+	do
+	{
+		data[0] = count & 0xF;
+		if (write_safe(ws2300, WRITE_ADDRESS, 1, WRITENIB, data, command) != 1)
+			write_error_exit();
+		count++;
+	} while ((elapsed = now() - start) < seconds_per_test);
+
+	printf("write_safe_1 %.1f tx/s\n", count / elapsed);
+}
+
+
+/********************************************************************
+ * bench_snapshot times the bulk read all current values take, the
+ * same as fetch2300 does
+ ********************************************************************/
+void bench_snapshot(WEATHERSTATION ws2300)
+{
+	static struct ws_snapshot snap;
+	double start = now(), elapsed;
+	int count = 0;
+
+	do
+	{
+		if (snapshot_take(ws2300, &snap) < 0)
+			read_error_exit();
+		count++;
+	} while ((elapsed = now() - start) < seconds_per_test);
+
+	printf("snapshot %.2f ms\n", elapsed / count * 1000);
+	printf("snapshot_transactions %d tx\n", snap.transactions);
+}
+
+
+/********************************************************************
+ * bench_history times reading all history records one by one like
+ * histlog2300 does after a long break
+ ********************************************************************/
+void bench_history(WEATHERSTATION ws2300, struct config_type *config)
+{
+	double temperature_in, temperature_out, pressure, rain;
+	double windspeed, winddir, dewpoint, windchill;
+	int humidity_in, humidity_out;
+	struct timestamp time_last;
+	int interval, countdown, records;
+	double start = now();
+	int i;
+
+	read_history_info(ws2300, &interval, &countdown, &time_last, &records);
+
+	for (i = 0; i < HISTORY_RECORDS; i++)
+	{
+		read_history_record(ws2300, i, config, &temperature_in,
+		                    &temperature_out, &pressure, &humidity_in,
+		                    &humidity_out, &rain, &windspeed, &winddir,
+		                    &dewpoint, &windchill);
+	}
+
+	printf("history_%d %.2f ms\n", HISTORY_RECORDS, (now() - start) * 1000);
+}
+
+
+/********************************************************************
+ * bench_history_bulk times the same with read_history_bulk
+ ********************************************************************/
+void bench_history_bulk(WEATHERSTATION ws2300, struct config_type *config)
+{
+	static struct history_raw records[HISTORY_RECORDS];
+	double temperature_in, temperature_out, pressure, rain;
+	double windspeed, winddir, dewpoint, windchill;
+	int humidity_in, humidity_out;
+	double start = now();
+	int i;
+
+	if (read_history_bulk(ws2300, 0, HISTORY_RECORDS, records) < 0)
+		read_error_exit();
+
+	for (i = 0; i < HISTORY_RECORDS; i++)
+	{
+		decode_history_record(&records[i], config, &temperature_in,
+		                      &temperature_out, &pressure, &humidity_in,
+		                      &humidity_out, &rain, &windspeed, &winddir,
+		                      &dewpoint, &windchill);
+	}
+
+	printf("history_bulk_%d %.2f ms\n", HISTORY_RECORDS, (now() - start) * 1000);
+}
+
+
+/********************************************************************
+ * bench_decode times decoding the same records one by one with
+ * decode_history_record and all at once with decode_history_batch.
+ * The station is not used, the records are made up so every value
+ * and both windchill and dewpoint branches occur.
+ ********************************************************************/
+void bench_decode(struct config_type *config)
+{
+	static struct history_raw records[HISTORY_RECORDS];
+	static unsigned char data[HISTORY_RECORDS * HISTORY_DATA_BYTES];
+	static double temperature_in[HISTORY_RECORDS], temperature_out[HISTORY_RECORDS];
+	static double pressure[HISTORY_RECORDS], rain[HISTORY_RECORDS];
+	static double windspeed[HISTORY_RECORDS], winddir[HISTORY_RECORDS];
+	static double dewpoint[HISTORY_RECORDS], windchill[HISTORY_RECORDS];
+	static int humidity_in[HISTORY_RECORDS], humidity_out[HISTORY_RECORDS];
+	struct history_columns columns = { temperature_in, temperature_out, pressure,
+	                                   humidity_in, humidity_out, rain, windspeed,
+	                                   winddir, dewpoint, windchill };
+	double start, elapsed;
+	long count;
+	int i, k;
+
+	srand(1);
+	for (i = 0; i < HISTORY_RECORDS; i++)
+	{
+		records[i].record = i;
+		for (k = 0; k < HISTORY_RECORD_NIBBLES; k++)
+			records[i].nibble[k] = rand() % 10;
+		records[i].nibble[10] = 1 + rand() % 9;  // humidity 10-99
+	}
+
+	count = 0;
+	start = now();
+	do
+	{
+		for (i = 0; i < HISTORY_RECORDS; i++)
+			decode_history_record(&records[i], config, &temperature_in[i],
+			                      &temperature_out[i], &pressure[i],
+			                      &humidity_in[i], &humidity_out[i], &rain[i],
+			                      &windspeed[i], &winddir[i], &dewpoint[i],
+			                      &windchill[i]);
+		count += HISTORY_RECORDS;
+	} while ((elapsed = now() - start) < seconds_per_test);
+
+	printf("decode_record %.1f ns/record\n", elapsed / count * 1e9);
+
+	count = 0;
+	start = now();
+	do
+	{
+		history_raw_pack(records, HISTORY_RECORDS, data);
+		decode_history_batch(data, HISTORY_RECORDS, config, &columns);
+		count += HISTORY_RECORDS;
+	} while ((elapsed = now() - start) < seconds_per_test);
+
+	printf("decode_batch %.1f ns/record\n", elapsed / count * 1e9);
+}
+
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * bench2300 runs each test for seconds_per_test seconds (default 2)
+ * and prints one line per result, "metric value unit", so results of
+ * different commits or config settings can be compared by a script.
+ * "make bench" starts emu2300 and runs it.
+ *
+ * The cache and prefetch are off so every call goes to the station.
+ * Writes go just past the end of the station memory, which emu2300
+ * keeps like any other address.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	WEATHERSTATION ws2300;
+	struct config_type config;
+	struct link_stats stats;
+	static const int sizes[] = { 1, 2, 8, 15 };
+	int i;
+
+	if (argc < 2 || argc > 3)
+		print_usage();
+
+	if (argc == 3 && (seconds_per_test = atof(argv[2])) <= 0)
+		print_usage();
+
+	get_configuration(&config, argv[1]);
+
+	ws2300 = open_weatherstation(config.serial_device_name);
+	configure_weatherstation(ws2300, &config);
+	cache_enable(ws2300, 0);
+
+	printf("# bench2300 %s transport %s seconds_per_test %g\n", VERSION,
+	       config.transport_mode == TRANSPORT_PIPELINED ? "pipelined" : "lockstep",
+	       seconds_per_test);
+
+	for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+		bench_read(ws2300, sizes[i]);
+
+	bench_write(ws2300);
+	bench_snapshot(ws2300);
+	bench_history(ws2300, &config);
+	bench_history_bulk(ws2300, &config);
+	bench_decode(&config);
+
+	get_link_stats(ws2300, &stats);
+	printf("transactions %lu tx\n", stats.transactions);
+	printf("failures %lu tx\n", stats.failures);
+	printf("resets_issued %lu resets\n", stats.resets_issued);
+
+	close_weatherstation(ws2300);
+
+	return(0);
+}
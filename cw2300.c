@@ -23,6 +23,7 @@
  */
 
 #include "rw2300.h"
+#include "out2300.h"
 
 #define CW_SOFTWARETYPE   "open2300v"
 #define DEBUG 0  // wu2300 stops writing to standard out if setting this to 0
@@ -41,9 +42,8 @@
 int main(int argc, char *argv[])
 {
 	WEATHERSTATION ws2300;
-	char aprsline[3000] = "";
-	char tempstring[1000] = "";
-	char datestring[50];        //used to hold the date stamp for the log file
+	char aprsdata[512];         //the APRS record
+	struct out_buffer aprs;
 	time_t basictime;
 	struct config_type config;
 	double tempfloat1, tempfloat2;
@@ -56,62 +56,67 @@ int main(int argc, char *argv[])
 		printf("Cannot open serial device %s\n",config.serial_device_name);
  		exit(-1);
 	}
+	configure_weatherstation(ws2300, &config);
 
 	/* GET DATE AND TIME FOR the WX record in UTC */
 	time(&basictime);
 	basictime = basictime - atof(config.timezone) * 60 * 60;
-	strftime(datestring, sizeof(datestring), "@%d%H%Mz",localtime(&basictime));
 
 	/* BUILD THE DATA STRING, START WITH URL, ID AND PASSWORD */
-	sprintf(aprsline, "%s>APRS,TCPXX*,qAX,%s:%s%s/%s",
-	        config.citizen_weather_id, config.citizen_weather_id, // Build weather record
-	        datestring,                                           // Add date time 
-	        config.citizen_weather_latitude, config.citizen_weather_longitude); // Add Lat Lon
+	out_init(&aprs, aprsdata, sizeof(aprsdata));
+	out_text(&aprs, config.citizen_weather_id);                 // Build weather record
+	out_text(&aprs, ">APRS,TCPXX*,qAX,");
+	out_text(&aprs, config.citizen_weather_id);
+	out_char(&aprs, ':');
+	out_time(&aprs, "@%d%H%Mz", basictime);                     // Add date time
+	out_text(&aprs, config.citizen_weather_latitude);           // Add Lat Lon
+	out_char(&aprs, '/');
+	out_text(&aprs, config.citizen_weather_longitude);
 
 
 	/* READ WIND DIRECTION (_) AND SPEED (/) - wind data must be mph for CWOP  */
 	tempfloat1 = wind_current(ws2300, MILES_PER_HOUR, &tempfloat2); // Fetch current wind data
-	sprintf(tempstring,"_%03.0f/%03.0f", tempfloat2, tempfloat1);  // _wind dir degrees/wind speed mph
-	strcat(aprsline, tempstring);
+	out_format(&aprs, "_%03.0f/%03.0f", tempfloat2, tempfloat1);  // _wind dir degrees/wind speed mph
 
 	/* WIND GUST */
 	/* This requires that you reset the station regularly */
 	/* Uncomment the two lines below to activate wind gust     */
-//	sprintf(aprsline, "%sg%03.0f", aprsline,
-//	        wind_minmax(ws2300, MILES_PER_HOUR, NULL, NULL, NULL, NULL));
+//	out_format(&aprs, "g%03.0f",
+//	           wind_minmax(ws2300, MILES_PER_HOUR, NULL, NULL, NULL, NULL));
 
 	/* READ TEMPERATURE OUTDOOR t - Force deg F for CWOP */
-	sprintf(tempstring, "t%03.0f", temperature_outdoor(ws2300, FAHRENHEIT));
-	strcat(aprsline, tempstring);
+	out_format(&aprs, "t%03.0f", temperature_outdoor(ws2300, FAHRENHEIT));
 
 	/* READ RAIN 1H r - force inches for CWOP*/
-	sprintf(tempstring,"r%03.0f", rain_1h(ws2300, INCHES) *100); // hundredths of an inch
-	strcat(aprsline, tempstring);
+	out_format(&aprs, "r%03.0f", rain_1h(ws2300, INCHES) *100); // hundredths of an inch
 
 	/* READ RAIN 24H p */
-	sprintf(tempstring,"p%03.0f", rain_24h(ws2300, INCHES) *100); // hundredths of an inch
-	strcat(aprsline, tempstring);
+	out_format(&aprs, "p%03.0f", rain_24h(ws2300, INCHES) *100); // hundredths of an inch
 
 	/* RAIN SINCE MIDNIGHT P */
 	// not directly readable in LaCrosse
 
 	/* READ RELATIVE HUMIDITY OUTDOOR */
-	sprintf(tempstring, "h%02d", humidity_outdoor(ws2300));
-	strcat(aprsline, tempstring);
+	out_char(&aprs, 'h');
+	out_int_zero(&aprs, humidity_outdoor(ws2300), 2);
 
 	/* READ BAROMETRIC PRESSURE b */
-	sprintf(tempstring,"b%05.0f", (rel_pressure(ws2300, MILLIBARS) *10)); // tenths of milibars
-	strcat(aprsline, tempstring);
+	out_format(&aprs, "b%05.0f", (rel_pressure(ws2300, MILLIBARS) *10)); // tenths of milibars
 
 	/* ADD SOFTWARE TYPE AND ACTION  */
-	sprintf(tempstring,".%s%s", CW_SOFTWARETYPE, VERSION);
-	strcat(aprsline, tempstring);
+	out_text(&aprs, "." CW_SOFTWARETYPE VERSION);
 
 	/* MAKE WEATHER STATION AVAILABLE FOR OTHER PROGRAMS */
 	close_weatherstation(ws2300);
 
 	/* CONNECT TO SERVER AND SEND THE RECORD */
-	if (citizen_weather_send(&config, aprsline) != 0)
+	if (aprs.overflow)
+	{
+		fprintf(stderr, "cw2300: the record is too long\n");
+		exit(-1);
+	}
+
+	if (citizen_weather_send(&config, aprs.data) != 0)
 	{
 		perror("Could not send data to Citizen Weather!\n");
 		exit(-1);
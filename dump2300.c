@@ -53,6 +53,9 @@ int main(int argc, char *argv[])
 	FILE *fileptr;
 	unsigned char data[20];
 	unsigned char command[25]; //room for write data also
+	static unsigned char nibble[0x2000 + 2 * 15];
+	const struct field_descriptor *field;
+	double value;
 	int i, j;
 	int address, start_adr, end_adr;
 	int bytes = 15;
@@ -68,6 +71,7 @@ int main(int argc, char *argv[])
 	// Setup serial port
 
 	ws2300 = open_weatherstation(config.serial_device_name);
+	configure_weatherstation(ws2300, &config);
 
 
 	// Get in-data and select mode.
@@ -132,9 +136,31 @@ int main(int argc, char *argv[])
 			       address+2*i,data[i]);
 			fprintf(fileptr,"A: %04X|%04X - D: %02X\n",address+2*i+1,
 			        address+2*i,data[i]);
+			nibble[address + 2 * i] = data[i] & 0xF;
+			nibble[address + 2 * i + 1] = data[i] >> 4;
 		}
 	}
 
+	// Decode the known fields that were dumped completely
+	printf("\n");
+	for (i = 0; i < field_count; i++)
+	{
+		field = &field_table[i];
+		if (field->address < start_adr ||
+		    field->address + field->nibbles - 1 > end_adr)
+			continue;
+
+		value = decode_field(nibble + field->address, field);
+		if (field->encoding == FIELD_BITS)
+			printf("%04X %-40s %X  (%s)\n", field->address, field->name,
+			       (int)value, field->description);
+		else if (field->encoding == FIELD_TIMESTAMP)
+			printf("%04X %-40s %010.0f\n", field->address, field->name, value);
+		else
+			printf("%04X %-40s %g %s\n", field->address, field->name,
+			       value, field->unit);
+	}
+
 	// Goodbye and Goodnight
 	close_weatherstation(ws2300);
 
@@ -53,6 +53,29 @@ int main(int argc, char *argv[])
 	printf("pgsql_connect\t%s\n",                config.pgsql_connect);
 	printf("pgsql_table\t%s\n",                  config.pgsql_table);
 	printf("pgsql_station\t%s\n",                config.pgsql_station);
+	printf("pgsql_batch\t%d\n",                  config.pgsql_batch);
+	printf("pgsql_flush\t%d\n",                  config.pgsql_flush);
+	printf("sqlite_journal_mode\t%s\n",          config.sqlite_journal_mode);
+	printf("sqlite_synchronous\t%s\n",           config.sqlite_synchronous);
+	printf("sqlite_ignore_duplicates\t%d\n",     config.sqlite_ignore_duplicates);
+	printf("transport_mode\t%d\n",               config.transport_mode);
+	printf("timeout_ack\t%d\n",                  config.timeout_ack);
+	printf("timeout_data\t%d\n",                 config.timeout_data);
+	printf("timeout_reset\t%d\n",                config.timeout_reset);
+	printf("idle_timeout\t%d\n",                 config.idle_timeout);
+	printf("cache\t%d\n",                        config.cache);
+	printf("daemon_socket\t%s\n",                config.daemon_socket);
+	printf("daemon_poll\t%d\n",                  config.daemon_poll);
+	printf("publish_file\t%s\n",                 config.publish_file);
+	printf("log_store\t%s\n",                    config.log_store);
+	printf("log_index\t%d\n",                    config.log_index);
+	printf("rollup\t%d\n",                       config.rollup);
+	for(i = 0; i < config.num_history_sinks; i++)
+	{
+		printf("history_sink %d\t%s %s %s\n", i, config.history_sink[i].type,
+		       config.history_sink[i].target, config.history_sink[i].cursor);
+	}
+	printf("history_queue\t%d\n",                config.history_queue);
 
 	return(EXIT_SUCCESS);
 }
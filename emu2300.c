@@ -0,0 +1,369 @@
+/*  open2300 - emu2300.c
+ *
+ *  Version 1.11
+ *
+ *  WS2300 station emulator on a pseudo terminal for testing and
+ *  benchmarking the open2300 programs without a weather station
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#define _XOPEN_SOURCE 600     // posix_openpt and friends
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <termios.h>
+#include "rw2300.h"
+
+struct emulator
+{
+	unsigned char memory[0x10000];   // one nibble per byte
+	int latency;                     // microseconds before each byte sent
+	double drop;                     // chance a byte sent is lost, 0-1
+	double corrupt;                  // chance a read checksum is wrong, 0-1
+	int verbose;
+	int address_nibbles;             // address nibbles received so far
+	int address;
+	unsigned long resets, reads, writes, bytes_in, bytes_out;
+	unsigned long dropped, corrupted, rejected;
+};
+
+static struct emulator emu;
+static volatile sig_atomic_t stop;
+
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("emu2300 - Emulate a WS-2300 on a pseudo terminal. Point SERIAL_DEVICE\n");
+	printf("at the link (or the pty printed at start) to use the programs with it.\n");
+	printf("Version %s (C)2003-2006 Kenneth Lavrsen.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("emu2300 [options] dumpfile [link]\n");
+	printf("dumpfile is a memory image as written by bin2300, '-' for all zeros\n");
+	printf("  -a address   dump starts at this nibble address (hex), default 0\n");
+	printf("  -l usec      latency before each byte sent, 4170 is like 2400 baud\n");
+	printf("  -d percent   chance that a byte sent is lost\n");
+	printf("  -c percent   chance that the checksum of a read is wrong\n");
+	printf("  -s seed      seed of the random faults\n");
+	printf("  -v           print every command\n");
+	exit(0);
+}
+
+
+/********************************************************************
+ * stop_handler ends the main loop on SIGTERM and SIGINT
+ ********************************************************************/
+void stop_handler(int signum)
+{
+	stop = 1;
+}
+
+
+/********************************************************************
+ * load_dump reads a bin2300 file, one nibble per byte, into the
+ * memory starting at 'address'
+ *
+ * Returns: number of nibbles loaded
+ ********************************************************************/
+int load_dump(char *filename, int address)
+{
+	FILE *fileptr;
+	int c, n = 0;
+
+	if (strcmp(filename, "-") == 0)
+		return 0;
+
+	if ((fileptr = fopen(filename, "rb")) == NULL)
+	{
+		printf("Cannot open file %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	while ((c = getc(fileptr)) != EOF && address + n < (int)sizeof(emu.memory))
+		emu.memory[address + n++] = c & 0xF;
+
+	fclose(fileptr);
+
+	return n;
+}
+
+
+/********************************************************************
+ * chance returns 1 with the given probability
+ ********************************************************************/
+int chance(double probability)
+{
+	return probability > 0 && rand() < probability * ((double)RAND_MAX + 1);
+}
+
+
+/********************************************************************
+ * send_bytes answers the program with latency and lost bytes
+ ********************************************************************/
+void send_bytes(int fd, unsigned char *buffer, int size)
+{
+	int i;
+
+	for (i = 0; i < size; i++)
+	{
+		if (emu.latency > 0)
+			usleep(emu.latency);
+
+		if (chance(emu.drop))
+		{
+			emu.dropped++;
+			continue;
+		}
+
+		if (write(fd, buffer + i, 1) == 1)
+			emu.bytes_out++;
+	}
+}
+
+
+/********************************************************************
+ * handle_byte carries out one byte received from the program.
+ *
+ * The station answers
+ *   0x06                        reset: 0x02, forgets the address
+ *   0x82 + 4 * nibble           address nibble k (most significant
+ *                               first): k * 16 + nibble
+ *   0xC2 + 4 * n                after 4 address nibbles, read n bytes:
+ *                               0x30 + n, the bytes and their sum
+ *   WRITENIB + 4 * nibble       after the address, write the nibble
+ *                               and move on: WRITEACK + nibble
+ *   SETBIT / UNSETBIT + 4 * bit after the address, change one bit of
+ *                               the nibble: SETACK / UNSETACK + bit
+ * Anything else is not answered and forgets the address.
+ ********************************************************************/
+void handle_byte(int fd, unsigned char byte)
+{
+	unsigned char answer[MAXREADBYTES + 2];
+	int value, i, n;
+
+	emu.bytes_in++;
+
+	if (byte == 0x06)
+	{
+		emu.resets++;
+		emu.address_nibbles = 0;
+		answer[0] = 0x02;
+		send_bytes(fd, answer, 1);
+		return;
+	}
+
+	// A new address may follow a finished write without a reset
+	if (byte >= 0x82 && byte <= 0xBE && (byte - 0x82) % 4 == 0)
+	{
+		if (emu.address_nibbles == 4)
+			emu.address_nibbles = 0;
+		value = (byte - 0x82) / 4;
+		answer[0] = emu.address_nibbles * 16 + value;
+		emu.address = (emu.address << 4 | value) & 0xFFFF;
+		emu.address_nibbles++;
+		send_bytes(fd, answer, 1);
+		return;
+	}
+
+	if (emu.address_nibbles == 4 && byte >= 0xC2 && (byte - 0xC2) % 4 == 0 &&
+	    (byte - 0xC2) / 4 <= MAXREADBYTES)
+	{
+		n = (byte - 0xC2) / 4;
+		answer[0] = 0x30 + n;
+		answer[n + 1] = 0;
+		for (i = 0; i < n; i++)
+		{
+			answer[i + 1] = emu.memory[(emu.address + 2 * i) & 0xFFFF] |
+			                emu.memory[(emu.address + 2 * i + 1) & 0xFFFF] << 4;
+			answer[n + 1] += answer[i + 1];
+		}
+
+		if (chance(emu.corrupt))
+		{
+			answer[n + 1] ^= 0x5A;
+			emu.corrupted++;
+		}
+
+		if (emu.verbose)
+			printf("read  %04X %2d\n", emu.address, n);
+
+		emu.reads++;
+		emu.address_nibbles = 0;
+		send_bytes(fd, answer, n + 2);
+		return;
+	}
+
+	if (emu.address_nibbles == 4 && (byte - 2) % 4 == 0 &&
+	    ((byte >= WRITENIB && byte <= WRITENIB + 0x3C) ||
+	     (byte >= SETBIT && byte <= SETBIT + 0x0C) ||
+	     (byte >= UNSETBIT && byte <= UNSETBIT + 0x0C)))
+	{
+		if (byte >= WRITENIB)
+		{
+			value = (byte - WRITENIB) / 4;
+			emu.memory[emu.address] = value;
+			emu.address = (emu.address + 1) & 0xFFFF;
+			answer[0] = WRITEACK + value;
+		}
+		else if (byte >= UNSETBIT)
+		{
+			value = (byte - UNSETBIT) / 4;
+			emu.memory[emu.address] &= ~(1 << value);
+			answer[0] = UNSETACK + value;
+		}
+		else
+		{
+			value = (byte - SETBIT) / 4;
+			emu.memory[emu.address] |= 1 << value;
+			answer[0] = SETACK + value;
+		}
+
+		if (emu.verbose)
+			printf("write %04X %02X\n", emu.address, byte);
+
+		emu.writes++;
+		send_bytes(fd, answer, 1);
+		return;
+	}
+
+	if (emu.verbose)
+		printf("unexpected byte %02X\n", byte);
+
+	emu.rejected++;
+	emu.address_nibbles = 0;
+}
+
+
+/********************************************************************
+ * open_pty creates the pseudo terminal in raw mode. The slave side
+ * is kept open too so the programs can come and go.
+ *
+ * Output:  slave - the open slave side
+ *
+ * Returns: file descriptor of the master side
+ ********************************************************************/
+int open_pty(int *slave)
+{
+	struct termios settings;
+	int master;
+
+	if ((master = posix_openpt(O_RDWR | O_NOCTTY)) < 0 ||
+	    grantpt(master) < 0 || unlockpt(master) < 0 ||
+	    (*slave = open(ptsname(master), O_RDWR | O_NOCTTY)) < 0)
+	{
+		perror("emu2300: cannot create pty");
+		exit(EXIT_FAILURE);
+	}
+
+	tcgetattr(*slave, &settings);
+	cfmakeraw(&settings);
+	tcsetattr(*slave, TCSANOW, &settings);
+
+	return master;
+}
+
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * emu2300 loads a memory image and answers the WS2300 protocol on a
+ * pseudo terminal until it gets SIGTERM or SIGINT, then prints what
+ * it did. Writes change the memory but are not saved.
+ *
+ * The faults make the retries and resyncs of the library testable:
+ * lost bytes make the program time out, a wrong checksum makes it
+ * read again.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	unsigned char buffer[256];
+	struct sigaction action;
+	char *link = NULL;
+	int start = 0, seed = 1;
+	int master, slave, loaded;
+	int option, ret, i;
+
+	while ((option = getopt(argc, argv, "a:l:d:c:s:v")) != -1)
+	{
+		switch (option)
+		{
+		case 'a': start = strtol(optarg, NULL, 16); break;
+		case 'l': emu.latency = atoi(optarg); break;
+		case 'd': emu.drop = atof(optarg) / 100; break;
+		case 'c': emu.corrupt = atof(optarg) / 100; break;
+		case 's': seed = atoi(optarg); break;
+		case 'v': emu.verbose = 1; break;
+		default: print_usage();
+		}
+	}
+
+	if (optind >= argc || argc - optind > 2 ||
+	    start < 0 || start >= (int)sizeof(emu.memory))
+		print_usage();
+
+	loaded = load_dump(argv[optind], start);
+	if (argc - optind == 2)
+		link = argv[optind + 1];
+
+	srand(seed);
+	master = open_pty(&slave);
+
+	if (link != NULL)
+	{
+		unlink(link);
+		if (symlink(ptsname(master), link) < 0)
+		{
+			perror("emu2300: cannot create link");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	printf("emu2300: %d nibbles loaded, station on %s\n", loaded,
+	       link != NULL ? link : ptsname(master));
+	fflush(stdout);
+
+	// No SA_RESTART so a signal ends the blocking read
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stop_handler;
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+
+	while (!stop)
+	{
+		ret = read(master, buffer, sizeof(buffer));
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+
+		for (i = 0; i < ret; i++)
+			handle_byte(master, buffer[i]);
+	}
+
+	if (link != NULL)
+		unlink(link);
+
+	printf("emu2300: resets %lu reads %lu writes %lu bytes_in %lu "
+	       "bytes_out %lu dropped %lu corrupted %lu rejected %lu\n",
+	       emu.resets, emu.reads, emu.writes, emu.bytes_in, emu.bytes_out,
+	       emu.dropped, emu.corrupted, emu.rejected);
+
+	close(slave);
+	close(master);
+
+	return(0);
+}
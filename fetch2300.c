@@ -9,6 +9,101 @@
  */
 
 #include "rw2300.h"
+#include "out2300.h"
+
+/* Memory windows read by the functions used below. They are fetched
+ * with as few transactions as possible before the functions are called
+ * and those then answer from the prefetched data.
+ */
+static struct read_request regions[] =
+{
+	{0x346,  4, NULL},    // temperature indoor
+	{0x34B, 30, NULL},    // temperature indoor min/max
+	{0x373,  4, NULL},    // temperature outdoor
+	{0x378, 30, NULL},    // temperature outdoor min/max
+	{0x3CE,  4, NULL},    // dewpoint
+	{0x3D3, 30, NULL},    // dewpoint min/max
+	{0x3FB, 26, NULL},    // humidity indoor with min/max
+	{0x419, 26, NULL},    // humidity outdoor with min/max
+	{0x527, 12, NULL},    // wind speed and directions
+	{0x4EE, 30, NULL},    // wind min/max
+	{0x3A0,  4, NULL},    // windchill
+	{0x3A5, 30, NULL},    // windchill min/max
+	{0x4B4, 22, NULL},    // rain 1h with max
+	{0x497, 22, NULL},    // rain 24h with max
+	{0x4D2, 16, NULL},    // rain total with time
+	{0x5E2,  6, NULL},    // relative pressure
+	{0x600, 26, NULL},    // relative pressure min/max
+	{0x61E, 20, NULL},    // pressure min/max times
+	{0x26B,  2, NULL}     // tendency and forecast
+};
+
+#define REGIONS (sizeof(regions) / sizeof(regions[0]))
+
+
+/********************************************************************
+ * out_stamp appends the time and date lines of a min or max as
+ *   T<name><which> hh:mm
+ *   D<name><which> yyyy-mm-dd
+ *
+ * Input:   name - name of the value
+ *          which - "min" or "max"
+ *          time - the time stamp
+ *
+ * Output:  out - the lines appended
+ *
+ ********************************************************************/
+static void out_stamp(struct out_buffer *out, const char *name,
+                      const char *which, struct timestamp *time)
+{
+	out_char(out, 'T');
+	out_text(out, name);
+	out_text(out, which);
+	out_char(out, ' ');
+	out_int_zero(out, time->hour, 2);
+	out_char(out, ':');
+	out_int_zero(out, time->minute, 2);
+	out_text(out, "\nD");
+	out_text(out, name);
+	out_text(out, which);
+	out_char(out, ' ');
+	out_int_zero(out, time->year, 4);
+	out_char(out, '-');
+	out_int_zero(out, time->month, 2);
+	out_char(out, '-');
+	out_int_zero(out, time->day, 2);
+	out_char(out, '\n');
+}
+
+
+/********************************************************************
+ * out_minmax appends the min and max of a value with their times as
+ *   <name>min, <name>max, T<name>min, D<name>min, T<name>max, D<name>max
+ *
+ * Input:   name - name of the value
+ *          min, max - the min and max
+ *          decimals - decimals of min and max
+ *          time_min, time_max - when they were recorded
+ *
+ * Output:  out - the lines appended
+ *
+ ********************************************************************/
+static void out_minmax(struct out_buffer *out, const char *name,
+                       double min, double max, int decimals,
+                       struct timestamp *time_min, struct timestamp *time_max)
+{
+	out_text(out, name);
+	out_text(out, "min ");
+	out_fixed(out, min, decimals);
+	out_char(out, '\n');
+	out_text(out, name);
+	out_text(out, "max ");
+	out_fixed(out, max, decimals);
+	out_char(out, '\n');
+	out_stamp(out, name, "min", time_min);
+	out_stamp(out, name, "max", time_max);
+}
+
 
  
 /********** MAIN PROGRAM ************************************************
@@ -18,6 +113,10 @@
  * the program weatherstation.php uses to display a nice webpage with
  * current weather data.
  *
+ * When ws2300d publishes its snapshots (PUBLISH_FILE) and the last one
+ * is less than three polls old the data is taken from there instead.
+ * This costs no serial traffic and returns at once.
+ *
  * It takes one parameter which is the config file name with path
  * If this parameter is omitted the program will look at the default paths
  * See the open2300.conf-dist file for info
@@ -26,9 +125,9 @@
 int main(int argc, char *argv[])
 {
 	WEATHERSTATION ws2300;
-	char logline[3000] = "";
-	char tempstring[1000] = "";
-	char datestring[50];     //used to hold the date stamp for the log file
+	char outdata[4096];         //everything, written at once at the end
+	char valuedata[4000];       //the readings, read before the time is taken
+	struct out_buffer out, values;
 	const char *directions[]= {"N","NNE","NE","ENE","E","ESE","SE","SSE",
 	                           "S","SSW","SW","WSW","W","WNW","NW","NNW"};
 	double winddir[6];
@@ -39,216 +138,182 @@ int main(int argc, char *argv[])
 	int tempint, tempint_min, tempint_max;
 	struct timestamp time_min, time_max;
 	time_t basictime;
+	int i;
 
 	get_configuration(&config, argv[1]);
 
-	ws2300 = open_weatherstation(config.serial_device_name);
+	/* USE THE SNAPSHOT PUBLISHED BY ws2300d IF IT IS RECENT */
+
+	if (open_publication(config.publish_file, 3 * config.daemon_poll,
+	                     &ws2300) < 0)
+	{
+		ws2300 = open_weatherstation(config.serial_device_name);
+		configure_weatherstation(ws2300, &config);
+
+
+		/* FETCH ALL MEMORY WINDOWS IN AS FEW READS AS POSSIBLE */
+
+		read_planned(ws2300, regions, REGIONS, PLAN_PREFETCH);
+	}
+
+	out_init(&values, valuedata, sizeof(valuedata));
 
 
 	/* READ TEMPERATURE INDOOR */
 
-	sprintf(logline, "Ti %.1f\n", temperature_indoor(ws2300, config.temperature_conv) );
+	out_text(&values, "Ti ");
+	out_fixed(&values, temperature_indoor(ws2300, config.temperature_conv), 1);
+	out_char(&values, '\n');
 
 	temperature_indoor_minmax(ws2300, config.temperature_conv, &tempfloat_min,
 	                          &tempfloat_max, &time_min, &time_max);
-
-	sprintf(tempstring, "Timin %.1f\nTimax %.1f\n"
-	                    "TTimin %02d:%02d\nDTimin %04d-%02d-%02d\n"
-	                    "TTimax %02d:%02d\nDTimax %04d-%02d-%02d\n",
-	        tempfloat_min, tempfloat_max,
-	        time_min.hour, time_min.minute, time_min.year, time_min.month, time_min.day,
-	        time_max.hour, time_max.minute, time_max.year, time_max.month, time_max.day);
-	strcat(logline, tempstring);
+	out_minmax(&values, "Ti", tempfloat_min, tempfloat_max, 1, &time_min, &time_max);
 
 
 	/* READ TEMPERATURE OUTDOOR */
 
-	sprintf(tempstring, "To %.1f\n", temperature_outdoor(ws2300, config.temperature_conv) );
-	strcat(logline, tempstring);
+	out_text(&values, "To ");
+	out_fixed(&values, temperature_outdoor(ws2300, config.temperature_conv), 1);
+	out_char(&values, '\n');
 
 	temperature_outdoor_minmax(ws2300, config.temperature_conv, &tempfloat_min,
 	                           &tempfloat_max, &time_min, &time_max);
-
-	sprintf(tempstring, "Tomin %.1f\nTomax %.1f\n"
-	                    "TTomin %02d:%02d\nDTomin %04d-%02d-%02d\n"
-	                    "TTomax %02d:%02d\nDTomax %04d-%02d-%02d\n",
-	        tempfloat_min, tempfloat_max,
-	        time_min.hour, time_min.minute, time_min.year, time_min.month, time_min.day,
-	        time_max.hour, time_max.minute, time_max.year, time_max.month, time_max.day);
-	strcat(logline, tempstring);
+	out_minmax(&values, "To", tempfloat_min, tempfloat_max, 1, &time_min, &time_max);
 
 
 	/* READ DEWPOINT */
 
-	sprintf(tempstring, "DP %.1f\n", dewpoint(ws2300, config.temperature_conv) );
-	strcat(logline, tempstring);
+	out_text(&values, "DP ");
+	out_fixed(&values, dewpoint(ws2300, config.temperature_conv), 1);
+	out_char(&values, '\n');
 
 	dewpoint_minmax(ws2300, config.temperature_conv, &tempfloat_min,
 	                &tempfloat_max, &time_min, &time_max);
-
-	sprintf(tempstring, "DPmin %.1f\nDPmax %.1f\n"
-	                    "TDPmin %02d:%02d\nDDPmin %04d-%02d-%02d\n"
-	                    "TDPmax %02d:%02d\nDDPmax %04d-%02d-%02d\n",
-	        tempfloat_min, tempfloat_max,
-	        time_min.hour, time_min.minute, time_min.year, time_min.month, time_min.day,
-	        time_max.hour, time_max.minute, time_max.year, time_max.month, time_max.day);
-	strcat(logline, tempstring);
+	out_minmax(&values, "DP", tempfloat_min, tempfloat_max, 1, &time_min, &time_max);
 
 
 	/* READ RELATIVE HUMIDITY INDOOR */
 
-	sprintf(tempstring, "RHi %d\n", humidity_indoor_all(ws2300, &tempint_min, &tempint_max,
-	                                                    &time_min, &time_max) );
-	strcat(logline, tempstring);
-
-	sprintf(tempstring, "RHimin %d\nRHimax %d\n"
-	                    "TRHimin %02d:%02d\nDRHimin %04d-%02d-%02d\n"
-	                    "TRHimax %02d:%02d\nDRHimax %04d-%02d-%02d\n",
-	        tempint_min, tempint_max,
-	        time_min.hour, time_min.minute, time_min.year, time_min.month, time_min.day,
-	        time_max.hour, time_max.minute, time_max.year, time_max.month, time_max.day);
-	strcat(logline, tempstring);
+	out_text(&values, "RHi ");
+	out_int(&values, humidity_indoor_all(ws2300, &tempint_min, &tempint_max,
+	                                     &time_min, &time_max));
+	out_char(&values, '\n');
+	out_minmax(&values, "RHi", tempint_min, tempint_max, 0, &time_min, &time_max);
 
 
 	/* READ RELATIVE HUMIDITY OUTDOOR */
 
-	sprintf(tempstring, "RHo %d\n", humidity_outdoor_all(ws2300, &tempint_min, &tempint_max,
-	                                                  &time_min, &time_max) );
-	strcat(logline, tempstring);
-
-	sprintf(tempstring, "RHomin %d\nRHomax %d\n"
-	                    "TRHomin %02d:%02d\nDRHomin %04d-%02d-%02d\n"
-	                    "TRHomax %02d:%02d\nDRHomax %04d-%02d-%02d\n",
-	        tempint_min, tempint_max,
-	        time_min.hour, time_min.minute, time_min.year, time_min.month, time_min.day,
-	        time_max.hour, time_max.minute, time_max.year, time_max.month, time_max.day);
-	strcat(logline, tempstring);
+	out_text(&values, "RHo ");
+	out_int(&values, humidity_outdoor_all(ws2300, &tempint_min, &tempint_max,
+	                                      &time_min, &time_max));
+	out_char(&values, '\n');
+	out_minmax(&values, "RHo", tempint_min, tempint_max, 0, &time_min, &time_max);
 
 
 	/* READ WIND SPEED AND DIRECTION */
 
-	sprintf(tempstring,"WS %.1f\n",
-	       wind_all(ws2300, config.wind_speed_conv_factor, &tempint, winddir));
-	strcat(logline, tempstring);
+	out_text(&values, "WS ");
+	out_fixed(&values, wind_all(ws2300, config.wind_speed_conv_factor, &tempint,
+	                            winddir), 1);
+	out_text(&values, "\nDIRtext ");
+	out_text(&values, directions[tempint]);
+	out_char(&values, '\n');
 
-	sprintf(tempstring,"DIRtext %s\nDIR0 %.1f\nDIR1 %0.1f\n"
-	                   "DIR2 %0.1f\nDIR3 %0.1f\nDIR4 %0.1f\nDIR5 %0.1f\n",
-	        directions[tempint], winddir[0], winddir[1],
-	        winddir[2], winddir[3], winddir[4], winddir[5]);
-	strcat(logline, tempstring);
+	for (i = 0; i < 6; i++)
+	{
+		out_text(&values, "DIR");
+		out_int(&values, i);
+		out_char(&values, ' ');
+		out_fixed(&values, winddir[i], 1);
+		out_char(&values, '\n');
+	}
 
 
 	/* WINDCHILL */
 
-	sprintf(tempstring, "WC %.1f\n", windchill(ws2300, config.temperature_conv) );
-	strcat(logline, tempstring);
+	out_text(&values, "WC ");
+	out_fixed(&values, windchill(ws2300, config.temperature_conv), 1);
+	out_char(&values, '\n');
 
 	windchill_minmax(ws2300, config.temperature_conv, &tempfloat_min,
-	                 &tempfloat_max, &time_min, &time_max); 
-
-	sprintf(tempstring, "WCmin %.1f\nWCmax %.1f\n"
-	                    "TWCmin %02d:%02d\nDWCmin %04d-%02d-%02d\n"
-	                    "TWCmax %02d:%02d\nDWCmax %04d-%02d-%02d\n",
-	        tempfloat_min, tempfloat_max,
-	        time_min.hour, time_min.minute, time_min.year, time_min.month, time_min.day,
-	        time_max.hour, time_max.minute, time_max.year, time_max.month, time_max.day);
-	strcat(logline, tempstring);
+	                 &tempfloat_max, &time_min, &time_max);
+	out_minmax(&values, "WC", tempfloat_min, tempfloat_max, 1, &time_min, &time_max);
 
 
 	/* READ WINDSPEED MIN/MAX */
 
 	wind_minmax(ws2300, config.wind_speed_conv_factor, &tempfloat_min,
 	            &tempfloat_max, &time_min, &time_max);
-
-	sprintf(tempstring, "WSmin %.1f\nWSmax %.1f\n"
-	                    "TWSmin %02d:%02d\nDWSmin %04d-%02d-%02d\n"
-	                    "TWSmax %02d:%02d\nDWSmax %04d-%02d-%02d\n",
-	        tempfloat_min, tempfloat_max,
-	        time_min.hour, time_min.minute, time_min.year, time_min.month, time_min.day,
-	        time_max.hour, time_max.minute, time_max.year, time_max.month, time_max.day);
-	strcat(logline, tempstring);
+	out_minmax(&values, "WS", tempfloat_min, tempfloat_max, 1, &time_min, &time_max);
 
 
 	/* READ RAIN 1H */
 
-	sprintf(tempstring, "R1h %.2f\n",
-	        rain_1h_all(ws2300, config.rain_conv_factor,
-	                    &tempfloat_max, &time_max));
-	strcat(logline, tempstring);
-
-	sprintf(tempstring, "R1hmax %.2f\n"
-	                    "TR1hmax %02d:%02d\nDR1hmax %04d-%02d-%02d\n",
-	        tempfloat_max,
-	        time_max.hour, time_max.minute, time_max.year, time_max.month, time_max.day);
-	strcat(logline, tempstring);
+	out_text(&values, "R1h ");
+	out_fixed(&values, rain_1h_all(ws2300, config.rain_conv_factor,
+	                               &tempfloat_max, &time_max), 2);
+	out_text(&values, "\nR1hmax ");
+	out_fixed(&values, tempfloat_max, 2);
+	out_char(&values, '\n');
+	out_stamp(&values, "R1h", "max", &time_max);
 
 
 	/* READ RAIN 24H */
 
-	sprintf(tempstring,"R24h %.2f\n",
-	        rain_24h_all(ws2300, config.rain_conv_factor,
-	                     &tempfloat_max, &time_max));
-	strcat(logline, tempstring);
-
-	sprintf(tempstring,"R24hmax %.2f\n"
-	                   "TR24hmax %02d:%02d\nDR24hmax %04d-%02d-%02d\n",
-	        tempfloat_max,
-	        time_max.hour, time_max.minute, time_max.year, time_max.month, time_max.day);
-	strcat(logline, tempstring);
+	out_text(&values, "R24h ");
+	out_fixed(&values, rain_24h_all(ws2300, config.rain_conv_factor,
+	                                &tempfloat_max, &time_max), 2);
+	out_text(&values, "\nR24hmax ");
+	out_fixed(&values, tempfloat_max, 2);
+	out_char(&values, '\n');
+	out_stamp(&values, "R24h", "max", &time_max);
 
 
 	/* READ RAIN TOTAL */
 
-	sprintf(tempstring,"Rtot %.2f\n",
-	        rain_total_all(ws2300, config.rain_conv_factor, &time_max));
-	strcat(logline, tempstring);
-
-	sprintf(tempstring,"TRtot %02d:%02d\nDRtot %04d-%02d-%02d\n",
-	        time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
-	strcat(logline, tempstring);
+	out_text(&values, "Rtot ");
+	out_fixed(&values, rain_total_all(ws2300, config.rain_conv_factor, &time_max), 2);
+	out_char(&values, '\n');
+	out_stamp(&values, "Rtot", "", &time_max);
 
 
 	/* READ RELATIVE PRESSURE */
 
-	sprintf(tempstring,"RP %.3f\n",
-	        rel_pressure(ws2300, config.pressure_conv_factor) );
-	strcat(logline, tempstring);
+	out_text(&values, "RP ");
+	out_fixed(&values, rel_pressure(ws2300, config.pressure_conv_factor), 3);
+	out_char(&values, '\n');
 
 
 	/* RELATIVE PRESSURE MIN/MAX */
 
 	rel_pressure_minmax(ws2300, config.pressure_conv_factor, &tempfloat_min,
 	                    &tempfloat_max, &time_min, &time_max);
-
-	sprintf(tempstring, "RPmin %.3f\nRPmax %.3f\n"
-	                    "TRPmin %02d:%02d\nDRPmin %04d-%02d-%02d\n"
-	                    "TRPmax %02d:%02d\nDRPmax %04d-%02d-%02d\n",
-	        tempfloat_min, tempfloat_max,
-	        time_min.hour, time_min.minute, time_min.year, time_min.month, time_min.day,
-	        time_max.hour, time_max.minute, time_max.year, time_max.month, time_max.day);
-	strcat(logline, tempstring);
+	out_minmax(&values, "RP", tempfloat_min, tempfloat_max, 3, &time_min, &time_max);
 
 
 	/* READ TENDENCY AND FORECAST */
 
 	tendency_forecast(ws2300, tendency, forecast);
-	sprintf(tempstring, "Tendency %s\nForecast %s\n", tendency, forecast);
-	strcat(logline, tempstring);
+	out_text(&values, "Tendency ");
+	out_text(&values, tendency);
+	out_text(&values, "\nForecast ");
+	out_text(&values, forecast);
+	out_char(&values, '\n');
 
 
 	/* GET DATE AND TIME FOR LOG FILE, PLACE BEFORE ALL DATA IN LOG LINE */
 
 	time(&basictime);
-	strftime(datestring, sizeof(datestring),"Date %Y-%b-%d\nTime %H:%M:%S\n",
-	         localtime(&basictime));
+	out_init(&out, outdata, sizeof(outdata));
+	out_time(&out, "Date %Y-%b-%d\nTime %H:%M:%S\n", basictime);
+	out_bytes(&out, values.data, values.length);
 
 	// Print out and leave
 
-	printf("%s%s", datestring, logline);
+	if (values.overflow || out_write(&out, stdout) < 0)
+		fprintf(stderr, "fetch2300: cannot write the data\n");
 
 	close_weatherstation(ws2300);
 
 	return(0);
 }
-
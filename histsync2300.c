@@ -0,0 +1,131 @@
+/*  open2300 - histsync2300.c
+ *
+ *  Version 1.11
+ *
+ *  Feed the history of a WS2300 to several stores at once
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#include "sink2300.h"
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("histsync2300 - Store new history data from WS-2300 in every\n");
+	printf("HISTORY_SINK of the config file, reading the station once.\n");
+	printf("Version %s (C)2003-2006 Kenneth Lavrsen.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("Sync once:               histsync2300 config_filename\n");
+	printf("Sync every n seconds:    histsync2300 -i n config_filename\n");
+	exit(0);
+}
+
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * This program reads the history records that are new to any of the
+ * stores given by HISTORY_SINK lines in the config file and writes
+ * each store the ones it misses. Run it from cron once per history
+ * interval instead of histlog2300, sqlitehistlog2300 and
+ * mysqlhistlog2300 one after the other.
+ *
+ * A store that cannot be opened or fails is reported and left out,
+ * the others are fed anyway. Its cursor file is not moved so it gets
+ * the records next time, as long as the station still has them.
+ *
+ * With -i the program keeps running and syncs every n seconds. The
+ * stores stay open between syncs, so a database connection is made
+ * once and not for every sync.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	WEATHERSTATION ws2300;
+	struct config_type config;
+	static struct history_sink sinks[MAX_HISTORY_SINKS];
+	int opened = 0, failed = 0;
+	int interval = 0;
+	int i;
+
+	if (argc > 2 && strcmp(argv[1], "-i") == 0)
+	{
+		interval = atoi(argv[2]);
+		argc -= 2;
+		argv += 2;
+
+		if (interval <= 0)
+			print_usage();
+	}
+
+	if (argc > 2)
+		print_usage();
+
+	get_configuration(&config, argc == 2 ? argv[1] : NULL);
+
+	if (config.num_history_sinks == 0)
+	{
+		fprintf(stderr, "No HISTORY_SINK in the config file\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < config.num_history_sinks; i++)
+	{
+		if (sink_open(&sinks[i], &config.history_sink[i], &config) < 0)
+		{
+			fprintf(stderr, "Cannot open history sink %s %s\n",
+			        config.history_sink[i].type, config.history_sink[i].target);
+			failed = 1;
+		}
+		else
+		{
+			opened++;
+		}
+	}
+
+	if (opened == 0)
+		exit(EXIT_FAILURE);
+
+	for (;;)
+	{
+		ws2300 = open_weatherstation(config.serial_device_name);
+		configure_weatherstation(ws2300, &config);
+
+		if (history_sync(ws2300, &config, sinks, config.num_history_sinks) < 0)
+		{
+			if (interval == 0)
+				read_error_exit();
+			fprintf(stderr, "Could not read the history, trying again later\n");
+		}
+
+		// The station is free for other programs between syncs
+		close_weatherstation(ws2300);
+
+		if (interval == 0)
+			break;
+
+		sleep_long(interval);
+	}
+
+	// Goodbye and Goodnight
+
+	for (i = 0; i < config.num_history_sinks; i++)
+	{
+		failed |= sinks[i].failed;
+		sink_close(&sinks[i]);
+	}
+
+	return(failed ? EXIT_FAILURE : 0);
+}
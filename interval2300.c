@@ -69,6 +69,7 @@ int main(int argc, char *argv[])
 
 	get_configuration(&config, argv[3]);
 	ws2300 = open_weatherstation(config.serial_device_name);
+	configure_weatherstation(ws2300, &config);
 
 	interval = (int)strtol(argv[1],NULL,10);
 	if (argc >= 3)
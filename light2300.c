@@ -58,6 +58,7 @@ int main(int argc, char *argv[])
 	get_configuration(&config, argv[2]);
 
 	ws2300 = open_weatherstation(config.serial_device_name);
+	configure_weatherstation(ws2300, &config);
 
    /* Get on or off */
 
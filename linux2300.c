@@ -14,11 +14,151 @@
 #define DEBUG 0
 
 #include <errno.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/un.h>
 #include "rw2300.h"
 
+#define RXBUFSIZE 64
+
+/* Bytes received from the station but not yet consumed. A multi-byte
+ * answer usually arrives in one or two read() calls so the ring
+ * keeps whatever a read returned beyond what the caller asked for.
+ */
+struct rx_ring
+{
+	int used;
+	int fd;
+	int head;
+	int count;
+	unsigned char data[RXBUFSIZE];
+};
+
+static struct rx_ring rings[MAXLINKS];
+static struct rx_ring spare_ring;
+
+/* Set from DAEMON_SOCKET by get_configuration */
+static char daemon_socket[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+
+/********************************************************************
+ * get_rx_ring returns the receive ring of a serial handle,
+ * allocating one on first use. Handles beyond MAXLINKS share the
+ * spare ring, which keeps its bytes until another handle uses it.
+ ********************************************************************/
+static struct rx_ring *get_rx_ring(int fd)
+{
+	struct rx_ring *free_ring = NULL;
+	int i;
+
+	for (i = 0; i < MAXLINKS; i++)
+	{
+		if (rings[i].used && rings[i].fd == fd)
+			return &rings[i];
+		if (!rings[i].used && free_ring == NULL)
+			free_ring = &rings[i];
+	}
+
+	if (free_ring == NULL)
+	{
+		// What is buffered came from another handle then
+		if (spare_ring.fd != fd)
+		{
+			spare_ring.head = 0;
+			spare_ring.count = 0;
+			spare_ring.fd = fd;
+		}
+		return &spare_ring;
+	}
+
+	memset(free_ring, 0, sizeof(struct rx_ring));
+	free_ring->used = 1;
+	free_ring->fd = fd;
+
+	return free_ring;
+}
+
+
+/********************************************************************
+ * flush_input discards everything received so far, both in the
+ * receive ring and in the kernel buffer.
+ ********************************************************************/
+static void flush_input(int fd)
+{
+	struct rx_ring *ring = get_rx_ring(fd);
+
+	ring->head = 0;
+	ring->count = 0;
+	tcflush(fd, TCIFLUSH);
+}
+
+
+/********************************************************************
+ * monotonic_ms - milliseconds from an arbitrary fixed point
+ ********************************************************************/
+static long long monotonic_ms(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/********************************************************************
+ * set_daemon_socket, Linux version
+ * Tells open_weatherstation where ws2300d listens. Called by
+ * get_configuration; ws2300d itself clears it again so it opens
+ * the serial port.
+ *
+ * Input:   path of the Unix socket, NULL or "" for none
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void set_daemon_socket(char *path)
+{
+	daemon_socket[0] = '\0';
+
+	if (path != NULL)
+		strncat(daemon_socket, path, sizeof(daemon_socket) - 1);
+}
+
+/********************************************************************
+ * connect_daemon connects to ws2300d.
+ *
+ * Returns: socket, -1 if the daemon is not running
+ ********************************************************************/
+static int connect_daemon(char *path)
+{
+	struct sockaddr_un address;
+	int fd;
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+
+	if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	// A daemon going away must not kill us in the middle of a write
+	signal(SIGPIPE, SIG_IGN);
+
+	return fd;
+}
+
 /********************************************************************
  * open_weatherstation, Linux version
+ * If ws2300d is running the handle is a connection to it, else the
+ * serial port is opened and locked.
  *
  * Input:   devicename (/dev/tty0, /dev/tty1 etc)
  * 
@@ -31,6 +171,13 @@ WEATHERSTATION open_weatherstation(char *device)
 	struct termios adtio;
 	int portstatus, fdflags;
 
+	if (daemon_socket[0] && (ws2300 = connect_daemon(daemon_socket)) >= 0)
+	{
+		get_rx_ring(ws2300);
+		set_client_mode(ws2300, CLIENT_DAEMON);
+		return ws2300;
+	}
+
 	//Setup serial port
 
 	if ((ws2300 = open(device, O_RDWR | O_NONBLOCK)) < 0)
@@ -89,8 +236,8 @@ WEATHERSTATION open_weatherstation(char *device)
 	// Raw output should disable all other output options
 	adtio.c_oflag &= ~OPOST;
 
-	adtio.c_cc[VTIME] = 10;		// timer 1s
-	adtio.c_cc[VMIN] = 0;		// blocking read until 1 char
+	adtio.c_cc[VTIME] = 0;		// no termios timer, read_device_timeout
+	adtio.c_cc[VMIN] = 0;		// polls against its own deadline
 	
 	if (tcsetattr(ws2300, TCSANOW, &adtio) < 0)
 	{
@@ -99,6 +246,7 @@ WEATHERSTATION open_weatherstation(char *device)
 	}
 
 	tcflush(ws2300, TCIOFLUSH);
+	get_rx_ring(ws2300);
 
 	// Set DTR low and RTS high and leave other ctrl lines untouched
 
@@ -120,6 +268,13 @@ WEATHERSTATION open_weatherstation(char *device)
  ********************************************************************/
 void close_weatherstation(WEATHERSTATION ws)
 {
+	struct rx_ring *ring = get_rx_ring(ws);
+
+	// A new handle with the same number must not get these bytes
+	ring->used = 0;
+	ring->count = 0;
+	ring->fd = -1;
+	release_link_state(ws);
 	close(ws);
 	return;
 }
@@ -136,13 +291,18 @@ void reset_06(WEATHERSTATION serdevice)
 {
 	unsigned char command = 0x06;
 	unsigned char answer;
+	int timeout = get_link_timeout(serdevice, TIMEOUT_RESET);
 	int i;
 
+	// ws2300d keeps its own link in sync
+	if (get_client_mode(serdevice))
+		return;
+
 	for (i = 0; i < 100; i++)
 	{
 
 		// Discard any garbage in the input buffer
-		tcflush(serdevice, TCIFLUSH);
+		flush_input(serdevice);
 
 		write_device(serdevice, &command, 1);
 
@@ -153,49 +313,132 @@ void reset_06(WEATHERSTATION serdevice)
 		// until all data is exhausted, if we got a two back at all, we
 		// consider it a success
 		
-		while (1 == read_device(serdevice, &answer, 1))
+		while (1 == read_device_timeout(serdevice, &answer, 1, timeout))
 		{
 			if (answer == 2)
 			{
+				// drop any further 2's so they do not look like acks
+				flush_input(serdevice);
 				return;
 			}
 		}
 
-		usleep(50000 * i);   //we sleep longer and longer for each retry
+		sleep_short(50 * i);   //we sleep longer and longer for each retry
 	}
 	fprintf(stderr, "\nCould not reset\n");
 	exit(EXIT_FAILURE);
 }
 
 /********************************************************************
- * read_device in the Linux version is identical
- * to the standard Linux read() 
+ * read_device_timeout, Linux version
+ * Reads exactly size bytes unless the deadline passes first.
+ * The deadline covers the whole call, not each byte, and is
+ * measured on the monotonic clock so it is immune to clock changes.
  *
  * Inputs:  serdevice - opened file handle
  *          buffer - pointer to the buffer to read into (unsigned char)
  *          size - number of bytes to read
+ *          timeout_ms - milliseconds before giving up
  *
  * Output:  *buffer - modified on success (pointer to unsigned char)
  * 
- * Returns: number of bytes read
+ * Returns: number of bytes read, less than size on timeout
+ *          and -1 on a read error
  *
  ********************************************************************/
-int read_device(WEATHERSTATION serdevice, unsigned char *buffer, int size)
+int read_device_timeout(WEATHERSTATION serdevice, unsigned char *buffer,
+                        int size, int timeout_ms)
 {
-	int ret;
+	struct rx_ring *ring = get_rx_ring(serdevice);
+	struct pollfd pfd;
+	long long deadline = monotonic_ms() + timeout_ms;
+	long long remaining;
+	unsigned char chunk[RXBUFSIZE];
+	int received = 0;
+	int ret, i;
+
+	pfd.fd = serdevice;
+	pfd.events = POLLIN;
+
+	for (;;)
+	{
+		// Hand out what is already buffered
+		while (ring->count > 0 && received < size)
+		{
+			buffer[received++] = ring->data[ring->head];
+			ring->head = (ring->head + 1) % RXBUFSIZE;
+			ring->count--;
+		}
 
-	for (;;) {
-		sleep_short(200);
-		ret = read(serdevice, buffer, size);
-		if (ret == 0 && errno == EINTR)
+		if (received == size)
+			return received;
+
+		remaining = deadline - monotonic_ms();
+		if (remaining <= 0)
+			return received;
+
+		ret = poll(&pfd, 1, (int)remaining);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -1;
+		if (ret == 0)
+			return received;
+
+		ret = read(serdevice, chunk, RXBUFSIZE - ring->count);
+		if (ret < 0 && (errno == EINTR || errno == EAGAIN))
 			continue;
-		return ret;
+		if (ret < 0)
+			return -1;
+		if (ret == 0)
+			return received;   // readable but nothing there: hangup
+
+		for (i = 0; i < ret; i++)
+			ring->data[(ring->head + ring->count++) % RXBUFSIZE] = chunk[i];
 	}
 }
 
 /********************************************************************
- * write_device in the Linux version is identical
- * to the standard Linux write()
+ * read_device_burst, Linux version
+ * Reads the answer to a pipelined burst. read_device_timeout keeps
+ * to its deadline to the millisecond already, so it is the same.
+ *
+ * Inputs:  as read_device_timeout
+ *
+ * Returns: number of bytes read, less than size on timeout
+ *          and -1 on a read error
+ *
+ ********************************************************************/
+int read_device_burst(WEATHERSTATION serdevice, unsigned char *buffer,
+                      int size, int timeout_ms)
+{
+	return read_device_timeout(serdevice, buffer, size, timeout_ms);
+}
+
+/********************************************************************
+ * read_device, Linux version
+ * Kept for callers that do not care about the protocol timeouts.
+ * Waits at most one second like the old termios VTIME setting.
+ *
+ * Inputs:  serdevice - opened file handle
+ *          buffer - pointer to the buffer to read into (unsigned char)
+ *          size - number of bytes to read
+ *
+ * Output:  *buffer - modified on success (pointer to unsigned char)
+ * 
+ * Returns: number of bytes read
+ *
+ ********************************************************************/
+int read_device(WEATHERSTATION serdevice, unsigned char *buffer, int size)
+{
+	return read_device_timeout(serdevice, buffer, size, 1000);
+}
+
+/********************************************************************
+ * write_device in the Linux version is the standard Linux write()
+ * followed by tcdrain() so the bytes are on the wire when it returns.
+ * No extra delay is needed since every answer is awaited with
+ * read_device_timeout.
  *
  * Inputs:  serdevice - opened file handle
  *          buffer - pointer to the buffer to write from
@@ -206,10 +449,21 @@ int read_device(WEATHERSTATION serdevice, unsigned char *buffer, int size)
  ********************************************************************/
 int write_device(WEATHERSTATION serdevice, unsigned char *buffer, int size)
 {
-	int ret = write(serdevice, buffer, size);
+	int written = 0;
+	int ret;
+
+	while (written < size)
+	{
+		ret = write(serdevice, buffer + written, size - written);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -1;
+		written += ret;
+	}
+
 	tcdrain(serdevice);	// wait for all output written
-	sleep_short(400);
-	return ret;
+	return written;
 }
 
 /********************************************************************
@@ -222,7 +476,7 @@ int write_device(WEATHERSTATION serdevice, unsigned char *buffer, int size)
  ********************************************************************/
 void sleep_short(int milliseconds)
 {
-	usleep(milliseconds/1000);
+	usleep(milliseconds * 1000);
 }
 
 /********************************************************************
@@ -239,6 +493,99 @@ void sleep_long(int seconds)
 }
 
 
+/********************************************************************
+ * replace_file - Linux version
+ * Puts a newly written file in place of another one so that readers
+ * see either the old or the complete new file, also after a crash.
+ *
+ * Inputs: from - the new file, closed
+ *         to - the file to replace
+ *
+ * Returns: 0 on success and -1 if fail.
+ *
+ ********************************************************************/
+int replace_file(char *from, char *to)
+{
+	int fd;
+
+	// The data must be on disk before the rename is
+	if ((fd = open(from, O_RDONLY)) < 0)
+		return -1;
+	fsync(fd);
+	close(fd);
+
+	return rename(from, to);
+}
+
+
+/********************************************************************
+ * flush_file - Linux version
+ * Writes what is buffered for a file and waits until it is on disk.
+ *
+ * Inputs: file - open for writing
+ *
+ * Returns: 0 on success and -1 if fail.
+ *
+ ********************************************************************/
+int flush_file(FILE *file)
+{
+	if (fflush(file) != 0 || fsync(fileno(file)) < 0)
+		return -1;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * map_file - Linux version
+ * Maps a whole file read only.
+ *
+ * Inputs: path - the file
+ *
+ * Output: size - bytes mapped
+ *
+ * Returns: pointer to the mapping, NULL if the file is missing, empty
+ *          or cannot be mapped
+ *
+ ********************************************************************/
+void *map_file(char *path, long *size)
+{
+	struct stat info;
+	void *map;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return NULL;
+
+	if (fstat(fd, &info) < 0 || info.st_size == 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return NULL;
+
+	*size = info.st_size;
+
+	return map;
+}
+
+
+/********************************************************************
+ * unmap_file - Linux version
+ * Releases a mapping of map_file.
+ ********************************************************************/
+void unmap_file(void *map, long size)
+{
+	if (map != NULL)
+		munmap(map, size);
+}
+
+
 /********************************************************************
  * http_request_url - Linux version
  * 
@@ -402,4 +749,181 @@ int citizen_weather_send(struct config_type *config, char *aprsline)
 	return(0);
 }
 
+
+/********************************************************************
+ * Shared memory publication
+ *
+ * ws2300d writes every new snapshot into a file that readers map
+ * into memory. A sequence counter works as a seqlock: the writer makes
+ * it odd, copies the snapshot and makes it even again. A reader copies
+ * the snapshot and retries if the counter was odd or has moved in the
+ * meantime. Readers never block the writer or each other and never
+ * touch the serial port.
+ *
+ ********************************************************************/
+
+#define PUBLISH_RETRIES 1000
+
+/********************************************************************
+ * map_publication maps a publication file, keeping the last mapping
+ * so a long running writer or reader maps the file only once.
+ *
+ * Returns: pointer to the mapping, NULL on error
+ ********************************************************************/
+static struct ws_publication *map_publication(char *path, int writer)
+{
+	static struct ws_publication *maps[2];
+	static char paths[2][256];
+	struct ws_publication *pub;
+	struct stat info;
+	int fd;
+
+	if (maps[writer] != NULL && strcmp(paths[writer], path) == 0)
+		return maps[writer];
+
+	if (writer)
+		fd = open(path, O_RDWR | O_CREAT, 0644);
+	else
+		fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+
+	if ((writer && ftruncate(fd, sizeof(struct ws_publication)) < 0) ||
+	    fstat(fd, &info) < 0 || info.st_size < (off_t)sizeof(struct ws_publication))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	pub = mmap(NULL, sizeof(struct ws_publication),
+	           writer ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (pub == MAP_FAILED)
+		return NULL;
+
+	if (maps[writer] != NULL)
+		munmap(maps[writer], sizeof(struct ws_publication));
+
+	maps[writer] = pub;
+	snprintf(paths[writer], sizeof(paths[writer]), "%s", path);
+
+	return pub;
+}
+
+/********************************************************************
+ * publish_snapshot, Linux version
+ * Makes a snapshot the latest published one.
+ *
+ * Input:   path - publication file, created if needed
+ *          snap - pointer to struct ws_snapshot
+ *
+ * Returns: 0 on success, -1 if the file cannot be mapped
+ *
+ ********************************************************************/
+int publish_snapshot(char *path, struct ws_snapshot *snap)
+{
+	struct ws_publication *pub = map_publication(path, 1);
+	unsigned int sequence;
+
+	if (pub == NULL)
+		return -1;
+
+	// A writer that died half way left the counter odd
+	sequence = (pub->sequence + 1) & ~1U;
+
+	pub->sequence = sequence + 1;
+	__sync_synchronize();
+
+	memcpy(&pub->snapshot, snap, sizeof(struct ws_snapshot));
+	pub->magic = PUBLISH_MAGIC;
+
+	__sync_synchronize();
+	pub->sequence = sequence + 2;
+
+	return 0;
+}
+
+/********************************************************************
+ * read_publication, Linux version
+ * Copies the latest published snapshot.
+ *
+ * Input:   path - publication file
+ *
+ * Output:  snap - pointer to struct ws_snapshot
+ *
+ * Returns: 0 on success, -1 if nothing is published there
+ *
+ ********************************************************************/
+int read_publication(char *path, struct ws_snapshot *snap)
+{
+	struct ws_publication *pub = map_publication(path, 0);
+	unsigned int sequence;
+	int i;
+
+	if (pub == NULL)
+		return -1;
+
+	for (i = 0; i < PUBLISH_RETRIES; i++)
+	{
+		sequence = pub->sequence;
+		if (sequence == 0)
+			return -1;
+
+		if (sequence & 1)
+		{
+			sleep_short(1);
+			continue;
+		}
+
+		__sync_synchronize();
+		memcpy(snap, (void *)&pub->snapshot, sizeof(struct ws_snapshot));
+		__sync_synchronize();
+
+		if (pub->sequence == sequence && pub->magic == PUBLISH_MAGIC)
+			return 0;
+	}
+
+	return -1;
+}
+
+/********************************************************************
+ * open_publication, Linux version
+ * Opens a handle that answers every read from the latest published
+ * snapshot instead of the station. Reads outside the snapshot and
+ * all writes fail.
+ *
+ * Input:   path - publication file
+ *          max_age - seconds the snapshot may be old, 0 for any age
+ *
+ * Output:  ws - handle to use with the library functions
+ *
+ * Returns: 0 on success, -1 if there is no snapshot young enough
+ *
+ ********************************************************************/
+int open_publication(char *path, int max_age, WEATHERSTATION *ws)
+{
+	struct ws_snapshot *snap;
+	int fd;
+
+	if (path[0] == '\0' || (snap = malloc(sizeof(struct ws_snapshot))) == NULL)
+		return -1;
+
+	if (read_publication(path, snap) < 0 ||
+	    (max_age > 0 && time(NULL) - snap->taken > max_age) ||
+	    (fd = open(path, O_RDONLY)) < 0)
+	{
+		free(snap);
+		return -1;
+	}
+
+	get_rx_ring(fd);
+	set_client_mode(fd, CLIENT_PUBLICATION);
+	adopt_snapshot(fd, snap);
+	*ws = fd;
+
+	return 0;
+}
+
 #endif
@@ -9,6 +9,32 @@
  */
 
 #include "rw2300.h"
+#include "store2300.h"
+#include "logindex2300.h"
+#include "rollup2300.h"
+#include "out2300.h"
+
+/* Memory windows read by the functions used below. They are fetched
+ * with as few transactions as possible before the functions are called
+ * and those then answer from the prefetched data.
+ */
+static struct read_request regions[] =
+{
+	{0x346,  4, NULL},    // temperature indoor
+	{0x373,  4, NULL},    // temperature outdoor
+	{0x3CE,  4, NULL},    // dewpoint
+	{0x3FB,  2, NULL},    // humidity indoor
+	{0x419,  2, NULL},    // humidity outdoor
+	{0x527, 12, NULL},    // wind speed and directions
+	{0x3A0,  4, NULL},    // windchill
+	{0x4B4,  6, NULL},    // rain 1h
+	{0x497,  6, NULL},    // rain 24h
+	{0x4D2,  6, NULL},    // rain total
+	{0x5E2,  6, NULL},    // relative pressure
+	{0x26B,  2, NULL}     // tendency and forecast
+};
+
+#define REGIONS (sizeof(regions) / sizeof(regions[0]))
 
 /********************************************************************
  * print_usage prints a short user guide
@@ -53,9 +79,9 @@ int main(int argc, char *argv[])
 {
 	WEATHERSTATION ws2300;
 	FILE *fileptr;
-	char logline[3000] = "";
-	char tempstring[1000] = "";
-	char datestring[50];        //used to hold the date stamp for the log file
+	char linedata[300];         //the log line, time stamp first
+	char valuedata[250];        //the readings, read before the time is taken
+	struct out_buffer line, values;
 	const char *directions[]= {"N","NNE","NE","ENE","E","ESE","SE","SSE",
 	                           "S","SSW","SW","WSW","W","WNW","NW","NNW"};
 	double winddir[6];
@@ -63,11 +89,16 @@ int main(int argc, char *argv[])
 	char tendency[15];
 	char forecast[15];
 	struct config_type config;
+	struct store_row row;       //the same reading for the LOG_STORE
+	struct rollup_observation observation;
+	struct rollup_store rollup;
 	time_t basictime;
+	int logged;                 //1 when the line is in the log
 
 	get_configuration(&config, argv[2]);
 
 	ws2300 = open_weatherstation(config.serial_device_name);
+	configure_weatherstation(ws2300, &config);
 
 	/* Get log filename. */
 
@@ -84,96 +115,146 @@ int main(int argc, char *argv[])
 	}
 
 
+	/* FETCH ALL MEMORY WINDOWS IN AS FEW READS AS POSSIBLE */
+
+	read_planned(ws2300, regions, REGIONS, PLAN_PREFETCH);
+	store_row_clear(&row);
+	out_init(&values, valuedata, sizeof(valuedata));
+
+
 	/* READ TEMPERATURE INDOOR */
 
-	sprintf(logline,"%.1f ", temperature_indoor(ws2300, config.temperature_conv));
+	row.value[STORE_TEMPERATURE_IN] = temperature_indoor(ws2300, config.temperature_conv);
+	out_fixed(&values, row.value[STORE_TEMPERATURE_IN], 1);
+	out_char(&values, ' ');
 
 
 	/* READ TEMPERATURE OUTDOOR */
 
-	sprintf(tempstring,"%.1f ", temperature_outdoor(ws2300, config.temperature_conv));
-	strcat(logline, tempstring);
+	row.value[STORE_TEMPERATURE_OUT] = temperature_outdoor(ws2300, config.temperature_conv);
+	out_fixed(&values, row.value[STORE_TEMPERATURE_OUT], 1);
+	out_char(&values, ' ');
 
 
 	/* READ DEWPOINT */
 
-	sprintf(tempstring,"%.1f ", dewpoint(ws2300, config.temperature_conv));
-	strcat(logline, tempstring);
+	row.value[STORE_DEWPOINT] = dewpoint(ws2300, config.temperature_conv);
+	out_fixed(&values, row.value[STORE_DEWPOINT], 1);
+	out_char(&values, ' ');
 
 
 	/* READ RELATIVE HUMIDITY INDOOR */
 
-	sprintf(tempstring,"%d ", humidity_indoor(ws2300));	
-	strcat(logline, tempstring);
+	row.code[STORE_HUMIDITY_IN] = humidity_indoor(ws2300);
+	out_int(&values, row.code[STORE_HUMIDITY_IN]);
+	out_char(&values, ' ');
 
 
 	/* READ RELATIVE HUMIDITY OUTDOOR */
 
-	sprintf(tempstring,"%d ", humidity_outdoor(ws2300));	 
-	strcat(logline, tempstring);
+	row.code[STORE_HUMIDITY_OUT] = humidity_outdoor(ws2300);
+	out_int(&values, row.code[STORE_HUMIDITY_OUT]);
+	out_char(&values, ' ');
 
 
 	/* READ WIND SPEED AND DIRECTION */
 
-	sprintf(tempstring,"%.1f ",
-	       wind_all(ws2300, config.wind_speed_conv_factor, &tempint, winddir));
-	strcat(logline, tempstring);
-	sprintf(tempstring,"%.1f %s ", winddir[0], directions[tempint]);
-	strcat(logline, tempstring);
+	row.value[STORE_WINDSPEED] = wind_all(ws2300, config.wind_speed_conv_factor,
+	                                      &tempint, winddir);
+	row.value[STORE_WIND_ANGLE] = winddir[0];
+	row.code[STORE_WIND_DIRECTION] = tempint;
+	out_fixed(&values, row.value[STORE_WINDSPEED], 1);
+	out_char(&values, ' ');
+	out_fixed(&values, winddir[0], 1);
+	out_char(&values, ' ');
+	out_text(&values, directions[tempint]);
+	out_char(&values, ' ');
 
 
 	/* READ WINDCHILL */
 
-	sprintf(tempstring,"%.1f ", windchill(ws2300, config.temperature_conv));
-	strcat(logline, tempstring);
+	row.value[STORE_WINDCHILL] = windchill(ws2300, config.temperature_conv);
+	out_fixed(&values, row.value[STORE_WINDCHILL], 1);
+	out_char(&values, ' ');
 
 
 	/* READ RAIN 1H */
 
-	sprintf(tempstring,"%.2f ", rain_1h(ws2300, config.rain_conv_factor));
-	strcat(logline, tempstring);
+	row.value[STORE_RAIN_1H] = rain_1h(ws2300, config.rain_conv_factor);
+	out_fixed(&values, row.value[STORE_RAIN_1H], 2);
+	out_char(&values, ' ');
 
 
 	/* READ RAIN 24H */
 
-	sprintf(tempstring,"%.2f ", rain_24h(ws2300, config.rain_conv_factor));
-	strcat(logline, tempstring);
+	row.value[STORE_RAIN_24H] = rain_24h(ws2300, config.rain_conv_factor);
+	out_fixed(&values, row.value[STORE_RAIN_24H], 2);
+	out_char(&values, ' ');
 
 
 	/* READ RAIN TOTAL */
 
-	sprintf(tempstring,"%.2f ", rain_total(ws2300, config.rain_conv_factor));
-	strcat(logline, tempstring);
+	row.value[STORE_RAIN_TOTAL] = rain_total(ws2300, config.rain_conv_factor);
+	out_fixed(&values, row.value[STORE_RAIN_TOTAL], 2);
+	out_char(&values, ' ');
 
 
 	/* READ RELATIVE PRESSURE */
 
-	sprintf(tempstring,"%.3f ", rel_pressure(ws2300, config.pressure_conv_factor));
-	strcat(logline, tempstring);
+	row.value[STORE_PRESSURE] = rel_pressure(ws2300, config.pressure_conv_factor);
+	out_fixed(&values, row.value[STORE_PRESSURE], 3);
+	out_char(&values, ' ');
 
 
 	/* READ TENDENCY AND FORECAST */
 
 	tendency_forecast(ws2300, tendency, forecast);
-	sprintf(tempstring,"%s %s ", tendency, forecast);
-	strcat(logline, tempstring);
+	row.code[STORE_TENDENCY] = store_code_index(tendency, store_tendencies, 3);
+	row.code[STORE_FORECAST] = store_code_index(forecast, store_forecasts, 3);
+	out_text(&values, tendency);
+	out_char(&values, ' ');
+	out_text(&values, forecast);
+	out_char(&values, ' ');
 
 
 	/* GET DATE AND TIME FOR LOG FILE, PLACE BEFORE ALL DATA IN LOG LINE */
 
 	time(&basictime);
-	strftime(datestring, sizeof(datestring), "%Y%m%d%H%M%S %Y-%b-%d %H:%M:%S",
-	         localtime(&basictime));
+	row.time = basictime;
+	out_init(&line, linedata, sizeof(linedata));
+	out_time(&line, "%Y%m%d%H%M%S %Y-%b-%d %H:%M:%S ", basictime);
+	out_bytes(&line, values.data, values.length);
+	out_char(&line, '\n');
 
 
 	// Print out and leave
 
-	// printf("%s %s\n",datestring, logline); //disabled to be used in cron job
-	fprintf(fileptr, "%s %s\n", datestring, logline);
+	// out_write(&line, stdout); //disabled to be used in cron job
+	logged = !values.overflow && out_write(&line, fileptr) == 0;
+
+	if (config.log_store[0] != '\0' && store_append(config.log_store, &row, 1) < 0)
+		printf("Cannot write store %s\n", config.log_store);
 
 	close_weatherstation(ws2300);
 	
-	fclose(fileptr);
+	// The line is only written once the file is closed
+	if (fclose(fileptr) != 0)
+		logged = 0;
+	if (!logged)
+		printf("Cannot write file %s\n", argv[1]);
+
+	if (log_index_update(argv[1], config.log_index) < 0)
+		printf("Cannot write file %s.idx\n", argv[1]);
+
+	// The rollups only get readings that are in the log
+	if (config.rollup && logged)
+	{
+		rollup_observation_from_store(&observation, &row);
+		if (rollup_open_files(&rollup, argv[1]) < 0 || rollup_begin(&rollup) < 0 ||
+		    rollup_add_newer(&rollup, &observation) < 0 || rollup_commit(&rollup) < 0)
+			printf("Cannot write the rollups of %s\n", argv[1]);
+		rollup_close(&rollup);
+	}
 
 	return(0);
 }
@@ -0,0 +1,321 @@
+/*  open2300 - logindex2300.c
+ *
+ *  Sparse time index of the text logs of log2300 and histlog2300
+ *
+ *  Every line of these logs starts with the time stamp YYYYMMDDhhmmss.
+ *  The index file log.idx next to the log holds the stamp and byte
+ *  offset of every n-th line, so a range of time is found with a
+ *  binary search of the index and one seek into the log instead of a
+ *  scan from the start. The log itself is not changed.
+ *
+ *  The index is brought up to date after each append. It remembers how
+ *  many bytes of the log it has read and only reads the new lines. A
+ *  log that was rotated or truncated since is indexed again.
+ *
+ *  The stamps are local time, so they run back an hour when the clock
+ *  is set back in autumn. A range that ends within that hour stops at
+ *  its first pass.
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#include "logindex2300.h"
+
+#define NAME_SIZE 300
+
+
+/********************************************************************
+ * log_line_stamp
+ * Read the time stamp at the start of a log line
+ *
+ * Returns: the stamp as the number YYYYMMDDhhmmss, 0 if the line does
+ *          not start with one
+ *
+ ********************************************************************/
+uint64_t log_line_stamp(const char *line)
+{
+	uint64_t stamp = 0;
+	int i;
+
+	for (i = 0; i < LOG_STAMP_DIGITS; i++)
+	{
+		if (line[i] < '0' || line[i] > '9')
+			return 0;
+		stamp = stamp * 10 + (line[i] - '0');
+	}
+
+	return stamp;
+}
+
+
+/********************************************************************
+ * log_parse_stamp
+ * Read a time given as YYYYMMDD[hh[mm[ss]]] on the command line
+ *
+ * Input:  text - the digits
+ *         end - 0 for the start of the time given, 1 for its end
+ *               (20061003 ends at 20061003999999)
+ *
+ * Returns: the stamp as the number YYYYMMDDhhmmss, 0 if not a time
+ *
+ ********************************************************************/
+uint64_t log_parse_stamp(const char *text, int end)
+{
+	uint64_t stamp = 0;
+	int i;
+
+	for (i = 0; text[i] != '\0'; i++)
+	{
+		if (i == LOG_STAMP_DIGITS || text[i] < '0' || text[i] > '9')
+			return 0;
+		stamp = stamp * 10 + (text[i] - '0');
+	}
+
+	if (i < 8)
+		return 0;
+
+	for (; i < LOG_STAMP_DIGITS; i++)
+		stamp = stamp * 10 + (end ? 9 : 0);
+
+	return stamp;
+}
+
+
+/********************************************************************
+ * entry_matches checks that an index entry points at the start of a
+ * line of the log with its stamp
+ ********************************************************************/
+static int entry_matches(FILE *log, struct log_index_entry *entry)
+{
+	char line[LOG_STAMP_DIGITS + 2];
+
+	if (entry->offset < 0)
+		return 0;
+
+	if (entry->offset == 0)
+	{
+		if (fseek(log, 0L, SEEK_SET) != 0 ||
+		    fread(line + 1, LOG_STAMP_DIGITS, 1, log) != 1)
+			return 0;
+		line[0] = '\n';
+	}
+	else if (fseek(log, entry->offset - 1, SEEK_SET) != 0 ||
+	         fread(line, LOG_STAMP_DIGITS + 1, 1, log) != 1)
+		return 0;
+
+	line[LOG_STAMP_DIGITS + 1] = '\0';
+
+	return line[0] == '\n' && log_line_stamp(line + 1) == entry->stamp;
+}
+
+
+/********************************************************************
+ * index_matches checks that the last entry of an index still points
+ * at its line, i.e. the log was not replaced since
+ ********************************************************************/
+static int index_matches(FILE *index, FILE *log, struct log_index_header *header)
+{
+	struct log_index_entry entry;
+
+	if (header->entries == 0)
+		return header->indexed == 0;
+
+	if (fseek(index, sizeof(*header) + (header->entries - 1) * sizeof(entry), SEEK_SET) != 0 ||
+	    fread(&entry, sizeof(entry), 1, index) != 1)
+		return 0;
+
+	return entry_matches(log, &entry);
+}
+
+
+/********************************************************************
+ * log_index_update
+ * Bring the index file logname.idx up to date with the log, creating
+ * it if needed. Only the lines appended since the last update are read.
+ * A line not ended yet is left for the next update.
+ *
+ * Input:  logname - the log of log2300 or histlog2300
+ *         every - lines of the log per index entry. An index made
+ *                 with another value is made again.
+ *
+ * Returns: number of entries added, -1 on error
+ *
+ ********************************************************************/
+int log_index_update(char *logname, int every)
+{
+	struct log_index_header header;
+	struct log_index_entry entry;
+	char indexname[NAME_SIZE];
+	char line[1024];
+	FILE *log, *index;
+	int64_t size, offset, complete;
+	uint64_t stamp = 0;
+	int start = 1, added = 0;
+	size_t length;
+
+	if (every < 1)
+		return 0;
+
+	snprintf(indexname, sizeof(indexname), "%s.idx", logname);
+
+	if ((log = fopen(logname, "rb")) == NULL)
+		return -1;
+
+	fseek(log, 0L, SEEK_END);
+	size = ftell(log);
+
+	if ((index = fopen(indexname, "r+b")) == NULL ||
+	    fread(&header, sizeof(header), 1, index) != 1 ||
+	    memcmp(header.magic, LOG_INDEX_MAGIC, 8) != 0 ||
+	    header.every != (uint32_t)every || header.indexed > size ||
+	    !index_matches(index, log, &header))
+	{
+		// No index yet or not one of this log: start over
+		if (index != NULL)
+			fclose(index);
+
+		if ((index = fopen(indexname, "w+b")) == NULL)
+		{
+			fclose(log);
+			return -1;
+		}
+
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, LOG_INDEX_MAGIC, 8);
+		header.every = every;
+	}
+
+	if (header.indexed == size)
+	{
+		fclose(log);
+		return fclose(index) == 0 ? 0 : -1;
+	}
+
+	offset = complete = header.indexed;
+	fseek(log, offset, SEEK_SET);
+	fseek(index, sizeof(header) + header.entries * sizeof(entry), SEEK_SET);
+
+	while (fgets(line, sizeof(line), log) != NULL)
+	{
+		length = strlen(line);
+
+		if (start)
+		{
+			entry.offset = offset;
+			stamp = log_line_stamp(line);
+		}
+
+		offset += length;
+
+		// A line longer than the buffer goes on in the next piece
+		if (line[length - 1] != '\n')
+		{
+			start = 0;
+			continue;
+		}
+
+		start = 1;
+		complete = offset;
+
+		if (stamp == 0)
+			continue;
+
+		if (header.pending == 0)
+		{
+			entry.stamp = stamp;
+			if (fwrite(&entry, sizeof(entry), 1, index) != 1)
+			{
+				// The header is not changed, the next update starts over here
+				fclose(log);
+				fclose(index);
+				return -1;
+			}
+			header.entries++;
+			added++;
+		}
+
+		header.pending = (header.pending + 1) % every;
+	}
+
+	fclose(log);
+
+	// The entries are on disk before the header counts them
+	header.indexed = complete;
+	if (flush_file(index) < 0 || fseek(index, 0L, SEEK_SET) != 0 ||
+	    fwrite(&header, sizeof(header), 1, index) != 1)
+		added = -1;
+
+	if (fclose(index) != 0)
+		added = -1;
+
+	return added;
+}
+
+
+/********************************************************************
+ * log_index_find
+ * Find where to start reading a log for the lines from a time on
+ *
+ * Input:  logname - the log, its index is logname.idx
+ *         stamp - YYYYMMDDhhmmss as a number
+ *
+ * Returns: byte offset of a line before the first line at or after
+ *          stamp, 0 if there is no index or it is not one of this
+ *          log any more (the log was rotated since it was updated)
+ *
+ ********************************************************************/
+long log_index_find(char *logname, uint64_t stamp)
+{
+	struct log_index_header *header;
+	struct log_index_entry *entries;
+	char indexname[NAME_SIZE];
+	long size, low, high, middle, offset = 0;
+	int64_t count, log_size;
+	FILE *log;
+	void *map;
+
+	snprintf(indexname, sizeof(indexname), "%s.idx", logname);
+
+	if ((log = fopen(logname, "rb")) == NULL)
+		return 0;
+
+	if (fseek(log, 0L, SEEK_END) != 0 || (log_size = ftell(log)) < 0 ||
+	    (map = map_file(indexname, &size)) == NULL)
+	{
+		fclose(log);
+		return 0;
+	}
+
+	header = map;
+	entries = (struct log_index_entry *)(header + 1);
+
+	if (size >= (long)sizeof(*header) &&
+	    memcmp(header->magic, LOG_INDEX_MAGIC, 8) == 0 &&
+	    header->indexed <= log_size)
+	{
+		count = header->entries;
+		if (count > (int64_t)((size - sizeof(*header)) / sizeof(*entries)))
+			count = (size - sizeof(*header)) / sizeof(*entries);
+
+		// The last entry before stamp
+		low = 0;
+		high = count;
+		while (low < high)
+		{
+			middle = low + (high - low) / 2;
+			if (entries[middle].stamp < stamp)
+				low = middle + 1;
+			else
+				high = middle;
+		}
+
+		if (low > 0 && entry_matches(log, &entries[low - 1]))
+			offset = entries[low - 1].offset;
+	}
+
+	unmap_file(map, size);
+	fclose(log);
+
+	return offset;
+}
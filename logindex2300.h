@@ -0,0 +1,41 @@
+/* open2300 - logindex2300.h
+ * Include file for the sparse time index of the text logs
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_LOGINDEX2300_H_
+#define _INCLUDE_LOGINDEX2300_H_
+
+#include <stdint.h>
+#include "rw2300.h"
+
+#define LOG_INDEX_MAGIC   "O2300LI1"   // first bytes of a log.idx file
+#define LOG_STAMP_DIGITS  14           // YYYYMMDDhhmmss at the start of a line
+
+/* Start of a log.idx file */
+struct log_index_header
+{
+	char     magic[8];
+	uint32_t every;                    //lines of the log per entry
+	uint32_t pending;                  //lines after the last entry
+	int64_t  indexed;                  //bytes of the log read so far
+	int64_t  entries;                  //entries following
+};
+
+/* The time stamp of a line, as the number YYYYMMDDhhmmss, and where
+ * the line starts */
+struct log_index_entry
+{
+	uint64_t stamp;
+	int64_t  offset;
+};
+
+uint64_t log_line_stamp(const char *line);
+
+uint64_t log_parse_stamp(const char *text, int end);
+
+int log_index_update(char *logname, int every);
+
+long log_index_find(char *logname, uint64_t stamp);
+
+#endif /* _INCLUDE_LOGINDEX2300_H_ */
@@ -0,0 +1,106 @@
+/*  open2300 - logquery2300.c
+ *
+ *  Version 1.11
+ *
+ *  Print the lines of a log2300 or histlog2300 log from a range of
+ *  time, using the sparse index of logindex2300.c
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#include "logindex2300.h"
+
+#define SCAN_BUFFER 65536
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("logquery2300 - Print the lines of a log2300 or histlog2300 log\n");
+	printf("from a range of time.\n");
+	printf("Version %s (C)2003-2006 Kenneth Lavrsen.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("Print a range:   logquery2300 log_filename from [to]\n");
+	printf("Index a log:     logquery2300 -i lines log_filename\n\n");
+	printf("from and to are local times YYYYMMDD[hh[mm[ss]]], both included.\n");
+	printf("The index log_filename.idx has an entry every lines lines. log2300\n");
+	printf("and histlog2300 keep it up to date with LOG_INDEX in the config file.\n");
+	printf("Without an index the log is read from the start.\n");
+	exit(0);
+}
+
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * The index gives the offset of a line before the range. From there
+ * the log is read in order until the first line after the range.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	static char buffer[SCAN_BUFFER];
+	char line[1024];
+	FILE *fileptr;
+	uint64_t from, to = UINT64_MAX, stamp;
+	int start = 1, inside = 0;
+	size_t length;
+	int n;
+
+	if (argc == 4 && strcmp(argv[1], "-i") == 0)
+	{
+		if ((n = log_index_update(argv[3], atoi(argv[2]))) < 0)
+		{
+			fprintf(stderr, "Cannot index %s\n", argv[3]);
+			exit(EXIT_FAILURE);
+		}
+		printf("%d index entries added\n", n);
+		return(0);
+	}
+
+	if (argc < 3 || argc > 4 ||
+	    (from = log_parse_stamp(argv[2], 0)) == 0 ||
+	    (argc == 4 && (to = log_parse_stamp(argv[3], 1)) == 0))
+		print_usage();
+
+	if ((fileptr = fopen(argv[1], "rb")) == NULL)
+	{
+		fprintf(stderr, "Cannot open file %s\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	setvbuf(fileptr, buffer, _IOFBF, sizeof(buffer));
+	fseek(fileptr, log_index_find(argv[1], from), SEEK_SET);
+
+	while (fgets(line, sizeof(line), fileptr) != NULL)
+	{
+		length = strlen(line);
+
+		// Lines without a stamp go with the line before them
+		if (start && (stamp = log_line_stamp(line)) != 0)
+		{
+			if (stamp > to)
+				break;
+			inside = stamp >= from;
+		}
+
+		if (inside)
+			fwrite(line, 1, length, stdout);
+
+		start = line[length - 1] == '\n';
+	}
+
+	fclose(fileptr);
+
+	return(0);
+}
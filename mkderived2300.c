@@ -0,0 +1,133 @@
+/*  open2300 - mkderived2300.c
+ *
+ *  Build tool that writes the lookup tables of the derived values
+ *  (windchill, dewpoint, wind direction averages) to derived2300.c
+ *  and derived2300.h
+ *
+ *  The station values these depend on are quantized, so every pow(),
+ *  log(), cos() and sin() the library would evaluate is computed here
+ *  once, with the same expression, and written as a hexadecimal
+ *  floating point constant. The library then gets the very same
+ *  doubles without calling libm. A cross compiled library gets the
+ *  results of the build host's libm, which may differ from the
+ *  target's in the last bit.
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+/* Must match rw2300.c */
+#define WIND_RADIANS (3.14159265358979 / 8)
+
+#define WIND_RAW     4096     // 12 bit wind speed, 0.1 m/s steps
+#define HUMIDITY_RAW 166      // two BCD nibbles, 0-99 valid, up to 0xFF=165
+#define DIRECTIONS   16
+
+
+/********************************************************************
+ * print_usage prints a short user guide
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("mkderived2300 - Generate the derived value tables of the open2300\n");
+	printf("library. Used by the Makefile.\n\n");
+	printf("Usage:\n");
+	printf("mkderived2300 derived2300.c derived2300.h\n");
+	exit(EXIT_FAILURE);
+}
+
+
+/********************************************************************
+ * table writes one table, four values a line, exact to the last bit
+ ********************************************************************/
+void table(FILE *out_c, FILE *out_h, const char *name, const char *comment,
+           double *values, int count)
+{
+	int i;
+
+	fprintf(out_h, "extern const double %s[%d];   // %s\n", name, count, comment);
+	fprintf(out_c, "/* %s */\nconst double %s[%d] =\n{", comment, name, count);
+
+	for (i = 0; i < count; i++)
+	{
+		fprintf(out_c, i % 4 == 0 ? "\n\t" : " ");
+
+		if (isinf(values[i]))
+			fprintf(out_c, "%sHUGE_VAL", values[i] < 0 ? "-" : "");
+		else
+			fprintf(out_c, "%a", values[i]);
+
+		if (i < count - 1)
+			fprintf(out_c, ",");
+	}
+
+	fprintf(out_c, "\n};\n\n");
+}
+
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * Each table is computed with exactly the expression the library used
+ * before the tables, see decode_history_batch and wind_summary.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	static double values[WIND_RAW];
+	FILE *out_c, *out_h;
+	double windspeed;
+	int i;
+
+	if (argc != 3)
+		print_usage();
+
+	if ((out_c = fopen(argv[1], "w")) == NULL ||
+	    (out_h = fopen(argv[2], "w")) == NULL)
+	{
+		printf("Cannot write output files\n");
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(out_h, "/* Generated by mkderived2300 - do not edit */\n\n"
+	               "#ifndef _INCLUDE_DERIVED2300_H_\n"
+	               "#define _INCLUDE_DERIVED2300_H_\n\n");
+
+	fprintf(out_c, "/* Generated by mkderived2300 - do not edit */\n\n"
+	               "#include <math.h>\n"
+	               "#include \"derived2300.h\"\n\n");
+
+	for (i = 0; i < WIND_RAW; i++)
+	{
+		windspeed = i / 10.0;
+		values[i] = pow(3.6 * windspeed, 0.16);
+	}
+	table(out_c, out_h, "wind_power_table",
+	      "pow(km/h, 0.16) of the raw wind speed", values, WIND_RAW);
+
+	for (i = 0; i < HUMIDITY_RAW; i++)
+		values[i] = log((double)i/100);
+	table(out_c, out_h, "log_humidity_table",
+	      "log(humidity/100) of the raw humidity", values, HUMIDITY_RAW);
+
+	for (i = 0; i < DIRECTIONS; i++)
+		values[i] = cos(i * WIND_RADIANS);
+	table(out_c, out_h, "wind_north_table",
+	      "cos() of the wind direction index", values, DIRECTIONS);
+
+	for (i = 0; i < DIRECTIONS; i++)
+		values[i] = sin(i * WIND_RADIANS);
+	table(out_c, out_h, "wind_east_table",
+	      "sin() of the wind direction index", values, DIRECTIONS);
+
+	fprintf(out_h, "\n#endif /* _INCLUDE_DERIVED2300_H_ */\n");
+
+	fclose(out_c);
+	fclose(out_h);
+
+	return 0;
+}
@@ -0,0 +1,426 @@
+/*  open2300 - mkfields2300.c
+ *
+ *  Build tool that turns memory_map_2300.txt into the field
+ *  descriptor table fields2300.c and its index fields2300.h
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAXFIELDS 400
+#define MAXTEXT   100
+
+/* Must match the FIELD_ encodings in rw2300.h */
+#define ENC_BCD       0
+#define ENC_BINARY    1
+#define ENC_BITS      2
+#define ENC_TIMESTAMP 3
+
+struct field
+{
+	int address;
+	int nibbles;
+	int encoding;
+	int decimals;
+	double scale;
+	double offset;
+	char unit[MAXTEXT];
+	char text[MAXTEXT];        // description of the first nibble
+	char key[MAXTEXT];         // what consecutive nibbles must share
+	char name[MAXTEXT];        // C identifier
+};
+
+static struct field fields[MAXFIELDS];
+static int field_count;
+
+
+/********************************************************************
+ * print_usage prints a short user guide
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("mkfields2300 - Generate the field table of the open2300 library\n");
+	printf("from the memory map. Used by the Makefile.\n\n");
+	printf("Usage:\n");
+	printf("mkfields2300 memory_map_2300.txt fields2300.c fields2300.h\n");
+	exit(EXIT_FAILURE);
+}
+
+
+/********************************************************************
+ * contains - case insensitive strstr returning a pointer or NULL
+ ********************************************************************/
+char *contains(char *text, char *word)
+{
+	int n = strlen(word);
+
+	for (; *text; text++)
+	{
+		if (strncasecmp(text, word, n) == 0)
+			return text;
+	}
+
+	return NULL;
+}
+
+
+/********************************************************************
+ * trim removes white space and stray commas at both ends
+ ********************************************************************/
+void trim(char *text)
+{
+	int n = strlen(text);
+
+	while (n > 0 && (isspace((unsigned char)text[n - 1]) || text[n - 1] == ','))
+		text[--n] = '\0';
+
+	while (*text == ' ')
+		memmove(text, text + 1, n--);
+}
+
+
+/********************************************************************
+ * make_key returns the part of a description that names the field.
+ * Time and date nibbles of a min/max record become one key so the
+ * 10 nibbles are decoded as one timestamp.
+ ********************************************************************/
+void make_key(char *text, char *key)
+{
+	char *end;
+
+	strcpy(key, text);
+
+	if ((end = strchr(key, ':')) != NULL ||
+	    (end = strchr(key, ',')) != NULL ||
+	    (end = strstr(key, " = ")) != NULL)
+		*end = '\0';
+
+	trim(key);
+
+	// Record dates are written "Date ..., BCD day 1s"
+	if (strncmp(key, "Date ", 5) == 0 && contains(text, ", BCD"))
+		memcpy(key, "Time ", 5);
+}
+
+
+/********************************************************************
+ * digit_weight returns the weight of a BCD nibble as written in the
+ * map ("0.01s", "1s", "10 [mm]" ...) or 0 if there is none.
+ ********************************************************************/
+double digit_weight(char *text)
+{
+	char *p;
+
+	if ((p = contains(text, "BCD")) == NULL)
+		return 0;
+
+	p += 3;
+	if (strncmp(p, " offset ", 8) == 0)
+		p += 8 + strspn(p + 8, "0123456789");    // skip the offset value
+
+	for (; *p; p++)
+	{
+		if (p[-1] == ' ' && isdigit((unsigned char)*p))
+			return atof(p);
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * parse_unit takes the unit and a scale from the last [...] group
+ * of a description: [C], [m/s * 10], [km/h / 100], [0.5 sec]
+ ********************************************************************/
+void parse_unit(struct field *f)
+{
+	char buffer[MAXTEXT];
+	char *start, *end, *token;
+
+	f->unit[0] = '\0';
+
+	if ((start = strrchr(f->text, '[')) == NULL ||
+	    (end = strchr(start, ']')) == NULL)
+		return;
+
+	memcpy(buffer, start + 1, end - start - 1);
+	buffer[end - start - 1] = '\0';
+
+	if ((token = strchr(buffer, '*')) != NULL)
+		f->scale /= atof(token + 1);
+	else if ((token = strstr(buffer, " / ")) != NULL)
+		f->scale /= atof(token + 3);
+	else if (isdigit((unsigned char)buffer[0]))
+		f->scale *= atof(buffer);
+
+	for (token = strtok(buffer, " *"); token; token = strtok(NULL, " *"))
+	{
+		if (isalpha((unsigned char)token[0]) && strcmp(token, "Range") != 0)
+		{
+			strcpy(f->unit, token);
+			break;
+		}
+	}
+}
+
+
+/********************************************************************
+ * finish_field works out the encoding of a completed group of
+ * nibbles from the description of its first nibble.
+ * Returns 0 if the group does not describe a value.
+ ********************************************************************/
+int finish_field(struct field *f, double *weights)
+{
+	char *p;
+	int i;
+
+	f->scale = 1;
+	f->offset = 0;
+	f->decimals = 0;
+
+	if (strncmp(f->key, "Time ", 5) == 0 && f->nibbles == 10)
+	{
+		f->encoding = ENC_TIMESTAMP;
+	}
+	else if (contains(f->text, "BCD"))
+	{
+		f->encoding = ENC_BCD;
+		// The nibble of weight 1 tells the number of decimals. The
+		// map has typos in the weights of the first nibble sometimes.
+		for (i = 0; i < f->nibbles; i++)
+		{
+			if (weights[i] == 1)
+			{
+				f->decimals = i;
+				break;
+			}
+		}
+	}
+	else if (contains(f->text, "binary"))
+	{
+		f->encoding = ENC_BINARY;
+		if ((p = contains(f->text, "nnnn/")) != NULL)
+			f->scale /= atof(p + 5);
+	}
+	else if (contains(f->text, "nibble *"))
+	{
+		f->encoding = ENC_BINARY;
+		p = contains(f->text, "nibble *");
+		f->scale = atof(p + 8);
+		strcpy(f->unit, "degrees");
+	}
+	else if (contains(f->text, "flags") || contains(f->text, "bit"))
+	{
+		f->encoding = ENC_BITS;
+	}
+	else if (strchr(f->text, '=') && f->nibbles == 1)
+	{
+		f->encoding = ENC_BINARY;      // enumeration like 0=rainy
+	}
+	else
+	{
+		return 0;
+	}
+
+	for (i = 0; i < f->decimals; i++)
+		f->scale /= 10;
+
+	if ((p = contains(f->text, "offset ")) != NULL)
+		f->offset = -atof(p + 7);
+
+	if (f->encoding != ENC_BINARY || !contains(f->text, "nibble *"))
+		parse_unit(f);
+
+	return 1;
+}
+
+
+/********************************************************************
+ * make_names builds unique upper case identifiers from the keys
+ ********************************************************************/
+void make_names(void)
+{
+	int i, j;
+	char *p;
+
+	for (i = 0; i < field_count; i++)
+	{
+		for (p = fields[i].key, j = 0; *p && j < MAXTEXT - 6; p++)
+		{
+			if (isalnum((unsigned char)*p))
+				fields[i].name[j++] = toupper((unsigned char)*p);
+			else if (j > 0 && fields[i].name[j - 1] != '_')
+				fields[i].name[j++] = '_';
+		}
+		while (j > 0 && fields[i].name[j - 1] == '_')
+			j--;
+		fields[i].name[j] = '\0';
+	}
+
+	// Keys used more than once get the address appended
+	for (i = 0; i < field_count; i++)
+	{
+		for (j = 0; j < field_count; j++)
+		{
+			if (i != j && strcasecmp(fields[i].key, fields[j].key) == 0)
+			{
+				sprintf(fields[i].name + strlen(fields[i].name), "_%04X",
+				        fields[i].address);
+				break;
+			}
+		}
+	}
+}
+
+
+/********************************************************************
+ * c_string writes text as a C string literal
+ ********************************************************************/
+void c_string(FILE *out, char *text)
+{
+	fputc('"', out);
+	for (; *text; text++)
+	{
+		if (*text == '"' || *text == '\\')
+			fputc('\\', out);
+		fputc(*text, out);
+	}
+	fputc('"', out);
+}
+
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * Each line of the memory map is "ADDR SAMPLE description". Lines
+ * next to each other whose descriptions share the same field name
+ * form one field. Groups whose description gives no encoding (BCD,
+ * binary, flags, enumerations) are left out.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	FILE *map, *out_c, *out_h;
+	char line[256];
+	char text[MAXTEXT], key[MAXTEXT];
+	double weights[64];
+	struct field current;
+	int address, last_address = -2;
+	int i, n;
+
+	if (argc != 4)
+		print_usage();
+
+	if ((map = fopen(argv[1], "r")) == NULL)
+	{
+		printf("Cannot open file %s\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&current, 0, sizeof(current));
+
+	for (;;)
+	{
+		text[0] = '\0';
+		address = -1;
+
+		if (fgets(line, sizeof(line), map) != NULL)
+		{
+			line[strcspn(line, "\r\n")] = '\0';
+			if (sscanf(line, "%x %*s %n", &address, &n) >= 1 &&
+			    strlen(line) > 4 && isxdigit((unsigned char)line[3]) &&
+			    line[4] == ' ')
+			{
+				strncpy(text, line + n, MAXTEXT - 1);
+				text[MAXTEXT - 1] = '\0';
+				trim(text);
+			}
+			else
+			{
+				address = -1;
+			}
+		}
+		else if (feof(map))
+		{
+			address = -2;
+		}
+
+		make_key(text, key);
+
+		// Extend the current group or close it
+		// Flag nibbles have their own bit legend each
+		if (current.nibbles > 0 && address == last_address + 1 &&
+		    text[0] && strcasecmp(key, current.key) == 0 &&
+		    !contains(text, "flags") && current.nibbles < 64)
+		{
+			weights[current.nibbles++] = digit_weight(text);
+			last_address = address;
+			continue;
+		}
+
+		if (current.nibbles > 0 && field_count < MAXFIELDS &&
+		    finish_field(&current, weights))
+			fields[field_count++] = current;
+
+		memset(&current, 0, sizeof(current));
+
+		if (address == -2)
+			break;
+
+		if (address >= 0 && text[0])
+		{
+			current.address = address;
+			current.nibbles = 1;
+			strcpy(current.text, text);
+			strcpy(current.key, key);
+			weights[0] = digit_weight(text);
+			last_address = address;
+		}
+	}
+
+	fclose(map);
+	make_names();
+
+	if ((out_c = fopen(argv[2], "w")) == NULL ||
+	    (out_h = fopen(argv[3], "w")) == NULL)
+	{
+		printf("Cannot write output files\n");
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(out_h, "/* Generated by mkfields2300 from %s - do not edit */\n\n"
+	               "#ifndef _INCLUDE_FIELDS2300_H_\n"
+	               "#define _INCLUDE_FIELDS2300_H_\n\n"
+	               "enum field_id\n{\n", argv[1]);
+
+	fprintf(out_c, "/* Generated by mkfields2300 from %s - do not edit */\n\n"
+	               "#include \"rw2300.h\"\n\n"
+	               "const struct field_descriptor field_table[] =\n{\n", argv[1]);
+
+	for (i = 0; i < field_count; i++)
+	{
+		fprintf(out_h, "\tFIELD_%s,\n", fields[i].name);
+
+		fprintf(out_c, "\t{0x%04X, %2d, %d, %.10g, %g, ",
+		        fields[i].address, fields[i].nibbles, fields[i].encoding,
+		        fields[i].scale, fields[i].offset);
+		c_string(out_c, fields[i].unit);
+		fprintf(out_c, ", \"%s\", ", fields[i].name);
+		c_string(out_c, fields[i].encoding == ENC_BITS ?
+		                fields[i].text : fields[i].key);
+		fprintf(out_c, "}%s\n", i < field_count - 1 ? "," : "");
+	}
+
+	fprintf(out_h, "\tFIELD_COUNT\n};\n\n#endif /* _INCLUDE_FIELDS2300_H_ */\n");
+	fprintf(out_c, "};\n\nconst int field_count = %d;\n", field_count);
+
+	fclose(out_c);
+	fclose(out_h);
+
+	return 0;
+}
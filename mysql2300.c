@@ -34,12 +34,207 @@
  *  1.6  2007 Jul 19  Emiliano Parasassi
  *       http://www.lavrsen.dk/twiki/bin/view/Open2300/MysqlPatch2
  *       Plus updates in ALTER TABLE to match patch from Rolan Yang
+ *
+ *  1.7  Prepared INSERT with binary values instead of building the
+ *       SQL text. Optional interval to keep running with one
+ *       connection.
  */
 
 #include <mysql.h>
 #include "rw2300.h"
 
- 
+#define COLUMNS 15         // values of a row, the datetime is NOW()
+
+/* The values of one row, where the bindings point */
+struct mysql_row
+{
+	double temperature_in;
+	double temperature_out;
+	double dewpoint;
+	int    humidity_in;
+	int    humidity_out;
+	double windspeed;
+	double winddir_degrees;
+	char   direction[4];
+	double windchill;
+	double rain_1h;
+	double rain_24h;
+	double rain_total;
+	double pressure;
+	char   tendency[15];
+	char   forecast[15];
+	unsigned long length[3];           // of direction, tendency and forecast
+};
+
+struct mysql_log
+{
+	MYSQL *mysql;
+	MYSQL_STMT *insert;
+	MYSQL_BIND bind[COLUMNS];
+	struct mysql_row row;
+};
+
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("mysql2300 - Write current data from WS-2300 to MySQL.\n");
+	printf("Version %s (C)2003-2007 Kenneth Lavrsen, Thomas Grieder.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("Write once:              mysql2300 config_filename\n");
+	printf("Write every n seconds:   mysql2300 config_filename n\n");
+	exit(0);
+}
+
+
+/********************************************************************
+ * mysql_log_bind points the bindings at the row, in the order of the
+ * columns after datetime
+ ********************************************************************/
+void mysql_log_bind(struct mysql_log *log)
+{
+	struct mysql_row *row = &log->row;
+	MYSQL_BIND *b = log->bind;
+	void *doubles[] = { &row->temperature_in, &row->temperature_out,
+	                    &row->dewpoint, NULL, NULL, &row->windspeed,
+	                    &row->winddir_degrees, NULL, &row->windchill,
+	                    &row->rain_1h, &row->rain_24h, &row->rain_total,
+	                    &row->pressure };
+	int i;
+
+	memset(log->bind, 0, sizeof(log->bind));
+
+	for (i = 0; i < 13; i++)
+	{
+		b[i].buffer_type = MYSQL_TYPE_DOUBLE;
+		b[i].buffer = doubles[i];
+	}
+
+	b[3].buffer_type = MYSQL_TYPE_LONG;
+	b[3].buffer = &row->humidity_in;
+	b[4].buffer_type = MYSQL_TYPE_LONG;
+	b[4].buffer = &row->humidity_out;
+	b[7].buffer_type = MYSQL_TYPE_STRING;
+	b[7].buffer = row->direction;
+	b[7].length = &row->length[0];
+	b[13].buffer_type = MYSQL_TYPE_STRING;
+	b[13].buffer = row->tendency;
+	b[13].length = &row->length[1];
+	b[14].buffer_type = MYSQL_TYPE_STRING;
+	b[14].buffer = row->forecast;
+	b[14].length = &row->length[2];
+}
+
+
+/********************************************************************
+ * mysql_log_connect connects to the database, dropping an old
+ * connection first, and prepares the INSERT
+ *
+ * Returns: 0 on success and -1 if fail
+ ********************************************************************/
+int mysql_log_connect(struct mysql_log *log, struct config_type *config)
+{
+	const char *query = "INSERT INTO weather VALUES "
+	                    "(NOW(), ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+
+	if (log->insert != NULL)
+		mysql_stmt_close(log->insert);
+	if (log->mysql != NULL)
+		mysql_close(log->mysql);
+	log->insert = NULL;
+
+	if ((log->mysql = mysql_init(NULL)) == NULL)
+	{
+		fprintf(stderr, "Cannot initialize MySQL\n");
+		return -1;
+	}
+
+	if (!mysql_real_connect(log->mysql, config->mysql_host, config->mysql_user,
+	                        config->mysql_passwd, config->mysql_database,
+	                        config->mysql_port, NULL, 0))
+	{
+		fprintf(stderr, "%d: %s \n",
+		        mysql_errno(log->mysql), mysql_error(log->mysql));
+		mysql_close(log->mysql);
+		log->mysql = NULL;
+		return -1;
+	}
+
+	if ((log->insert = mysql_stmt_init(log->mysql)) == NULL)
+	{
+		fprintf(stderr, "Cannot prepare %s %d: %s \n", query,
+		        mysql_errno(log->mysql), mysql_error(log->mysql));
+		mysql_close(log->mysql);
+		log->mysql = NULL;
+		return -1;
+	}
+
+	// The errors of prepare and bind are kept by the statement
+	if (mysql_stmt_prepare(log->insert, query, strlen(query)) != 0 ||
+	    mysql_stmt_bind_param(log->insert, log->bind) != 0)
+	{
+		fprintf(stderr, "Cannot prepare %s %d: %s \n", query,
+		        mysql_stmt_errno(log->insert), mysql_stmt_error(log->insert));
+		mysql_stmt_close(log->insert);
+		mysql_close(log->mysql);
+		log->insert = NULL;
+		log->mysql = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * read_row reads the current values from the station into the row.
+ * The station is closed again to enable other programs to access it.
+ ********************************************************************/
+void read_row(struct config_type *config, struct mysql_row *row)
+{
+	WEATHERSTATION ws2300;
+	const char *directions[]= {"N","NNE","NE","ENE","E","ESE","SE","SSE",
+	                           "S","SSW","SW","WSW","W","WNW","NW","NNW"};
+	double winddir[6];
+	int tempint;
+
+	ws2300 = open_weatherstation(config->serial_device_name);
+	configure_weatherstation(ws2300, config);
+
+	row->temperature_in = temperature_indoor(ws2300, config->temperature_conv);
+	row->temperature_out = temperature_outdoor(ws2300, config->temperature_conv);
+	row->dewpoint = dewpoint(ws2300, config->temperature_conv);
+	row->humidity_in = humidity_indoor(ws2300);
+	row->humidity_out = humidity_outdoor(ws2300);
+	row->windspeed = wind_all(ws2300, config->wind_speed_conv_factor, &tempint, winddir);
+	row->winddir_degrees = winddir[0];
+	strcpy(row->direction, directions[tempint]);
+	row->windchill = windchill(ws2300, config->temperature_conv);
+	row->rain_1h = rain_1h(ws2300, config->rain_conv_factor);
+	row->rain_24h = rain_24h(ws2300, config->rain_conv_factor);
+	row->rain_total = rain_total(ws2300, config->rain_conv_factor);
+	row->pressure = rel_pressure(ws2300, config->pressure_conv_factor);
+	tendency_forecast(ws2300, row->tendency, row->forecast);
+
+	close_weatherstation(ws2300);
+
+	row->length[0] = strlen(row->direction);
+	row->length[1] = strlen(row->tendency);
+	row->length[2] = strlen(row->forecast);
+}
+
+
 /********** MAIN PROGRAM ************************************************
  *
  * This program reads current weather data from a WS2300
@@ -69,106 +264,54 @@ ALTER TABLE `open2300`.`weather` CHANGE COLUMN `wind_chill`   `wind_chill`   DEC
  * If this parameter is omitted the program will look at the default paths
  * See the open2300.conf-dist file for info
  *
+ * With a number of seconds after the config file it keeps running and
+ * writes a row every so often over the same connection and prepared
+ * statement, connecting again if the server has gone away.
+ *
  ***********************************************************************/
 int main(int argc, char *argv[])
 {
-	WEATHERSTATION ws2300;
-	MYSQL mysql;
-	char logline[3000] = "";
-	char tempstring[1000] = "";
-	const char *directions[]= {"N","NNE","NE","ENE","E","ESE","SE","SSE",
-	                           "S","SSW","SW","WSW","W","WNW","NW","NNW"};
-	double winddir[6];
-	int tempint;
-	char tendency[15];
-	char forecast[15];
+	static struct mysql_log log;
 	struct config_type config;
-	char query[4096];
+	int interval = 0;
+
+	if (argc > 3)
+		print_usage();
+
+	if (argc == 3 && (interval = atoi(argv[2])) <= 0)
+		print_usage();
 
 	get_configuration(&config, argv[1]);
-	ws2300 = open_weatherstation(config.serial_device_name);
-
-	/* READ TEMPERATURE INDOOR */
-	sprintf(logline,"\'%.1f\',", temperature_indoor(ws2300, config.temperature_conv) );
-	
-	/* READ TEMPERATURE OUTDOOR */
-	sprintf(tempstring,"\'%.1f\',", temperature_outdoor(ws2300, config.temperature_conv) );
-	strcat(logline, tempstring);
-	
-	/* READ DEWPOINT */
-	sprintf(tempstring,"\'%.1f\',", dewpoint(ws2300, config.temperature_conv) );
-	strcat(logline, tempstring);
-	
-	/* READ RELATIVE HUMIDITY INDOOR */
-	sprintf(tempstring,"\'%d\',", humidity_indoor(ws2300) );
-	strcat(logline, tempstring);
-	
-	/* READ RELATIVE HUMIDITY OUTDOOR */
-	sprintf(tempstring,"\'%d\',", humidity_outdoor(ws2300) );
-	strcat(logline, tempstring);
-
-	/* READ WIND SPEED AND DIRECTION aND WINDCHILL */
-	sprintf(tempstring,"\'%.1f\',",
-	        wind_all(ws2300, config.wind_speed_conv_factor, &tempint, winddir) );
-	strcat(logline, tempstring);
-	sprintf(tempstring,"\'%.1f\',\'%s\',", winddir[0], directions[tempint]);
-	strcat(logline, tempstring);
-	
-	/* READ WINDCHILL */
-	sprintf(tempstring,"\'%.1f\',", windchill(ws2300, config.temperature_conv) );
-	strcat(logline, tempstring);
-
-	/* READ RAIN 1H */
-	sprintf(tempstring,"\'%.1f\',", rain_1h(ws2300, config.rain_conv_factor) );
-	strcat(logline, tempstring);
-	
-	/* READ RAIN 24H */
-	sprintf(tempstring,"\'%.1f\',", rain_24h(ws2300, config.rain_conv_factor) );
-	strcat(logline, tempstring);
-	
-	/* READ RAIN TOTAL */
-	sprintf(tempstring,"\'%.1f\',", rain_total(ws2300, config.rain_conv_factor) );
-	strcat(logline, tempstring);
-
-	/* READ RELATIVE PRESSURE */
-	sprintf(tempstring,"\'%.1f\',", rel_pressure(ws2300, config.pressure_conv_factor) );
-	strcat(logline, tempstring);
-
-	/* READ TENDENCY AND FORECAST */
-	tendency_forecast(ws2300, tendency, forecast);
-	sprintf(tempstring,"\'%s\',\'%s\'", tendency, forecast);
-	strcat(logline, tempstring);
-
-	/* CLOSE THE WEATHER STATION TO ENABLE OTHER PROGRAMS TO ACCESS */
-	close_weatherstation(ws2300);
 
-	/* INIT MYSQL AND CONNECT */
-	if (!mysql_init(&mysql))
-	{
-		fprintf(stderr, "Cannot initialize MySQL");
-		exit(EXIT_FAILURE);
-	}
+	mysql_log_bind(&log);
 
-	if(!mysql_real_connect(&mysql, config.mysql_host, config.mysql_user,
-	                       config.mysql_passwd, config.mysql_database,
-	                       config.mysql_port, NULL, 0))
+	for (;;)
 	{
-		fprintf(stderr, "%d: %s \n",
-		mysql_errno(&mysql), mysql_error(&mysql));
-		exit(EXIT_FAILURE);
-	}
+		read_row(&config, &log.row);
 
-	sprintf(query, "INSERT INTO weather VALUES ( NOW(), %s )", logline);
+		/* CONNECT ONCE, AND AGAIN IF THE SERVER HAS GONE AWAY */
+		if ((log.mysql == NULL || mysql_ping(log.mysql) != 0) &&
+		    mysql_log_connect(&log, &config) < 0)
+		{
+			if (interval == 0)
+				exit(EXIT_FAILURE);
+		}
+		else if (mysql_stmt_execute(log.insert) != 0)
+		{
+			fprintf(stderr, "Could not insert row. %d: %s \n",
+			        mysql_stmt_errno(log.insert), mysql_stmt_error(log.insert));
+			if (interval == 0)
+				exit(EXIT_FAILURE);
+		}
 
-	if (mysql_query(&mysql, query))
-	{
-		fprintf(stderr, "Could not insert row. %s %d: \%s \n",
-		        query, mysql_errno(&mysql), mysql_error(&mysql));
-		mysql_close(&mysql);
-		exit(EXIT_FAILURE);
+		if (interval == 0)
+			break;
+
+		sleep_long(interval);
 	}
 
-	mysql_close(&mysql);
+	mysql_stmt_close(log.insert);
+	mysql_close(log.mysql);
 
 	return(0);
 }
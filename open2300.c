@@ -71,6 +71,7 @@ int main(int argc, char *argv[])
 	// Setup serial port
 
 	ws2300 = open_weatherstation(config.serial_device_name);
+	configure_weatherstation(ws2300, &config);
 
 
 	// Get in-data and select mode.
@@ -0,0 +1,270 @@
+/*  open2300 - out2300.c
+ *
+ *  Bounded output buffer for the lines, XML files and requests the
+ *  programs write
+ *
+ *  The text is appended into a buffer of the caller, usually on its
+ *  stack, which keeps the length so nothing is scanned again. An append
+ *  that does not fit is dropped and remembered, so a field added later
+ *  cannot run over the buffer. The result goes out in one write.
+ *
+ *  The readings are mostly printed with one, two or three decimals.
+ *  out_fixed does that without printf and gives the same digits. A
+ *  value within a hair of a rounding tie, or too large, is left to
+ *  printf to round.
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#include <stdarg.h>
+#include "rw2300.h"
+#include "out2300.h"
+
+#define FIXED_LIMIT 1e9                // largest value scaled by out_fixed itself
+#define FIXED_TIE   1e-6               // closer to a tie than this goes to printf
+
+static const double powers[OUT_DECIMALS + 1] = { 1, 10, 100, 1e3, 1e4, 1e5, 1e6 };
+
+
+/********************************************************************
+ * out_init
+ * Start an empty text in a buffer
+ *
+ * Input:  data - the buffer
+ *         size - its size in bytes, at least 1
+ *
+ * Output: out - the empty text
+ *
+ ********************************************************************/
+void out_init(struct out_buffer *out, char *data, size_t size)
+{
+	out->data = data;
+	out->size = size;
+	out->length = 0;
+	out->overflow = 0;
+	data[0] = '\0';
+}
+
+
+/********************************************************************
+ * out_bytes
+ * Append bytes, dropped if they do not all fit
+ *
+ * Input:  bytes - what to append, need not end with '\0'
+ *         length - number of bytes
+ *
+ ********************************************************************/
+void out_bytes(struct out_buffer *out, const char *bytes, size_t length)
+{
+	if (out->overflow || length >= out->size - out->length)
+	{
+		out->overflow = 1;
+		return;
+	}
+
+	memcpy(out->data + out->length, bytes, length);
+	out->length += length;
+	out->data[out->length] = '\0';
+}
+
+
+void out_text(struct out_buffer *out, const char *text)
+{
+	out_bytes(out, text, strlen(text));
+}
+
+
+void out_char(struct out_buffer *out, char c)
+{
+	out_bytes(out, &c, 1);
+}
+
+
+/********************************************************************
+ * out_int_zero
+ * Append an integer as printf "%0*ld" does
+ *
+ * Input:  value - the integer
+ *         width - least number of characters, padded with zeros after
+ *                 the sign
+ *
+ ********************************************************************/
+void out_int_zero(struct out_buffer *out, long value, int width)
+{
+	char digits[32];
+	unsigned long number;
+	int i = sizeof(digits);
+
+	number = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+	if (value < 0)
+		width--;
+	if (width > (int)sizeof(digits) - 1)
+		width = sizeof(digits) - 1;
+
+	do
+	{
+		digits[--i] = '0' + number % 10;
+		number /= 10;
+	} while (number > 0);
+
+	while ((int)sizeof(digits) - i < width)
+		digits[--i] = '0';
+
+	if (value < 0)
+		digits[--i] = '-';
+
+	out_bytes(out, digits + i, sizeof(digits) - i);
+}
+
+
+void out_int(struct out_buffer *out, long value)
+{
+	out_int_zero(out, value, 0);
+}
+
+
+/********************************************************************
+ * out_fixed
+ * Append a value with a fixed number of decimals, the same text as
+ * printf "%.*f" gives
+ *
+ * Input:  value - the value, NaN and infinity are passed to printf
+ *         decimals - number of decimals
+ *
+ ********************************************************************/
+void out_fixed(struct out_buffer *out, double value, int decimals)
+{
+	char digits[32];
+	double scaled, whole, fraction;
+	unsigned long long number;
+	int i = sizeof(digits);
+	int n;
+
+	if (decimals < 0 || decimals > OUT_DECIMALS)
+	{
+		out_format(out, "%.*f", decimals, value);
+		return;
+	}
+
+	// The scaled value is off by less than FIXED_TIE below FIXED_LIMIT,
+	// so rounding it rounds the value unless it is that close to a tie
+	scaled = fabs(value) * powers[decimals];
+	if (!(scaled < FIXED_LIMIT))
+	{
+		out_format(out, "%.*f", decimals, value);
+		return;
+	}
+
+	whole = floor(scaled);
+	fraction = scaled - whole;
+	if (fabs(fraction - 0.5) < FIXED_TIE)
+	{
+		out_format(out, "%.*f", decimals, value);
+		return;
+	}
+
+	number = (unsigned long long)whole + (fraction > 0.5);
+
+	for (n = 0; n < decimals; n++)
+	{
+		digits[--i] = '0' + number % 10;
+		number /= 10;
+	}
+
+	if (decimals > 0)
+		digits[--i] = '.';
+
+	do
+	{
+		digits[--i] = '0' + number % 10;
+		number /= 10;
+	} while (number > 0);
+
+	// printf keeps the sign of a negative value that rounds to zero
+	if (signbit(value))
+		digits[--i] = '-';
+
+	out_bytes(out, digits + i, sizeof(digits) - i);
+}
+
+
+/********************************************************************
+ * out_format
+ * Append as printf does, for what the functions above do not cover
+ *
+ * Input:  format and arguments as for printf
+ *
+ ********************************************************************/
+void out_format(struct out_buffer *out, const char *format, ...)
+{
+	va_list arguments;
+	size_t room = out->size - out->length;
+	int length;
+
+	if (out->overflow)
+		return;
+
+	va_start(arguments, format);
+	length = vsnprintf(out->data + out->length, room, format, arguments);
+	va_end(arguments);
+
+	if (length < 0 || (size_t)length >= room)
+	{
+		out->overflow = 1;
+		out->data[out->length] = '\0';
+		return;
+	}
+
+	out->length += length;
+}
+
+
+/********************************************************************
+ * out_time
+ * Append a local time as strftime does
+ *
+ * Input:  format - as for strftime, must not give an empty text
+ *         time - the time
+ *
+ ********************************************************************/
+void out_time(struct out_buffer *out, const char *format, time_t time)
+{
+	size_t length;
+
+	if (out->overflow)
+		return;
+
+	length = strftime(out->data + out->length, out->size - out->length,
+	                  format, localtime(&time));
+	if (length == 0)
+	{
+		out->overflow = 1;
+		out->data[out->length] = '\0';
+		return;
+	}
+
+	out->length += length;
+}
+
+
+/********************************************************************
+ * out_write
+ * Write the text in one go
+ *
+ * Input:  fileptr - where to
+ *
+ * Returns: 0 on success, -1 if it did not fit the buffer (nothing is
+ *          written then) or on a write error
+ *
+ ********************************************************************/
+int out_write(struct out_buffer *out, FILE *fileptr)
+{
+	if (out->overflow)
+		return -1;
+
+	if (fwrite(out->data, 1, out->length, fileptr) != out->length)
+		return -1;
+
+	return 0;
+}
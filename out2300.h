@@ -0,0 +1,46 @@
+/* open2300 - out2300.h
+ * Include file for the bounded output buffer the programs assemble
+ * their lines, files and requests in
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_OUT2300_H_
+#define _INCLUDE_OUT2300_H_
+
+#include <stdio.h>
+#include <time.h>
+
+#define OUT_DECIMALS 6                 // most decimals out_fixed formats itself
+
+/* The text so far is data[0..length-1], always followed by a '\0'.
+ * What does not fit is dropped and overflow is set; the text then ends
+ * with the last append that did fit whole. */
+struct out_buffer
+{
+	char   *data;
+	size_t  size;
+	size_t  length;
+	int     overflow;
+};
+
+void out_init(struct out_buffer *out, char *data, size_t size);
+
+void out_bytes(struct out_buffer *out, const char *bytes, size_t length);
+
+void out_text(struct out_buffer *out, const char *text);
+
+void out_char(struct out_buffer *out, char c);
+
+void out_int(struct out_buffer *out, long value);
+
+void out_int_zero(struct out_buffer *out, long value, int width);
+
+void out_fixed(struct out_buffer *out, double value, int decimals);
+
+void out_format(struct out_buffer *out, const char *format, ...);
+
+void out_time(struct out_buffer *out, const char *format, time_t time);
+
+int out_write(struct out_buffer *out, FILE *fileptr);
+
+#endif /* _INCLUDE_OUT2300_H_ */
@@ -11,147 +11,296 @@
  *
  *	1.1  2004 Nov 25  Przemyslaw Sztoch
  *	Creates pgsql2300. A Rewrite of mysql2300.
+ *
+ *	1.2  Rows are sent with COPY FROM STDIN, several at a time when
+ *	running with an interval (PGSQL_BATCH and PGSQL_FLUSH), over one
+ *	connection that is reset when lost.
  */
 
+#include <signal.h>
 #include <libpq-fe.h>
 #include "rw2300.h"
 
- 
-/********** MAIN PROGRAM ************************************************
+#define MAX_PGSQL_BATCH 1000   // rows held back at most
+#define PGSQL_LINE      256    // one row as a COPY text line
+
+static char batch[MAX_PGSQL_BATCH][PGSQL_LINE];
+static int batched;
+static volatile sig_atomic_t stop;
+
+
+/********************************************************************
+ * print_usage prints a short user guide
  *
- * This program reads current weather data from a WS2300
- * and writes the data to a PgSQL database.
+ * Input:   none
  *
- * The open2300.conf config file must contain the following parameters
- * 
- * It takes one parameters. The config file name with path
- * If this parameter is omitted the program will look at the default paths
- * See the open2300.conf-dist file for info
+ * Output:  prints to stdout
  *
- ***********************************************************************/
-int main(int argc, char *argv[])
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
 {
-	WEATHERSTATION ws2300;
-	PGconn *conn;
-	PGresult *res;
-	int retval = 1;
-	unsigned char logline[200] = "";
-	const char *directions[]= {"N","NNE","NE","ENE","E","ESE","SE","SSE",
-	                           "S","SSW","SW","WSW","W","WNW","NW","NNW"};
-	double winddir[6];
-	int tempint;
-	char tendency[15];
-	char forecast[15];
-	struct config_type config;
-	char query[4096];
+	printf("\n");
+	printf("pgsql2300 - Write current data from WS-2300 to PostgreSQL.\n");
+	printf("Version %s (C)2004-2005 Kenneth Lavrsen, Thomas Grieder, Przemyslaw Sztoch.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("Write once:              pgsql2300 config_filename\n");
+	printf("Write every n seconds:   pgsql2300 config_filename n\n");
+	exit(0);
+}
 
-	get_configuration(&config, argv[1]);
 
-	ws2300 = open_weatherstation(config.serial_device_name);
+/********************************************************************
+ * stop_handler ends the interval loop on SIGTERM and SIGINT, the rows
+ * held back are sent before the program exits
+ ********************************************************************/
+void stop_handler(int signum)
+{
+	stop = 1;
+}
 
-	/* READ TEMPERATURE INDOOR */
 
-	sprintf(logline,"%s\'%.1f\',", logline,
-	        temperature_indoor(ws2300, config.temperature_conv) );
-	
+/********************************************************************
+ * copy_escape copies a string to a COPY text field, escaping the
+ * backslash, tab and line breaks
+ ********************************************************************/
+void copy_escape(char *field, int size, const char *text)
+{
+	int n = 0;
 
-	/* READ TEMPERATURE OUTDOOR */
+	for (; *text != '\0' && n < size - 2; text++)
+	{
+		if (*text == '\\' || *text == '\t' || *text == '\n' || *text == '\r')
+		{
+			field[n++] = '\\';
+			field[n++] = *text == '\t' ? 't' : *text == '\n' ? 'n' :
+			             *text == '\r' ? 'r' : '\\';
+		}
+		else
+		{
+			field[n++] = *text;
+		}
+	}
 
-	sprintf(logline,"%s\'%.1f\',", logline,
-	        temperature_outdoor(ws2300, config.temperature_conv) );
-	
+	field[n] = '\0';
+}
 
-	/* READ DEWPOINT */
 
-	sprintf(logline,"%s\'%.1f\',", logline,
-	        dewpoint(ws2300, config.temperature_conv) );
-	
+/********************************************************************
+ * read_line reads the current values from the station as one COPY
+ * line in the column order of the table, stamped with the local time.
+ * The station is closed again to enable other programs to access it.
+ ********************************************************************/
+void read_line(struct config_type *config, char *station, char *line)
+{
+	WEATHERSTATION ws2300;
+	const char *directions[]= {"N","NNE","NE","ENE","E","ESE","SE","SSE",
+	                           "S","SSW","SW","WSW","W","WNW","NW","NNW"};
+	double winddir[6];
+	double temperature_in, temperature_out, dew, wind, chill;
+	double rain1h, rain24h, raintotal, pressure;
+	int humidity_in, humidity_out;
+	int tempint;
+	char tendency[15];
+	char forecast[15];
+	char datestring[50];
+	time_t now;
+
+	ws2300 = open_weatherstation(config->serial_device_name);
+	configure_weatherstation(ws2300, config);
+
+	temperature_in = temperature_indoor(ws2300, config->temperature_conv);
+	temperature_out = temperature_outdoor(ws2300, config->temperature_conv);
+	dew = dewpoint(ws2300, config->temperature_conv);
+	humidity_in = humidity_indoor(ws2300);
+	humidity_out = humidity_outdoor(ws2300);
+	wind = wind_all(ws2300, config->wind_speed_conv_factor, &tempint, winddir);
+	chill = windchill(ws2300, config->temperature_conv);
+	rain1h = rain_1h(ws2300, config->rain_conv_factor);
+	rain24h = rain_24h(ws2300, config->rain_conv_factor);
+	raintotal = rain_total(ws2300, config->rain_conv_factor);
+	pressure = rel_pressure(ws2300, config->pressure_conv_factor);
+	tendency_forecast(ws2300, tendency, forecast);
 
-	/* READ RELATIVE HUMIDITY INDOOR */
+	/* CLOSE THE WEATHER STATION TO ENABLE OTHER PROGRAMS TO ACCESS */
+	close_weatherstation(ws2300);
 
-	sprintf(logline,"%s\'%d\',", logline, humidity_indoor(ws2300) );
-	
-	
-	/* READ RELATIVE HUMIDITY OUTDOOR */
+	// The time of the reading with its UTC offset, rows may be sent later
+	time(&now);
+	strftime(datestring, sizeof(datestring), "%Y-%m-%d %H:%M:%S%z", localtime(&now));
 
-	sprintf(logline,"%s\'%d\',", logline, humidity_outdoor(ws2300) );
+	snprintf(line, PGSQL_LINE,
+	         "%s\t%s\t%.1f\t%.1f\t%.1f\t%d\t%d\t%.1f\t%.1f\t%s\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%s\t%s\n",
+	         station, datestring, temperature_in, temperature_out, dew,
+	         humidity_in, humidity_out, wind, winddir[0], directions[tempint],
+	         chill, rain1h, rain24h, raintotal, pressure, tendency, forecast);
+}
 
 
-	/* READ WIND SPEED AND DIRECTION aND WINDCHILL */
+/********************************************************************
+ * flush_batch sends the rows held back with one COPY, connecting or
+ * resetting a lost connection first. The rows are kept if it fails.
+ *
+ * Returns: 0 on success and -1 if fail
+ ********************************************************************/
+int flush_batch(PGconn **conn, struct config_type *config)
+{
+	PGresult *res;
+	char query[100];
+	int i, ok;
 
-	sprintf(logline,"%s\'%.1f\',", logline,
-	        wind_all(ws2300, config.wind_speed_conv_factor,
-	                 &tempint, winddir) );
+	if (*conn == NULL)
+		*conn = PQconnectdb(config->pgsql_connect);
+	else if (PQstatus(*conn) != CONNECTION_OK)
+		PQreset(*conn);
 
-	sprintf(logline,"%s\'%.1f\',\'%s\',", logline,
-	        winddir[0], directions[tempint]);
-	
+	if (PQstatus(*conn) != CONNECTION_OK)
+	{
+		fprintf(stderr, "Connection to PgSQL failed:\n%s\n", config->pgsql_connect);
+		fprintf(stderr, "%s", PQerrorMessage(*conn));
+		return -1;
+	}
 
-	/* READ WINDCHILL */
+	snprintf(query, sizeof(query), "COPY %s FROM STDIN", config->pgsql_table);
 
-	sprintf(logline,"%s\'%.1f\',", logline,
-	        windchill(ws2300, config.temperature_conv) );
+	res = PQexec(*conn, query);
+	ok = PQresultStatus(res) == PGRES_COPY_IN;
+	if (!ok)
+		fprintf(stderr, "Could not insert rows. %s:\n%s\n", PQresultErrorMessage(res), query);
+	PQclear(res);
 
-	
-	/* READ RAIN 1H */
+	if (!ok)
+		return -1;
 
-	sprintf(logline,"%s\'%.1f\',", logline,
-	        rain_1h(ws2300, config.rain_conv_factor) );
-	
-	
-	/* READ RAIN 24H */
+	for (i = 0; i < batched; i++)
+	{
+		if (PQputCopyData(*conn, batch[i], strlen(batch[i])) != 1)
+			break;
+	}
 
-	sprintf(logline,"%s\'%.1f\',", logline,
-	        rain_24h(ws2300, config.rain_conv_factor) );
+	// An aborted COPY is rolled back by the server
+	PQputCopyEnd(*conn, i < batched ? "write failed" : NULL);
 
-	
-	/* READ RAIN TOTAL */
+	ok = i == batched;
+	while ((res = PQgetResult(*conn)) != NULL)
+	{
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		{
+			fprintf(stderr, "Could not insert rows. %s:\n%s\n", PQresultErrorMessage(res), query);
+			ok = 0;
+		}
+		PQclear(res);
+	}
 
-	sprintf(logline,"%s\'%.1f\',", logline,
-	        rain_total(ws2300, config.rain_conv_factor) );
+	if (!ok)
+		return -1;
 
-	
-	/* READ RELATIVE PRESSURE */
+	batched = 0;
 
-	sprintf(logline,"%s\'%.1f\',", logline,	
-	        rel_pressure(ws2300, config.pressure_conv_factor) );
+	return 0;
+}
 
+ 
+/********** MAIN PROGRAM ************************************************
+ *
+ * This program reads current weather data from a WS2300
+ * and writes the data to a PgSQL database.
+ *
+ * The open2300.conf config file must contain the following parameters
+ * 
+ * It takes one parameters. The config file name with path
+ * If this parameter is omitted the program will look at the default paths
+ * See the open2300.conf-dist file for info
+ *
+ * With a number of seconds after the config file it keeps running and
+ * reads the station that often. The rows are sent with one COPY when
+ * PGSQL_BATCH of them are waiting or the oldest has waited PGSQL_FLUSH
+ * seconds. The connection is kept and reset when lost; rows that could
+ * not be sent are sent with the next batch, the oldest dropped when
+ * MAX_PGSQL_BATCH are waiting. The PGSQL_FLUSH limit is checked every
+ * second between the readings, and a failed send is tried again after
+ * another PGSQL_FLUSH seconds. On SIGTERM or SIGINT the rows waiting
+ * are sent before it exits.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	PGconn *conn = NULL;
+	struct config_type config;
+	char station[50];
+	time_t first = 0;
+	time_t next_read;
+	int interval = 0;
+	int size;
+	int retval;
 
-	/* READ TENDENCY AND FORECAST */
-	
-	tendency_forecast(ws2300, tendency, forecast);
-	sprintf(logline,"%s\'%s\',\'%s\'", logline, tendency, forecast);
+	if (argc > 3)
+		print_usage();
 
+	if (argc == 3 && (interval = atoi(argv[2])) <= 0)
+		print_usage();
 
-	/* CLOSE THE WEATHER STATION TO ENABLE OTHER PROGRAMS TO ACCESS */
-	close_weatherstation(ws2300);
+	get_configuration(&config, argv[1]);
 
-	sprintf(query, "INSERT INTO %s VALUES ('%s', current_timestamp, %s)", config.pgsql_table, config.pgsql_station, logline);
+	copy_escape(station, sizeof(station), config.pgsql_station);
 
-	//printf("%s\n",query);  //disabled to be used in cron job
-	//printf("%s\n",config.pgsql_connect); //debug
+	size = interval == 0 ? 1 : config.pgsql_batch;
+	if (size < 1)
+		size = 1;
+	if (size > MAX_PGSQL_BATCH)
+		size = MAX_PGSQL_BATCH;
 
-	/* INIT PQ AND EXECUTE QUERY */
-	conn = PQconnectdb(config.pgsql_connect);
+	signal(SIGTERM, stop_handler);
+	signal(SIGINT, stop_handler);
 
-	if (PQstatus(conn) == CONNECTION_BAD)
+	retval = 0;
+	while (!stop)
 	{
-		fprintf(stderr, "Connection to PgSQL failed:\n%s\n", config.pgsql_connect);
-		fprintf(stderr, "%s", PQerrorMessage(conn));
+		if (batched == MAX_PGSQL_BATCH)
+		{
+			fprintf(stderr, "PgSQL unreachable, oldest row dropped\n");
+			memmove(batch[0], batch[1], (MAX_PGSQL_BATCH - 1) * PGSQL_LINE);
+			batched--;
+		}
+
+		if (batched == 0)
+			time(&first);
+
+		next_read = time(NULL) + interval;
+		read_line(&config, station, batch[batched++]);
+
+		// A failed send waits for another PGSQL_FLUSH unless the batch
+		// fills up before that
+		retval = 0;
+		if (batched >= size && (retval = flush_batch(&conn, &config)) != 0)
+			time(&first);
+
+		if (interval == 0)
+			break;
+
+		while (!stop && time(NULL) < next_read)
+		{
+			if (batched > 0 && config.pgsql_flush > 0 &&
+			    difftime(time(NULL), first) >= config.pgsql_flush)
+			{
+				if ((retval = flush_batch(&conn, &config)) != 0)
+					time(&first);
+			}
+
+			sleep_long(1);
+		}
 	}
-	else
+
+	// Rows held back when stopped are sent before exiting
+	if (stop && batched > 0 && flush_batch(&conn, &config) != 0)
 	{
-		res = PQexec(conn, query);
-	
-		if (PQresultStatus(res) == PGRES_COMMAND_OK)
-			retval = 0;
-		else
-			fprintf(stderr, "Could not insert row. %s:\n%s\n", PQresultErrorMessage(res), query);
-				
-		PQclear(res);
+		fprintf(stderr, "PgSQL unreachable, %d rows lost\n", batched);
+		retval = -1;
 	}
-		
+
 	PQfinish(conn);
 
-	return retval;
+	return retval ? 1 : 0;
 }
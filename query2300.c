@@ -0,0 +1,1474 @@
+/*  open2300 - query2300.c
+ *
+ *  Version 1.11
+ *
+ *  Read a range of time back out of what the loggers stored: the text
+ *  logs of log2300 and histlog2300, the tables weather_log of
+ *  sqlitelog2300 and weather_history of sqlitehistlog2300, and the
+ *  stores of store2300.c. The rows can be filtered and grouped by time
+ *  into count, mean, min, max, sum and percentiles of each column, and
+ *  are written as CSV or JSON.
+ *
+ *  Every file is read once, oldest row first, and only the groups are
+ *  kept: count, sum, min and max of each column and, for percentiles, a
+ *  sketch of the values (see below). Rows that are not grouped are
+ *  written as they are read. Several files are read by parallel
+ *  threads, each into groups of its own that are merged by time at the
+ *  end, so a day that starts in one log and ends in the next is one
+ *  group.
+ *
+ *  A text log is read from the entry of its index (logindex2300.c)
+ *  before the range, a store only decodes the chunks of the range and
+ *  the columns asked for and SQLite gets the range in its WHERE.
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#include <pthread.h>
+#ifdef WITH_SQLITE
+#include <sqlite3.h>
+#endif
+#include "store2300.h"
+#include "logindex2300.h"
+
+#define SCAN_BUFFER      65536
+#define MAX_FILTERS      16
+#define MAX_AGGREGATES   16
+#define MAX_JOBS         64
+#define LOG_FIELDS       18        // fields of a log2300 line
+#define HISTLOG_FIELDS   14        // fields of a histlog2300 line
+
+/* Percentiles come from a histogram of at most SKETCH_BUCKETS counters
+ * per column and group, see sketch_add */
+#define SKETCH_WIDTH     0.001     // the finest the loggers write
+#define SKETCH_BUCKETS   2048
+
+/* A column of the output */
+struct column
+{
+	const char *name;
+	int         store_value;           //index in store_row.value or -1
+	int         store_code;            //index in store_row.code or -1
+	int         log_field;             //field of a log2300 line
+	int         histlog_field;         //field of a histlog2300 line or -1
+	const char *sql;                   //column of weather_log and weather_history
+	int         history;               //1 if weather_history has it too
+};
+
+static const struct column columns[] =
+{
+	{ "temperature_in",  STORE_TEMPERATURE_IN,  -1, 3,  3,  "temperature_in",   1 },
+	{ "temperature_out", STORE_TEMPERATURE_OUT, -1, 4,  4,  "temperature_out",  1 },
+	{ "dewpoint",        STORE_DEWPOINT,        -1, 5,  5,  "dewpoint",         1 },
+	{ "humidity_in",     -1, STORE_HUMIDITY_IN,     6,  6,  "rel_humidity_in",  1 },
+	{ "humidity_out",    -1, STORE_HUMIDITY_OUT,    7,  7,  "rel_humidity_out", 1 },
+	{ "wind_speed",      STORE_WINDSPEED,       -1, 8,  8,  "wind_speed",       1 },
+	{ "wind_angle",      STORE_WIND_ANGLE,      -1, 9,  9,  "wind_angle",       1 },
+	{ "wind_chill",      STORE_WINDCHILL,       -1, 11, 11, "wind_chill",       1 },
+	{ "rain_1h",         STORE_RAIN_1H,         -1, 12, -1, "rain_1h",          0 },
+	{ "rain_24h",        STORE_RAIN_24H,        -1, 13, -1, "rain_24h",         0 },
+	{ "rain_total",      STORE_RAIN_TOTAL,      -1, 14, 12, "rain_total",       1 },
+	{ "pressure",        STORE_PRESSURE,        -1, 15, 13, "rel_pressure",     1 }
+};
+
+#define COLUMNS (int)(sizeof(columns) / sizeof(columns[0]))
+
+/* A row of any source. The time is the local time stamp YYYYMMDDhhmmss
+ * the logs are written with, a value not known is NaN. */
+struct query_row
+{
+	uint64_t stamp;
+	double   value[COLUMNS];
+};
+
+enum filter_op { OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE };
+
+struct filter
+{
+	int    column;
+	int    op;
+	double value;
+};
+
+enum aggregate_type { AGG_COUNT, AGG_MEAN, AGG_MIN, AGG_MAX, AGG_SUM, AGG_PERCENTILE };
+
+struct aggregate
+{
+	int    type;
+	double percentile;                 //0 to 100 for AGG_PERCENTILE
+	char   name[16];
+};
+
+enum group_by { GROUP_NONE, GROUP_MINUTES, GROUP_HOUR, GROUP_DAY, GROUP_MONTH, GROUP_YEAR };
+
+struct sketch
+{
+	double    width;                   //of a bucket
+	int64_t   low;                     //bucket of count[0]
+	int       size;                    //buckets, 0 while empty
+	uint32_t *count;
+	double   *sum;                     //of the values of each bucket
+};
+
+struct column_stat
+{
+	int64_t count;
+	double  sum;
+	double  min;
+	double  max;
+	struct sketch sketch;
+};
+
+struct group
+{
+	uint64_t key;                      //stamp of the start of the group
+	int64_t  rows;
+	struct column_stat *stat;          //of each column of the output
+};
+
+/* What a file gave, filled in by the thread that read it */
+struct result
+{
+	struct group *groups;              //in order of key
+	int    count;
+	int    size;
+	int    last;                       //group of the row before
+	int    error;
+};
+
+/* The query of the command line */
+static struct
+{
+	uint64_t from;
+	uint64_t to;
+	int      column[COLUMNS];          //columns of the output
+	int      columns;
+	int      needed[COLUMNS];          //1 for a column of the output or a filter
+	struct filter filter[MAX_FILTERS];
+	int      filters;
+	struct aggregate aggregate[MAX_AGGREGATES];
+	int      aggregates;
+	int      percentiles;              //1 if a sketch is needed
+	int      group;
+	int      minutes;                  //of GROUP_MINUTES
+	int      json;
+	char   **files;
+	int      file_count;
+	struct result *results;
+	int      next_file;                //next file for a thread
+	pthread_mutex_t lock;
+	int      records;                  //written so far
+} query;
+
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	int i;
+
+	printf("\n");
+	printf("query2300 - Read a range of time from the logs, SQLite databases\n");
+	printf("and stores of the open2300 loggers, optionally grouped by time.\n");
+	printf("Version %s (C)2003-2006 Kenneth Lavrsen.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("query2300 [options] file...\n\n");
+	printf("  -f from        local time YYYYMMDD[hh[mm[ss]]], included\n");
+	printf("  -t to          local time YYYYMMDD[hh[mm[ss]]], included\n");
+	printf("  -c columns     comma separated, default all\n");
+	printf("  -w filter      column<value, <=, >, >=, = or !=. All must hold.\n");
+	printf("  -g group       minutes, hour, day, month or year\n");
+	printf("  -a aggregates  count, mean, min, max, sum and percentiles like\n");
+	printf("                 p50 or p99.9. Default mean,min,max\n");
+	printf("  -o format      csv (default) or json\n");
+	printf("  -j jobs        files read at a time, default one per core\n\n");
+	printf("A file is a log of log2300 or histlog2300, a store (LOG_STORE,\n");
+	printf("store history sink) or an SQLite database of sqlitelog2300 or\n");
+	printf("sqlitehistlog2300. Give the files of a log oldest first.\n");
+	printf("Percentiles come from at most %d buckets per group, %g wide or\n",
+	       SKETCH_BUCKETS, SKETCH_WIDTH);
+	printf("wider for a wide spread. They are exact for the usual steps of the\n");
+	printf("values (0.1 degree, 1%% humidity), else within a bucket.\n");
+	printf("Columns:");
+	for (i = 0; i < COLUMNS; i++)
+		printf(" %s", columns[i].name);
+	printf("\n");
+	exit(0);
+}
+
+
+/********************************************************************
+ * find_column looks up a column by name
+ *
+ * Returns: its index in columns or -1
+ ********************************************************************/
+static int find_column(const char *name, size_t length)
+{
+	int i;
+
+	for (i = 0; i < COLUMNS; i++)
+	{
+		if (strlen(columns[i].name) == length &&
+		    strncmp(columns[i].name, name, length) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+
+/********************************************************************
+ * parse_columns reads the list of -c
+ *
+ * Returns: 0 on success and -1 on an unknown column
+ ********************************************************************/
+static int parse_columns(const char *text)
+{
+	const char *end;
+	int column;
+
+	query.columns = 0;
+
+	for (; *text != '\0'; text = *end == ',' ? end + 1 : end)
+	{
+		end = text + strcspn(text, ",");
+		if ((column = find_column(text, end - text)) < 0 || query.columns == COLUMNS)
+		{
+			fprintf(stderr, "Unknown column %.*s\n", (int)(end - text), text);
+			return -1;
+		}
+		query.column[query.columns++] = column;
+	}
+
+	return query.columns > 0 ? 0 : -1;
+}
+
+
+/********************************************************************
+ * parse_filter reads a -w like temperature_out<=0
+ *
+ * Returns: 0 on success and -1 if not a filter
+ ********************************************************************/
+static int parse_filter(const char *text)
+{
+	static const char *ops[] = { "<=", ">=", "!=", "<", ">", "=" };
+	static const int op_types[] = { OP_LE, OP_GE, OP_NE, OP_LT, OP_GT, OP_EQ };
+	struct filter *filter = &query.filter[query.filters];
+	size_t length = strcspn(text, "<>=!");
+	char *end;
+	int i;
+
+	if (query.filters == MAX_FILTERS ||
+	    (filter->column = find_column(text, length)) < 0)
+	{
+		fprintf(stderr, "Bad filter %s\n", text);
+		return -1;
+	}
+
+	for (i = 0; i < 6; i++)
+	{
+		if (strncmp(text + length, ops[i], strlen(ops[i])) == 0)
+			break;
+	}
+
+	if (i == 6 ||
+	    (filter->value = strtod(text + length + strlen(ops[i]), &end),
+	     end == text + length + strlen(ops[i]) || *end != '\0'))
+	{
+		fprintf(stderr, "Bad filter %s\n", text);
+		return -1;
+	}
+
+	filter->op = op_types[i];
+	query.filters++;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * parse_aggregates reads the list of -a
+ *
+ * Returns: 0 on success and -1 on an unknown aggregate
+ ********************************************************************/
+static int parse_aggregates(const char *text)
+{
+	static const char *names[] = { "count", "mean", "min", "max", "sum" };
+	struct aggregate *aggregate;
+	const char *end;
+	char *number_end;
+	size_t length;
+	int i;
+
+	query.aggregates = 0;
+	query.percentiles = 0;
+
+	for (; *text != '\0'; text = *end == ',' ? end + 1 : end)
+	{
+		end = text + strcspn(text, ",");
+		length = end - text;
+		aggregate = &query.aggregate[query.aggregates];
+
+		if (query.aggregates == MAX_AGGREGATES || length >= sizeof(aggregate->name))
+			break;
+
+		memcpy(aggregate->name, text, length);
+		aggregate->name[length] = '\0';
+
+		for (i = 0; i < 5; i++)
+		{
+			if (strcmp(aggregate->name, names[i]) == 0)
+				break;
+		}
+
+		aggregate->type = i;
+
+		if (i == 5)
+		{
+			aggregate->type = AGG_PERCENTILE;
+			if (aggregate->name[0] != 'p')
+				break;
+			aggregate->percentile = strtod(aggregate->name + 1, &number_end);
+			if (number_end == aggregate->name + 1 || *number_end != '\0' ||
+			    aggregate->percentile < 0 || aggregate->percentile > 100)
+				break;
+			query.percentiles = 1;
+		}
+
+		query.aggregates++;
+	}
+
+	if (*text != '\0' || query.aggregates == 0)
+	{
+		fprintf(stderr, "Bad aggregate in %s\n", text);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * parse_group reads the -g
+ *
+ * Returns: 0 on success and -1 if not a group
+ ********************************************************************/
+static int parse_group(const char *text)
+{
+	static const char *names[] = { "hour", "day", "month", "year" };
+	int i;
+
+	for (i = 0; i < 4; i++)
+	{
+		if (strcmp(text, names[i]) == 0)
+		{
+			query.group = GROUP_HOUR + i;
+			return 0;
+		}
+	}
+
+	query.group = GROUP_MINUTES;
+	query.minutes = atoi(text);
+	if (query.minutes < 1 || query.minutes > 1440 || strspn(text, "0123456789") != strlen(text))
+	{
+		fprintf(stderr, "Bad group %s\n", text);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * group_key finds the start of the group of a time stamp
+ ********************************************************************/
+static uint64_t group_key(uint64_t stamp)
+{
+	uint64_t day = stamp / 1000000;
+	int minute;
+
+	switch (query.group)
+	{
+	case GROUP_MINUTES:
+		minute = (stamp / 10000 % 100) * 60 + stamp / 100 % 100;
+		minute -= minute % query.minutes;
+		return day * 1000000 + (minute / 60) * 10000 + (minute % 60) * 100;
+	case GROUP_HOUR:
+		return stamp / 10000 * 10000;
+	case GROUP_DAY:
+		return day * 1000000;
+	case GROUP_MONTH:
+		return stamp / 100000000 * 100000000 + 1000000;
+	default:
+		return stamp / 10000000000ULL * 10000000000ULL + 101000000;
+	}
+}
+
+
+/********************************************************************
+ * stamp_text writes a stamp as YYYY-MM-DD hh:mm:ss, the form of the
+ * SQLite tables
+ ********************************************************************/
+static void stamp_text(uint64_t stamp, char *text, size_t size)
+{
+	snprintf(text, size, "%04d-%02d-%02d %02d:%02d:%02d",
+	         (int)(stamp / 10000000000ULL), (int)(stamp / 100000000 % 100),
+	         (int)(stamp / 1000000 % 100), (int)(stamp / 10000 % 100),
+	         (int)(stamp / 100 % 100), (int)(stamp % 100));
+}
+
+
+/********************************************************************
+ * stamp_time turns a stamp of the command line into a time. The 99
+ * of an end count as the last hour, minute or second.
+ ********************************************************************/
+static time_t stamp_time(uint64_t stamp)
+{
+	struct tm time_tm;
+
+	memset(&time_tm, 0, sizeof(time_tm));
+	time_tm.tm_year = (int)(stamp / 10000000000ULL) - 1900;
+	time_tm.tm_mon = (int)(stamp / 100000000 % 100) - 1;
+	time_tm.tm_mday = (int)(stamp / 1000000 % 100);
+	time_tm.tm_hour = (int)(stamp / 10000 % 100);
+	time_tm.tm_min = (int)(stamp / 100 % 100);
+	time_tm.tm_sec = (int)(stamp % 100);
+	time_tm.tm_isdst = -1;
+
+	if (time_tm.tm_hour > 23)
+		time_tm.tm_hour = 23;
+	if (time_tm.tm_min > 59)
+		time_tm.tm_min = 59;
+	if (time_tm.tm_sec > 59)
+		time_tm.tm_sec = 59;
+
+	return mktime(&time_tm);
+}
+
+
+/********************************************************************
+ * time_stamp turns a time into the local time stamp of the logs
+ ********************************************************************/
+static uint64_t time_stamp(time_t time)
+{
+	struct tm time_tm;
+
+#ifdef WIN32
+	time_tm = *localtime(&time);       // thread local on Windows
+#else
+	localtime_r(&time, &time_tm);
+#endif
+
+	return (uint64_t)(time_tm.tm_year + 1900) * 10000000000ULL +
+	       (uint64_t)(time_tm.tm_mon + 1) * 100000000 +
+	       (uint64_t)time_tm.tm_mday * 1000000 + time_tm.tm_hour * 10000 +
+	       time_tm.tm_min * 100 + time_tm.tm_sec;
+}
+
+
+/********************************************************************
+ * Sketch of the values of a column in a group: a histogram of buckets
+ * width wide, bucket k counting the values from k * width on, with
+ * their sum. The width starts at SKETCH_WIDTH, the finest the loggers
+ * write. Only when the values of a group spread over more than
+ * SKETCH_BUCKETS buckets is the width doubled, two buckets made one,
+ * as often as needed. A percentile is the mean of its bucket, so it
+ * stays exact as long as the buckets are narrower than the steps of
+ * the values (0.1 degrees, 1% humidity...).
+ ********************************************************************/
+
+/* Division rounding down, also for buckets below 0 */
+static int64_t floor_half(int64_t k)
+{
+	return k >= 0 ? k / 2 : -((1 - k) / 2);
+}
+
+
+static int64_t sketch_bucket(struct sketch *sketch, double value)
+{
+	// A value written with 3 decimals is a hair below its bucket
+	return (int64_t)floor(value / sketch->width + 1e-6);
+}
+
+
+/* Make the buckets twice as wide. A counter moves to the same or an
+ * earlier place, so the pairs are summed in place. */
+static void sketch_coarsen(struct sketch *sketch)
+{
+	int64_t low = floor_half(sketch->low);
+	uint32_t count;
+	double sum;
+	int i, k;
+
+	for (i = 0; i < sketch->size; i++)
+	{
+		count = sketch->count[i];
+		sum = sketch->sum[i];
+		sketch->count[i] = 0;
+		sketch->sum[i] = 0;
+		k = (int)(floor_half(sketch->low + i) - low);
+		sketch->count[k] += count;
+		sketch->sum[k] += sum;
+	}
+
+	sketch->size = (int)(floor_half(sketch->low + sketch->size - 1) - low + 1);
+	sketch->low = low;
+	sketch->width *= 2;
+}
+
+
+/* Make room for the buckets from low to high of the width now, fewer
+ * than SKETCH_BUCKETS */
+static int sketch_grow(struct sketch *sketch, int64_t low, int64_t high)
+{
+	uint32_t *count;
+	double *sum;
+	int size;
+
+	if (sketch->size > 0)
+	{
+		if (low >= sketch->low && high < sketch->low + sketch->size)
+			return 0;
+		if (sketch->low < low)
+			low = sketch->low;
+		if (sketch->low + sketch->size - 1 > high)
+			high = sketch->low + sketch->size - 1;
+	}
+
+	size = (int)(high - low + 1);
+	count = calloc(size, sizeof(*count));
+	sum = calloc(size, sizeof(*sum));
+	if (count == NULL || sum == NULL)
+	{
+		free(count);
+		free(sum);
+		return -1;
+	}
+
+	if (sketch->size > 0)
+	{
+		memcpy(count + (sketch->low - low), sketch->count, sketch->size * sizeof(*count));
+		memcpy(sum + (sketch->low - low), sketch->sum, sketch->size * sizeof(*sum));
+	}
+
+	free(sketch->count);
+	free(sketch->sum);
+	sketch->count = count;
+	sketch->sum = sum;
+	sketch->low = low;
+	sketch->size = size;
+
+	return 0;
+}
+
+
+static int sketch_add(struct sketch *sketch, double value)
+{
+	int64_t bucket, low, high;
+
+	if (sketch->size == 0)
+		sketch->width = SKETCH_WIDTH;
+
+	for (;;)
+	{
+		bucket = sketch_bucket(sketch, value);
+		low = sketch->size > 0 && sketch->low < bucket ? sketch->low : bucket;
+		high = sketch->size > 0 && sketch->low + sketch->size - 1 > bucket ?
+		       sketch->low + sketch->size - 1 : bucket;
+
+		if (high - low < SKETCH_BUCKETS)
+			break;
+		sketch_coarsen(sketch);
+	}
+
+	if (sketch_grow(sketch, low, high) < 0)
+		return -1;
+
+	sketch->count[bucket - sketch->low]++;
+	sketch->sum[bucket - sketch->low] += value;
+
+	return 0;
+}
+
+
+/* Add the counts of other, which may be coarsened for it */
+static int sketch_merge(struct sketch *sketch, struct sketch *other)
+{
+	int64_t low, high;
+	int i;
+
+	if (other->size == 0)
+		return 0;
+
+	if (sketch->size == 0)
+		sketch->width = other->width;
+
+	while (other->width < sketch->width)
+		sketch_coarsen(other);
+
+	for (;;)
+	{
+		while (sketch->size > 0 && sketch->width < other->width)
+			sketch_coarsen(sketch);
+
+		low = sketch->size > 0 && sketch->low < other->low ? sketch->low : other->low;
+		high = sketch->size > 0 && sketch->low + sketch->size > other->low + other->size ?
+		       sketch->low + sketch->size - 1 : other->low + other->size - 1;
+
+		if (high - low < SKETCH_BUCKETS)
+			break;
+		sketch_coarsen(other);
+	}
+
+	if (sketch_grow(sketch, low, high) < 0)
+		return -1;
+
+	for (i = 0; i < other->size; i++)
+	{
+		sketch->count[other->low + i - sketch->low] += other->count[i];
+		sketch->sum[other->low + i - sketch->low] += other->sum[i];
+	}
+
+	return 0;
+}
+
+
+/* The value with percentile % of the count values below it, the
+ * mean of the values of its bucket */
+static double sketch_percentile(struct sketch *sketch, int64_t count, double percentile)
+{
+	int64_t rank = (int64_t)(percentile / 100 * (count - 1));
+	int64_t seen = 0;
+	int i;
+
+	for (i = 0; i < sketch->size; i++)
+	{
+		seen += sketch->count[i];
+		if (seen > rank)
+			break;
+	}
+
+	return sketch->sum[i] / sketch->count[i];
+}
+
+
+/********************************************************************
+ * find_group finds the group of a key in the groups of a file, adding
+ * it if it is new. The rows come in order, so that is nearly always
+ * the group of the row before or a new last one.
+ *
+ * Returns: the group or NULL if out of memory
+ ********************************************************************/
+static struct group *find_group(struct result *result, uint64_t key)
+{
+	struct group *groups;
+	int low = 0, high = result->count, middle, size;
+
+	if (result->count > 0 && result->groups[result->last].key == key)
+		return &result->groups[result->last];
+
+	if (result->count > 0 && result->groups[result->count - 1].key >= key)
+	{
+		// Back in time, e.g. when the clock is set back in autumn
+		while (low < high)
+		{
+			middle = low + (high - low) / 2;
+			if (result->groups[middle].key < key)
+				low = middle + 1;
+			else
+				high = middle;
+		}
+
+		if (result->groups[low].key == key)
+		{
+			result->last = low;
+			return &result->groups[low];
+		}
+	}
+	else
+		low = result->count;
+
+	if (result->count == result->size)
+	{
+		size = result->size > 0 ? result->size * 2 : 256;
+		if ((groups = realloc(result->groups, size * sizeof(*groups))) == NULL)
+			return NULL;
+		result->groups = groups;
+		result->size = size;
+	}
+
+	memmove(&result->groups[low + 1], &result->groups[low],
+	        (result->count - low) * sizeof(*result->groups));
+
+	result->groups[low].key = key;
+	result->groups[low].rows = 0;
+	if ((result->groups[low].stat = calloc(query.columns, sizeof(struct column_stat))) == NULL)
+	{
+		memmove(&result->groups[low], &result->groups[low + 1],
+		        (result->count - low) * sizeof(*result->groups));
+		return NULL;
+	}
+
+	result->count++;
+	result->last = low;
+
+	return &result->groups[low];
+}
+
+
+static void free_group(struct group *group)
+{
+	int i;
+
+	for (i = 0; i < query.columns; i++)
+	{
+		free(group->stat[i].sketch.count);
+		free(group->stat[i].sketch.sum);
+	}
+	free(group->stat);
+}
+
+
+/********************************************************************
+ * print_number writes a field of the output, NaN as empty or null
+ ********************************************************************/
+static void print_number(const char *name, double value)
+{
+	if (query.json)
+	{
+		if (isnan(value))
+			printf(", \"%s\": null", name);
+		else
+			printf(", \"%s\": %.10g", name, value);
+	}
+	else if (isnan(value))
+		printf(",");
+	else
+		printf(",%.10g", value);
+}
+
+
+/********************************************************************
+ * print_start and print_end write what comes before and after the
+ * records: the CSV header or the brackets of the JSON array
+ ********************************************************************/
+static void print_start(void)
+{
+	int i, a;
+
+	if (query.json)
+	{
+		printf("[");
+		return;
+	}
+
+	printf(query.group == GROUP_NONE ? "time" : "time,rows");
+
+	for (i = 0; i < query.columns; i++)
+	{
+		if (query.group == GROUP_NONE)
+			printf(",%s", columns[query.column[i]].name);
+		else
+		{
+			for (a = 0; a < query.aggregates; a++)
+				printf(",%s_%s", columns[query.column[i]].name, query.aggregate[a].name);
+		}
+	}
+
+	printf("\n");
+}
+
+
+static void print_end(void)
+{
+	if (query.json)
+		printf(query.records > 0 ? "\n]\n" : "]\n");
+}
+
+
+/* The start of a record, up to its time */
+static void print_record(uint64_t stamp)
+{
+	char text[30];
+
+	stamp_text(stamp, text, sizeof(text));
+
+	if (query.json)
+		printf("%s\n{\"time\": \"%s\"", query.records > 0 ? "," : "", text);
+	else
+		printf("%s", text);
+
+	query.records++;
+}
+
+
+static void print_row(struct query_row *row)
+{
+	int i;
+
+	print_record(row->stamp);
+
+	for (i = 0; i < query.columns; i++)
+		print_number(columns[query.column[i]].name, row->value[query.column[i]]);
+
+	printf(query.json ? "}" : "\n");
+}
+
+
+static void print_group(struct group *group)
+{
+	struct aggregate *aggregate;
+	struct column_stat *stat;
+	char name[64];
+	double value;
+	int i, a;
+
+	print_record(group->key);
+	print_number("rows", group->rows);
+
+	for (i = 0; i < query.columns; i++)
+	{
+		stat = &group->stat[i];
+
+		for (a = 0; a < query.aggregates; a++)
+		{
+			aggregate = &query.aggregate[a];
+
+			switch (aggregate->type)
+			{
+			case AGG_COUNT:
+				value = stat->count;
+				break;
+			case AGG_MEAN:
+				value = stat->count > 0 ? stat->sum / stat->count : NAN;
+				break;
+			case AGG_MIN:
+				value = stat->count > 0 ? stat->min : NAN;
+				break;
+			case AGG_MAX:
+				value = stat->count > 0 ? stat->max : NAN;
+				break;
+			case AGG_SUM:
+				value = stat->sum;
+				break;
+			default:
+				value = NAN;
+				if (stat->count > 0)
+				{
+					// Never outside what was seen
+					value = sketch_percentile(&stat->sketch, stat->count,
+					                          aggregate->percentile);
+					value = value < stat->min ? stat->min :
+					        value > stat->max ? stat->max : value;
+				}
+			}
+
+			snprintf(name, sizeof(name), "%s_%s", columns[query.column[i]].name,
+			         aggregate->name);
+			print_number(name, value);
+		}
+	}
+
+	printf(query.json ? "}" : "\n");
+}
+
+
+/********************************************************************
+ * take_row hands a row of a file to the query: it is written at once
+ * if it is not grouped, else added to its group in the result of the
+ * file. Rows outside the range or failing a filter are dropped.
+ ********************************************************************/
+static void take_row(struct result *result, struct query_row *row)
+{
+	struct filter *filter;
+	struct group *group;
+	struct column_stat *stat;
+	double value;
+	int i, pass;
+
+	if (row->stamp < query.from || row->stamp > query.to)
+		return;
+
+	for (i = 0; i < query.filters; i++)
+	{
+		filter = &query.filter[i];
+		value = row->value[filter->column];
+
+		switch (filter->op)
+		{
+		case OP_LT: pass = value < filter->value; break;
+		case OP_LE: pass = value <= filter->value; break;
+		case OP_GT: pass = value > filter->value; break;
+		case OP_GE: pass = value >= filter->value; break;
+		case OP_EQ: pass = value == filter->value; break;
+		default:    pass = !isnan(value) && value != filter->value; break;
+		}
+
+		if (!pass)
+			return;
+	}
+
+	if (query.group == GROUP_NONE)
+	{
+		print_row(row);
+		return;
+	}
+
+	if ((group = find_group(result, group_key(row->stamp))) == NULL)
+	{
+		result->error = 1;
+		return;
+	}
+
+	group->rows++;
+
+	for (i = 0; i < query.columns; i++)
+	{
+		value = row->value[query.column[i]];
+		if (isnan(value))
+			continue;
+
+		stat = &group->stat[i];
+		if (stat->count == 0 || value < stat->min)
+			stat->min = value;
+		if (stat->count == 0 || value > stat->max)
+			stat->max = value;
+		stat->count++;
+		stat->sum += value;
+
+		if (query.percentiles && sketch_add(&stat->sketch, value) < 0)
+			result->error = 1;
+	}
+}
+
+
+/********************************************************************
+ * parse_line reads a line of log2300 (18 fields) or histlog2300
+ * (14 fields). Only the columns needed are converted.
+ *
+ * Returns: 1 if the line was read, 0 if it is not a log line
+ ********************************************************************/
+static int parse_line(char *line, struct query_row *row)
+{
+	char *field[LOG_FIELDS + 1];
+	int fields = 0, i, f;
+
+	while (fields <= LOG_FIELDS)
+	{
+		while (*line == ' ' || *line == '\t')
+			line++;
+		if (*line == '\0' || *line == '\n' || *line == '\r')
+			break;
+		field[fields++] = line;
+		while (*line != ' ' && *line != '\t' && *line != '\0' &&
+		       *line != '\n' && *line != '\r')
+			line++;
+	}
+
+	if ((fields != LOG_FIELDS && fields != HISTLOG_FIELDS) ||
+	    (row->stamp = log_line_stamp(field[0])) == 0)
+		return 0;
+
+	for (i = 0; i < COLUMNS; i++)
+	{
+		f = fields == LOG_FIELDS ? columns[i].log_field : columns[i].histlog_field;
+		row->value[i] = query.needed[i] && f >= 0 ? strtod(field[f], NULL) : NAN;
+	}
+
+	return 1;
+}
+
+
+/********************************************************************
+ * read_text reads the range from a log of log2300 or histlog2300
+ ********************************************************************/
+static void read_text(char *path, struct result *result)
+{
+	struct query_row row;
+	char line[1024];
+	char *buffer;
+	FILE *fileptr;
+	int start = 1;
+	size_t length;
+
+	if ((fileptr = fopen(path, "rb")) == NULL)
+	{
+		fprintf(stderr, "Cannot open file %s\n", path);
+		result->error = 1;
+		return;
+	}
+
+	if ((buffer = malloc(SCAN_BUFFER)) != NULL)
+		setvbuf(fileptr, buffer, _IOFBF, SCAN_BUFFER);
+
+	fseek(fileptr, log_index_find(path, query.from), SEEK_SET);
+
+	while (fgets(line, sizeof(line), fileptr) != NULL)
+	{
+		length = strlen(line);
+
+		// The rest of a line longer than the buffer is no line
+		if (start && parse_line(line, &row))
+		{
+			if (row.stamp > query.to)
+				break;
+			take_row(result, &row);
+		}
+
+		start = line[length - 1] == '\n';
+	}
+
+	fclose(fileptr);
+	free(buffer);
+}
+
+
+/* store_scan calls this for every row of the range */
+static int store_found(struct store_row *store_row, void *arg)
+{
+	struct query_row row;
+	int i;
+
+	row.stamp = time_stamp(store_row->time);
+
+	for (i = 0; i < COLUMNS; i++)
+	{
+		if (columns[i].store_value >= 0)
+			row.value[i] = store_row->value[columns[i].store_value];
+		else
+			row.value[i] = store_row->code[columns[i].store_code] == STORE_NONE ?
+			               NAN : store_row->code[columns[i].store_code];
+	}
+
+	take_row(arg, &row);
+
+	return 0;
+}
+
+
+/********************************************************************
+ * read_store reads the range from a store of store2300.c. Only the
+ * chunks of the range and the columns needed are decoded.
+ ********************************************************************/
+static void read_store(char *path, struct result *result)
+{
+	struct store store;
+	unsigned int bits = 0;
+	time_t from = 0, to = 0;
+	int i;
+
+	if (store_open(&store, path) < 0)
+	{
+		fprintf(stderr, "Cannot open store %s\n", path);
+		result->error = 1;
+		return;
+	}
+
+	for (i = 0; i < COLUMNS; i++)
+	{
+		if (!query.needed[i])
+			continue;
+		if (columns[i].store_value >= 0)
+			bits |= STORE_COLUMN_DOUBLE(columns[i].store_value);
+		else
+			bits |= STORE_COLUMN_CODE(columns[i].store_code);
+	}
+
+	// An hour more on each side for the change of summer time, the
+	// stamps of the rows decide
+	if (query.from > 0 && (from = stamp_time(query.from) - 3600) < 1)
+		from = 1;
+	if (query.to != UINT64_MAX)
+		to = stamp_time(query.to) + 3600;
+
+	if (store_scan(&store, from, to, bits, store_found, result) < 0)
+	{
+		fprintf(stderr, "Cannot read store %s\n", path);
+		result->error = 1;
+	}
+
+	store_close(&store);
+}
+
+
+#ifdef WITH_SQLITE
+/********************************************************************
+ * read_sqlite reads the range from the table weather_history of
+ * sqlitehistlog2300 or, if there is none, weather_log of sqlitelog2300
+ ********************************************************************/
+static void read_sqlite(char *path, struct result *result)
+{
+	static const char *tables[] = { "weather_history", "ws_datetime",
+	                                "weather_log", "datetime" };
+	struct query_row row;
+	sqlite3 *db;
+	sqlite3_stmt *statement = NULL;
+	char sql[1024], from[30], to[30];
+	const unsigned char *text;
+	int history, i, rc;
+
+	if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+	{
+		fprintf(stderr, "Cannot open database %s: %s\n", path, sqlite3_errmsg(db));
+		sqlite3_close(db);
+		result->error = 1;
+		return;
+	}
+
+	for (history = 1; history >= 0; history--)
+	{
+		// Columns weather_history does not have are NULL
+		snprintf(sql, sizeof(sql), "SELECT %s", tables[history ? 1 : 3]);
+		for (i = 0; i < COLUMNS; i++)
+		{
+			strcat(sql, ", ");
+			strcat(sql, query.needed[i] && (columns[i].history || !history) ?
+			            columns[i].sql : "NULL");
+		}
+		snprintf(sql + strlen(sql), sizeof(sql) - strlen(sql),
+		         " FROM %s WHERE %s BETWEEN ? AND ? ORDER BY %s",
+		         tables[history ? 0 : 2], tables[history ? 1 : 3], tables[history ? 1 : 3]);
+
+		if (sqlite3_prepare_v2(db, sql, -1, &statement, NULL) == SQLITE_OK)
+			break;
+	}
+
+	if (statement == NULL)
+	{
+		fprintf(stderr, "No weather_history or weather_log table in %s\n", path);
+		sqlite3_close(db);
+		result->error = 1;
+		return;
+	}
+
+	// The times are text in the form of stamp_text, the 99 of an end
+	// still sort after every time
+	stamp_text(query.from, from, sizeof(from));
+	stamp_text(query.to == UINT64_MAX ? 99999999999999ULL : query.to, to, sizeof(to));
+	sqlite3_bind_text(statement, 1, from, -1, SQLITE_STATIC);
+	sqlite3_bind_text(statement, 2, to, -1, SQLITE_STATIC);
+
+	while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+	{
+		if ((text = sqlite3_column_text(statement, 0)) == NULL)
+			continue;
+
+		for (row.stamp = 0, i = 0; text[i] != '\0' && i < 19; i++)
+		{
+			if (text[i] >= '0' && text[i] <= '9')
+				row.stamp = row.stamp * 10 + (text[i] - '0');
+		}
+
+		for (i = 0; i < COLUMNS; i++)
+			row.value[i] = sqlite3_column_type(statement, i + 1) == SQLITE_NULL ?
+			               NAN : sqlite3_column_double(statement, i + 1);
+
+		take_row(result, &row);
+	}
+
+	if (rc != SQLITE_DONE)
+	{
+		fprintf(stderr, "Cannot read %s: %s\n", path, sqlite3_errmsg(db));
+		result->error = 1;
+	}
+
+	sqlite3_finalize(statement);
+	sqlite3_close(db);
+}
+#endif
+
+
+/********************************************************************
+ * read_file reads a file of the command line into its result, by what
+ * it starts with
+ ********************************************************************/
+static void read_file(int index)
+{
+	char *path = query.files[index];
+	struct result *result = &query.results[index];
+	char magic[16];
+	FILE *fileptr;
+	size_t length = 0;
+
+	if ((fileptr = fopen(path, "rb")) != NULL)
+	{
+		length = fread(magic, 1, sizeof(magic), fileptr);
+		fclose(fileptr);
+	}
+
+	if (length == sizeof(magic) && memcmp(magic, "SQLite format 3", 16) == 0)
+	{
+#ifdef WITH_SQLITE
+		read_sqlite(path, result);
+#else
+		fprintf(stderr, "%s is an SQLite database, query2300 is built without SQLite\n", path);
+		result->error = 1;
+#endif
+	}
+	else if (length >= 8 && memcmp(magic, STORE_MAGIC, 8) == 0)
+		read_store(path, result);
+	else
+		read_text(path, result);
+}
+
+
+/* A thread reads the files no other thread has taken yet */
+static void *read_files(void *arg)
+{
+	int index;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&query.lock);
+		index = query.next_file++;
+		pthread_mutex_unlock(&query.lock);
+
+		if (index >= query.file_count)
+			return NULL;
+
+		read_file(index);
+	}
+}
+
+
+/* Groups of all files by time, of the same time in the order of the files */
+static int compare_groups(const void *a, const void *b)
+{
+	const struct group *ga = *(struct group * const *)a;
+	const struct group *gb = *(struct group * const *)b;
+
+	if (ga->key != gb->key)
+		return ga->key < gb->key ? -1 : 1;
+
+	return ga < gb ? -1 : ga > gb;
+}
+
+
+/********************************************************************
+ * print_groups merges the groups of all files by time and writes them
+ *
+ * Returns: 0 on success and -1 if out of memory
+ ********************************************************************/
+static int print_groups(void)
+{
+	struct group **all, *group;
+	struct result *result;
+	int count = 0, f, g, i, next;
+
+	for (f = 0; f < query.file_count; f++)
+		count += query.results[f].count;
+
+	if ((all = malloc((count + 1) * sizeof(*all))) == NULL)
+		return -1;
+
+	// The results of the files are one array each, in the order of
+	// the files, so the pointers sort by file too
+	for (count = 0, f = 0; f < query.file_count; f++)
+	{
+		result = &query.results[f];
+		for (g = 0; g < result->count; g++)
+			all[count++] = &result->groups[g];
+	}
+
+	qsort(all, count, sizeof(*all), compare_groups);
+
+	for (g = 0; g < count; g = next)
+	{
+		group = all[g];
+
+		for (next = g + 1; next < count && all[next]->key == group->key; next++)
+		{
+			group->rows += all[next]->rows;
+
+			for (i = 0; i < query.columns; i++)
+			{
+				struct column_stat *stat = &group->stat[i], *other = &all[next]->stat[i];
+
+				if (other->count == 0)
+					continue;
+				if (stat->count == 0 || other->min < stat->min)
+					stat->min = other->min;
+				if (stat->count == 0 || other->max > stat->max)
+					stat->max = other->max;
+				stat->count += other->count;
+				stat->sum += other->sum;
+
+				if (sketch_merge(&stat->sketch, &other->sketch) < 0)
+				{
+					free(all);
+					return -1;
+				}
+			}
+		}
+
+		print_group(group);
+	}
+
+	free(all);
+
+	return 0;
+}
+
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * query2300 [options] file...
+ *
+ * Just run the program without parameters for usage.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	static char output[SCAN_BUFFER];
+	pthread_t threads[MAX_JOBS];
+	int jobs = 0, threads_started = 0;
+	int error = 0, f, g, i;
+	char *value;
+
+	query.from = 0;
+	query.to = UINT64_MAX;
+	query.group = GROUP_NONE;
+	for (i = 0; i < COLUMNS; i++)
+		query.column[i] = i;
+	query.columns = COLUMNS;
+	parse_aggregates("mean,min,max");
+
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++)
+	{
+		if (argv[i][2] != '\0' || i + 1 == argc)
+			print_usage();
+
+		value = argv[++i];
+
+		switch (argv[i - 1][1])
+		{
+		case 'f':
+			if ((query.from = log_parse_stamp(value, 0)) == 0)
+				print_usage();
+			break;
+		case 't':
+			if ((query.to = log_parse_stamp(value, 1)) == 0)
+				print_usage();
+			break;
+		case 'c':
+			if (parse_columns(value) < 0)
+				exit(EXIT_FAILURE);
+			break;
+		case 'w':
+			if (parse_filter(value) < 0)
+				exit(EXIT_FAILURE);
+			break;
+		case 'g':
+			if (parse_group(value) < 0)
+				exit(EXIT_FAILURE);
+			break;
+		case 'a':
+			if (parse_aggregates(value) < 0)
+				exit(EXIT_FAILURE);
+			break;
+		case 'o':
+			if (strcmp(value, "json") == 0)
+				query.json = 1;
+			else if (strcmp(value, "csv") != 0)
+				print_usage();
+			break;
+		case 'j':
+			if ((jobs = atoi(value)) < 1)
+				print_usage();
+			break;
+		default:
+			print_usage();
+		}
+	}
+
+	if (i == argc)
+		print_usage();
+
+	query.files = &argv[i];
+	query.file_count = argc - i;
+
+	for (i = 0; i < query.columns; i++)
+		query.needed[query.column[i]] = 1;
+	for (i = 0; i < query.filters; i++)
+		query.needed[query.filter[i].column] = 1;
+
+	if ((query.results = calloc(query.file_count, sizeof(struct result))) == NULL)
+		exit(EXIT_FAILURE);
+
+	setvbuf(stdout, output, _IOFBF, sizeof(output));
+	print_start();
+
+	if (jobs == 0)
+	{
+#ifdef _SC_NPROCESSORS_ONLN
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (jobs < 1)
+			jobs = 1;
+	}
+	if (jobs > MAX_JOBS)
+		jobs = MAX_JOBS;
+	if (jobs > query.file_count)
+		jobs = query.file_count;
+
+	// Rows that are not grouped are written by one thread, in order
+	if (query.group == GROUP_NONE || jobs == 1)
+	{
+		for (f = 0; f < query.file_count; f++)
+			read_file(f);
+	}
+	else
+	{
+		pthread_mutex_init(&query.lock, NULL);
+
+		for (threads_started = 0; threads_started < jobs; threads_started++)
+		{
+			if (pthread_create(&threads[threads_started], NULL, read_files, NULL) != 0)
+				break;
+		}
+
+		// If no thread could be started this one does the work
+		if (threads_started == 0)
+			read_files(NULL);
+
+		for (i = 0; i < threads_started; i++)
+			pthread_join(threads[i], NULL);
+
+		pthread_mutex_destroy(&query.lock);
+	}
+
+	for (f = 0; f < query.file_count; f++)
+		error |= query.results[f].error;
+
+	if (query.group != GROUP_NONE && !error && print_groups() < 0)
+		error = 1;
+
+	print_end();
+
+	for (f = 0; f < query.file_count; f++)
+	{
+		for (g = 0; g < query.results[f].count; g++)
+			free_group(&query.results[f].groups[g]);
+		free(query.results[f].groups);
+	}
+	free(query.results);
+
+	if (error)
+	{
+		fflush(stdout);
+		fprintf(stderr, "query2300: the query did not complete\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return(0);
+}
@@ -0,0 +1,720 @@
+/*  open2300 - rollup2300.c
+ *
+ *  Hourly, daily and monthly aggregates kept up to date while logging
+ *
+ *  Every observation stored by log2300, sqlitelog2300 or a history
+ *  sink is added to the bucket of its hour, day and month (local
+ *  time): count, sum, min and max of each value with the times of the
+ *  min and max, and the rain fallen. A page that shows the days of a
+ *  month reads 30 buckets instead of all the readings.
+ *
+ *  The rain comes from the rain total counter. The rain between two
+ *  readings belongs to the bucket of the later one. A history record
+ *  that arrives late, between two readings already added, takes the
+ *  rain from its predecessor and gives the bucket of its successor
+ *  only the rain after it, so every bucket ends up as if the readings
+ *  had come in order. The readings before and after are found from the
+ *  first and last reading of the hour buckets, at most
+ *  ROLLUP_SEARCH_HOURS away. The history of the station never reaches
+ *  further back. Only a late record inside an hour in which the rain
+ *  total was reset can leave that hour off by its rain before the reset.
+ *
+ *  The buckets are kept in the store that is logged to: the table
+ *  weather_rollup of an SQLite database (rollupsqlite2300.c) or, next
+ *  to a log file, in the files log.rollup-hour, -day and -month here.
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#include "rollup2300.h"
+
+#define NAME_SIZE 300
+
+const char *rollup_periods[ROLLUP_PERIODS] = { "hour", "day", "month" };
+const char *rollup_measures[ROLLUP_MEASURES] =
+{
+	"temperature_in", "temperature_out", "dewpoint", "humidity_in",
+	"humidity_out", "wind_speed", "wind_chill", "pressure"
+};
+
+/* A reading of the rain total */
+struct rain_reading
+{
+	int64_t time;
+	double  total;
+};
+
+
+/********************************************************************
+ * rollup_observation_clear marks every value as not known
+ ********************************************************************/
+void rollup_observation_clear(struct rollup_observation *observation)
+{
+	int m;
+
+	observation->time = 0;
+	for (m = 0; m < ROLLUP_MEASURES; m++)
+		observation->value[m] = NAN;
+	observation->rain_total = NAN;
+}
+
+
+/********************************************************************
+ * rollup_observation_from_store takes the values of a row of the
+ * columnar store (store2300.c) as an observation
+ ********************************************************************/
+void rollup_observation_from_store(struct rollup_observation *observation,
+                                   struct store_row *row)
+{
+	observation->time = row->time;
+	observation->value[ROLLUP_TEMPERATURE_IN] = row->value[STORE_TEMPERATURE_IN];
+	observation->value[ROLLUP_TEMPERATURE_OUT] = row->value[STORE_TEMPERATURE_OUT];
+	observation->value[ROLLUP_DEWPOINT] = row->value[STORE_DEWPOINT];
+	observation->value[ROLLUP_HUMIDITY_IN] = row->code[STORE_HUMIDITY_IN] == STORE_NONE ?
+	                                         NAN : row->code[STORE_HUMIDITY_IN];
+	observation->value[ROLLUP_HUMIDITY_OUT] = row->code[STORE_HUMIDITY_OUT] == STORE_NONE ?
+	                                          NAN : row->code[STORE_HUMIDITY_OUT];
+	observation->value[ROLLUP_WINDSPEED] = row->value[STORE_WINDSPEED];
+	observation->value[ROLLUP_WINDCHILL] = row->value[STORE_WINDCHILL];
+	observation->value[ROLLUP_PRESSURE] = row->value[STORE_PRESSURE];
+	observation->rain_total = row->value[STORE_RAIN_TOTAL];
+}
+
+
+/********************************************************************
+ * days_from_civil numbers the days of the calendar from 1970-01-01
+ ********************************************************************/
+static int64_t days_from_civil(int64_t year, int month, int day)
+{
+	int64_t era, yoe, doy, doe;
+
+	year -= month <= 2;
+	era = (year >= 0 ? year : year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + doe - 719468;
+}
+
+
+/********************************************************************
+ * bucket_slot finds the slot of a time and when its period starts
+ ********************************************************************/
+static int64_t bucket_slot(time_t time, int period, time_t *start)
+{
+	struct tm time_tm = *localtime(&time);
+	int64_t day;
+
+	day = days_from_civil(time_tm.tm_year + 1900, time_tm.tm_mon + 1, time_tm.tm_mday);
+
+	time_tm.tm_sec = 0;
+	time_tm.tm_min = 0;
+	time_tm.tm_isdst = -1;
+
+	if (period == ROLLUP_HOUR)
+	{
+		*start = mktime(&time_tm);
+		return day * 24 + time_tm.tm_hour;
+	}
+
+	time_tm.tm_hour = 0;
+
+	if (period == ROLLUP_DAY)
+	{
+		*start = mktime(&time_tm);
+		return day;
+	}
+
+	time_tm.tm_mday = 1;
+	*start = mktime(&time_tm);
+
+	return (int64_t)(time_tm.tm_year + 1900) * 12 + time_tm.tm_mon;
+}
+
+
+/********************************************************************
+ * rain_delta is the rain between two readings of the rain total. The
+ * total only goes down when it is reset.
+ ********************************************************************/
+static double rain_delta(double before, double after)
+{
+	return after >= before ? after - before : after;
+}
+
+
+/********************************************************************
+ * load_bucket reads a bucket, cleared if there is none
+ ********************************************************************/
+static int load_bucket(struct rollup_store *store, int period, int64_t slot,
+                       struct rollup_bucket *bucket)
+{
+	memset(bucket, 0, sizeof(*bucket));
+	bucket->period = period;
+	bucket->slot = slot;
+
+	return store->load(store->handle, bucket);
+}
+
+
+/********************************************************************
+ * find_reading looks for the nearest rain total reading before or
+ * after an hour, in the hour buckets kept
+ *
+ * Returns: 1 if found, 0 if not and -1 on error
+ ********************************************************************/
+static int find_reading(struct rollup_store *store, int64_t slot, int direction,
+                        struct rain_reading *reading)
+{
+	struct rollup_bucket bucket;
+	int64_t first, last, end;
+	int found;
+
+	if ((found = store->range(store->handle, ROLLUP_HOUR, &first, &last)) <= 0)
+		return found;
+
+	if (direction > 0)
+		end = slot + ROLLUP_SEARCH_HOURS < last ? slot + ROLLUP_SEARCH_HOURS : last;
+	else
+		end = slot - ROLLUP_SEARCH_HOURS > first ? slot - ROLLUP_SEARCH_HOURS : first;
+
+	for (slot += direction; direction > 0 ? slot <= end : slot >= end; slot += direction)
+	{
+		if (load_bucket(store, ROLLUP_HOUR, slot, &bucket) < 0)
+			return -1;
+
+		if (bucket.time_first == 0)
+			continue;
+
+		reading->time = direction > 0 ? bucket.time_first : bucket.time_last;
+		reading->total = direction > 0 ? bucket.rain_first : bucket.rain_last;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * readings_linked tells if the later of two readings found the other
+ * when it was added, i.e. took its rain from it
+ ********************************************************************/
+static int readings_linked(struct rain_reading *before, struct rain_reading *after)
+{
+	time_t start;
+
+	return bucket_slot(after->time, ROLLUP_HOUR, &start) -
+	       bucket_slot(before->time, ROLLUP_HOUR, &start) <= ROLLUP_SEARCH_HOURS;
+}
+
+
+/********************************************************************
+ * move_rain adds rain to the buckets of the reading after a late one
+ ********************************************************************/
+static int move_rain(struct rollup_store *store, struct rollup_bucket *bucket,
+                     struct rain_reading *after, double rain)
+{
+	struct rollup_bucket other;
+	time_t start;
+	int64_t slot;
+	int p;
+
+	for (p = 0; p < ROLLUP_PERIODS; p++)
+	{
+		slot = bucket_slot(after->time, p, &start);
+
+		if (slot == bucket[p].slot)
+		{
+			bucket[p].rain += rain;
+			continue;
+		}
+
+		if (load_bucket(store, p, slot, &other) < 0)
+			return -1;
+		other.rain += rain;
+		if (store->save(store->handle, &other) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * add_stat adds a value to the aggregate of a measure
+ ********************************************************************/
+static void add_stat(struct rollup_stat *stat, double value, int64_t time)
+{
+	if (stat->count == 0 || value < stat->min ||
+	    (value == stat->min && time < stat->time_min))
+	{
+		stat->min = value;
+		stat->time_min = time;
+	}
+
+	if (stat->count == 0 || value > stat->max ||
+	    (value == stat->max && time < stat->time_max))
+	{
+		stat->max = value;
+		stat->time_max = time;
+	}
+
+	stat->count++;
+	stat->sum += value;
+}
+
+
+/********************************************************************
+ * rollup_begin
+ * Start adding a batch of observations. The store writes them as one
+ * transaction if it can.
+ *
+ * Returns: 0 on success and -1 on error
+ *
+ ********************************************************************/
+int rollup_begin(struct rollup_store *store)
+{
+	return store->begin != NULL ? store->begin(store->handle) : 0;
+}
+
+
+/********************************************************************
+ * rollup_commit
+ * Finish a batch of observations started with rollup_begin
+ *
+ * Returns: 0 on success and -1 on error
+ *
+ ********************************************************************/
+int rollup_commit(struct rollup_store *store)
+{
+	return store->commit != NULL ? store->commit(store->handle) : 0;
+}
+
+
+/********************************************************************
+ * rollup_add
+ * Add an observation to its hour, day and month. It may be older than
+ * the ones added before. Add each observation once: one with the time
+ * of the first or last rain reading of its hour is taken as added.
+ *
+ * Input:  store - where the buckets are kept
+ *         observation - the values, NaN for not known
+ *
+ * Returns: 1 if added, 0 if it was added before and -1 on error
+ *
+ ********************************************************************/
+int rollup_add(struct rollup_store *store, struct rollup_observation *observation)
+{
+	struct rollup_bucket bucket[ROLLUP_PERIODS];
+	struct rollup_bucket *hour = &bucket[ROLLUP_HOUR];
+	struct rain_reading before, after;
+	int have_before = 0, have_after = 0;
+	double total = observation->rain_total;
+	int64_t time = observation->time;
+	time_t start[ROLLUP_PERIODS];
+	int p, m;
+
+	for (p = 0; p < ROLLUP_PERIODS; p++)
+	{
+		if (load_bucket(store, p, bucket_slot(time, p, &start[p]), &bucket[p]) < 0)
+			return -1;
+	}
+
+	if (hour->time_first != 0 && (time == hour->time_first || time == hour->time_last))
+		return 0;
+
+	if (!isnan(total) &&
+	    !(hour->time_first != 0 && time > hour->time_first && time < hour->time_last))
+	{
+		// Not between two readings of its own hour: the rain moves
+		// between buckets, find the readings around it
+		if (hour->time_first != 0 && time > hour->time_last)
+		{
+			before.time = hour->time_last;
+			before.total = hour->rain_last;
+			have_before = 1;
+		}
+		else if ((have_before = find_reading(store, hour->slot, -1, &before)) < 0)
+			return -1;
+
+		if (hour->time_first != 0 && time < hour->time_first)
+		{
+			after.time = hour->time_first;
+			after.total = hour->rain_first;
+			have_after = 1;
+		}
+		else if ((have_after = find_reading(store, hour->slot, 1, &after)) < 0)
+			return -1;
+
+		if (have_before)
+		{
+			for (p = 0; p < ROLLUP_PERIODS; p++)
+				bucket[p].rain += rain_delta(before.total, total);
+		}
+
+		// The reading after had the rain from the one before only if
+		// they were near enough to find each other
+		if (have_after &&
+		    move_rain(store, bucket, &after, rain_delta(total, after.total) -
+		              (have_before && readings_linked(&before, &after) ?
+		               rain_delta(before.total, after.total) : 0)) < 0)
+			return -1;
+	}
+
+	for (p = 0; p < ROLLUP_PERIODS; p++)
+	{
+		if (bucket[p].observations == 0)
+			bucket[p].start = start[p];
+		bucket[p].observations++;
+
+		for (m = 0; m < ROLLUP_MEASURES; m++)
+		{
+			if (!isnan(observation->value[m]))
+				add_stat(&bucket[p].stat[m], observation->value[m], time);
+		}
+
+		if (!isnan(total))
+		{
+			if (bucket[p].time_first == 0 || time < bucket[p].time_first)
+			{
+				bucket[p].time_first = time;
+				bucket[p].rain_first = total;
+			}
+			if (time > bucket[p].time_last)
+			{
+				bucket[p].time_last = time;
+				bucket[p].rain_last = total;
+			}
+		}
+
+		if (store->save(store->handle, &bucket[p]) < 0)
+			return -1;
+	}
+
+	return 1;
+}
+
+
+/********************************************************************
+ * rollup_add_newer
+ * Add an observation of a log that only grows: one that is not newer
+ * than the last reading with a rain total of its hour, day or month
+ * is taken as added, e.g. after the clock was set back.
+ *
+ * Input:  store - where the buckets are kept
+ *         observation - the values, NaN for not known
+ *
+ * Returns: 1 if added, 0 if not newer and -1 on error
+ *
+ ********************************************************************/
+int rollup_add_newer(struct rollup_store *store, struct rollup_observation *observation)
+{
+	struct rollup_bucket bucket;
+	time_t start;
+	int p;
+
+	for (p = 0; p < ROLLUP_PERIODS; p++)
+	{
+		if (load_bucket(store, p, bucket_slot(observation->time, p, &start), &bucket) < 0)
+			return -1;
+		if (bucket.time_last != 0 && observation->time <= bucket.time_last)
+			return 0;
+	}
+
+	return rollup_add(store, observation);
+}
+
+
+/********************************************************************
+ * rollup_close closes the store of the buckets
+ ********************************************************************/
+void rollup_close(struct rollup_store *store)
+{
+	if (store->handle != NULL)
+		store->close(store->handle);
+	store->handle = NULL;
+}
+
+
+/********************************************************************
+ * Rollup files. One file for each period: a header and then the
+ * buckets of consecutive slots, so a bucket is found by its slot
+ * without a search.
+ ********************************************************************/
+
+struct rollup_file_header
+{
+	char     magic[8];
+	uint32_t period;
+	uint32_t bucket_size;              //sizeof(struct rollup_bucket) of the writer
+	int64_t  base;                     //slot of the first bucket
+	int64_t  reserved;
+};
+
+struct rollup_files
+{
+	FILE    *file[ROLLUP_PERIODS];
+	char     name[ROLLUP_PERIODS][NAME_SIZE];
+	int64_t  base[ROLLUP_PERIODS];
+	int64_t  slots[ROLLUP_PERIODS];    //buckets in the file
+};
+
+
+static int write_header(FILE *file, int period, int64_t base)
+{
+	struct rollup_file_header header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, ROLLUP_MAGIC, 8);
+	header.period = period;
+	header.bucket_size = sizeof(struct rollup_bucket);
+	header.base = base;
+
+	return fseek(file, 0L, SEEK_SET) == 0 &&
+	       fwrite(&header, sizeof(header), 1, file) == 1 ? 0 : -1;
+}
+
+
+static int write_empty(FILE *file, int64_t count)
+{
+	static const struct rollup_bucket empty;
+
+	for (; count > 0; count--)
+	{
+		if (fwrite(&empty, sizeof(empty), 1, file) != 1)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+static int files_load(void *handle, struct rollup_bucket *bucket)
+{
+	struct rollup_files *files = handle;
+	int period = bucket->period;
+	int64_t slot = bucket->slot;
+	int64_t index = slot - files->base[period];
+
+	if (index < 0 || index >= files->slots[period])
+		return 0;
+
+	if (fseek(files->file[period], sizeof(struct rollup_file_header) +
+	          index * sizeof(*bucket), SEEK_SET) != 0 ||
+	    fread(bucket, sizeof(*bucket), 1, files->file[period]) != 1)
+		return -1;
+
+	// A slot of a gap is all zeros
+	bucket->period = period;
+	bucket->slot = slot;
+
+	return 0;
+}
+
+
+/* A bucket before the first one: the file is written again with the
+ * new first slot */
+static int files_rebase(struct rollup_files *files, int period, int64_t base)
+{
+	struct rollup_bucket *buckets;
+	char tempname[NAME_SIZE + 4];
+	FILE *temp;
+	int64_t count = files->slots[period];
+	int64_t gap = files->base[period] - base;
+	int ok;
+
+	if ((buckets = malloc(count * sizeof(*buckets))) == NULL)
+		return -1;
+
+	snprintf(tempname, sizeof(tempname), "%s.new", files->name[period]);
+
+	if (fseek(files->file[period], sizeof(struct rollup_file_header), SEEK_SET) != 0 ||
+	    (int64_t)fread(buckets, sizeof(*buckets), count, files->file[period]) != count ||
+	    (temp = fopen(tempname, "wb")) == NULL)
+	{
+		free(buckets);
+		return -1;
+	}
+
+	ok = write_header(temp, period, base) == 0 && write_empty(temp, gap) == 0 &&
+	     (int64_t)fwrite(buckets, sizeof(*buckets), count, temp) == count &&
+	     flush_file(temp) == 0;
+
+	free(buckets);
+
+	if (fclose(temp) != 0 || !ok)
+	{
+		remove(tempname);
+		return -1;
+	}
+
+	fclose(files->file[period]);
+
+	ok = replace_file(tempname, files->name[period]) == 0;
+
+	if ((files->file[period] = fopen(files->name[period], "r+b")) == NULL || !ok)
+		return -1;
+
+	files->base[period] = base;
+	files->slots[period] = count + gap;
+
+	return 0;
+}
+
+
+static int files_save(void *handle, struct rollup_bucket *bucket)
+{
+	struct rollup_files *files = handle;
+	int period = bucket->period;
+	FILE *file = files->file[period];
+	int64_t index;
+
+	if (files->slots[period] == 0)
+	{
+		files->base[period] = bucket->slot;
+		if (write_header(file, period, bucket->slot) < 0)
+			return -1;
+	}
+	else if (bucket->slot < files->base[period] &&
+	         files_rebase(files, period, bucket->slot) < 0)
+		return -1;
+
+	file = files->file[period];
+	index = bucket->slot - files->base[period];
+
+	if (index > files->slots[period])
+	{
+		// The slots in between stay empty
+		if (fseek(file, sizeof(struct rollup_file_header) +
+		          files->slots[period] * sizeof(*bucket), SEEK_SET) != 0 ||
+		    write_empty(file, index - files->slots[period]) < 0)
+			return -1;
+	}
+	else if (fseek(file, sizeof(struct rollup_file_header) + index * sizeof(*bucket),
+	               SEEK_SET) != 0)
+		return -1;
+
+	if (fwrite(bucket, sizeof(*bucket), 1, file) != 1)
+		return -1;
+
+	if (index >= files->slots[period])
+		files->slots[period] = index + 1;
+
+	return 0;
+}
+
+
+static int files_range(void *handle, int period, int64_t *first, int64_t *last)
+{
+	struct rollup_files *files = handle;
+
+	if (files->slots[period] == 0)
+		return 0;
+
+	*first = files->base[period];
+	*last = files->base[period] + files->slots[period] - 1;
+
+	return 1;
+}
+
+
+static int files_commit(void *handle)
+{
+	struct rollup_files *files = handle;
+	int p;
+
+	for (p = 0; p < ROLLUP_PERIODS; p++)
+	{
+		if (flush_file(files->file[p]) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+static void files_close(void *handle)
+{
+	struct rollup_files *files = handle;
+	int p;
+
+	for (p = 0; p < ROLLUP_PERIODS; p++)
+	{
+		if (files->file[p] != NULL)
+			fclose(files->file[p]);
+	}
+
+	free(files);
+}
+
+
+/********************************************************************
+ * rollup_open_files
+ * Open or create the rollup files of a log: path.rollup-hour,
+ * path.rollup-day and path.rollup-month
+ *
+ * Input:  path - the log file
+ *
+ * Output: store - the open store
+ *
+ * Returns: 0 on success and -1 if a file cannot be opened or is not
+ *          a rollup file of this version and machine
+ *
+ ********************************************************************/
+int rollup_open_files(struct rollup_store *store, char *path)
+{
+	struct rollup_file_header header;
+	struct rollup_files *files;
+	long size;
+	int p;
+
+	store->handle = NULL;
+	if ((files = calloc(1, sizeof(*files))) == NULL)
+		return -1;
+
+	store->load = files_load;
+	store->save = files_save;
+	store->range = files_range;
+	store->begin = NULL;
+	store->commit = files_commit;
+	store->close = files_close;
+	store->handle = files;
+
+	for (p = 0; p < ROLLUP_PERIODS; p++)
+	{
+		snprintf(files->name[p], NAME_SIZE, "%s.rollup-%s", path, rollup_periods[p]);
+
+		if ((files->file[p] = fopen(files->name[p], "r+b")) == NULL)
+		{
+			if ((files->file[p] = fopen(files->name[p], "w+b")) == NULL ||
+			    write_header(files->file[p], p, 0) < 0)
+				break;
+			continue;
+		}
+
+		fseek(files->file[p], 0L, SEEK_END);
+		size = ftell(files->file[p]);
+
+		if (fseek(files->file[p], 0L, SEEK_SET) != 0 ||
+		    fread(&header, sizeof(header), 1, files->file[p]) != 1 ||
+		    memcmp(header.magic, ROLLUP_MAGIC, 8) != 0 || header.period != (uint32_t)p ||
+		    header.bucket_size != sizeof(struct rollup_bucket))
+		{
+			fprintf(stderr, "%s is not a rollup file of this version and machine\n",
+			        files->name[p]);
+			break;
+		}
+
+		files->base[p] = header.base;
+		files->slots[p] = (size - sizeof(header)) / sizeof(struct rollup_bucket);
+	}
+
+	if (p < ROLLUP_PERIODS)
+	{
+		rollup_close(store);
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,105 @@
+/* open2300 - rollup2300.h
+ * Include file for the hourly, daily and monthly aggregates kept while
+ * logging
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_ROLLUP2300_H_
+#define _INCLUDE_ROLLUP2300_H_
+
+#include <stdint.h>
+#include "rw2300.h"
+#include "store2300.h"
+
+#define ROLLUP_MAGIC        "O2300RU1"   // first bytes of a rollup file
+#define ROLLUP_SEARCH_HOURS (31 * 24)    // how far rain looks for the reading before or after
+
+enum rollup_period
+{
+	ROLLUP_HOUR, ROLLUP_DAY, ROLLUP_MONTH, ROLLUP_PERIODS
+};
+
+/* The values aggregated. Rain is kept apart, from the rain total. */
+enum rollup_measure
+{
+	ROLLUP_TEMPERATURE_IN, ROLLUP_TEMPERATURE_OUT, ROLLUP_DEWPOINT,
+	ROLLUP_HUMIDITY_IN, ROLLUP_HUMIDITY_OUT, ROLLUP_WINDSPEED,
+	ROLLUP_WINDCHILL, ROLLUP_PRESSURE, ROLLUP_MEASURES
+};
+
+/* One observation as handed to rollup_add. A value not known is NaN. */
+struct rollup_observation
+{
+	time_t time;
+	double value[ROLLUP_MEASURES];
+	double rain_total;
+};
+
+struct rollup_stat
+{
+	int64_t count;
+	double  sum;                       //mean is sum/count
+	double  min;
+	double  max;
+	int64_t time_min;                  //first time of the min
+	int64_t time_max;                  //first time of the max
+};
+
+/* An hour, day or month. slot numbers the periods in local time: hours
+ * and days since 1970-01-01, months since year 0. Also the record of
+ * a rollup file. */
+struct rollup_bucket
+{
+	int32_t  period;
+	int32_t  reserved;
+	int64_t  slot;
+	int64_t  start;                    //time the period starts
+	int64_t  observations;             //0 for a bucket not used yet
+	struct rollup_stat stat[ROLLUP_MEASURES];
+	double   rain;                     //rain fallen, from the rain total before
+	double   rain_first;               //rain total at time_first
+	double   rain_last;                //rain total at time_last
+	int64_t  time_first;               //first and last reading with a rain
+	int64_t  time_last;                //total, 0 if none
+};
+
+/* Where the buckets are kept. load fills in the bucket of
+ * bucket->period and bucket->slot or clears it if there is none,
+ * range gives the first and last slot kept. begin and commit may be
+ * NULL. All but close return -1 on error. */
+struct rollup_store
+{
+	int  (*load)(void *handle, struct rollup_bucket *bucket);
+	int  (*save)(void *handle, struct rollup_bucket *bucket);
+	int  (*range)(void *handle, int period, int64_t *first, int64_t *last);
+	int  (*begin)(void *handle);
+	int  (*commit)(void *handle);
+	void (*close)(void *handle);
+	void *handle;
+};
+
+extern const char *rollup_periods[ROLLUP_PERIODS];
+extern const char *rollup_measures[ROLLUP_MEASURES];
+
+void rollup_observation_clear(struct rollup_observation *observation);
+
+void rollup_observation_from_store(struct rollup_observation *observation,
+                                   struct store_row *row);
+
+int rollup_open_files(struct rollup_store *store, char *path);
+
+struct sqlite3;
+
+int rollup_open_sqlite(struct rollup_store *store, struct sqlite3 *db);
+
+int rollup_begin(struct rollup_store *store);
+
+int rollup_add(struct rollup_store *store, struct rollup_observation *observation);
+
+int rollup_add_newer(struct rollup_store *store, struct rollup_observation *observation);
+
+int rollup_commit(struct rollup_store *store);
+
+void rollup_close(struct rollup_store *store);
+
+#endif /* _INCLUDE_ROLLUP2300_H_ */
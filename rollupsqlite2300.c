@@ -0,0 +1,314 @@
+/*  open2300 - rollupsqlite2300.c
+ *
+ *  Version 1.11
+ *
+ *  The hourly, daily and monthly aggregates of rollup2300.c in the
+ *  table weather_rollup of an SQLite database, one row per bucket.
+ *  For example the days of October 2006:
+ *
+ *    SELECT datetime(start, 'unixepoch', 'localtime'),
+ *           temperature_out_min, temperature_out_max,
+ *           temperature_out_sum / temperature_out_count, rain
+ *    FROM weather_rollup WHERE period = 'day'
+ *    AND start >= strftime('%s', '2006-10-01', 'utc') ORDER BY slot LIMIT 31;
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#include <sqlite3.h>
+#include "rollup2300.h"
+
+#define QUERY_SIZE 4096
+
+struct rollup_sqlite
+{
+	sqlite3      *db;
+	sqlite3_stmt *select;
+	sqlite3_stmt *replace;
+	sqlite3_stmt *range;
+	int           began;               //1 when begin started a transaction
+};
+
+/* The columns after period and slot */
+static const char *stat_columns[] = { "count", "sum", "min", "max", "min_time", "max_time" };
+static const char *rain_columns[] = { "rain", "rain_first", "rain_last", "time_first", "time_last" };
+
+#define STAT_COLUMNS 6
+#define RAIN_COLUMNS 5
+
+
+/********************************************************************
+ * column_list appends the names of the bucket columns after period
+ * and slot to a query
+ ********************************************************************/
+static void column_list(char *query)
+{
+	char column[100];
+	int m, c;
+
+	strcat(query, "start, observations");
+
+	for (m = 0; m < ROLLUP_MEASURES; m++)
+	{
+		for (c = 0; c < STAT_COLUMNS; c++)
+		{
+			snprintf(column, sizeof(column), ", %s_%s", rollup_measures[m], stat_columns[c]);
+			strcat(query, column);
+		}
+	}
+
+	for (c = 0; c < RAIN_COLUMNS; c++)
+	{
+		strcat(query, ", ");
+		strcat(query, rain_columns[c]);
+	}
+}
+
+
+static int sqlite_load(void *handle, struct rollup_bucket *bucket)
+{
+	struct rollup_sqlite *r = handle;
+	sqlite3_stmt *s = r->select;
+	int rc, m, i = 0;
+
+	sqlite3_reset(s);
+	sqlite3_bind_text(s, 1, rollup_periods[bucket->period], -1, SQLITE_STATIC);
+	sqlite3_bind_int64(s, 2, bucket->slot);
+
+	if ((rc = sqlite3_step(s)) == SQLITE_DONE)
+		return 0;
+	if (rc != SQLITE_ROW)
+		return -1;
+
+	bucket->start = sqlite3_column_int64(s, i++);
+	bucket->observations = sqlite3_column_int64(s, i++);
+
+	for (m = 0; m < ROLLUP_MEASURES; m++)
+	{
+		bucket->stat[m].count = sqlite3_column_int64(s, i++);
+		bucket->stat[m].sum = sqlite3_column_double(s, i++);
+		bucket->stat[m].min = sqlite3_column_double(s, i++);
+		bucket->stat[m].max = sqlite3_column_double(s, i++);
+		bucket->stat[m].time_min = sqlite3_column_int64(s, i++);
+		bucket->stat[m].time_max = sqlite3_column_int64(s, i++);
+	}
+
+	bucket->rain = sqlite3_column_double(s, i++);
+	bucket->rain_first = sqlite3_column_double(s, i++);
+	bucket->rain_last = sqlite3_column_double(s, i++);
+	bucket->time_first = sqlite3_column_int64(s, i++);
+	bucket->time_last = sqlite3_column_int64(s, i++);
+
+	sqlite3_reset(s);
+
+	return 0;
+}
+
+
+static int sqlite_save(void *handle, struct rollup_bucket *bucket)
+{
+	struct rollup_sqlite *r = handle;
+	sqlite3_stmt *s = r->replace;
+	int m, i = 1;
+
+	sqlite3_reset(s);
+	sqlite3_bind_text(s, i++, rollup_periods[bucket->period], -1, SQLITE_STATIC);
+	sqlite3_bind_int64(s, i++, bucket->slot);
+	sqlite3_bind_int64(s, i++, bucket->start);
+	sqlite3_bind_int64(s, i++, bucket->observations);
+
+	// No min or max without a value: NULL
+	for (m = 0; m < ROLLUP_MEASURES; m++)
+	{
+		sqlite3_bind_int64(s, i++, bucket->stat[m].count);
+		sqlite3_bind_double(s, i++, bucket->stat[m].sum);
+		if (bucket->stat[m].count > 0)
+		{
+			sqlite3_bind_double(s, i++, bucket->stat[m].min);
+			sqlite3_bind_double(s, i++, bucket->stat[m].max);
+			sqlite3_bind_int64(s, i++, bucket->stat[m].time_min);
+			sqlite3_bind_int64(s, i++, bucket->stat[m].time_max);
+		}
+		else
+		{
+			sqlite3_bind_null(s, i++);
+			sqlite3_bind_null(s, i++);
+			sqlite3_bind_null(s, i++);
+			sqlite3_bind_null(s, i++);
+		}
+	}
+
+	sqlite3_bind_double(s, i++, bucket->rain);
+	if (bucket->time_first != 0)
+	{
+		sqlite3_bind_double(s, i++, bucket->rain_first);
+		sqlite3_bind_double(s, i++, bucket->rain_last);
+		sqlite3_bind_int64(s, i++, bucket->time_first);
+		sqlite3_bind_int64(s, i++, bucket->time_last);
+	}
+	else
+	{
+		sqlite3_bind_null(s, i++);
+		sqlite3_bind_null(s, i++);
+		sqlite3_bind_null(s, i++);
+		sqlite3_bind_null(s, i++);
+	}
+
+	if (sqlite3_step(s) != SQLITE_DONE)
+	{
+		fprintf(stderr, "Cannot store rollup: %s\n", sqlite3_errmsg(r->db));
+		sqlite3_reset(s);
+		return -1;
+	}
+
+	sqlite3_reset(s);
+
+	return 0;
+}
+
+
+static int sqlite_range(void *handle, int period, int64_t *first, int64_t *last)
+{
+	struct rollup_sqlite *r = handle;
+	sqlite3_stmt *s = r->range;
+	int found;
+
+	sqlite3_reset(s);
+	sqlite3_bind_text(s, 1, rollup_periods[period], -1, SQLITE_STATIC);
+
+	if (sqlite3_step(s) != SQLITE_ROW)
+		return -1;
+
+	found = sqlite3_column_type(s, 0) != SQLITE_NULL;
+	*first = sqlite3_column_int64(s, 0);
+	*last = sqlite3_column_int64(s, 1);
+	sqlite3_reset(s);
+
+	return found;
+}
+
+
+/* A transaction of its own unless the caller has one open */
+static int sqlite_begin(void *handle)
+{
+	struct rollup_sqlite *r = handle;
+
+	r->began = 0;
+	if (!sqlite3_get_autocommit(r->db))
+		return 0;
+
+	if (sqlite3_exec(r->db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)
+		return -1;
+	r->began = 1;
+
+	return 0;
+}
+
+
+static int sqlite_commit(void *handle)
+{
+	struct rollup_sqlite *r = handle;
+
+	if (!r->began)
+		return 0;
+	r->began = 0;
+
+	return sqlite3_exec(r->db, "COMMIT", NULL, NULL, NULL) == SQLITE_OK ? 0 : -1;
+}
+
+
+static void sqlite_close(void *handle)
+{
+	struct rollup_sqlite *r = handle;
+
+	if (r->began)
+		sqlite3_exec(r->db, "ROLLBACK", NULL, NULL, NULL);
+
+	sqlite3_finalize(r->select);
+	sqlite3_finalize(r->replace);
+	sqlite3_finalize(r->range);
+	free(r);
+}
+
+
+/********************************************************************
+ * rollup_open_sqlite
+ * Keep the buckets in the table weather_rollup of a database, created
+ * if needed. The database stays open, it belongs to the caller.
+ *
+ * Input:  db - open database
+ *
+ * Output: store - the open store
+ *
+ * Returns: 0 on success and -1 on error
+ *
+ ********************************************************************/
+int rollup_open_sqlite(struct rollup_store *store, struct sqlite3 *db)
+{
+	static char query[QUERY_SIZE];
+	struct rollup_sqlite *r;
+	char column[100];
+	int i, m, c;
+
+	store->handle = NULL;
+	if ((r = calloc(1, sizeof(*r))) == NULL)
+		return -1;
+	r->db = db;
+
+	store->load = sqlite_load;
+	store->save = sqlite_save;
+	store->range = sqlite_range;
+	store->begin = sqlite_begin;
+	store->commit = sqlite_commit;
+	store->close = sqlite_close;
+	store->handle = r;
+
+	strcpy(query, "CREATE TABLE IF NOT EXISTS weather_rollup ("
+	              "period TEXT NOT NULL, slot INTEGER NOT NULL, "
+	              "start INTEGER NOT NULL, observations INTEGER NOT NULL");
+	for (m = 0; m < ROLLUP_MEASURES; m++)
+	{
+		for (c = 0; c < STAT_COLUMNS; c++)
+		{
+			snprintf(column, sizeof(column), ", %s_%s %s", rollup_measures[m],
+			         stat_columns[c], c == 1 || c == 2 || c == 3 ? "REAL" : "INTEGER");
+			strcat(query, column);
+		}
+	}
+	strcat(query, ", rain REAL, rain_first REAL, rain_last REAL, "
+	              "time_first INTEGER, time_last INTEGER, PRIMARY KEY (period, slot))");
+
+	if (sqlite3_exec(db, query, NULL, NULL, NULL) != SQLITE_OK)
+	{
+		fprintf(stderr, "Cannot create table weather_rollup: %s\n", sqlite3_errmsg(db));
+		rollup_close(store);
+		return -1;
+	}
+
+	strcpy(query, "SELECT ");
+	column_list(query);
+	strcat(query, " FROM weather_rollup WHERE period = ? AND slot = ?");
+	if (sqlite3_prepare_v2(db, query, -1, &r->select, NULL) != SQLITE_OK)
+	{
+		rollup_close(store);
+		return -1;
+	}
+
+	strcpy(query, "INSERT OR REPLACE INTO weather_rollup (period, slot, ");
+	column_list(query);
+	strcat(query, ") VALUES (?, ?");
+	for (i = 0; i < 2 + ROLLUP_MEASURES * STAT_COLUMNS + RAIN_COLUMNS; i++)
+		strcat(query, ", ?");
+	strcat(query, ")");
+	if (sqlite3_prepare_v2(db, query, -1, &r->replace, NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(db, "SELECT min(slot), max(slot) FROM weather_rollup "
+	                       "WHERE period = ?", -1, &r->range, NULL) != SQLITE_OK)
+	{
+		fprintf(stderr, "Cannot prepare rollup: %s\n", sqlite3_errmsg(db));
+		rollup_close(store);
+		return -1;
+	}
+
+	return 0;
+}
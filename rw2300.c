@@ -10,6 +10,7 @@
  */
 
 #include "rw2300.h"
+#include "derived2300.h"
 
 /********************************************************************/
 /* temperature_indoor
@@ -854,6 +855,9 @@ int humidity_outdoor_reset(WEATHERSTATION ws2300, char minmax)
 }
 
 
+static void read_wind(WEATHERSTATION ws2300, int bytes, unsigned char *data);
+
+
 /********************************************************************
  * wind_current
  * Read wind speed, wind direction and last 5 wind directions
@@ -872,27 +876,9 @@ double wind_current(WEATHERSTATION ws2300,
                     double *winddir)
 {
 	unsigned char data[20];
-	unsigned char command[25];	//room for write data also
-	int i;
-	int address=0x527; //Windspeed and direction
 	int bytes=3;
 	
-	for (i=0; i<MAXWINDRETRIES; i++)
-	{
-		if (read_safe(ws2300, address, bytes, data, command)!=bytes) //Wind
-			read_error_exit();
-		
-		if ( (data[0]!=0x00) ||                            //Invalid wind data
-		    ((data[1]==0xFF) && (((data[2]&0xF)==0)||((data[2]&0xF)==1))) )
-		{
-			sleep_long(10); //wait 10 seconds for new wind measurement
-			continue;
-		}
-		else
-		{
-			break;
-		}
-	}
+	read_wind(ws2300, bytes, data);	//Windspeed and direction
 	
 	//Calculate wind directions
 
@@ -928,27 +914,9 @@ double wind_all(WEATHERSTATION ws2300,
                 double *winddir)
 {
 	unsigned char data[20];
-	unsigned char command[25];	//room for write data also
-	int i;
-	int address=0x527; //Windspeed and direction
 	int bytes=6;
 	
-	for (i=0; i<MAXWINDRETRIES; i++)
-	{
-		if (read_safe(ws2300, address, bytes, data, command)!=bytes) //Wind
-			read_error_exit();
-		     
-		if ( (data[0]!=0x00) ||                             //Invalid wind data
-		   ((data[1]==0xFF) && (((data[2]&0xF)==0)||( (data[2]&0xF)==1))) )
-		{
-			sleep_long(10); //wait 10 seconds for new wind measurement
-			continue;
-		}
-		else
-		{
-			break;
-		}
-	}
+	read_wind(ws2300, bytes, data);	//Windspeed and direction
 	
 	//Calculate wind directions
 
@@ -1049,28 +1017,11 @@ int wind_reset(WEATHERSTATION ws2300, char minmax)
 	unsigned char command[25];	//room for write data also
 	int address;
 	int number;
-	int i;
 	int current_wind;
 	
-	address=0x527; //Windspeed
 	number=3;
 	
-	for (i=0; i<MAXWINDRETRIES; i++)
-	{
-		if (read_safe(ws2300, address, number, data_read, command)!=number)
-			read_error_exit();
-		     
-		if ((data_read[0]!=0x00) ||                            //Invalid wind data
-		    ((data_read[1]==0xFF)&&(((data_read[2]&0xF)==0)||((data_read[2]&0xF)==1))))
-		{
-			sleep_long(10); //wait 10 seconds for new wind measurement
-			continue;
-		}
-		else
-		{
-			break;
-		}
-	}
+	read_wind(ws2300, number, data_read); //Windspeed
 	
 	current_wind = ( ((data_read[2]&0xF)<<8) + (data_read[1]) ) * 36;
 
@@ -2157,6 +2108,19 @@ void tendency_forecast(WEATHERSTATION ws2300, char *tendency, char *forecast)
 }
 
 
+static int nibble_at(unsigned char *data, int n);
+
+/********************************************************************
+ * decode_window decodes field 'id' from nibbles read starting at
+ * 'address'. The field must lie inside what was read.
+ ********************************************************************/
+static double decode_window(unsigned char *nibble, int address, int id)
+{
+	return decode_field(nibble + field_table[id].address - address,
+	                    &field_table[id]);
+}
+
+
 /********************************************************************
  * read_history_info
  * Read the history information like interval, countdown, time
@@ -2177,26 +2141,45 @@ int read_history_info(WEATHERSTATION ws2300, int *interval, int *countdown,
 {
 	unsigned char data[20];
 	unsigned char command[25];
+	unsigned char nibble[20];
 	int address=0x6B2;
 	int bytes=10;
+	int i;
 
 	if (read_safe(ws2300, address, bytes, data, command) != bytes)
 	    read_error_exit();
-	
-	*interval = (data[1] & 0xF)*256 + data[0] + 1;
-	*countdown = data[2]*16 + (data[1] >> 4) + 1;
-	time_last->minute = ((data[3] >> 4) * 10) + (data[3] & 0xF);
-	time_last->hour = ((data[4] >> 4) * 10) + (data[4] & 0xF);
-	time_last->day = ((data[5] >> 4) * 10) + (data[5] & 0xF);
-	time_last->month = ((data[6] >> 4) * 10) + (data[6] & 0xF);
-	time_last->year = 2000 + ((data[7] >> 4) * 10) + (data[7] & 0xF);
-	*no_records = data[9];
 
-	return data[8];
+	for (i = 0; i < 2 * bytes; i++)
+		nibble[i] = nibble_at(data, i);
+
+	*interval = (int)decode_window(nibble, address,
+	                               FIELD_HISTORY_SAVING_INTERVAL);
+	*countdown = (int)decode_window(nibble, address,
+	                                FIELD_COUNTDOWN_TO_NEXT_SAVING);
+	field_timestamp(decode_window(nibble, address, FIELD_TIME_LAST_RECORD),
+	                time_last);
+	*no_records = (int)decode_window(nibble, address, FIELD_NUMBER_OF_RECORDS);
+
+	return (int)decode_window(nibble, address,
+	                          FIELD_POINTER_TO_LAST_WRITTEN_RECORD);
 
 }
 
 
+static void decode_history_data(unsigned char *data,
+                                struct config_type *config,
+                                double *temperature_indoor,
+                                double *temperature_outdoor,
+                                double *pressure,
+                                int *humidity_indoor,
+                                int *humidity_outdoor,
+                                double *raincount,
+                                double *windspeed,
+                                double *winddir_degrees,
+                                double *dewpoint,
+                                double *windchill);
+
+
 /********************************************************************
  * read_history_record
  * Read the history information like interval, countdown, time
@@ -2238,73 +2221,510 @@ int read_history_record(WEATHERSTATION ws2300,
 	unsigned char command[25];
 	int address;
 	int bytes=10;
-	long int tempint;
-	double A, B, C; // Intermediate values used for dewpoint calculation
-	double wind_kmph;
 
-	address = 0x6C6 + record*19;
+	address = HISTORY_START + record * HISTORY_RECORD_NIBBLES;
 
 	if (read_safe(ws2300, address, bytes, data, command) != bytes)
 	    read_error_exit();
 	
-	tempint = (data[4]<<12) + (data[3]<<4) + (data[2] >> 4);
-	
-	*pressure = 1000 + (tempint % 10000)/10.0;
-	
-	if (*pressure >= 1502.2)
-		*pressure = *pressure - 1000;
-		
-	*pressure = *pressure / config->pressure_conv_factor;
-	
-	*humidity_indoor = (tempint - (tempint % 10000)) / 10000.0;
+	decode_history_data(data, config, temperature_indoor, temperature_outdoor,
+	                    pressure, humidity_indoor, humidity_outdoor, raincount,
+	                    windspeed, winddir_degrees, dewpoint, windchill);
 
-	*humidity_outdoor = (data[5]>>4)*10 + (data[5]&0xF);
-	
-	*raincount = ((data[7]&0xF)*256 + data[6]) * 0.518 / config->rain_conv_factor;
-	
-	*windspeed = (data[8]*16 + (data[7]>>4))/ 10.0; //Need metric for WC
-	
-	*winddir_degrees = (data[9]&0xF)*22.5;
-	
-	// Temperatures	in Celcius. Cannot convert until WC is calculated
-	tempint = ((data[2] & 0xF)<<16) + (data[1]<<8) + data[0];
-	*temperature_indoor = (tempint % 1000)/10.0 - 30.0;
-	*temperature_outdoor = (tempint - (tempint % 1000))/10000.0 - 30.0;
-	
-	// Calculate windchill using new post 2001 USA/Canadian formula
-	// Twc = 13.112 + 0.6215*Ta -11.37*V^0.16 + 0.3965*Ta*V^0.16 [Celcius and km/h] 
-	
-	wind_kmph = 3.6 * *windspeed;
-	if (wind_kmph > 4.8)
+	return (++record) % HISTORY_RECORDS;
+}
+
+
+/********************************************************************
+ * read_history_bulk
+ * Read a run of history records in as few transactions as possible.
+ * The records lie back to back from 0x6C6, 19 nibbles each, so the
+ * run is read as one or (when it wraps from 0xAE to 0x00) two
+ * stretches of memory in full 15 byte reads that cross the record
+ * boundaries, and cut into records afterwards.
+ *
+ * Input:  Handle to weatherstation
+ *         first - index of the first record [0x00-0xAE]
+ *         count - number of records, at most HISTORY_RECORDS
+ *
+ * Output: records - array of count raw records, oldest first
+ *
+ * Returns: number of records read, -1 if reading failed
+ *
+ ********************************************************************/
+int read_history_bulk(WEATHERSTATION ws2300, int first, int count,
+                      struct history_raw *records)
+{
+	static unsigned char nibble[HISTORY_RECORDS * HISTORY_RECORD_NIBBLES + 1];
+	unsigned char data[MAXREADBYTES];
+	unsigned char command[25];
+	int done = 0;
+	int span, address, total, bytes;
+	int i, j;
+
+	if (first < 0 || first >= HISTORY_RECORDS || count < 0 ||
+	    count > HISTORY_RECORDS)
+		return -1;
+
+	while (done < count)
+	{
+		// Records up to the end of the ring are contiguous
+		span = HISTORY_RECORDS - (first + done) % HISTORY_RECORDS;
+		if (span > count - done)
+			span = count - done;
+
+		address = HISTORY_START +
+		          (first + done) % HISTORY_RECORDS * HISTORY_RECORD_NIBBLES;
+		total = span * HISTORY_RECORD_NIBBLES;
+
+		for (i = 0; i < total; i += 2 * bytes)
+		{
+			bytes = (total - i + 1) / 2;
+			if (bytes > MAXREADBYTES)
+				bytes = MAXREADBYTES;
+
+			if (read_safe(ws2300, address + i, bytes, data, command) != bytes)
+				return -1;
+
+			for (j = 0; j < 2 * bytes; j++)
+				nibble[i + j] = nibble_at(data, j);
+		}
+
+		for (i = 0; i < span; i++)
+		{
+			records[done + i].record = (first + done + i) % HISTORY_RECORDS;
+			memcpy(records[done + i].nibble,
+			       nibble + i * HISTORY_RECORD_NIBBLES, HISTORY_RECORD_NIBBLES);
+		}
+
+		done += span;
+	}
+
+	return count;
+}
+
+
+/********************************************************************
+ * decode_history_record
+ * Decode a raw record from read_history_bulk. Gives the same values
+ * as read_history_record.
+ *
+ * Input:  raw - pointer to the record
+ *         config structure with conversion factors
+ *
+ * Output: as read_history_record
+ *
+ * Returns: interger index number pointing to next record
+ *
+ ********************************************************************/
+int decode_history_record(struct history_raw *raw,
+                          struct config_type *config,
+                          double *temperature_indoor,
+                          double *temperature_outdoor,
+                          double *pressure,
+                          int *humidity_indoor,
+                          int *humidity_outdoor,
+                          double *raincount,
+                          double *windspeed,
+                          double *winddir_degrees,
+                          double *dewpoint,
+                          double *windchill)
+{
+	unsigned char data[HISTORY_DATA_BYTES];
+
+	history_raw_pack(raw, 1, data);
+
+	decode_history_data(data, config, temperature_indoor, temperature_outdoor,
+	                    pressure, humidity_indoor, humidity_outdoor, raincount,
+	                    windspeed, winddir_degrees, dewpoint, windchill);
+
+	return (raw->record + 1) % HISTORY_RECORDS;
+}
+
+
+/********************************************************************
+ * History sync cursor
+ *
+ * The cursor remembers the ring index, station time and interval of
+ * the last history record a program has stored. The next run finds
+ * the new records from the ring pointer alone instead of working
+ * them out from the time of the last line in its log. Because the
+ * old interval is kept, records written before an interval change
+ * with interval2300 still get their right time.
+ *
+ * The file is one line "record YYYYMMDDhhmm interval" and is
+ * replaced as a whole so it is never seen half written.
+ *
+ ********************************************************************/
+
+/********************************************************************
+ * history_cursor_load
+ * Read a history sync cursor file
+ *
+ * Input:  path - file name
+ *
+ * Output: cursor - the cursor, record -1 if there is no valid file
+ *
+ * Returns: 1 if the file was read, 0 if not
+ *
+ ********************************************************************/
+int history_cursor_load(char *path, struct history_cursor *cursor)
+{
+	FILE *fileptr;
+	struct tm time_tm;
+	int n = 0;
+
+	memset(&time_tm, 0, sizeof(time_tm));
+	cursor->record = -1;
+	cursor->time = 0;
+	cursor->interval = 0;
+
+	if ((fileptr = fopen(path, "r")) == NULL)
+		return 0;
+
+	n = fscanf(fileptr, "%d %4d%2d%2d%2d%2d %d", &cursor->record,
+	           &time_tm.tm_year, &time_tm.tm_mon, &time_tm.tm_mday,
+	           &time_tm.tm_hour, &time_tm.tm_min, &cursor->interval);
+	fclose(fileptr);
+
+	if (n != 7 || cursor->record < 0 || cursor->record >= HISTORY_RECORDS ||
+	    cursor->interval < 1)
+	{
+		cursor->record = -1;
+		return 0;
+	}
+
+	time_tm.tm_year -= 1900;
+	time_tm.tm_mon -= 1;
+	time_tm.tm_isdst = -1;
+	cursor->time = mktime(&time_tm);
+
+	return 1;
+}
+
+
+/********************************************************************
+ * history_cursor_save
+ * Write a history sync cursor file. A new file is written next to
+ * it and then put in its place.
+ *
+ * Input:  path - file name
+ *         cursor - the cursor
+ *
+ * Returns: 0 on success and -1 if fail
+ *
+ ********************************************************************/
+int history_cursor_save(char *path, struct history_cursor *cursor)
+{
+	FILE *fileptr;
+	char tempname[512];
+	char timestring[20];
+	int ok;
+
+	if (cursor->record < 0)
+		return 0;
+
+	snprintf(tempname, sizeof(tempname), "%s.new", path);
+
+	if ((fileptr = fopen(tempname, "w")) == NULL)
+		return -1;
+
+	strftime(timestring, sizeof(timestring), "%Y%m%d%H%M",
+	         localtime(&cursor->time));
+	ok = fprintf(fileptr, "%d %s %d\n", cursor->record, timestring,
+	             cursor->interval) > 0;
+
+	if (fclose(fileptr) != 0 || !ok || replace_file(tempname, path) < 0)
+	{
+		remove(tempname);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * history_pending
+ * Work out which history records are new since the cursor and when
+ * each was written.
+ *
+ * With a cursor the count is the distance in the ring from the
+ * cursor to the last written record. The time passed tells if the
+ * ring went round since, and the number of valid records the station
+ * reports limits the count after a reset. After an
+ * interval change the station only counts the records since, the
+ * ones before it are timed forward from the cursor with the old
+ * interval.
+ *
+ * Input:  Handle to weatherstation
+ *         cursor - last record stored. Record -1 if unknown, then
+ *                  cursor->time must be the time of the last record
+ *                  stored (0 for none) and the count is worked out
+ *                  from the time passed since.
+ *
+ * Output: first - ring index of the first new record
+ *         times - HISTORY_RECORDS times, one per new record
+ *         cursor - the last new record, to be saved once all are
+ *                  stored. Unchanged if there are none.
+ *
+ * Returns: number of new records
+ *
+ ********************************************************************/
+int history_pending(WEATHERSTATION ws2300, struct history_cursor *cursor,
+                    int *first, time_t *times)
+{
+	struct timestamp time_last;
+	struct tm time_tm;
+	time_t last;
+	int interval, countdown, records, current;
+	int n, expected, before = 0;
+	int k;
+
+	current = read_history_info(ws2300, &interval, &countdown, &time_last,
+	                            &records);
+
+	memset(&time_tm, 0, sizeof(time_tm));
+	time_tm.tm_year = time_last.year - 1900;
+	time_tm.tm_mon = time_last.month - 1;
+	time_tm.tm_mday = time_last.day;
+	time_tm.tm_hour = time_last.hour;
+	time_tm.tm_min = time_last.minute;
+	time_tm.tm_isdst = -1;
+	last = mktime(&time_tm);
+
+	if (interval < 1)
+		return 0;
+
+	if (records > HISTORY_RECORDS)
+		records = HISTORY_RECORDS;
+
+	if (cursor->record < 0 || cursor->interval < 1)
 	{
-		*windchill = 13.112 + 0.6215 * *temperature_outdoor -
-		             11.37 * pow(wind_kmph, 0.16) +
-		             0.3965 * *temperature_outdoor * pow(wind_kmph, 0.16);
+		n = (int)(difftime(last, cursor->time) / (60 * interval));
 	}
 	else
 	{
-		*windchill = *temperature_outdoor;
+		n = (current - cursor->record + HISTORY_RECORDS) % HISTORY_RECORDS;
+
+		if (cursor->interval == interval)
+		{
+			// Only the time tells if the ring went round since
+			expected = (int)(difftime(last, cursor->time) / (60 * interval));
+			if (expected >= HISTORY_RECORDS)
+				n = expected;
+		}
+		else if (n > records &&
+		         cursor->time + (time_t)(n - records) * 60 * cursor->interval <
+		         last - (time_t)(records - 1) * 60 * interval)
+		{
+			before = n - records;
+		}
+		else
+		{
+			n = records;
+		}
 	}
-	
+
+	if (n > records + before)
+		n = records + before;
+	if (n > HISTORY_RECORDS)
+		n = HISTORY_RECORDS;
+	if (n <= 0)
+		return 0;
+
+	*first = (current - n + 1 + HISTORY_RECORDS) % HISTORY_RECORDS;
+
+	for (k = 0; k < n; k++)
+	{
+		if (k < before)
+			times[k] = cursor->time + (time_t)(k + 1) * 60 * cursor->interval;
+		else
+			times[k] = last - (time_t)(n - 1 - k) * 60 * interval;
+	}
+
+	cursor->record = current;
+	cursor->time = last;
+	cursor->interval = interval;
+
+	return n;
+}
+
+
+/********************************************************************
+ * history_raw_pack
+ * Pack raw records from read_history_bulk into the bytes
+ * decode_history_batch takes, HISTORY_DATA_BYTES per record, laid out
+ * like read_safe returns them.
+ *
+ * Input:  raw - array of count records
+ *
+ * Output: data - count * HISTORY_DATA_BYTES bytes
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void history_raw_pack(struct history_raw *raw, int count, unsigned char *data)
+{
+	int i, k;
+
+	for (k = 0; k < count; k++, data += HISTORY_DATA_BYTES)
+	{
+		for (i = 0; i < HISTORY_DATA_BYTES; i++)
+		{
+			data[i] = raw[k].nibble[2 * i];
+			if (2 * i + 1 < HISTORY_RECORD_NIBBLES)
+				data[i] |= raw[k].nibble[2 * i + 1] << 4;
+		}
+	}
+}
+
+
+/********************************************************************
+ * decode_history_batch
+ * Decode many history records into one array per value. Gives the
+ * same values, to the last bit, as decode_history_record.
+ *
+ * The work is done column by column: one pass unpacks the BCD and
+ * binary fields, then one pass each for the windchill, the dewpoint
+ * and the unit conversion. None of them calls libm, the pow() and
+ * log() values come from the tables of mkderived2300, indexed by the
+ * raw wind speed and humidity.
+ *
+ * Input:  data - count * HISTORY_DATA_BYTES bytes as read from the
+ *                station or made by history_raw_pack
+ *         count - number of records
+ *         config structure with conversion factors
+ *
+ * Output: columns - each array gets count values, in the units of
+ *                   the config like read_history_record
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void decode_history_batch(unsigned char *data, int count,
+                          struct config_type *config,
+                          struct history_columns *columns)
+{
+	double *temperature_indoor = columns->temperature_indoor;
+	double *temperature_outdoor = columns->temperature_outdoor;
+	double *pressure = columns->pressure;
+	int *humidity_indoor = columns->humidity_indoor;
+	int *humidity_outdoor = columns->humidity_outdoor;
+	double *raincount = columns->raincount;
+	double *windspeed = columns->windspeed;
+	double *winddir_degrees = columns->winddir_degrees;
+	double *dewpoint = columns->dewpoint;
+	double *windchill = columns->windchill;
+	double A, B, C; // Intermediate values used for dewpoint calculation
+	double wind_kmph, wind_power;
+	unsigned char *d;
+	long int tempint;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		d = data + i * HISTORY_DATA_BYTES;
+
+		tempint = (d[4]<<12) + (d[3]<<4) + (d[2] >> 4);
+		pressure[i] = 1000 + (tempint % 10000)/10.0;
+		if (pressure[i] >= 1502.2)
+			pressure[i] = pressure[i] - 1000;
+		humidity_indoor[i] = (tempint - (tempint % 10000)) / 10000.0;
+
+		humidity_outdoor[i] = (d[5]>>4)*10 + (d[5]&0xF);
+		raincount[i] = ((d[7]&0xF)*256 + d[6]) * 0.518 / config->rain_conv_factor;
+		windspeed[i] = (d[8]*16 + (d[7]>>4))/ 10.0; //Need metric for WC
+		winddir_degrees[i] = (d[9]&0xF)*22.5;
+
+		// Temperatures in Celcius. Cannot convert until WC is calculated
+		tempint = ((d[2] & 0xF)<<16) + (d[1]<<8) + d[0];
+		temperature_indoor[i] = (tempint % 1000)/10.0 - 30.0;
+		temperature_outdoor[i] = (tempint - (tempint % 1000))/10000.0 - 30.0;
+	}
+
+	// Calculate windchill using new post 2001 USA/Canadian formula
+	// Twc = 13.112 + 0.6215*Ta -11.37*V^0.16 + 0.3965*Ta*V^0.16 [Celcius and km/h]
+	for (i = 0; i < count; i++)
+	{
+		d = data + i * HISTORY_DATA_BYTES;
+		wind_kmph = 3.6 * windspeed[i];
+		if (wind_kmph > 4.8)
+		{
+			wind_power = wind_power_table[d[8]*16 + (d[7]>>4)];
+			windchill[i] = 13.112 + 0.6215 * temperature_outdoor[i] -
+			               11.37 * wind_power +
+			               0.3965 * temperature_outdoor[i] * wind_power;
+		}
+		else
+		{
+			windchill[i] = temperature_outdoor[i];
+		}
+	}
+
 	// Calculate dewpoint
-	// REF http://www.faqs.org/faqs/meteorology/temp-dewpoint/             
+	// REF http://www.faqs.org/faqs/meteorology/temp-dewpoint/
 	A = 17.2694;
-	B = (*temperature_outdoor > 0) ? 237.3 : 265.5;
-	C = (A * *temperature_outdoor)/(B + *temperature_outdoor) + log((double)*humidity_outdoor/100);
-	*dewpoint = B * C / (A - C);
+	for (i = 0; i < count; i++)
+	{
+		B = (temperature_outdoor[i] > 0) ? 237.3 : 265.5;
+		C = (A * temperature_outdoor[i])/(B + temperature_outdoor[i]) +
+		    log_humidity_table[humidity_outdoor[i]];
+		dewpoint[i] = B * C / (A - C);
+	}
 
 	// Now that WC/DP is calculated we can convert all temperatures and winds
+	for (i = 0; i < count; i++)
+	{
+		pressure[i] = pressure[i] / config->pressure_conv_factor;
+		windspeed[i] *= config->wind_speed_conv_factor;
+	}
+
 	if (config->temperature_conv)
 	{
-		*temperature_indoor = *temperature_indoor * 9/5 + 32;
-		*temperature_outdoor = *temperature_outdoor * 9/5 + 32;
-		*windchill = *windchill * 9/5 + 32;
-		*dewpoint = *dewpoint * 9/5 + 32;
+		for (i = 0; i < count; i++)
+		{
+			temperature_indoor[i] = temperature_indoor[i] * 9/5 + 32;
+			temperature_outdoor[i] = temperature_outdoor[i] * 9/5 + 32;
+			windchill[i] = windchill[i] * 9/5 + 32;
+			dewpoint[i] = dewpoint[i] * 9/5 + 32;
+		}
 	}
-	
-	*windspeed *= config->wind_speed_conv_factor;
-	
-	return (++record)%0xAF;
+}
+
+
+/********************************************************************
+ * decode_history_data decodes the 10 bytes read at the start of a
+ * history record. Used by read_history_record and
+ * decode_history_record.
+ ********************************************************************/
+static void decode_history_data(unsigned char *data,
+                                struct config_type *config,
+                                double *temperature_indoor,
+                                double *temperature_outdoor,
+                                double *pressure,
+                                int *humidity_indoor,
+                                int *humidity_outdoor,
+                                double *raincount,
+                                double *windspeed,
+                                double *winddir_degrees,
+                                double *dewpoint,
+                                double *windchill)
+{
+	struct history_columns columns;
+
+	columns.temperature_indoor = temperature_indoor;
+	columns.temperature_outdoor = temperature_outdoor;
+	columns.pressure = pressure;
+	columns.humidity_indoor = humidity_indoor;
+	columns.humidity_outdoor = humidity_outdoor;
+	columns.raincount = raincount;
+	columns.windspeed = windspeed;
+	columns.winddir_degrees = winddir_degrees;
+	columns.dewpoint = dewpoint;
+	columns.windchill = windchill;
+
+	decode_history_batch(data, 1, config, &columns);
 }
 
 
@@ -2390,6 +2810,8 @@ int get_configuration(struct config_type *config, char *path)
 	char token[100] = "";
 	char val[100] = "";
 	char val2[100] = "";
+	char val3[256] = "";
+	sinkdata *sink;
 	
 	// First we set everything to defaults - faster than many if statements
 	strcpy(config->serial_device_name, DEFAULT_SERIAL_DEVICE);  // Name of serial device
@@ -2418,6 +2840,25 @@ int get_configuration(struct config_type *config, char *path)
 	strcpy(config->pgsql_connect, "hostaddr='127.0.0.1'dbname='open2300'user='postgres'"); // connection string
 	strcpy(config->pgsql_table, "weather");             // PgSQL table name
 	strcpy(config->pgsql_station, "open2300");          // Unique station id
+	config->pgsql_batch = 1;                            // Every row right away
+	config->pgsql_flush = 0;
+	strcpy(config->sqlite_journal_mode, "");            // SQLite defaults
+	strcpy(config->sqlite_synchronous, "");
+	config->sqlite_ignore_duplicates = 0;               // A stored record is an error
+	config->transport_mode = TRANSPORT_LOCKSTEP;        // One command byte per round trip
+	config->timeout_ack = DEFAULT_TIMEOUT_ACK;          // Serial timeouts in milliseconds
+	config->timeout_data = DEFAULT_TIMEOUT_DATA;
+	config->timeout_reset = DEFAULT_TIMEOUT_RESET;
+	config->idle_timeout = DEFAULT_IDLE_TIMEOUT;        // Seconds
+	config->cache = 0;                                  // Always read from the station
+	strcpy(config->daemon_socket, "");                  // Tools open the serial port themselves
+	config->daemon_poll = DEFAULT_DAEMON_POLL;          // Seconds
+	strcpy(config->publish_file, "");                   // ws2300d publishes nothing
+	strcpy(config->log_store, "");                      // log2300 writes its text log only
+	config->log_index = 0;                              // Text logs get no index
+	config->rollup = 0;                                 // No hourly, daily and monthly rollups
+	config->num_history_sinks = 0;                      // histsync2300 feeds nothing
+	config->history_queue = DEFAULT_HISTORY_QUEUE;      // Rows
 
 	// open the config file
 
@@ -2441,7 +2882,9 @@ int get_configuration(struct config_type *config, char *path)
 
 	while (fscanf(fptr, "%[^\n]\n", inputline) != EOF)
 	{
-		sscanf(inputline, "%[^= \t]%*[ \t=]%s%*[, \t]%s%*[^\n]", token, val, val2);
+		val3[0] = '\0';
+		sscanf(inputline, "%[^= \t]%*[ \t=]%s%*[, \t]%s%*[, \t]%255s%*[^\n]",
+		       token, val, val2, val3);
 
 		if (token[0] == '#')	// comment
 			continue;
@@ -2583,17 +3026,151 @@ int get_configuration(struct config_type *config, char *path)
 			strcpy(config->pgsql_station, val);
 			continue;
 		}
-		
-	}
-	
-	// Expose the default host names if no configuration file was found or
-	// one was supplied but it didn't contain any APRS_SERVER entries.
-	if (0 == config->num_hosts) {
-		config->num_hosts = 3;
-	}
 
-	return (0);
-}
+		if ((strcmp(token,"PGSQL_BATCH") == 0) && (strlen(val) != 0))
+		{
+			config->pgsql_batch = atoi(val);
+			continue;
+		}
+
+		if ((strcmp(token,"PGSQL_FLUSH") == 0) && (strlen(val) != 0))
+		{
+			config->pgsql_flush = atoi(val);
+			continue;
+		}
+
+		if ((strcmp(token,"SQLITE_JOURNAL_MODE") == 0) && (strlen(val) != 0))
+		{
+			snprintf(config->sqlite_journal_mode, sizeof(config->sqlite_journal_mode), "%s", val);
+			continue;
+		}
+
+		if ((strcmp(token,"SQLITE_SYNCHRONOUS") == 0) && (strlen(val) != 0))
+		{
+			snprintf(config->sqlite_synchronous, sizeof(config->sqlite_synchronous), "%s", val);
+			continue;
+		}
+
+		if ((strcmp(token,"SQLITE_IGNORE_DUPLICATES") == 0) && (strlen(val) != 0))
+		{
+			config->sqlite_ignore_duplicates = atoi(val);
+			continue;
+		}
+
+		if ((strcmp(token,"TRANSPORT") == 0) && (strlen(val) != 0))
+		{
+			if (strcmp(val, "lockstep") == 0)
+				config->transport_mode = TRANSPORT_LOCKSTEP;
+			else if (strcmp(val, "pipelined") == 0)
+				config->transport_mode = TRANSPORT_PIPELINED;
+			continue; //else default remains
+		}
+
+		if ((strcmp(token,"TIMEOUT_ACK") == 0) && (atoi(val) > 0))
+		{
+			config->timeout_ack = atoi(val);
+			continue;
+		}
+
+		if ((strcmp(token,"TIMEOUT_DATA") == 0) && (atoi(val) > 0))
+		{
+			config->timeout_data = atoi(val);
+			continue;
+		}
+
+		if ((strcmp(token,"TIMEOUT_RESET") == 0) && (atoi(val) > 0))
+		{
+			config->timeout_reset = atoi(val);
+			continue;
+		}
+
+		if ((strcmp(token,"IDLE_TIMEOUT") == 0) && (strlen(val) != 0))
+		{
+			config->idle_timeout = atoi(val);
+			continue;
+		}
+
+		if ((strcmp(token,"CACHE") == 0) && (strlen(val) != 0))
+		{
+			config->cache = atoi(val);
+			continue;
+		}
+
+		if ((strcmp(token,"DAEMON_SOCKET") == 0) && (strlen(val) != 0))
+		{
+			strncpy(config->daemon_socket, val, sizeof(config->daemon_socket) - 1);
+			config->daemon_socket[sizeof(config->daemon_socket) - 1] = '\0';
+			continue;
+		}
+
+		if ((strcmp(token,"DAEMON_POLL") == 0) && (strlen(val) != 0))
+		{
+			config->daemon_poll = atoi(val);
+			continue;
+		}
+
+		if ((strcmp(token,"PUBLISH_FILE") == 0) && (strlen(val) != 0))
+		{
+			strncpy(config->publish_file, val, sizeof(config->publish_file) - 1);
+			config->publish_file[sizeof(config->publish_file) - 1] = '\0';
+			continue;
+		}
+
+		if ((strcmp(token,"HISTORY_SINK") == 0) && (strlen(val) != 0) && (strlen(val2) != 0))
+		{
+			if (config->num_history_sinks >= MAX_HISTORY_SINKS)
+				continue;           // ignore sinks over the defined max
+			sink = &config->history_sink[config->num_history_sinks];
+			snprintf(sink->type, sizeof(sink->type), "%s", val);
+			snprintf(sink->target, sizeof(sink->target), "%s", val2);
+			if (val3[0] == '#')     // a comment, not a cursor file
+				val3[0] = '\0';
+			strcpy(sink->cursor, val3);
+			config->num_history_sinks++;
+			continue;
+		}
+
+		if ((strcmp(token,"LOG_STORE") == 0) && (strlen(val) != 0))
+		{
+			snprintf(config->log_store, sizeof(config->log_store), "%s", val);
+			continue;
+		}
+
+		if ((strcmp(token,"LOG_INDEX") == 0) && (strlen(val) != 0))
+		{
+			config->log_index = atoi(val);
+			if (config->log_index < 0)
+				config->log_index = 0;
+			continue;
+		}
+
+		if ((strcmp(token,"ROLLUP") == 0) && (strlen(val) != 0))
+		{
+			config->rollup = atoi(val) != 0;
+			continue;
+		}
+
+		if ((strcmp(token,"HISTORY_QUEUE") == 0) && (strlen(val) != 0))
+		{
+			config->history_queue = atoi(val);
+			if (config->history_queue < 1)
+				config->history_queue = 1;
+			continue;
+		}
+		
+	}
+	
+	// Expose the default host names if no configuration file was found or
+	// one was supplied but it didn't contain any APRS_SERVER entries.
+	if (0 == config->num_hosts) {
+		config->num_hosts = 3;
+	}
+
+	// open_weatherstation talks to ws2300d instead of the port if it runs
+	set_daemon_socket(config->daemon_socket);
+
+	return (0);
+}
 
 
  /********************************************************************
@@ -2739,222 +3316,1974 @@ unsigned char data_checksum(unsigned char *data, int number)
 
 
 /********************************************************************
- * initialize resets WS2300 to cold start (rewind and start over)
- * 
- * Input:   device number of the already open serial port
- *           
- * Returns: 0 if fail, 1 if success
+ * Link state
+ * The WEATHERSTATION handle is a plain file descriptor (a HANDLE in
+ * Windows) so the settings belonging to an open station are kept in
+ * a small table keyed on the handle. An entry is created the first
+ * time a handle is used and released by close_weatherstation.
+ * Should more than MAXLINKS stations be open at the same time the
+ * extra ones share a spare entry that always runs lock-step.
  *
  ********************************************************************/
-int initialize(WEATHERSTATION ws2300)
+struct link_state
 {
-	unsigned char command = 0x06;
-	unsigned char answer;
-
-	write_device(ws2300, &command, 1);
-
-	if (read_device(ws2300, &answer, 1) != 1)
-		return 0;
-
-	write_device(ws2300, &command, 1);
-	write_device(ws2300, &command, 1);
-
-	if (read_device(ws2300, &answer, 1) != 1)
-		return 0;
-
-	write_device(ws2300, &command, 1);
-
-	if (read_device(ws2300, &answer, 1) != 1)
-		return 0;
+	int used;
+	WEATHERSTATION handle;
+	int transport_mode;          // TRANSPORT_LOCKSTEP or TRANSPORT_PIPELINED
+	int pipeline_fails;          // consecutive failed pipelined transactions
+	int timeout[3];              // TIMEOUT_ACK, TIMEOUT_DATA, TIMEOUT_RESET in ms
+	int in_sync;                 // last transaction ended with a good checksum/ack
+	time_t last_ok;              // when that transaction finished
+	int idle_timeout;            // seconds before in_sync is no longer trusted
+	struct link_stats stats;
+	struct ws_snapshot *snapshot; // read_safe answers from this when it can
+	int own_snapshot;            // snapshot came from read_planned, free it
+	struct ws_cache *cache;      // memory cache, NULL when disabled
+	int client;                  // CLIENT_NONE, CLIENT_DAEMON or CLIENT_PUBLICATION
+	struct wind_ring *wind;      // wind sampler, NULL when disabled
+};
+
+static int client_read(WEATHERSTATION ws2300, int address, int number,
+                       unsigned char *readdata);
+static int client_write(WEATHERSTATION ws2300, int address, int number,
+                        unsigned char encode_constant, unsigned char *writedata);
+
+static int cache_lookup(struct link_state *link, int address, int number,
+                        unsigned char *readdata);
+static void cache_store(struct link_state *link, int address, int nibbles,
+                        unsigned char *data);
+static void cache_discard(struct link_state *link, int address, int nibbles);
+static int cache_copy(struct link_state *link, int address, int nibbles,
+                      struct ws_snapshot *snap);
+
+static int prefetch_lookup(struct link_state *link, int address, int number,
+                           unsigned char *readdata);
+static int read_station_safe(WEATHERSTATION ws2300, struct link_state *link,
+                             int address, int number,
+                             unsigned char *readdata, unsigned char *commanddata);
+
+static struct link_state links[MAXLINKS];
+static struct link_state spare_link = { 0, 0, TRANSPORT_LOCKSTEP, 0,
+	{ DEFAULT_TIMEOUT_ACK, DEFAULT_TIMEOUT_DATA, DEFAULT_TIMEOUT_RESET },
+	0, 0, 0 };
+
+static struct link_state *get_link_state(WEATHERSTATION ws)
+{
+	struct link_state *free_link = NULL;
+	int i;
 
-	write_device(ws2300, &command, 1);
+	for (i = 0; i < MAXLINKS; i++)
+	{
+		if (links[i].used && links[i].handle == ws)
+			return &links[i];
+		if (!links[i].used && free_link == NULL)
+			free_link = &links[i];
+	}
 
-	if (read_device(ws2300, &answer, 1) != 1)
-		return 0;
+	if (free_link == NULL)
+		return &spare_link;
 
-	if (answer != 2)
-		return 0;
+	memset(free_link, 0, sizeof(struct link_state));
+	free_link->used = 1;
+	free_link->handle = ws;
+	free_link->transport_mode = TRANSPORT_LOCKSTEP;
+	free_link->timeout[TIMEOUT_ACK] = DEFAULT_TIMEOUT_ACK;
+	free_link->timeout[TIMEOUT_DATA] = DEFAULT_TIMEOUT_DATA;
+	free_link->timeout[TIMEOUT_RESET] = DEFAULT_TIMEOUT_RESET;
+	free_link->idle_timeout = DEFAULT_IDLE_TIMEOUT;
 
-	return 1;
+	return free_link;
 }
 
 
 /********************************************************************
- * read_data reads data from the WS2300 based on a given address,
- * number of data read, and a an already open serial port
+ * release_link_state forgets everything known about a handle.
+ * Called by close_weatherstation so that a new station opened on a
+ * recycled handle starts with default settings.
  *
- * Inputs:  serdevice - device number of the already open serial port
- *          address (interger - 16 bit)
- *          number - number of bytes to read, max value 15
+ * Input:   Handle to weatherstation
  *
- * Output:  readdata - pointer to an array of chars containing
- *                     the just read data, not zero terminated
- *          commanddata - pointer to an array of chars containing
- *                     the commands that were sent to the station
- * 
- * Returns: number of bytes read, -1 if failed
+ * Returns: nothing
  *
  ********************************************************************/
-int read_data(WEATHERSTATION ws2300, int address, int number,
-			  unsigned char *readdata, unsigned char *commanddata)
+void release_link_state(WEATHERSTATION ws)
 {
-
-	unsigned char answer;
 	int i;
 
-	// First 4 bytes are populated with converted address range 0000-13B0
-	address_encoder(address, commanddata);
-	// Last populate the 5th byte with the converted number of bytes
-	commanddata[4] = numberof_encoder(number);
-
-	for (i = 0; i < 4; i++)
+	for (i = 0; i < MAXLINKS; i++)
 	{
-		if (write_device(ws2300, commanddata + i, 1) != 1)
-			return -1;
-		if (read_device(ws2300, &answer, 1) != 1)
-			return -1;
-		if (answer != command_check0123(commanddata + i, i))
-			return -1;
+		if (links[i].used && links[i].handle == ws)
+		{
+			if (links[i].own_snapshot)
+				free(links[i].snapshot);
+			links[i].snapshot = NULL;
+			links[i].own_snapshot = 0;
+			free(links[i].cache);
+			links[i].cache = NULL;
+			free(links[i].wind);
+			links[i].wind = NULL;
+			links[i].used = 0;
+		}
 	}
 
-	//Send the final command that asks for 'number' of bytes, check answer
-	if (write_device(ws2300, commanddata + 4, 1) != 1)
-		return -1;
-	if (read_device(ws2300, &answer, 1) != 1)
-		return -1;
-	if (answer != command_check4(number))
-		return -1;
+	return;
+}
 
-	//Read the data bytes
-	for (i = 0; i < number; i++)
-	{
-		if (read_device(ws2300, readdata + i, 1) != 1)
-			return -1;
-	}
 
-	//Read and verify checksum
-	if (read_device(ws2300, &answer, 1) != 1)
-		return -1;
-	if (answer != data_checksum(readdata, number))
-		return -1;
-		
-	return i;
+/********************************************************************
+ * set_transport_mode selects how commands are framed on the wire.
+ *
+ * Input:   Handle to weatherstation
+ *          mode - TRANSPORT_LOCKSTEP sends one command byte and waits
+ *                 for its acknowledge before sending the next.
+ *                 TRANSPORT_PIPELINED sends the whole command as one
+ *                 burst and checks all acknowledges from one read.
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void set_transport_mode(WEATHERSTATION ws, int mode)
+{
+	struct link_state *link = get_link_state(ws);
 
+	if (link == &spare_link)
+		return;
+
+	link->transport_mode = mode;
+	link->pipeline_fails = 0;
+
+	return;
 }
 
 
 /********************************************************************
- * write_data writes data to the WS2300.
- * It can both write nibbles and set/unset bits
+ * set_link_timeouts sets how long the transport waits for the
+ * station before giving up on a transaction.
  *
- * Inputs:      ws2300 - device number of the already open serial port
- *              address (interger - 16 bit)
- *              number - number of nibbles to be written/changed
- *                       must 1 for bit modes (SETBIT and UNSETBIT)
- *                       max 80 for nibble mode (WRITENIB)
- *              encode_constant - unsigned char
- *                                (SETBIT, UNSETBIT or WRITENIB)
- *              writedata - pointer to an array of chars containing
- *                          data to write, not zero terminated
- *                          data must be in hex - one digit per byte
- *                          If bit mode value must be 0-3 and only
- *                          the first byte can be used.
- * 
- * Output:      commanddata - pointer to an array of chars containing
- *                            the commands that were sent to the station
+ * Input:   Handle to weatherstation
+ *          ack_ms - deadline for each command acknowledge
+ *          data_ms - deadline for all data bytes plus the checksum
+ *          reset_ms - deadline for the answer to a 0x06 reset
  *
- * Returns:     number of bytes written, -1 if failed
+ * Returns: nothing
  *
  ********************************************************************/
-int write_data(WEATHERSTATION ws2300, int address, int number,
-			   unsigned char encode_constant, unsigned char *writedata,
-			   unsigned char *commanddata)
+void set_link_timeouts(WEATHERSTATION ws, int ack_ms, int data_ms, int reset_ms)
 {
-	unsigned char answer;
-	unsigned char encoded_data[80];
-	int i = 0;
-	unsigned char ack_constant = WRITEACK;
-	
-	if (encode_constant == SETBIT)
-	{
-		ack_constant = SETACK;
-	}
-	else if (encode_constant == UNSETBIT)
-	{
-		ack_constant = UNSETACK;
-	}
+	struct link_state *link = get_link_state(ws);
 
-	// First 4 bytes are populated with converted address range 0000-13XX
-	address_encoder(address, commanddata);
-	// populate the encoded_data array
-	data_encoder(number, encode_constant, writedata, encoded_data);
+	if (link == &spare_link)
+		return;
 
-	//Write the 4 address bytes
-	for (i = 0; i < 4; i++)
-	{
-		if (write_device(ws2300, commanddata + i, 1) != 1)
-			return -1;
-		if (read_device(ws2300, &answer, 1) != 1)
-			return -1;
-		if (answer != command_check0123(commanddata + i, i))
-			return -1;
-	}
+	link->timeout[TIMEOUT_ACK] = ack_ms;
+	link->timeout[TIMEOUT_DATA] = data_ms;
+	link->timeout[TIMEOUT_RESET] = reset_ms;
 
-	//Write the data nibbles or set/unset the bits
-	for (i = 0; i < number; i++)
-	{
-		if (write_device(ws2300, encoded_data + i, 1) != 1)
-			return -1;
-		if (read_device(ws2300, &answer, 1) != 1)
-			return -1;
-		if (answer != (writedata[i] + ack_constant))
-			return -1;
-		commanddata[i + 4] = encoded_data[i];
-	}
+	return;
+}
 
-	return i;
+
+/********************************************************************
+ * get_link_timeout
+ *
+ * Input:   Handle to weatherstation
+ *          which - TIMEOUT_ACK, TIMEOUT_DATA or TIMEOUT_RESET
+ *
+ * Returns: the timeout in milliseconds
+ *
+ ********************************************************************/
+int get_link_timeout(WEATHERSTATION ws, int which)
+{
+	return get_link_state(ws)->timeout[which];
 }
 
 
 /********************************************************************
- * read_safe Read data, retry until success or maxretries
- * Reads data from the WS2300 based on a given address,
- * number of data read, and a an already open serial port
- * Uses the read_data function and has same interface
+ * set_client_mode marks a handle that is not a serial port. Resets
+ * are never sent on such a handle.
+ * Called by open_weatherstation and open_publication.
  *
- * Inputs:  ws2300 - device number of the already open serial port
- *          address (interger - 16 bit)
- *          number - number of bytes to read, max value 15
+ * Input:   Handle to weatherstation
+ *          mode - CLIENT_NONE for a serial port
+ *                 CLIENT_DAEMON for a connection to ws2300d. Reads
+ *                 and writes are sent to the daemon as requests.
+ *                 CLIENT_PUBLICATION for a snapshot published by
+ *                 ws2300d. Reads are answered from the snapshot only.
  *
- * Output:  readdata - pointer to an array of chars containing
- *                     the just read data, not zero terminated
- *          commanddata - pointer to an array of chars containing
- *                     the commands that were sent to the station
- * 
- * Returns: number of bytes read, -1 if failed
+ * Returns: nothing
  *
  ********************************************************************/
-int read_safe(WEATHERSTATION ws2300, int address, int number,
-			  unsigned char *readdata, unsigned char *commanddata)
+void set_client_mode(WEATHERSTATION ws, int mode)
 {
-	int j;
+	struct link_state *link = get_link_state(ws);
+
+	if (link != &spare_link)
+		link->client = mode;
+
+	return;
+}
+
+
+/********************************************************************
+ * get_client_mode tells what a handle is connected to
+ *
+ * Returns: CLIENT_NONE, CLIENT_DAEMON or CLIENT_PUBLICATION
+ ********************************************************************/
+int get_client_mode(WEATHERSTATION ws)
+{
+	return get_link_state(ws)->client;
+}
+
+
+/********************************************************************
+ * set_idle_timeout sets how long a synchronized link is trusted
+ * without traffic. After that read_safe and write_safe send a
+ * reset_06 before the next transaction again. 0 means always reset.
+ *
+ * Input:   Handle to weatherstation
+ *          seconds
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void set_idle_timeout(WEATHERSTATION ws, int seconds)
+{
+	struct link_state *link = get_link_state(ws);
+
+	if (link == &spare_link)
+		return;
+
+	link->idle_timeout = seconds;
+
+	return;
+}
+
+
+/********************************************************************
+ * get_link_stats copies the transaction and reset counters of a
+ * handle. They count from open_weatherstation.
+ *
+ * Input:   Handle to weatherstation
+ *
+ * Output:  stats - pointer to struct link_stats
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void get_link_stats(WEATHERSTATION ws, struct link_stats *stats)
+{
+	*stats = get_link_state(ws)->stats;
+	return;
+}
+
+
+/********************************************************************
+ * configure_weatherstation applies the link related settings from
+ * the config file to an open weatherstation. Call it right after
+ * open_weatherstation.
+ *
+ * Input:   Handle to weatherstation
+ *          config structure (pointer to) as filled by get_configuration
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void configure_weatherstation(WEATHERSTATION ws, struct config_type *config)
+{
+	set_transport_mode(ws, config->transport_mode);
+	set_link_timeouts(ws, config->timeout_ack, config->timeout_data,
+	                  config->timeout_reset);
+	set_idle_timeout(ws, config->idle_timeout);
+	cache_enable(ws, config->cache);
+
+	return;
+}
+
+
+/********************************************************************
+ * pipeline_failed books a failed pipelined transaction. A station
+ * that keeps rejecting bursts is switched to lock-step for good so
+ * we do not pay for a failed burst on every transaction.
+ *
+ ********************************************************************/
+static void pipeline_failed(struct link_state *link)
+{
+	if (++link->pipeline_fails >= MAXPIPELINEFAILS)
+		link->transport_mode = TRANSPORT_LOCKSTEP;
+
+	return;
+}
+
+
+/********************************************************************
+ * link_transaction_done records the outcome of one read_data or
+ * write_data. Only a fully acknowledged transaction with a good
+ * checksum leaves the station waiting for the next address byte.
+ ********************************************************************/
+static void link_transaction_done(struct link_state *link, int ok)
+{
+	if (ok)
+	{
+		link->stats.transactions++;
+		link->in_sync = 1;
+		link->last_ok = time(NULL);
+	}
+	else
+	{
+		link->stats.failures++;
+		link->in_sync = 0;
+	}
+}
+
+
+/********************************************************************
+ * link_resync sends reset_06 unless the previous transaction left
+ * the link in sync recently enough. Used by read_safe and write_safe.
+ ********************************************************************/
+static void link_resync(WEATHERSTATION ws2300, struct link_state *link)
+{
+	time_t now = time(NULL);
+
+	if (link->client)
+		return;
+
+	if (link != &spare_link && link->in_sync &&
+	    now >= link->last_ok && now - link->last_ok < link->idle_timeout)
+	{
+		link->stats.resets_avoided++;
+		return;
+	}
+
+	reset_06(ws2300);
+	link->stats.resets_issued++;
+}
+
+/********************************************************************
+ * initialize resets WS2300 to cold start (rewind and start over)
+ * 
+ * Input:   device number of the already open serial port
+ *           
+ * Returns: 0 if fail, 1 if success
+ *
+ ********************************************************************/
+int initialize(WEATHERSTATION ws2300)
+{
+	unsigned char command = 0x06;
+	unsigned char answer;
+	int timeout = get_link_timeout(ws2300, TIMEOUT_RESET);
+
+	if (get_client_mode(ws2300))
+		return 1;
+
+	write_device(ws2300, &command, 1);
+
+	if (read_device_timeout(ws2300, &answer, 1, timeout) != 1)
+		return 0;
+
+	write_device(ws2300, &command, 1);
+	write_device(ws2300, &command, 1);
+
+	if (read_device_timeout(ws2300, &answer, 1, timeout) != 1)
+		return 0;
+
+	write_device(ws2300, &command, 1);
+
+	if (read_device_timeout(ws2300, &answer, 1, timeout) != 1)
+		return 0;
+
+	write_device(ws2300, &command, 1);
+
+	if (read_device_timeout(ws2300, &answer, 1, timeout) != 1)
+		return 0;
+
+	if (answer != 2)
+		return 0;
+
+	return 1;
+}
+
+
+/********************************************************************
+ * read_data_lockstep is the classic read transaction: each command
+ * byte is sent on its own and its acknowledge awaited before the next.
+ * Same interface as read_data plus the link state for the timeouts.
+ ********************************************************************/
+static int read_data_lockstep(WEATHERSTATION ws2300, struct link_state *link,
+                              int address, int number,
+                              unsigned char *readdata, unsigned char *commanddata)
+{
+	unsigned char answer;
+	int i;
+
+	// First 4 bytes are populated with converted address range 0000-13B0
+	address_encoder(address, commanddata);
+	// Last populate the 5th byte with the converted number of bytes
+	commanddata[4] = numberof_encoder(number);
+
+	for (i = 0; i < 4; i++)
+	{
+		if (write_device(ws2300, commanddata + i, 1) != 1)
+			return -1;
+		if (read_device_timeout(ws2300, &answer, 1,
+		                        link->timeout[TIMEOUT_ACK]) != 1)
+			return -1;
+		if (answer != command_check0123(commanddata + i, i))
+			return -1;
+	}
+
+	//Send the final command that asks for 'number' of bytes, check answer
+	if (write_device(ws2300, commanddata + 4, 1) != 1)
+		return -1;
+	if (read_device_timeout(ws2300, &answer, 1, link->timeout[TIMEOUT_ACK]) != 1)
+		return -1;
+	if (answer != command_check4(number))
+		return -1;
+
+	//Read the data bytes and the checksum under one deadline
+	if (read_device_timeout(ws2300, readdata, number,
+	                        link->timeout[TIMEOUT_DATA]) != number)
+		return -1;
+
+	//Read and verify checksum
+	if (read_device_timeout(ws2300, &answer, 1, link->timeout[TIMEOUT_ACK]) != 1)
+		return -1;
+	if (answer != data_checksum(readdata, number))
+		return -1;
+		
+	return number;
+
+}
+
+
+/********************************************************************
+ * read_data reads data from the WS2300 based on a given address,
+ * number of data read, and a an already open serial port
+ *
+ * Inputs:  serdevice - device number of the already open serial port
+ *          address (interger - 16 bit)
+ *          number - number of bytes to read, max value 15
+ *
+ * Output:  readdata - pointer to an array of chars containing
+ *                     the just read data, not zero terminated
+ *          commanddata - pointer to an array of chars containing
+ *                     the commands that were sent to the station
+ * 
+ * Returns: number of bytes read, -1 if failed
+ *
+ ********************************************************************/
+int read_data(WEATHERSTATION ws2300, int address, int number,
+			  unsigned char *readdata, unsigned char *commanddata)
+{
+	struct link_state *link = get_link_state(ws2300);
+	int ret;
+
+	if (link->client)
+	{
+		address_encoder(address, commanddata);
+		commanddata[4] = numberof_encoder(number);
+		if (link->client != CLIENT_DAEMON)
+			return -1;
+		return client_read(ws2300, address, number, readdata);
+	}
+
+	// A request too large for one burst goes lock-step, it is not a
+	// failure of the pipeline
+	if (link->transport_mode == TRANSPORT_PIPELINED &&
+	    number >= 1 && number <= MAXREADBYTES)
+	{
+		if (read_data_pipelined(ws2300, address, number, readdata,
+		                        commanddata) == number)
+		{
+			link->pipeline_fails = 0;
+			link_transaction_done(link, 1);
+			return number;
+		}
+
+		// The station may still be chewing on the burst. Get back in
+		// sync and retry the same transaction lock-step.
+		pipeline_failed(link);
+		reset_06(ws2300);
+	}
+
+	ret = read_data_lockstep(ws2300, link, address, number, readdata,
+	                         commanddata);
+	link_transaction_done(link, ret == number);
+
+	return ret;
+}
+
+
+/********************************************************************
+ * write_data_lockstep is the classic write transaction, one command
+ * byte per acknowledge. Same interface as write_data plus the link
+ * state for the timeouts.
+ ********************************************************************/
+static int write_data_lockstep(WEATHERSTATION ws2300, struct link_state *link,
+                               int address, int number,
+                               unsigned char encode_constant,
+                               unsigned char *writedata,
+                               unsigned char *commanddata)
+{
+	unsigned char answer;
+	unsigned char encoded_data[80];
+	int i = 0;
+	unsigned char ack_constant = WRITEACK;
+
+	if (encode_constant == SETBIT)
+	{
+		ack_constant = SETACK;
+	}
+	else if (encode_constant == UNSETBIT)
+	{
+		ack_constant = UNSETACK;
+	}
+
+	// First 4 bytes are populated with converted address range 0000-13XX
+	address_encoder(address, commanddata);
+	// populate the encoded_data array
+	data_encoder(number, encode_constant, writedata, encoded_data);
+
+	//Write the 4 address bytes
+	for (i = 0; i < 4; i++)
+	{
+		if (write_device(ws2300, commanddata + i, 1) != 1)
+			return -1;
+		if (read_device_timeout(ws2300, &answer, 1,
+		                        link->timeout[TIMEOUT_ACK]) != 1)
+			return -1;
+		if (answer != command_check0123(commanddata + i, i))
+			return -1;
+	}
+
+	//Write the data nibbles or set/unset the bits
+	for (i = 0; i < number; i++)
+	{
+		if (write_device(ws2300, encoded_data + i, 1) != 1)
+			return -1;
+		if (read_device_timeout(ws2300, &answer, 1,
+		                        link->timeout[TIMEOUT_ACK]) != 1)
+			return -1;
+		if (answer != (writedata[i] + ack_constant))
+			return -1;
+		commanddata[i + 4] = encoded_data[i];
+	}
+
+	return i;
+}
+
+
+/********************************************************************
+ * write_data writes data to the WS2300.
+ * It can both write nibbles and set/unset bits
+ *
+ * Inputs:      ws2300 - device number of the already open serial port
+ *              address (interger - 16 bit)
+ *              number - number of nibbles to be written/changed
+ *                       must 1 for bit modes (SETBIT and UNSETBIT)
+ *                       max 80 for nibble mode (WRITENIB)
+ *              encode_constant - unsigned char
+ *                                (SETBIT, UNSETBIT or WRITENIB)
+ *              writedata - pointer to an array of chars containing
+ *                          data to write, not zero terminated
+ *                          data must be in hex - one digit per byte
+ *                          If bit mode value must be 0-3 and only
+ *                          the first byte can be used.
+ * 
+ * Output:      commanddata - pointer to an array of chars containing
+ *                            the commands that were sent to the station
+ *
+ * Returns:     number of bytes written, -1 if failed
+ *
+ ********************************************************************/
+int write_data(WEATHERSTATION ws2300, int address, int number,
+			   unsigned char encode_constant, unsigned char *writedata,
+			   unsigned char *commanddata)
+{
+	struct link_state *link = get_link_state(ws2300);
+	int ret;
+
+	if (link->client)
+	{
+		address_encoder(address, commanddata);
+		if (link->client != CLIENT_DAEMON)
+			return -1;
+		ret = client_write(ws2300, address, number, encode_constant, writedata);
+		prefetch_discard(ws2300, address, number);
+		return ret;
+	}
+
+	if (link->transport_mode == TRANSPORT_PIPELINED &&
+	    number >= 1 && number <= MAXBURSTNIBBLES)
+	{
+		if (write_data_pipelined(ws2300, address, number, encode_constant,
+		                         writedata, commanddata) == number)
+		{
+			link->pipeline_fails = 0;
+			link_transaction_done(link, 1);
+			prefetch_discard(ws2300, address, number);
+			return number;
+		}
+
+		pipeline_failed(link);
+		reset_06(ws2300);
+	}
+	
+	ret = write_data_lockstep(ws2300, link, address, number, encode_constant,
+	                          writedata, commanddata);
+	link_transaction_done(link, ret == number);
+	prefetch_discard(ws2300, address, number);
+
+	return ret;
+}
+
+
+/********************************************************************
+ * read_data_pipelined reads data from the WS2300 like read_data but
+ * sends the 4 address bytes and the byte count as one burst and then
+ * collects the 5 acknowledges, the data and the checksum with as few
+ * reads as the device allows. This saves 8 of the 10 serial round
+ * trips a lock-step read costs.
+ *
+ * Inputs:  ws2300 - device number of the already open serial port
+ *          address (interger - 16 bit)
+ *          number - number of bytes to read, max value 15
+ *
+ * Output:  readdata - pointer to an array of chars containing
+ *                     the just read data, not zero terminated
+ *          commanddata - pointer to an array of chars containing
+ *                     the commands that were sent to the station
+ *
+ * Returns: number of bytes read, -1 if failed or any acknowledge
+ *          did not match. The caller must resync with reset_06
+ *          before sending anything else after a failure. A number
+ *          out of range gives -1 before anything is sent.
+ *
+ ********************************************************************/
+int read_data_pipelined(WEATHERSTATION ws2300, int address, int number,
+                        unsigned char *readdata, unsigned char *commanddata)
+{
+	struct link_state *link = get_link_state(ws2300);
+	unsigned char answer[MAXREADBYTES + 6];
+	int i;
+
+	if (number < 1 || number > MAXREADBYTES)
+		return -1;
+
+	address_encoder(address, commanddata);
+	commanddata[4] = numberof_encoder(number);
+
+	if (write_device(ws2300, commanddata, 5) != 5)
+		return -1;
+
+	// 4 address acks + byte count ack + data + checksum
+	if (read_device_burst(ws2300, answer, number + 6,
+	                      link->timeout[TIMEOUT_ACK] +
+	                      link->timeout[TIMEOUT_DATA]) != number + 6)
+		return -1;
+
+	for (i = 0; i < 4; i++)
+	{
+		if (answer[i] != command_check0123(commanddata + i, i))
+			return -1;
+	}
+
+	if (answer[4] != command_check4(number))
+		return -1;
+
+	memcpy(readdata, answer + 5, number);
+
+	if (answer[number + 5] != data_checksum(readdata, number))
+		return -1;
+
+	return number;
+}
+
+
+/********************************************************************
+ * write_data_pipelined writes data to the WS2300 like write_data
+ * but sends the address and all data nibbles as one burst and
+ * verifies all the acknowledges from one buffered read.
+ *
+ * Inputs:      ws2300 - device number of the already open serial port
+ *              address (interger - 16 bit)
+ *              number - number of nibbles to be written/changed
+ *                       must 1 for bit modes (SETBIT and UNSETBIT)
+ *                       max 15 for nibble mode (WRITENIB)
+ *              encode_constant - unsigned char
+ *                                (SETBIT, UNSETBIT or WRITENIB)
+ *              writedata - pointer to an array of chars containing
+ *                          data to write, not zero terminated
+ *
+ * Output:      commanddata - pointer to an array of chars containing
+ *                            the commands that were sent to the station
+ *
+ * Returns:     number of bytes written, -1 if failed. The caller must
+ *              resync with reset_06 after a failure.
+ *
+ ********************************************************************/
+int write_data_pipelined(WEATHERSTATION ws2300, int address, int number,
+                         unsigned char encode_constant, unsigned char *writedata,
+                         unsigned char *commanddata)
+{
+	struct link_state *link = get_link_state(ws2300);
+	unsigned char answer[MAXBURSTNIBBLES + 4];
+	unsigned char ack_constant = WRITEACK;
+	int i;
+
+	if (number < 1 || number > MAXBURSTNIBBLES)
+		return -1;
+
+	if (encode_constant == SETBIT)
+		ack_constant = SETACK;
+	else if (encode_constant == UNSETBIT)
+		ack_constant = UNSETACK;
+
+	address_encoder(address, commanddata);
+	data_encoder(number, encode_constant, writedata, commanddata + 4);
+
+	if (write_device(ws2300, commanddata, number + 4) != number + 4)
+		return -1;
+
+	if (read_device_burst(ws2300, answer, number + 4,
+	                      link->timeout[TIMEOUT_ACK] * 2) != number + 4)
+		return -1;
+
+	for (i = 0; i < 4; i++)
+	{
+		if (answer[i] != command_check0123(commanddata + i, i))
+			return -1;
+	}
+
+	for (i = 0; i < number; i++)
+	{
+		if (answer[i + 4] != (writedata[i] + ack_constant))
+			return -1;
+	}
+
+	return number;
+}
+
+
+/********************************************************************
+ * read_safe Read data, retry until success or maxretries
+ * Reads data from the WS2300 based on a given address,
+ * number of data read, and a an already open serial port
+ * Uses the read_data function and has same interface
+ * A reset_06 is only sent when the previous transaction on the
+ * handle failed or is older than the idle timeout.
+ *
+ * Inputs:  ws2300 - device number of the already open serial port
+ *          address (interger - 16 bit)
+ *          number - number of bytes to read, max value 15
+ *
+ * Output:  readdata - pointer to an array of chars containing
+ *                     the just read data, not zero terminated
+ *          commanddata - pointer to an array of chars containing
+ *                     the commands that were sent to the station
+ * 
+ * Returns: number of bytes read, -1 if failed
+ *
+ ********************************************************************/
+int read_safe(WEATHERSTATION ws2300, int address, int number,
+			  unsigned char *readdata, unsigned char *commanddata)
+{
+	struct link_state *link = get_link_state(ws2300);
+
+	if (prefetch_lookup(link, address, number, readdata) ||
+	    cache_lookup(link, address, number, readdata))
+	{
+		address_encoder(address, commanddata);
+		commanddata[4] = numberof_encoder(number);
+		return number;
+	}
+
+	return read_station_safe(ws2300, link, address, number, readdata,
+	                         commanddata);
+}
+
+
+/********************************************************************
+ * read_station_safe is read_safe without the prefetch and cache
+ * lookup. It always asks the station and refreshes the cache.
+ ********************************************************************/
+static int read_station_safe(WEATHERSTATION ws2300, struct link_state *link,
+                             int address, int number,
+                             unsigned char *readdata, unsigned char *commanddata)
+{
+	int j;
+
+	for (j = 0; j < MAXRETRIES; j++)
+	{
+		// Only resync if the last transaction failed or was long ago
+		link_resync(ws2300, link);
+		
+		// Read the data. If expected number of bytes read break out of loop.
+		if (read_data(ws2300, address, number, readdata, commanddata)==number)
+		{
+			break;
+		}
+	}
+
+	// If we have tried MAXRETRIES times to read we expect not to
+	// have valid data
+	if (j == MAXRETRIES)
+	{
+		return -1;
+	}
+
+	cache_store(link, address, 2 * number, readdata);
+
+	return number;
+}
+
+
+/********************************************************************
+ * write_safe Write data, retry until success or maxretries
+ * Writes data to the WS2300 based on a given address,
+ * number of data to write, and a an already open serial port
+ * Uses the write_data function and has same interface
+ * Resets the link only when needed, like read_safe.
+ *
+ * Inputs:      serdevice - device number of the already open serial port
+ *              address (interger - 16 bit)
+ *              number - number of nibbles to be written/changed
+ *                       must 1 for bit modes (SETBIT and UNSETBIT)
+ *                       unlimited for nibble mode (WRITENIB)
+ *              encode_constant - unsigned char
+ *                               (SETBIT, UNSETBIT or WRITENIB)
+ *              writedata - pointer to an array of chars containing
+ *                          data to write, not zero terminated
+ *                          data must be in hex - one digit per byte
+ *                          If bit mode value must be 0-3 and only
+ *                          the first byte can be used.
+ * 
+ * Output:      commanddata - pointer to an array of chars containing
+ *                            the commands that were sent to the station
+ * 
+ * Returns: number of bytes written, -1 if failed
+ *
+ ********************************************************************/
+int write_safe(WEATHERSTATION ws2300, int address, int number,
+               unsigned char encode_constant, unsigned char *writedata,
+               unsigned char *commanddata)
+{
+	struct link_state *link = get_link_state(ws2300);
+	int j;
 
 	for (j = 0; j < MAXRETRIES; j++)
 	{
-		reset_06(ws2300);
-		
-		// Read the data. If expected number of bytes read break out of loop.
-		if (read_data(ws2300, address, number, readdata, commanddata)==number)
+		// printf("Iteration = %d\n",j); // debug
+		link_resync(ws2300, link);
+
+		// Read the data. If expected number of bytes read break out of loop.
+		if (write_data(ws2300, address, number, encode_constant, writedata,
+		    commanddata)==number)
+		{
+			break;
+		}
+	}
+
+	// If we have tried MAXRETRIES times to read we expect not to
+	// have valid data
+	if (j == MAXRETRIES)
+	{
+		return -1;
+	}
+
+	return number;
+}
+
+
+
+/********************************************************************
+ * Read planning
+ *
+ * Many functions read overlapping or neighbouring windows of the
+ * station memory. read_planned takes all of them at once, marks the
+ * wanted nibbles in a map of the whole memory and covers them from
+ * the lowest address up, each read_data transaction starting at the
+ * first nibble not yet covered and spanning up to 15 bytes. Covering
+ * points with fixed length windows this way gives the smallest
+ * number of transactions.
+ *
+ * The nibbles read end up in a struct ws_snapshot. With PLAN_PREFETCH
+ * that image is kept with the handle and read_safe answers from it
+ * when the whole request is covered, so the ordinary functions can be
+ * used unchanged after one planned read. A snapshot taken with
+ * snapshot_take can be attached the same way with use_snapshot.
+ * Anything written to the station is dropped from the attached image.
+ *
+ ********************************************************************/
+
+/* The current values and min/max records of all sensors plus the
+ * station clock and the history pointers. One snapshot_take of these
+ * answers every function of the library except read_history_record.
+ */
+static struct read_request snapshot_regions[] =
+{
+	{0x23B, 12, NULL},    // station date and time
+	{0x26B,  2, NULL},    // tendency and forecast
+	{0x346, 35, NULL},    // temperature indoor with min/max
+	{0x373, 35, NULL},    // temperature outdoor with min/max
+	{0x3A0, 35, NULL},    // windchill with min/max
+	{0x3CE, 35, NULL},    // dewpoint with min/max
+	{0x3FB, 26, NULL},    // humidity indoor with min/max
+	{0x419, 26, NULL},    // humidity outdoor with min/max
+	{0x497, 22, NULL},    // rain 24h with max
+	{0x4B4, 22, NULL},    // rain 1h with max
+	{0x4D2, 16, NULL},    // rain total with time
+	{0x4EE, 30, NULL},    // wind min/max
+	{0x527, 12, NULL},    // wind speed and directions
+	{0x5D8,  6, NULL},    // absolute pressure
+	{0x5E2,  6, NULL},    // relative pressure
+	{0x5EC,  6, NULL},    // pressure correction
+	{0x5F6, 26, NULL},    // absolute pressure min/max
+	{0x600, 26, NULL},    // relative pressure min/max
+	{0x61E, 20, NULL},    // pressure min/max times
+	{0x6B2, 20, NULL}     // history interval, countdown and pointers
+};
+
+#define SNAPSHOT_REGIONS (sizeof(snapshot_regions) / sizeof(snapshot_regions[0]))
+
+
+/********************************************************************
+ * nibble_at returns nibble n of data packed as read_data returns it,
+ * low nibble first.
+ ********************************************************************/
+static int nibble_at(unsigned char *data, int n)
+{
+	return (n & 1) ? data[n >> 1] >> 4 : data[n >> 1] & 0xF;
+}
+
+
+/********************************************************************
+ * fill_snapshot plans and runs the transactions for a list of
+ * requests and stores every nibble read in snap. Nibbles already
+ * in snap that are not read again are left as they are.
+ *
+ * Returns: number of transactions, -1 on a bad request or read error
+ ********************************************************************/
+static int fill_snapshot(WEATHERSTATION ws2300, struct link_state *link,
+                         struct read_request *requests, int count,
+                         int dry_run, struct ws_snapshot *snap)
+{
+	unsigned char wanted[WS2300_MEMSIZE];
+	unsigned char data[MAXREADBYTES];
+	unsigned char command[25];
+	int transactions = 0;
+	int address, last, bytes;
+	int i, j;
+
+	memset(wanted, 0, sizeof(wanted));
+
+	for (i = 0; i < count; i++)
+	{
+		if (requests[i].address < 0 || requests[i].nibbles < 0 ||
+		    requests[i].address + requests[i].nibbles > WS2300_MEMSIZE)
+			return -1;
+
+		// Windows still fresh in the memory cache need no transaction
+		if (cache_copy(link, requests[i].address, requests[i].nibbles,
+		               dry_run ? NULL : snap))
+			continue;
+
+		memset(wanted + requests[i].address, 1, requests[i].nibbles);
+	}
+
+	for (address = 0; address < WS2300_MEMSIZE; address++)
+	{
+		if (!wanted[address])
+			continue;
+
+		// Stretch the transaction to the last wanted nibble in reach
+		last = address;
+		for (j = address; j < address + 2 * MAXREADBYTES &&
+		                  j < WS2300_MEMSIZE; j++)
+		{
+			if (wanted[j])
+				last = j;
+		}
+
+		bytes = (last - address + 2) / 2;
+		transactions++;
+
+		if (!dry_run)
+		{
+			if (read_station_safe(ws2300, link, address, bytes, data,
+			                      command) != bytes)
+				return -1;
+
+			for (j = 0; j < 2 * bytes && address + j < WS2300_MEMSIZE; j++)
+			{
+				snap->nibble[address + j] = nibble_at(data, j);
+				snap->valid[address + j] = 1;
+			}
+		}
+
+		address += 2 * bytes - 1;
+	}
+
+	return transactions;
+}
+
+
+/********************************************************************
+ * prefetch_lookup copies 'number' bytes from 'address' out of the
+ * snapshot attached to a link.
+ *
+ * Returns: 1 if every nibble was available, else 0 and readdata
+ *          is left untouched
+ ********************************************************************/
+static int prefetch_lookup(struct link_state *link, int address, int number,
+                           unsigned char *readdata)
+{
+	if (link->snapshot == NULL)
+		return 0;
+
+	return snapshot_read(link->snapshot, address, number, readdata) == number;
+}
+
+
+/********************************************************************
+ * prefetch_discard forgets nibbles of the snapshot attached to the
+ * handle and of the memory cache so the next read_safe of them goes
+ * to the station. Used
+ * after writes and when a value has to be read again, like an
+ * invalid wind reading.
+ *
+ * Input:   Handle to weatherstation
+ *          address - first nibble
+ *          nibbles - number of nibbles
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void prefetch_discard(WEATHERSTATION ws2300, int address, int nibbles)
+{
+	struct link_state *link = get_link_state(ws2300);
+	int i;
+
+	cache_discard(link, address, nibbles);
+
+	if (link->snapshot == NULL)
+		return;
+
+	for (i = address; i < address + nibbles; i++)
+	{
+		if (i >= 0 && i < WS2300_MEMSIZE)
+			link->snapshot->valid[i] = 0;
+	}
+
+	return;
+}
+
+
+/********************************************************************
+ * read_planned reads a list of memory windows with as few read_data
+ * transactions as possible and scatters the result back.
+ *
+ * Input:   Handle to weatherstation
+ *          requests - array of struct read_request. The windows may
+ *                     overlap and be given in any order.
+ *          count - number of requests
+ *          mode - PLAN_EXECUTE reads and fills requests[].data
+ *                 PLAN_DRY_RUN only counts the transactions
+ *                 PLAN_PREFETCH also keeps the nibbles for read_safe
+ *
+ * Output:  requests[].data - packed like read_data returns it
+ *                            (not touched in dry run or when NULL)
+ *
+ * Returns: number of transactions (planned or executed),
+ *          -1 if a request is outside the memory or a read failed
+ *
+ ********************************************************************/
+int read_planned(WEATHERSTATION ws2300, struct read_request *requests,
+                 int count, int mode)
+{
+	struct link_state *link = get_link_state(ws2300);
+	struct ws_snapshot *snap;
+	int transactions;
+	int i;
+
+	if ((snap = calloc(1, sizeof(struct ws_snapshot))) == NULL)
+		return -1;
+
+	transactions = fill_snapshot(ws2300, link, requests, count,
+	                             mode == PLAN_DRY_RUN, snap);
+
+	if (transactions < 0 || mode == PLAN_DRY_RUN)
+	{
+		free(snap);
+		return transactions;
+	}
+
+	snap->taken = time(NULL);
+	snap->transactions = transactions;
+
+	for (i = 0; i < count; i++)
+	{
+		if (requests[i].data != NULL)
+			snapshot_read_nibbles(snap, requests[i].address,
+			                      requests[i].nibbles, requests[i].data);
+	}
+
+	if (mode == PLAN_PREFETCH && link != &spare_link)
+	{
+		use_snapshot(ws2300, NULL);
+		link->snapshot = snap;
+		link->own_snapshot = 1;
+	}
+	else
+	{
+		free(snap);
+	}
+
+	return transactions;
+}
+
+
+/********************************************************************
+ * snapshot_take reads the current values and min/max records of all
+ * sensors into a snapshot in one planned pass, so they all belong to
+ * the same moment instead of being spread over 30 separate reads.
+ *
+ * Input:   Handle to weatherstation
+ *
+ * Output:  snap - pointer to struct ws_snapshot
+ *
+ * Returns: number of read_data transactions used, -1 if failed
+ *
+ ********************************************************************/
+int snapshot_take(WEATHERSTATION ws2300, struct ws_snapshot *snap)
+{
+	memset(snap->valid, 0, sizeof(snap->valid));
+
+	snap->transactions = fill_snapshot(ws2300, get_link_state(ws2300),
+	                                   snapshot_regions, SNAPSHOT_REGIONS,
+	                                   0, snap);
+	snap->taken = time(NULL);
+
+	return snap->transactions;
+}
+
+
+/********************************************************************
+ * use_snapshot makes read_safe answer from a snapshot whenever the
+ * requested bytes are in it, so every function of the library can be
+ * served from one snapshot_take without serial traffic.
+ * The snapshot must stay valid until it is detached again.
+ *
+ * Input:   Handle to weatherstation
+ *          snap - pointer to struct ws_snapshot, NULL to detach
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void use_snapshot(WEATHERSTATION ws2300, struct ws_snapshot *snap)
+{
+	struct link_state *link = get_link_state(ws2300);
+
+	if (link == &spare_link)
+		return;
+
+	if (link->own_snapshot)
+		free(link->snapshot);
+
+	link->snapshot = snap;
+	link->own_snapshot = 0;
+
+	return;
+}
+
+
+/********************************************************************
+ * adopt_snapshot is use_snapshot for a snapshot allocated with
+ * malloc that the library frees when the handle is closed or
+ * another snapshot is attached.
+ *
+ * Input:   Handle to weatherstation
+ *          snap - pointer to struct ws_snapshot from malloc
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void adopt_snapshot(WEATHERSTATION ws2300, struct ws_snapshot *snap)
+{
+	struct link_state *link = get_link_state(ws2300);
+
+	if (link == &spare_link)
+	{
+		free(snap);
+		return;
+	}
+
+	use_snapshot(ws2300, snap);
+	link->own_snapshot = 1;
+
+	return;
+}
+
+
+/********************************************************************
+ * snapshot_read copies bytes out of a snapshot exactly like read_data
+ * would have returned them from the station.
+ *
+ * Input:   snap - pointer to struct ws_snapshot
+ *          address - first nibble
+ *          number - number of bytes
+ *
+ * Output:  data - packed bytes, low nibble first
+ *
+ * Returns: number, or -1 if any nibble is not in the snapshot
+ *
+ ********************************************************************/
+int snapshot_read(struct ws_snapshot *snap, int address, int number,
+                  unsigned char *data)
+{
+	return snapshot_read_nibbles(snap, address, 2 * number, data) < 0 ?
+	       -1 : number;
+}
+
+
+/********************************************************************
+ * snapshot_read_nibbles is snapshot_read for an odd number of nibbles.
+ * The high half of the last byte is 0 then.
+ *
+ * Returns: nibbles, or -1 if any nibble is not in the snapshot
+ ********************************************************************/
+int snapshot_read_nibbles(struct ws_snapshot *snap, int address, int nibbles,
+                          unsigned char *data)
+{
+	int i;
+
+	if (address < 0 || address + nibbles > WS2300_MEMSIZE)
+		return -1;
+
+	for (i = 0; i < nibbles; i++)
+	{
+		if (!snap->valid[address + i])
+			return -1;
+	}
+
+	for (i = 0; i < nibbles; i += 2)
+	{
+		data[i / 2] = snap->nibble[address + i];
+		if (i + 1 < nibbles)
+			data[i / 2] |= snap->nibble[address + i + 1] << 4;
+	}
+
+	return nibbles;
+}
+
+
+/********************************************************************
+ * Decoding from a snapshot
+ *
+ * The functions below work on the nibble image only and never touch
+ * the station. Addresses are nibble addresses as in
+ * memory_map_2300.txt and values are returned in the station's own
+ * units (deg C, %, m/s, mm, hPa). A value whose nibbles are not in
+ * the snapshot decodes as 0.
+ *
+ ********************************************************************/
+
+/********************************************************************
+ * decode_bcd returns the BCD number of 'digits' nibbles starting at
+ * 'address', least significant digit first, with 'decimals' of them
+ * after the decimal point.
+ ********************************************************************/
+double decode_bcd(struct ws_snapshot *snap, int address, int digits,
+                  int decimals)
+{
+	double value = 0;
+	int i;
+
+	if (address < 0 || address + digits > WS2300_MEMSIZE)
+		return 0;
+
+	for (i = digits - 1; i >= 0; i--)
+		value = value * 10 + snap->nibble[address + i];
+
+	for (i = 0; i < decimals; i++)
+		value /= 10;
+
+	return value;
+}
+
+
+/********************************************************************
+ * decode_temperature - 4 BCD digits, 2 decimals, offset by 30 deg C
+ ********************************************************************/
+double decode_temperature(struct ws_snapshot *snap, int address)
+{
+	return decode_bcd(snap, address, 4, 2) - 30.0;
+}
+
+
+/********************************************************************
+ * decode_humidity - 2 BCD digits in %
+ ********************************************************************/
+int decode_humidity(struct ws_snapshot *snap, int address)
+{
+	return (int)decode_bcd(snap, address, 2, 0);
+}
+
+
+/********************************************************************
+ * decode_pressure - 5 BCD digits, 1 decimal, hPa
+ ********************************************************************/
+double decode_pressure(struct ws_snapshot *snap, int address)
+{
+	return decode_bcd(snap, address, 5, 1);
+}
+
+
+/********************************************************************
+ * decode_rain - 6 BCD digits, 2 decimals, mm
+ ********************************************************************/
+double decode_rain(struct ws_snapshot *snap, int address)
+{
+	return decode_bcd(snap, address, 6, 2);
+}
+
+
+/********************************************************************
+ * decode_timestamp - minute, hour, day, month, year as 2 BCD digits
+ * each, the layout used by all min/max records
+ ********************************************************************/
+void decode_timestamp(struct ws_snapshot *snap, int address,
+                      struct timestamp *time)
+{
+	time->minute = (int)decode_bcd(snap, address, 2, 0);
+	time->hour = (int)decode_bcd(snap, address + 2, 2, 0);
+	time->day = (int)decode_bcd(snap, address + 4, 2, 0);
+	time->month = (int)decode_bcd(snap, address + 6, 2, 0);
+	time->year = 2000 + (int)decode_bcd(snap, address + 8, 2, 0);
+}
+
+
+/********************************************************************
+ * decode_wind decodes the wind record at 0x527: speed in m/s as a
+ * 3 nibble binary number in tenths, and the current plus last five
+ * directions in 22.5 degree steps.
+ *
+ * Output:  winddir - 6 doubles in degrees (may be NULL)
+ *
+ * Returns: wind speed in m/s, -1 if the station marks it invalid
+ *
+ ********************************************************************/
+double decode_wind(struct ws_snapshot *snap, double *winddir)
+{
+	unsigned char *n = snap->nibble + 0x527;
+	int i;
+
+	if (n[0] != 0 || n[1] != 0 ||
+	    (n[2] == 0xF && n[3] == 0xF && (n[4] == 0 || n[4] == 1)))
+		return -1;
+
+	if (winddir != NULL)
+	{
+		for (i = 0; i < 6; i++)
+			winddir[i] = n[5 + i] * 22.5;
+	}
+
+	return ((n[4] << 8) + (n[3] << 4) + n[2]) / 10.0;
+}
+
+
+/********************************************************************
+ * Decoding by field descriptor
+ *
+ * field_table is generated from memory_map_2300.txt by mkfields2300
+ * and fields2300.h has a FIELD_ id for each entry. All encodings come
+ * down to a number of nibbles read most significant first in base 10
+ * (BCD, timestamps) or base 16 (binary, bit flags), then scaled and
+ * offset. Keeping the loops free of per-encoding branches lets the
+ * compiler unroll and vectorize them for a whole list of fields.
+ *
+ ********************************************************************/
+
+/********************************************************************
+ * decode_field decodes one field from its nibbles.
+ *
+ * Input:   nibbles - the field's first nibble, one nibble per byte
+ *          field - pointer to its descriptor
+ *
+ * Returns: value in the unit of the descriptor
+ *
+ ********************************************************************/
+double decode_field(const unsigned char *nibbles,
+                    const struct field_descriptor *field)
+{
+	double base = (field->encoding == FIELD_BCD ||
+	               field->encoding == FIELD_TIMESTAMP) ? 10 : 16;
+	double raw = 0;
+	int i;
+
+	for (i = field->nibbles - 1; i >= 0; i--)
+		raw = raw * base + nibbles[i];
+
+	return raw * field->scale + field->offset;
+}
+
+
+/********************************************************************
+ * decode_fields decodes a list of fields from a snapshot.
+ *
+ * Input:   snap - pointer to struct ws_snapshot
+ *          ids - array of FIELD_ ids, NULL for the whole field_table
+ *          count - number of ids (ignored when ids is NULL)
+ *
+ * Output:  values - one double per field, 0 for a field whose
+ *                   nibbles are not all in the snapshot
+ *
+ * Returns: number of fields that were in the snapshot
+ *
+ ********************************************************************/
+int decode_fields(struct ws_snapshot *snap, const int *ids, int count,
+                  double *values)
+{
+	const struct field_descriptor *field;
+	int found = 0;
+	int valid;
+	int i, j;
+
+	if (ids == NULL)
+		count = field_count;
+
+	for (i = 0; i < count; i++)
+	{
+		field = &field_table[ids == NULL ? i : ids[i]];
+
+		valid = 1;
+		for (j = 0; j < field->nibbles; j++)
+			valid &= snap->valid[field->address + j];
+
+		values[i] = valid ? decode_field(snap->nibble + field->address,
+		                                 field) : 0;
+		found += valid;
+	}
+
+	return found;
+}
+
+
+/********************************************************************
+ * find_field looks up a field by name, with or without the FIELD_
+ * prefix and in any case.
+ *
+ * Returns: FIELD_ id, -1 if there is no such field
+ *
+ ********************************************************************/
+int find_field(const char *name)
+{
+	int i;
+
+	if (strncasecmp(name, "FIELD_", 6) == 0)
+		name += 6;
+
+	for (i = 0; i < field_count; i++)
+	{
+		if (strcasecmp(name, field_table[i].name) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+
+/********************************************************************
+ * field_timestamp splits a decoded FIELD_TIMESTAMP value
+ * (YYMMDDhhmm) into a struct timestamp.
+ ********************************************************************/
+void field_timestamp(double value, struct timestamp *time)
+{
+	time->minute = (int)fmod(value, 100);
+	time->hour = (int)fmod(floor(value / 100), 100);
+	time->day = (int)fmod(floor(value / 10000), 100);
+	time->month = (int)fmod(floor(value / 1000000), 100);
+	time->year = 2000 + (int)floor(value / 100000000);
+}
+
+
+/* Current values decoded by snapshot_readings, in struct order */
+static const int reading_fields[] =
+{
+	FIELD_CURRENT_INDOOR_TEMPERATURE,
+	FIELD_CURRENT_OUTDOOR_TEMPERATURE,
+	FIELD_CURRENT_DEWPOINT,
+	FIELD_CURRENT_WINDCHILL,
+	FIELD_REL_HUMIDITY_INDOORS,
+	FIELD_REL_HUMIDITY_OUTDOORS,
+	FIELD_RAIN_1_HOUR,
+	FIELD_RAIN_24_HOUR,
+	FIELD_RAIN_TOTAL,
+	FIELD_RELATIVE_AIR_PRESSURE,
+	FIELD_ABSOLUTE_AIR_PRESSURE,
+	FIELD_TENDENCY,
+	FIELD_FORECAST
+};
+
+#define READING_FIELDS (sizeof(reading_fields) / sizeof(reading_fields[0]))
+
+
+/********************************************************************
+ * snapshot_readings decodes the current value of every sensor.
+ *
+ * Input:   snap - pointer to a snapshot filled by snapshot_take
+ *
+ * Output:  readings - pointer to struct ws_readings, station units
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void snapshot_readings(struct ws_snapshot *snap, struct ws_readings *readings)
+{
+	double value[READING_FIELDS];
+
+	decode_fields(snap, reading_fields, READING_FIELDS, value);
+
+	readings->taken = snap->taken;
+	readings->temperature_indoor = value[0];
+	readings->temperature_outdoor = value[1];
+	readings->dewpoint = value[2];
+	readings->windchill = value[3];
+	readings->humidity_indoor = (int)value[4];
+	readings->humidity_outdoor = (int)value[5];
+	readings->wind_speed = decode_wind(snap, readings->wind_direction);
+	readings->rain_1h = value[6];
+	readings->rain_24h = value[7];
+	readings->rain_total = value[8];
+	readings->rel_pressure = value[9];
+	readings->abs_pressure = value[10];
+	readings->tendency = (int)value[11];
+	readings->forecast = (int)value[12];
+}
+
+
+/********************************************************************
+ * Memory cache
+ *
+ * With the cache enabled every nibble read from the station is kept
+ * together with the time it was read, and read_safe and read_planned
+ * answer from it as long as the nibble is fresh. What fresh means
+ * depends on the region of memory: the clock changes every second,
+ * wind every few seconds, the other sensors every 15-30 seconds and
+ * the settings only when someone presses the buttons. The history
+ * records only change when the station saves a new one, which the
+ * countdown at 0x6B5 announces. Such regions use the countdown as a
+ * change hint instead of a time to live.
+ *
+ * Writes through write_data and prefetch_discard drop the nibbles
+ * concerned so a changed value is never served from the cache.
+ *
+ ********************************************************************/
+
+struct cache_region
+{
+	int start;                   // first nibble
+	int end;                     // first nibble after the region
+	int ttl;                     // seconds a read stays fresh, 0 = only the hint
+	int hint;                    // FIELD_ id counting down to the next change, -1 = none
+};
+
+static const struct cache_region cache_regions[] =
+{
+	{0x0000, 0x0200, 300, -1},   // settings and alarm flags
+	{0x0200, 0x0266,   1, -1},   // clock
+	{0x0266, 0x0346,  60, -1},   // tendency, forecast and alarm settings
+	{0x0346, 0x0497,  15, -1},   // temperatures and humidity
+	{0x0497, 0x0527,  30, -1},   // rain and wind min/max
+	{0x0527, 0x0533,   4, -1},   // wind speed and directions
+	{0x0533, 0x054D,  60, -1},   // wind alarm settings
+	{0x054D, 0x05D8,   1, -1},   // connection and countdown to next data
+	{0x05D8, 0x06B2,  15, -1},   // air pressure
+	{0x06B2, 0x06C6,  30, -1},   // history interval, countdown and pointers
+	{0x06C6, WS2300_MEMSIZE, 0, FIELD_COUNTDOWN_TO_NEXT_SAVING} // history records
+};
+
+#define CACHE_REGIONS (sizeof(cache_regions) / sizeof(cache_regions[0]))
+
+struct ws_cache
+{
+	unsigned char nibble[WS2300_MEMSIZE];
+	time_t fetched[WS2300_MEMSIZE];       // when the nibble was read, 0 = never
+	unsigned char region[WS2300_MEMSIZE]; // index into cache_regions
+	int ttl[CACHE_REGIONS];
+	int force;                            // bypass lookups, still store
+	struct cache_stats stats;
+};
+
+
+/********************************************************************
+ * cache_enable switches the memory cache of a station on or off.
+ * Switching it off forgets everything cached.
+ *
+ * Input:   Handle to weatherstation
+ *          on - 1 to cache, 0 to always read from the station
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void cache_enable(WEATHERSTATION ws, int on)
+{
+	struct link_state *link = get_link_state(ws);
+	struct ws_cache *cache;
+	int i, j;
+
+	if (!on || link == &spare_link)
+	{
+		free(link->cache);
+		link->cache = NULL;
+		return;
+	}
+
+	if (link->cache != NULL)
+		return;
+
+	if ((cache = calloc(1, sizeof(struct ws_cache))) == NULL)
+		return;
+
+	for (i = 0; i < (int)CACHE_REGIONS; i++)
+	{
+		cache->ttl[i] = cache_regions[i].ttl;
+		for (j = cache_regions[i].start; j < cache_regions[i].end; j++)
+			cache->region[j] = i;
+	}
+
+	link->cache = cache;
+
+	return;
+}
+
+
+/********************************************************************
+ * cache_set_ttl changes how long reads stay fresh in every cache
+ * region that overlaps the given nibbles. The cache must be enabled.
+ *
+ * Input:   Handle to weatherstation
+ *          address - first nibble
+ *          nibbles - number of nibbles
+ *          seconds - new time to live, 0 = never fresh unless the
+ *                    region has a change hint
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void cache_set_ttl(WEATHERSTATION ws, int address, int nibbles, int seconds)
+{
+	struct link_state *link = get_link_state(ws);
+	int i;
+
+	if (link->cache == NULL)
+		return;
+
+	for (i = 0; i < (int)CACHE_REGIONS; i++)
+	{
+		if (address < cache_regions[i].end &&
+		    address + nibbles > cache_regions[i].start)
+			link->cache->ttl[i] = seconds;
+	}
+
+	return;
+}
+
+
+/********************************************************************
+ * cache_force_refresh makes every read go to the station while
+ * force is set. What is read still refreshes the cache.
+ *
+ * Input:   Handle to weatherstation
+ *          force - 1 to bypass the cache, 0 to use it again
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void cache_force_refresh(WEATHERSTATION ws, int force)
+{
+	struct link_state *link = get_link_state(ws);
+
+	if (link->cache != NULL)
+		link->cache->force = force;
+
+	return;
+}
+
+
+/********************************************************************
+ * get_cache_stats returns the hit and miss counters of the cache.
+ * All zero when the cache is disabled.
+ *
+ * Input:   Handle to weatherstation
+ *
+ * Output:  stats - pointer to struct cache_stats
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void get_cache_stats(WEATHERSTATION ws, struct cache_stats *stats)
+{
+	struct link_state *link = get_link_state(ws);
+
+	if (link->cache != NULL)
+		*stats = link->cache->stats;
+	else
+		memset(stats, 0, sizeof(struct cache_stats));
+
+	return;
+}
+
+
+/********************************************************************
+ * cache_hint_until works out until when a region with a change hint
+ * stays the same. The hint is a countdown field read into the cache
+ * at 'since'. Countdowns in minutes are rounded up by the station,
+ * so one minute is taken off to be safe.
+ *
+ * Returns: time of the next change, 0 if the hint is not cached
+ ********************************************************************/
+static time_t cache_hint_until(struct ws_cache *cache, int id, time_t *since)
+{
+	const struct field_descriptor *field = &field_table[id];
+	double countdown;
+	int i;
+
+	*since = 0;
+	for (i = field->address; i < field->address + field->nibbles; i++)
+	{
+		if (cache->fetched[i] == 0)
+			return 0;
+		if (*since == 0 || cache->fetched[i] < *since)
+			*since = cache->fetched[i];
+	}
+
+	countdown = decode_field(cache->nibble + field->address, field);
+
+	if (strcmp(field->unit, "minutes") == 0)
+		countdown = (countdown - 1) * 60;
+
+	return *since + (time_t)countdown;
+}
+
+
+/********************************************************************
+ * cache_fresh tells if every nibble of a window can be served from
+ * the cache right now.
+ ********************************************************************/
+static int cache_fresh(struct ws_cache *cache, int address, int nibbles)
+{
+	time_t now = time(NULL);
+	time_t since = 0, until = 0;
+	int hint = -1;
+	int i, r;
+
+	if (cache->force || address < 0 || nibbles <= 0 ||
+	    address + nibbles > WS2300_MEMSIZE)
+		return 0;
+
+	for (i = address; i < address + nibbles; i++)
+	{
+		if (cache->fetched[i] == 0)
+			return 0;
+
+		r = cache->region[i];
+		if (cache->ttl[r] > 0 && now >= cache->fetched[i] &&
+		    now - cache->fetched[i] < cache->ttl[r])
+			continue;
+
+		if (cache_regions[r].hint < 0)
+			return 0;
+
+		if (cache_regions[r].hint != hint)
+		{
+			hint = cache_regions[r].hint;
+			until = cache_hint_until(cache, hint, &since);
+		}
+
+		// Read after the countdown and the change is still to come
+		if (until == 0 || cache->fetched[i] < since || now >= until)
+			return 0;
+	}
+
+	return 1;
+}
+
+
+/********************************************************************
+ * cache_lookup is the read_safe side of the cache. It copies
+ * 'number' bytes packed like read_data returns them.
+ *
+ * Returns: 1 if answered from the cache, else 0
+ ********************************************************************/
+static int cache_lookup(struct link_state *link, int address, int number,
+                        unsigned char *readdata)
+{
+	struct ws_cache *cache = link->cache;
+	int i;
+
+	if (cache == NULL)
+		return 0;
+
+	if (!cache_fresh(cache, address, 2 * number))
+	{
+		cache->stats.misses++;
+		return 0;
+	}
+
+	for (i = 0; i < number; i++)
+		readdata[i] = cache->nibble[address + 2 * i] |
+		              cache->nibble[address + 2 * i + 1] << 4;
+
+	cache->stats.hits++;
+
+	return 1;
+}
+
+
+/********************************************************************
+ * cache_copy is the read_planned side of the cache. It copies a
+ * window into a snapshot (when snap is not NULL).
+ *
+ * Returns: 1 if the window was fresh in the cache, else 0
+ ********************************************************************/
+static int cache_copy(struct link_state *link, int address, int nibbles,
+                      struct ws_snapshot *snap)
+{
+	struct ws_cache *cache = link->cache;
+
+	if (cache == NULL)
+		return 0;
+
+	if (!cache_fresh(cache, address, nibbles))
+	{
+		cache->stats.misses++;
+		return 0;
+	}
+
+	if (snap != NULL)
+	{
+		memcpy(snap->nibble + address, cache->nibble + address, nibbles);
+		memset(snap->valid + address, 1, nibbles);
+	}
+
+	cache->stats.hits++;
+
+	return 1;
+}
+
+
+/********************************************************************
+ * cache_store keeps nibbles just read from the station. data is
+ * packed like read_data returns it.
+ ********************************************************************/
+static void cache_store(struct link_state *link, int address, int nibbles,
+                        unsigned char *data)
+{
+	time_t now = time(NULL);
+	int i;
+
+	if (link->cache == NULL)
+		return;
+
+	for (i = 0; i < nibbles && address + i < WS2300_MEMSIZE; i++)
+	{
+		if (address + i < 0)
+			continue;
+		link->cache->nibble[address + i] = nibble_at(data, i);
+		link->cache->fetched[address + i] = now;
+	}
+
+	return;
+}
+
+
+/********************************************************************
+ * cache_discard forgets nibbles so they are read again
+ ********************************************************************/
+static void cache_discard(struct link_state *link, int address, int nibbles)
+{
+	int i;
+
+	if (link->cache == NULL)
+		return;
+
+	for (i = address; i < address + nibbles; i++)
+	{
+		if (i >= 0 && i < WS2300_MEMSIZE)
+			link->cache->fetched[i] = 0;
+	}
+
+	return;
+}
+
+
+/********************************************************************
+ * Daemon client
+ *
+ * A handle connected to ws2300d sends each read_data and write_data
+ * as one text line and waits for the one line answer:
+ *
+ *   READ aaaa n             ->  OK dddd...    n bytes in hex
+ *   WRITE aaaa n ee hhh...  ->  OK            n nibbles in hex
+ *
+ * Anything else than OK is an error. The daemon does the resets,
+ * retries and caching against the station itself.
+ *
+ ********************************************************************/
+
+/********************************************************************
+ * client_request sends one request line to ws2300d and reads the
+ * answer line without the newline.
+ *
+ * Returns: 1 if the answer starts with "OK", else 0
+ ********************************************************************/
+static int client_request(WEATHERSTATION ws2300, char *request,
+                          char *answer, int size)
+{
+	unsigned char c;
+	int length = 0;
+
+	if (write_device(ws2300, (unsigned char *)request, strlen(request)) < 0)
+		return 0;
+
+	while (read_device_timeout(ws2300, &c, 1, DAEMON_TIMEOUT) == 1)
+	{
+		if (c == '\n')
 		{
-			break;
+			answer[length] = '\0';
+			return strncmp(answer, "OK", 2) == 0;
 		}
+
+		if (length < size - 1)
+			answer[length++] = c;
 	}
 
-	// If we have tried MAXRETRIES times to read we expect not to
-	// have valid data
-	if (j == MAXRETRIES)
-	{
+	return 0;
+}
+
+
+/********************************************************************
+ * client_read is read_data for a ws2300d connection
+ ********************************************************************/
+static int client_read(WEATHERSTATION ws2300, int address, int number,
+                       unsigned char *readdata)
+{
+	char request[DAEMON_LINE];
+	char answer[DAEMON_LINE];
+	unsigned int byte;
+	int i;
+
+	sprintf(request, "READ %04X %d\n", address, number);
+
+	if (!client_request(ws2300, request, answer, sizeof(answer)) ||
+	    (int)strlen(answer) < 3 + 2 * number)
 		return -1;
+
+	for (i = 0; i < number; i++)
+	{
+		if (sscanf(answer + 3 + 2 * i, "%2x", &byte) != 1)
+			return -1;
+		readdata[i] = byte;
 	}
 
 	return number;
@@ -2962,56 +5291,292 @@ int read_safe(WEATHERSTATION ws2300, int address, int number,
 
 
 /********************************************************************
- * write_safe Write data, retry until success or maxretries
- * Writes data to the WS2300 based on a given address,
- * number of data to write, and a an already open serial port
- * Uses the write_data function and has same interface
- *
- * Inputs:      serdevice - device number of the already open serial port
- *              address (interger - 16 bit)
- *              number - number of nibbles to be written/changed
- *                       must 1 for bit modes (SETBIT and UNSETBIT)
- *                       unlimited for nibble mode (WRITENIB)
- *              encode_constant - unsigned char
- *                               (SETBIT, UNSETBIT or WRITENIB)
- *              writedata - pointer to an array of chars containing
- *                          data to write, not zero terminated
- *                          data must be in hex - one digit per byte
- *                          If bit mode value must be 0-3 and only
- *                          the first byte can be used.
- * 
- * Output:      commanddata - pointer to an array of chars containing
- *                            the commands that were sent to the station
- * 
- * Returns: number of bytes written, -1 if failed
+ * client_write is write_data for a ws2300d connection
+ ********************************************************************/
+static int client_write(WEATHERSTATION ws2300, int address, int number,
+                        unsigned char encode_constant, unsigned char *writedata)
+{
+	char request[DAEMON_LINE];
+	char answer[DAEMON_LINE];
+	int length;
+	int i;
+
+	if (number < 1 || number > 80)
+		return -1;
+
+	length = sprintf(request, "WRITE %04X %d %02X ", address, number,
+	                 encode_constant);
+	for (i = 0; i < number; i++)
+		request[length++] = "0123456789ABCDEF"[writedata[i] & 0xF];
+	request[length++] = '\n';
+	request[length] = '\0';
+
+	if (!client_request(ws2300, request, answer, sizeof(answer)))
+		return -1;
+
+	return number;
+}
+
+
+/********************************************************************
+ * Wind sampler
+ *
+ * The station marks the wind record at 0x527 invalid while it waits
+ * for the next reading from the wind sensor, which made wind_current
+ * and friends sleep 10 seconds per retry. With the sampler enabled a
+ * long running program such as ws2300d calls wind_sample at the
+ * update rate of the station. Every valid record goes into a ring of
+ * the last WIND_SAMPLES samples, from which wind_summary works out
+ * averages, gusts and the mean direction without touching the
+ * station, and the wind functions use the last valid record instead
+ * of waiting for a new one.
  *
  ********************************************************************/
-int write_safe(WEATHERSTATION ws2300, int address, int number,
-               unsigned char encode_constant, unsigned char *writedata,
-               unsigned char *commanddata)
+
+#define WIND_RADIANS (3.14159265358979 / 8)   // one direction step, as in mkderived2300.c
+
+struct wind_ring
 {
-	int j;
+	time_t time[WIND_SAMPLES];
+	unsigned short speed[WIND_SAMPLES];   // 0.1 m/s
+	unsigned char direction[WIND_SAMPLES];// 0-15, 22.5 degree steps
+	int next;                             // slot of the next sample
+	int count;                            // samples in the ring
+	unsigned char last[6];                // last valid record as read
+	time_t last_time;                     // when it was read, 0 = never
+};
 
-	for (j = 0; j < MAXRETRIES; j++)
+
+/********************************************************************
+ * wind_valid tells if the 3 or more bytes read at 0x527 hold a wind
+ * speed. The station writes 0 in the first byte and 0x1FF or 0x0FF
+ * into the speed while a reading is missing.
+ ********************************************************************/
+static int wind_valid(unsigned char *data)
+{
+	return data[0] == 0x00 &&
+	       !(data[1] == 0xFF && ((data[2] & 0xF) == 0 || (data[2] & 0xF) == 1));
+}
+
+
+/********************************************************************
+ * read_wind reads 3 or 6 bytes of the wind record at 0x527 for the
+ * wind functions. An invalid record is replaced by the last valid
+ * sample when the sampler has one. Otherwise it is read again every
+ * 10 seconds, up to MAXWINDRETRIES times.
+ ********************************************************************/
+static void read_wind(WEATHERSTATION ws2300, int bytes, unsigned char *data)
+{
+	struct link_state *link = get_link_state(ws2300);
+	unsigned char command[25];
+	int i;
+
+	for (i = 0; i < MAXWINDRETRIES; i++)
 	{
-		// printf("Iteration = %d\n",j); // debug
-		reset_06(ws2300);
+		if (read_safe(ws2300, 0x527, bytes, data, command) != bytes)
+			read_error_exit();
 
-		// Read the data. If expected number of bytes read break out of loop.
-		if (write_data(ws2300, address, number, encode_constant, writedata,
-		    commanddata)==number)
+		if (wind_valid(data))
+			return;
+
+		// A sampled record only while it is recent, a dead sensor
+		// must not be served as current wind
+		if (link->wind != NULL && link->wind->last_time != 0 &&
+		    time(NULL) - link->wind->last_time <= WIND_LAST_AGE)
 		{
-			break;
+			memcpy(data, link->wind->last, bytes);
+			return;
 		}
+
+		prefetch_discard(ws2300, 0x527, 2 * bytes);
+		sleep_long(10); //wait 10 seconds for new wind measurement
 	}
 
-	// If we have tried MAXRETRIES times to read we expect not to
-	// have valid data
-	if (j == MAXRETRIES)
+	return;
+}
+
+
+/********************************************************************
+ * wind_sampler_enable switches the wind sampler of a station on or
+ * off. Switching it off forgets all samples.
+ *
+ * Input:   Handle to weatherstation
+ *          on - 1 to keep samples, 0 to wait for valid wind data
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void wind_sampler_enable(WEATHERSTATION ws, int on)
+{
+	struct link_state *link = get_link_state(ws);
+
+	if (!on || link == &spare_link)
 	{
-		return -1;
+		free(link->wind);
+		link->wind = NULL;
+		return;
 	}
 
-	return number;
+	if (link->wind == NULL)
+		link->wind = calloc(1, sizeof(struct wind_ring));
+
+	return;
+}
+
+
+/********************************************************************
+ * wind_sample reads the wind record once, bypassing the cache, and
+ * adds it to the ring if it is valid. It never waits for the
+ * station to finish a wind reading.
+ *
+ * Input:   Handle to weatherstation
+ *
+ * Returns: 1 if a sample was added, 0 if the station marked the
+ *          record invalid, -1 if the sampler is off or the read failed
+ *
+ ********************************************************************/
+int wind_sample(WEATHERSTATION ws2300)
+{
+	struct link_state *link = get_link_state(ws2300);
+	struct wind_ring *ring = link->wind;
+	unsigned char data[6];
+	unsigned char command[25];
+
+	if (ring == NULL)
+		return -1;
+
+	prefetch_discard(ws2300, 0x527, 2 * sizeof(data));
+
+	if (read_safe(ws2300, 0x527, sizeof(data), data, command) != sizeof(data))
+		return -1;
+
+	if (!wind_valid(data))
+		return 0;
+
+	memcpy(ring->last, data, sizeof(data));
+	ring->last_time = time(NULL);
+
+	ring->time[ring->next] = ring->last_time;
+	ring->speed[ring->next] = ((data[2] & 0xF) << 8) + data[1];
+	ring->direction[ring->next] = data[2] >> 4;
+	ring->next = (ring->next + 1) % WIND_SAMPLES;
+	if (ring->count < WIND_SAMPLES)
+		ring->count++;
+
+	return 1;
+}
+
+
+/********************************************************************
+ * wind_last_valid gives the last valid wind record the sampler read
+ *
+ * Input:   Handle to weatherstation
+ *
+ * Output:  data - the 6 bytes read at 0x527
+ *
+ * Returns: time of the record, 0 if there is none
+ *
+ ********************************************************************/
+time_t wind_last_valid(WEATHERSTATION ws2300, unsigned char *data)
+{
+	struct wind_ring *ring = get_link_state(ws2300)->wind;
+
+	if (ring == NULL || ring->last_time == 0)
+		return 0;
+
+	memcpy(data, ring->last, sizeof(ring->last));
+
+	return ring->last_time;
 }
 
+
+/********************************************************************
+ * wind_summary works out the wind of the last 'seconds' seconds from
+ * the samples. The mean direction is the direction of the vector sum
+ * of all samples, each weighted by its speed, so that the mean of
+ * north-west and north-east is north and calm samples do not count.
+ * On a handle connected to ws2300d the daemon's sampler is asked.
+ *
+ * Input:   Handle to weatherstation
+ *          seconds - length of the window, e.g. 120 or 600
+ *          wind_speed_conv_factor controlling convertion to other
+ *             units than m/s
+ *
+ * Output:  summary - last sample, average, gust and mean direction
+ *
+ * Returns: number of samples in the window, -1 if there is no sampler
+ *
+ ********************************************************************/
+int wind_summary(WEATHERSTATION ws2300, int seconds,
+                 double wind_speed_conv_factor, struct wind_summary *summary)
+{
+	struct link_state *link = get_link_state(ws2300);
+	struct wind_ring *ring = link->wind;
+	char request[DAEMON_LINE];
+	char answer[DAEMON_LINE];
+	unsigned long last;
+	time_t since = time(NULL) - seconds;
+	double north = 0, east = 0;
+	double sum = 0;
+	int i, n, slot;
+
+	memset(summary, 0, sizeof(*summary));
+
+	if (link->client == CLIENT_DAEMON)
+	{
+		sprintf(request, "WIND %d\n", seconds);
+		if (!client_request(ws2300, request, answer, sizeof(answer)) ||
+		    sscanf(answer, "OK %d %lf %lf %lf %lf %lf %lu", &summary->samples,
+		           &summary->speed, &summary->direction, &summary->average,
+		           &summary->gust, &summary->mean_direction, &last) != 7)
+			return -1;
+
+		summary->last = last;
+		summary->speed *= wind_speed_conv_factor;
+		summary->average *= wind_speed_conv_factor;
+		summary->gust *= wind_speed_conv_factor;
+
+		return summary->samples;
+	}
+
+	if (ring == NULL)
+		return -1;
+
+	if (ring->last_time != 0)
+	{
+		summary->speed = (((ring->last[2] & 0xF) << 8) + ring->last[1]) / 10.0;
+		summary->direction = (ring->last[2] >> 4) * 22.5;
+		summary->last = ring->last_time;
+	}
+
+	for (i = 0, n = 0; i < ring->count; i++)
+	{
+		slot = (ring->next - 1 - i + WIND_SAMPLES) % WIND_SAMPLES;
+		if (ring->time[slot] < since)
+			break;
+
+		sum += ring->speed[slot];
+		if (ring->speed[slot] > summary->gust)
+			summary->gust = ring->speed[slot];
+		north += ring->speed[slot] * wind_north_table[ring->direction[slot]];
+		east += ring->speed[slot] * wind_east_table[ring->direction[slot]];
+		n++;
+	}
+
+	summary->samples = n;
+	summary->speed *= wind_speed_conv_factor;
+
+	if (n == 0)
+		return 0;
+
+	summary->average = sum / n / 10.0 * wind_speed_conv_factor;
+	summary->gust = summary->gust / 10.0 * wind_speed_conv_factor;
+
+	if (north != 0 || east != 0)
+		summary->mean_direction = fmod(atan2(east, north) * 22.5 / WIND_RADIANS
+		                               + 360, 360);
+	else
+		summary->mean_direction = summary->direction;
+
+	return n;
+}
@@ -25,6 +25,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include "fields2300.h"
+
 #define MAXRETRIES          50
 #define MAXWINDRETRIES      20
 #define WRITENIB            0x42
@@ -35,6 +37,45 @@
 #define UNSETACK            0x0C
 #define RESET_MIN           0x01
 #define RESET_MAX           0x02
+#define MAXPIPELINEFAILS    3
+#define MAXLINKS            4
+
+#define TRANSPORT_LOCKSTEP  0
+#define TRANSPORT_PIPELINED 1
+
+#define TIMEOUT_ACK         0      // waiting for the acknowledge of a command byte
+#define TIMEOUT_DATA        1      // waiting for the data bytes and checksum
+#define TIMEOUT_RESET       2      // waiting for the answer to a 0x06 reset
+#define DEFAULT_TIMEOUT_ACK   250  // milliseconds
+#define DEFAULT_TIMEOUT_DATA  500
+#define DEFAULT_TIMEOUT_RESET 100
+#define DEFAULT_IDLE_TIMEOUT  5    // seconds before a synchronized link is reset anyway
+#define DEFAULT_DAEMON_POLL   10   // seconds between two polls of ws2300d
+#define DAEMON_TIMEOUT      60000  // ms a client waits for an answer from ws2300d
+#define DAEMON_LINE         512    // longest request or answer line of ws2300d
+#define CLIENT_NONE         0      // handle is a serial port
+#define CLIENT_DAEMON       1      // handle is a connection to ws2300d
+#define CLIENT_PUBLICATION  2      // handle reads a snapshot published by ws2300d
+#define PUBLISH_MAGIC       0x33325357  // "WS23" in a ws_publication file
+#define WIND_SAMPLES        600    // samples kept by the wind sampler
+#define WIND_SAMPLE_INTERVAL 2     // seconds between two wind samples of ws2300d
+#define WIND_LAST_AGE       (15 * WIND_SAMPLE_INTERVAL) // s a sampled wind record stands in for an invalid one
+
+#define WS2300_MEMSIZE      0x13D0 // nibbles of station memory
+#define HISTORY_START       0x6C6  // first history record
+#define HISTORY_RECORD_NIBBLES 19  // history records lie back to back
+#define HISTORY_RECORDS     0xAF   // records in the history ring
+#define HISTORY_DATA_BYTES  10     // bytes of a record that hold the values
+#define MAXREADBYTES        15     // largest read_data transaction
+#define MAXBURSTNIBBLES     15     // largest write_data_pipelined burst
+#define PLAN_EXECUTE        0      // read_planned: read and scatter
+#define PLAN_DRY_RUN        1      // read_planned: only count transactions
+#define PLAN_PREFETCH       2      // read_planned: also serve read_safe from result
+
+#define FIELD_BCD           0      // field_descriptor encodings
+#define FIELD_BINARY        1
+#define FIELD_BITS          2
+#define FIELD_TIMESTAMP     3      // 10 BCD nibbles decoded as YYMMDDhhmm
 
 #define METERS_PER_SECOND   1.0
 #define KILOMETERS_PER_HOUR 3.6
@@ -61,6 +102,15 @@ typedef struct {
 	int port;
 } hostdata;
 
+#define MAX_HISTORY_SINKS   8
+#define DEFAULT_HISTORY_QUEUE 32   // rows a history sink stores at a time
+
+typedef struct {
+	char type[10];                     //text, csv, sqlite, mysql or pgsql
+	char target[256];                  //file name or table name
+	char cursor[256];                  //cursor file, "" for target.cursor
+} sinkdata;
+
 struct config_type
 {
 	char   serial_device_name[50];
@@ -84,6 +134,134 @@ struct config_type
 	char   pgsql_connect[128];
 	char   pgsql_table[25];
 	char   pgsql_station[25];
+	int    pgsql_batch;                //rows per COPY of pgsql2300 with an interval
+	int    pgsql_flush;                //seconds a row may wait, 0 = no limit
+	char   sqlite_journal_mode[10];    //"" = leave as is, delete, wal, ...
+	char   sqlite_synchronous[10];     //"" = leave as is, off, normal, full, extra
+	int    sqlite_ignore_duplicates;   //1=INSERT OR IGNORE records already stored
+	int    transport_mode;             //0=lock-step, 1=pipelined command framing
+	int    timeout_ack;                //milliseconds to wait for a command acknowledge
+	int    timeout_data;               //milliseconds to wait for data and checksum
+	int    timeout_reset;              //milliseconds to wait for the reset answer
+	int    idle_timeout;               //seconds a link stays trusted without traffic
+	int    cache;                      //1=serve repeated reads from the memory cache
+	char   daemon_socket[108];         //Unix socket of ws2300d, "" for none
+	int    daemon_poll;                //seconds between ws2300d polls
+	char   publish_file[256];          //ws2300d publishes snapshots here, "" for none
+	char   log_store[256];             //log2300 also appends to this store, "" for none
+	int    log_index;                  //lines per entry of the index of text logs, 0 = none
+	int    rollup;                     //1 = keep hourly, daily and monthly rollups of the logs
+	sinkdata history_sink[MAX_HISTORY_SINKS]; // stores fed by histsync2300
+	int    num_history_sinks;
+	int    history_queue;              //rows queued per history sink
+};
+
+struct read_request
+{
+	int address;                       //first nibble address
+	int nibbles;                       //number of nibbles wanted
+	unsigned char *data;               //(nibbles+1)/2 bytes packed like read_data, may be NULL
+};
+
+struct ws_snapshot
+{
+	time_t taken;                      //when the bulk read finished
+	int    transactions;               //read_data transactions it took
+	unsigned char nibble[WS2300_MEMSIZE]; //station memory, one nibble per byte
+	unsigned char valid[WS2300_MEMSIZE];  //1 where nibble[] holds read data
+};
+
+struct field_descriptor
+{
+	int    address;                    //first nibble, least significant
+	int    nibbles;
+	int    encoding;                   //FIELD_BCD, FIELD_BINARY, ...
+	double scale;                      //value = raw * scale + offset
+	double offset;
+	const char *unit;                  //station unit, "" if none
+	const char *name;                  //FIELD_ id without the prefix
+	const char *description;           //as in memory_map_2300.txt
+};
+
+/* Layout of the file ws2300d publishes the latest snapshot in. The
+ * sequence is odd while the snapshot is being rewritten. */
+struct ws_publication
+{
+	unsigned int magic;                //PUBLISH_MAGIC
+	volatile unsigned int sequence;    //0 until the first snapshot
+	struct ws_snapshot snapshot;
+};
+
+struct ws_readings
+{
+	time_t taken;
+	double temperature_indoor;         //deg C
+	double temperature_outdoor;
+	double dewpoint;
+	double windchill;
+	int    humidity_indoor;            //%
+	int    humidity_outdoor;
+	double wind_speed;                 //m/s, -1 if the station marked it invalid
+	double wind_direction[6];          //degrees, current and last 5
+	double rain_1h;                    //mm
+	double rain_24h;
+	double rain_total;
+	double rel_pressure;               //hPa
+	double abs_pressure;
+	int    tendency;                   //0=Steady, 1=Rising, 2=Falling
+	int    forecast;                   //0=Rainy, 1=Cloudy, 2=Sunny
+};
+
+struct link_stats
+{
+	unsigned long transactions;        //successful read_data/write_data calls
+	unsigned long failures;            //failed read_data/write_data calls
+	unsigned long resets_issued;       //reset_06 sent by read_safe/write_safe
+	unsigned long resets_avoided;      //reset_06 skipped because the link was in sync
+};
+
+struct cache_stats
+{
+	unsigned long hits;                //reads answered from the cache
+	unsigned long misses;              //reads that had to go to the station
+};
+
+struct history_raw
+{
+	int record;                        //index in the ring, 0x00-0xAE
+	unsigned char nibble[HISTORY_RECORD_NIBBLES]; //one nibble per byte
+};
+
+struct history_columns
+{
+	double *temperature_indoor;        //arrays of one value per record
+	double *temperature_outdoor;
+	double *pressure;
+	int    *humidity_indoor;
+	int    *humidity_outdoor;
+	double *raincount;
+	double *windspeed;
+	double *winddir_degrees;
+	double *dewpoint;
+	double *windchill;
+};
+
+struct history_cursor
+{
+	int record;                        //ring index of the last record stored, -1 = none
+	time_t time;                       //station time of that record
+	int interval;                      //history interval in minutes when it was written
+};
+
+struct wind_summary
+{
+	int samples;                       //valid samples in the window
+	double speed;                      //last valid sample
+	double direction;                  //its direction in degrees
+	double average;                    //mean speed over the window
+	double gust;                       //highest sample in the window
+	double mean_direction;             //vector mean direction in degrees
+	time_t last;                       //time of the last valid sample, 0 = none
 };
 
 struct timestamp
@@ -251,6 +429,35 @@ int read_history_record(WEATHERSTATION ws2300,
                         double *dewpoint,
                         double *windchill);
                         
+int read_history_bulk(WEATHERSTATION ws2300, int first, int count,
+                      struct history_raw *records);
+
+int decode_history_record(struct history_raw *raw,
+                          struct config_type *config,
+                          double *temperature_indoor,
+                          double *temperature_outdoor,
+                          double *pressure,
+                          int *humidity_indoor,
+                          int *humidity_outdoor,
+                          double *raincount,
+                          double *windspeed,
+                          double *winddir_degrees,
+                          double *dewpoint,
+                          double *windchill);
+
+void history_raw_pack(struct history_raw *raw, int count, unsigned char *data);
+
+void decode_history_batch(unsigned char *data, int count,
+                          struct config_type *config,
+                          struct history_columns *columns);
+
+int history_cursor_load(char *path, struct history_cursor *cursor);
+
+int history_cursor_save(char *path, struct history_cursor *cursor);
+
+int history_pending(WEATHERSTATION ws2300, struct history_cursor *cursor,
+                    int *first, time_t *times);
+
 void light(WEATHERSTATION ws2300, int control);
 
 
@@ -268,6 +475,20 @@ WEATHERSTATION open_weatherstation(char *device);
 
 void close_weatherstation(WEATHERSTATION ws);
 
+void configure_weatherstation(WEATHERSTATION ws, struct config_type *config);
+
+void set_transport_mode(WEATHERSTATION ws, int mode);
+
+void set_link_timeouts(WEATHERSTATION ws, int ack_ms, int data_ms, int reset_ms);
+
+int get_link_timeout(WEATHERSTATION ws, int which);
+
+void set_idle_timeout(WEATHERSTATION ws, int seconds);
+
+void get_link_stats(WEATHERSTATION ws, struct link_stats *stats);
+
+void release_link_state(WEATHERSTATION ws);
+
 void address_encoder(int address_in, unsigned char *address_out);
 
 void data_encoder(int number, unsigned char encode_constant,
@@ -288,10 +509,17 @@ void reset_06(WEATHERSTATION ws2300);
 int read_data(WEATHERSTATION ws2300, int address, int number,
 			  unsigned char *readdata, unsigned char *commanddata);
 
+int read_data_pipelined(WEATHERSTATION ws2300, int address, int number,
+			  unsigned char *readdata, unsigned char *commanddata);
+
 int write_data(WEATHERSTATION ws2300, int address, int number,
 			   unsigned char encode_constant, unsigned char *writedata,
 			   unsigned char *commanddata);
 
+int write_data_pipelined(WEATHERSTATION ws2300, int address, int number,
+			   unsigned char encode_constant, unsigned char *writedata,
+			   unsigned char *commanddata);
+
 int read_safe(WEATHERSTATION ws2300, int address, int number,
 			  unsigned char *readdata, unsigned char *commanddata);
 			  
@@ -299,13 +527,94 @@ int write_safe(WEATHERSTATION ws2300, int address, int number,
 			   unsigned char encode_constant, unsigned char *writedata,
 			   unsigned char *commanddata);
 
+void set_client_mode(WEATHERSTATION ws, int mode);
+
+int get_client_mode(WEATHERSTATION ws);
+
+void cache_enable(WEATHERSTATION ws, int on);
+
+void cache_set_ttl(WEATHERSTATION ws, int address, int nibbles, int seconds);
+
+void cache_force_refresh(WEATHERSTATION ws, int force);
+
+void get_cache_stats(WEATHERSTATION ws, struct cache_stats *stats);
+
+void wind_sampler_enable(WEATHERSTATION ws, int on);
+
+int wind_sample(WEATHERSTATION ws2300);
+
+time_t wind_last_valid(WEATHERSTATION ws2300, unsigned char *data);
+
+int wind_summary(WEATHERSTATION ws2300, int seconds,
+                 double wind_speed_conv_factor, struct wind_summary *summary);
+
+int read_planned(WEATHERSTATION ws2300, struct read_request *requests,
+                 int count, int mode);
+
+void prefetch_discard(WEATHERSTATION ws2300, int address, int nibbles);
+
+int snapshot_take(WEATHERSTATION ws2300, struct ws_snapshot *snap);
+
+void use_snapshot(WEATHERSTATION ws2300, struct ws_snapshot *snap);
+
+void adopt_snapshot(WEATHERSTATION ws2300, struct ws_snapshot *snap);
+
+int snapshot_read(struct ws_snapshot *snap, int address, int number,
+                  unsigned char *data);
+
+int snapshot_read_nibbles(struct ws_snapshot *snap, int address, int nibbles,
+                          unsigned char *data);
+
+void snapshot_readings(struct ws_snapshot *snap, struct ws_readings *readings);
+
+double decode_bcd(struct ws_snapshot *snap, int address, int digits,
+                  int decimals);
+
+double decode_temperature(struct ws_snapshot *snap, int address);
+
+int decode_humidity(struct ws_snapshot *snap, int address);
+
+double decode_pressure(struct ws_snapshot *snap, int address);
+
+double decode_rain(struct ws_snapshot *snap, int address);
+
+void decode_timestamp(struct ws_snapshot *snap, int address,
+                      struct timestamp *time);
+
+double decode_wind(struct ws_snapshot *snap, double *winddir);
+
+double decode_field(const unsigned char *nibbles,
+                    const struct field_descriptor *field);
+
+int decode_fields(struct ws_snapshot *snap, const int *ids, int count,
+                  double *values);
+
+int find_field(const char *name);
+
+void field_timestamp(double value, struct timestamp *time);
+
+extern const struct field_descriptor field_table[];
+extern const int field_count;
+
 
 /* Platform dependent functions */
 int read_device(WEATHERSTATION serdevice, unsigned char *buffer, int size);
+int read_device_timeout(WEATHERSTATION serdevice, unsigned char *buffer,
+                        int size, int timeout_ms);
+int read_device_burst(WEATHERSTATION serdevice, unsigned char *buffer,
+                      int size, int timeout_ms);
 int write_device(WEATHERSTATION serdevice, unsigned char *buffer, int size);
 void sleep_short(int milliseconds);
 void sleep_long(int seconds);
 int http_request_url(char *urlline);
+int replace_file(char *from, char *to);
+int flush_file(FILE *file);
+void *map_file(char *path, long *size);
+void unmap_file(void *map, long size);
+void set_daemon_socket(char *path);
+int publish_snapshot(char *path, struct ws_snapshot *snap);
+int read_publication(char *path, struct ws_snapshot *snap);
+int open_publication(char *path, int max_age, WEATHERSTATION *ws);
 int citizen_weather_send(struct config_type *config, char *datastring);
 
 #endif /* _INCLUDE_RW2300_H_ */ 
@@ -0,0 +1,648 @@
+/*  open2300 - sink2300.c
+ *
+ *  Version 1.11
+ *
+ *  History ingestion engine. The new history records are read from
+ *  the station once and handed to every configured store (sink).
+ *  The text, CSV and store file sinks live here, the database sinks in
+ *  sinksqlite2300.c, sinkmysql2300.c and sinkpgsql2300.c.
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#include "sink2300.h"
+#include "store2300.h"
+#include "logindex2300.h"
+#include "out2300.h"
+
+#define LINES_SIZE 16384                // text buffered for a write
+#define LINE_SIZE  300                  // longest line written
+
+const char *sink_directions[16] = {"N","NNE","NE","ENE","E","ESE","SE","SSE",
+                                   "S","SSW","SW","WSW","W","WNW","NW","NNW"};
+
+static const struct sink_ops *sink_types[] =
+{
+	&sink_text,
+	&sink_csv,
+	&sink_store,
+#ifdef WITH_SQLITE
+	&sink_sqlite,
+#endif
+#ifdef WITH_MYSQL
+	&sink_mysql,
+#endif
+#ifdef WITH_PGSQL
+	&sink_pgsql,
+#endif
+	NULL
+};
+
+
+/********************************************************************
+ * last_line_time
+ * Read the time at the start of the last line of a log file
+ *
+ * Input:  fileptr - the file, opened for reading
+ *         format - sscanf format of year, month, day, hour, minute
+ *
+ * Output: last - the time, 0 if the file is empty or the line does
+ *                not start with a time
+ *
+ * Returns: 1 if a time was found, 0 if not
+ *
+ ********************************************************************/
+static int last_line_time(FILE *fileptr, const char *format, time_t *last)
+{
+	char buffer[1024];
+	struct tm time_tm;
+	char *line;
+	long size;
+	int length;
+
+	*last = 0;
+
+	if (fseek(fileptr, 0L, SEEK_END) < 0 || (size = ftell(fileptr)) <= 0)
+		return 0;
+
+	length = size < (long)sizeof(buffer) - 1 ? (int)size : (int)sizeof(buffer) - 1;
+	if (fseek(fileptr, -length, SEEK_END) < 0)
+		return 0;
+	length = fread(buffer, 1, length, fileptr);
+	buffer[length] = '\0';
+
+	while (length > 0 && (buffer[length - 1] == '\n' || buffer[length - 1] == '\r'))
+		buffer[--length] = '\0';
+
+	line = buffer + length;
+	while (line > buffer && line[-1] != '\n' && line[-1] != '\r')
+		line--;
+
+	memset(&time_tm, 0, sizeof(time_tm));
+	if (sscanf(line, format, &time_tm.tm_year, &time_tm.tm_mon,
+	           &time_tm.tm_mday, &time_tm.tm_hour, &time_tm.tm_min) != 5)
+		return 0;
+
+	time_tm.tm_year -= 1900;
+	time_tm.tm_mon -= 1;
+	time_tm.tm_isdst = -1;
+	*last = mktime(&time_tm);
+
+	return 1;
+}
+
+
+/********************************************************************
+ * write_lines
+ * Append one line per record to a text or CSV log: the time, then the
+ * values separated by separator
+ *
+ * Input:  fileptr - the log
+ *         rows - the records
+ *         count - number of records
+ *         time_format - strftime format of the time
+ *         separator - between the fields
+ *         end - after the last field, with the newline
+ *
+ * Returns: number of records written. After a write error the log is
+ *          cut back to the end of the last lines written whole.
+ *
+ ********************************************************************/
+static int write_lines(FILE *fileptr, struct history_row *rows, int count,
+                       const char *time_format, char separator, const char *end)
+{
+	char outdata[LINES_SIZE];
+	struct out_buffer out;
+	struct history_row *row;
+	long size;
+	int written = 0;
+	int i;
+
+	if (fseek(fileptr, 0L, SEEK_END) != 0 || (size = ftell(fileptr)) < 0)
+		return 0;
+
+	out_init(&out, outdata, sizeof(outdata));
+
+	for (i = 0; i < count; i++)
+	{
+		row = &rows[i];
+
+		out_time(&out, time_format, row->time);
+		out_char(&out, separator);
+		out_fixed(&out, row->temperature_in, 1);
+		out_char(&out, separator);
+		out_fixed(&out, row->temperature_out, 1);
+		out_char(&out, separator);
+		out_fixed(&out, row->dewpoint, 1);
+		out_char(&out, separator);
+		out_int(&out, row->humidity_in);
+		out_char(&out, separator);
+		out_int(&out, row->humidity_out);
+		out_char(&out, separator);
+		out_fixed(&out, row->windspeed, 1);
+		out_char(&out, separator);
+		out_fixed(&out, row->winddir_degrees, 1);
+		out_char(&out, separator);
+		out_text(&out, sink_directions[(int)(row->winddir_degrees / 22.5)]);
+		out_char(&out, separator);
+		out_fixed(&out, row->windchill, 1);
+		out_char(&out, separator);
+		out_fixed(&out, row->rain, 2);
+		out_char(&out, separator);
+		out_fixed(&out, row->pressure, 3);
+		out_text(&out, end);
+
+		// The file is unbuffered, each write goes out whole or fails
+		if (out.size - out.length < LINE_SIZE || i == count - 1)
+		{
+			if (out_write(&out, fileptr) < 0)
+			{
+				clearerr(fileptr);
+#ifdef WIN32
+				_chsize(fileno(fileptr), size);
+#else
+				if (ftruncate(fileno(fileptr), size) < 0)
+					fprintf(stderr, "Cannot cut back a partial line\n");
+#endif
+				return written;
+			}
+			size += out.length;
+			written = i + 1;
+			out_init(&out, outdata, sizeof(outdata));
+		}
+	}
+
+	return written;
+}
+
+
+/********************************************************************
+ * file_rollup keeps the rollups of a file sink in the files
+ * target.rollup-hour, -day and -month (rollup2300.c)
+ ********************************************************************/
+static int file_rollup(struct history_sink *sink, struct rollup_store *store)
+{
+	return rollup_open_files(store, sink->target);
+}
+
+
+/********************************************************************
+ * Text sink, the log format of histlog2300
+ ********************************************************************/
+
+static int text_open(struct history_sink *sink, struct config_type *config)
+{
+	sink->log_index = config->log_index;
+
+	if ((sink->handle = fopen(sink->target, "ab+")) == NULL)
+		return -1;
+
+	// write_lines buffers the lines itself
+	setvbuf(sink->handle, NULL, _IONBF, 0);
+
+	return 0;
+}
+
+static int text_last_time(struct history_sink *sink, time_t *last)
+{
+	return last_line_time(sink->handle, "%4d%2d%2d%2d%2d", last);
+}
+
+static int text_write(struct history_sink *sink, struct history_row *rows,
+                      int count)
+{
+	int written;
+
+	written = write_lines(sink->handle, rows, count,
+	                      "%Y%m%d%H%M%S %Y-%b-%d %H:%M:%S", ' ', " \n");
+
+	if (written > 0 && log_index_update(sink->target, sink->log_index) < 0)
+		fprintf(stderr, "Cannot write file %s.idx\n", sink->target);
+
+	return written;
+}
+
+static void text_close(struct history_sink *sink)
+{
+	fclose(sink->handle);
+}
+
+const struct sink_ops sink_text =
+{
+	"text", text_open, text_last_time, text_write, text_close, file_rollup
+};
+
+
+/********************************************************************
+ * CSV sink, one header line and one line per record
+ ********************************************************************/
+
+static int csv_open(struct history_sink *sink, struct config_type *config)
+{
+	FILE *fileptr;
+
+	if ((fileptr = fopen(sink->target, "ab+")) == NULL)
+		return -1;
+
+	// write_lines buffers the lines itself
+	setvbuf(fileptr, NULL, _IONBF, 0);
+
+	fseek(fileptr, 0L, SEEK_END);
+	if (ftell(fileptr) == 0)
+		fprintf(fileptr, "time,temperature_in,temperature_out,dewpoint,"
+		        "humidity_in,humidity_out,wind_speed,wind_angle,"
+		        "wind_direction,wind_chill,rain_total,rel_pressure\n");
+
+	sink->handle = fileptr;
+
+	return fflush(fileptr) == 0 ? 0 : -1;
+}
+
+static int csv_last_time(struct history_sink *sink, time_t *last)
+{
+	return last_line_time(sink->handle, "%4d-%2d-%2d %2d:%2d", last);
+}
+
+static int csv_write(struct history_sink *sink, struct history_row *rows,
+                     int count)
+{
+	return write_lines(sink->handle, rows, count, "%Y-%m-%d %H:%M:%S", ',', "\n");
+}
+
+const struct sink_ops sink_csv =
+{
+	"csv", csv_open, csv_last_time, csv_write, text_close, file_rollup
+};
+
+
+/********************************************************************
+ * Store sink, the columnar store of store2300.c. It skips records it
+ * has already, so it needs no cursor file.
+ ********************************************************************/
+
+static int store_sink_open(struct history_sink *sink, struct config_type *config)
+{
+	return 0;
+}
+
+static int store_last_time(struct history_sink *sink, time_t *last)
+{
+	struct store store;
+	struct store_chunk *chunk, *previous = NULL;
+	long offset = 0;
+
+	*last = 0;
+
+	if (store_open(&store, sink->target) < 0)
+		return 0;
+
+	if (store.tail_rows > 0)
+		*last = store.tail[store.tail_rows - 1].time;
+	else
+	{
+		while ((chunk = store_next_chunk(&store, &offset)) != NULL)
+			previous = chunk;
+		if (previous != NULL)
+			*last = previous->time_last;
+	}
+
+	store_close(&store);
+
+	return *last != 0;
+}
+
+static void store_row_from_history(struct store_row *row, struct history_row *history)
+{
+	store_row_clear(row);
+	row->time = history->time;
+	row->value[STORE_TEMPERATURE_IN] = history->temperature_in;
+	row->value[STORE_TEMPERATURE_OUT] = history->temperature_out;
+	row->value[STORE_DEWPOINT] = history->dewpoint;
+	row->value[STORE_WINDSPEED] = history->windspeed;
+	row->value[STORE_WIND_ANGLE] = history->winddir_degrees;
+	row->value[STORE_WINDCHILL] = history->windchill;
+	row->value[STORE_RAIN_TOTAL] = history->rain;
+	row->value[STORE_PRESSURE] = history->pressure;
+	row->code[STORE_HUMIDITY_IN] = history->humidity_in;
+	row->code[STORE_HUMIDITY_OUT] = history->humidity_out;
+	row->code[STORE_WIND_DIRECTION] = (int)(history->winddir_degrees / 22.5);
+}
+
+static int store_write(struct history_sink *sink, struct history_row *rows,
+                       int count)
+{
+	static struct store_row store_rows[HISTORY_RECORDS];
+	int done, n, i;
+
+	for (done = 0; done < count; done += n)
+	{
+		n = count - done < HISTORY_RECORDS ? count - done : HISTORY_RECORDS;
+
+		for (i = 0; i < n; i++)
+			store_row_from_history(&store_rows[i], &rows[done + i]);
+
+		if (store_append(sink->target, store_rows, n) < 0)
+			break;
+	}
+
+	return done;
+}
+
+static void store_sink_close(struct history_sink *sink)
+{
+}
+
+const struct sink_ops sink_store =
+{
+	"store", store_sink_open, store_last_time, store_write, store_sink_close,
+	file_rollup
+};
+
+
+/********************************************************************
+ * sink_open
+ * Open a store for history_sync and find out where it stopped: from
+ * its cursor file, or else from the last record in the store itself.
+ *
+ * Input:  def - type, target and cursor file from the config. A
+ *               cursor file "-" means none, the store is asked
+ *         config - the configuration
+ *
+ * Output: sink - the open sink
+ *
+ * Returns: 0 on success and -1 if the type is unknown or the store
+ *          cannot be opened
+ *
+ ********************************************************************/
+int sink_open(struct history_sink *sink, sinkdata *def,
+              struct config_type *config)
+{
+	time_t last;
+	int i;
+
+	memset(sink, 0, sizeof(*sink));
+
+	for (i = 0; sink_types[i] != NULL; i++)
+	{
+		if (strcmp(sink_types[i]->type, def->type) == 0)
+			sink->ops = sink_types[i];
+	}
+
+	if (sink->ops == NULL)
+	{
+		fprintf(stderr, "Unknown history sink %s\n", def->type);
+		return -1;
+	}
+
+	strcpy(sink->target, def->target);
+	if (strcmp(def->cursor, "-") == 0)
+		sink->cursorname[0] = '\0';
+	else if (def->cursor[0] != '\0')
+		strcpy(sink->cursorname, def->cursor);
+	else
+		snprintf(sink->cursorname, sizeof(sink->cursorname), "%s.cursor",
+		         def->target);
+
+	sink->queue_size = config->history_queue;
+	sink->queue = malloc(sink->queue_size * sizeof(struct history_row));
+
+	if (sink->queue == NULL || sink->ops->open(sink, config) < 0)
+	{
+		free(sink->queue);
+		sink->ops = NULL;
+		return -1;
+	}
+
+	// A store without its rollups still gets the rows
+	sink->rollup.handle = NULL;
+	if (config->rollup && sink->ops->rollup == NULL)
+		fprintf(stderr, "ROLLUP ignored, the %s store %s keeps no rollups\n",
+		        sink->ops->type, sink->target);
+	else if (config->rollup && sink->ops->rollup(sink, &sink->rollup) < 0)
+		fprintf(stderr, "Cannot keep the rollups of %s\n", sink->target);
+
+	if ((sink->cursorname[0] == '\0' ||
+	     !history_cursor_load(sink->cursorname, &sink->cursor)) &&
+	    sink->ops->last_time != NULL && sink->ops->last_time(sink, &last))
+		sink->cursor.time = last;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * sink_close closes a sink opened by sink_open
+ ********************************************************************/
+void sink_close(struct history_sink *sink)
+{
+	if (sink->ops == NULL)
+		return;
+
+	rollup_close(&sink->rollup);
+	sink->ops->close(sink);
+	free(sink->queue);
+	sink->ops = NULL;
+}
+
+
+/********************************************************************
+ * sink_rollup adds the rows a sink stored to its rollups
+ ********************************************************************/
+static void sink_rollup(struct history_sink *sink, struct history_row *rows,
+                        int count)
+{
+	struct rollup_observation observation;
+	struct store_row row;
+	int ok, i;
+
+	if (sink->rollup.handle == NULL)
+		return;
+
+	ok = rollup_begin(&sink->rollup) == 0;
+
+	for (i = 0; ok && i < count; i++)
+	{
+		store_row_from_history(&row, &rows[i]);
+		rollup_observation_from_store(&observation, &row);
+		ok = rollup_add(&sink->rollup, &observation) >= 0;
+	}
+
+	if (!ok || rollup_commit(&sink->rollup) < 0)
+	{
+		fprintf(stderr, "Cannot write the rollups of %s\n", sink->target);
+		rollup_close(&sink->rollup);
+	}
+}
+
+
+/********************************************************************
+ * sink_flush
+ * Write the queued rows of a sink and move its cursor past the ones
+ * it acknowledged. If it stores fewer than it was given it gets no
+ * more rows this sync, the rest is sent again next time.
+ *
+ * Returns: number of rows acknowledged
+ *
+ ********************************************************************/
+static int sink_flush(struct history_sink *sink)
+{
+	struct history_row *last;
+	int stored;
+
+	if (sink->queued == 0)
+		return 0;
+
+	stored = sink->ops->write(sink, sink->queue, sink->queued);
+
+	if (stored > 0)
+	{
+		sink_rollup(sink, sink->queue, stored);
+
+		last = &sink->queue[stored - 1];
+		sink->cursor.record = last->record;
+		sink->cursor.time = last->time;
+		sink->cursor.interval = last->interval;
+		sink->written += stored;
+
+		if (sink->cursorname[0] != '\0' &&
+		    history_cursor_save(sink->cursorname, &sink->cursor) < 0)
+			fprintf(stderr, "Cannot write file %s\n", sink->cursorname);
+	}
+
+	if (stored < sink->queued)
+	{
+		fprintf(stderr, "History sink %s %s stopped after %d records\n",
+		        sink->ops->type, sink->target, sink->written);
+		sink->failed = 1;
+	}
+
+	sink->queued = 0;
+
+	return stored;
+}
+
+
+/********************************************************************
+ * history_sync
+ * Read the history records that are new to any of the sinks once
+ * and hand each sink the ones it has not got yet, oldest first.
+ *
+ * Every sink has a queue of config->history_queue rows. A full
+ * queue is written and acknowledged before more rows go in, so a
+ * slow or failing store never holds more than that and never stops
+ * the others. Each sink keeps its own cursor file.
+ *
+ * Input:  Handle to weatherstation
+ *         config - units and queue size
+ *         sinks - open sinks
+ *         count - number of sinks, at most MAX_HISTORY_SINKS
+ *
+ * Output: sinks - cursor, written and failed updated
+ *
+ * Returns: number of records read from the station, -1 if reading
+ *          failed
+ *
+ ********************************************************************/
+int history_sync(WEATHERSTATION ws2300, struct config_type *config,
+                 struct history_sink *sinks, int count)
+{
+	static struct history_raw records[HISTORY_RECORDS];
+	static struct history_row rows[HISTORY_RECORDS];
+	static time_t times[MAX_HISTORY_SINKS][HISTORY_RECORDS];
+	static unsigned char data[HISTORY_RECORDS * HISTORY_DATA_BYTES];
+	static double temperature_in[HISTORY_RECORDS], temperature_out[HISTORY_RECORDS];
+	static double pressure[HISTORY_RECORDS], rain[HISTORY_RECORDS];
+	static double windspeed[HISTORY_RECORDS], winddir_degrees[HISTORY_RECORDS];
+	static double dewpoint[HISTORY_RECORDS], windchill[HISTORY_RECORDS];
+	static int humidity_in[HISTORY_RECORDS], humidity_out[HISTORY_RECORDS];
+	struct history_columns columns = { temperature_in, temperature_out, pressure,
+	                                   humidity_in, humidity_out, rain, windspeed,
+	                                   winddir_degrees, dewpoint, windchill };
+	struct history_cursor next[MAX_HISTORY_SINKS];
+	struct history_sink *sink;
+	struct history_row *row;
+	int pending[MAX_HISTORY_SINKS];
+	double pressure_term;
+	int first, start = 0, n = 0;
+	int s, i, k;
+
+	if (count > MAX_HISTORY_SINKS)
+		count = MAX_HISTORY_SINKS;
+
+	// The history pointers are read once however many sinks there are
+	if (!config->cache)
+		cache_enable(ws2300, 1);
+
+	for (s = 0; s < count; s++)
+	{
+		pending[s] = 0;
+		sinks[s].written = 0;
+		sinks[s].failed = 0;
+
+		if (sinks[s].ops == NULL)
+			continue;
+
+		next[s] = sinks[s].cursor;
+		pending[s] = history_pending(ws2300, &next[s], &first, times[s]);
+
+		if (pending[s] > n)
+		{
+			n = pending[s];
+			start = first;
+		}
+	}
+
+	pressure_term = pressure_correction(ws2300, config->pressure_conv_factor);
+
+	if (!config->cache)
+		cache_enable(ws2300, 0);
+
+	if (n == 0)
+		return 0;
+
+	if (read_history_bulk(ws2300, start, n, records) != n)
+		return -1;
+
+	history_raw_pack(records, n, data);
+
+	decode_history_batch(data, n, config, &columns);
+
+	for (i = 0; i < n; i++)
+	{
+		row = &rows[i];
+		row->record = records[i].record;
+		row->temperature_in = temperature_in[i];
+		row->temperature_out = temperature_out[i];
+		row->dewpoint = dewpoint[i];
+		row->humidity_in = humidity_in[i];
+		row->humidity_out = humidity_out[i];
+		row->windspeed = windspeed[i];
+		row->winddir_degrees = winddir_degrees[i];
+		row->windchill = windchill[i];
+		row->rain = rain[i];
+		row->pressure = pressure[i] + pressure_term;
+	}
+
+	// The records new to a sink are the last pending[s] of the run
+	for (s = 0; s < count; s++)
+	{
+		sink = &sinks[s];
+
+		for (k = 0; k < pending[s] && !sink->failed; k++)
+		{
+			row = &sink->queue[sink->queued++];
+			*row = rows[n - pending[s] + k];
+			row->time = times[s][k];
+			row->interval = next[s].interval;
+
+			if (sink->queued == sink->queue_size)
+				sink_flush(sink);
+		}
+
+		if (!sink->failed)
+			sink_flush(sink);
+	}
+
+	return n;
+}
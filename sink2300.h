@@ -0,0 +1,86 @@
+/* open2300 - sink2300.h
+ * Include file for the history ingestion engine and the stores it
+ * feeds (sinks)
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_SINK2300_H_
+#define _INCLUDE_SINK2300_H_
+
+#include "rw2300.h"
+#include "rollup2300.h"
+
+/* One decoded history record as handed to the sinks */
+struct history_row
+{
+	int    record;                     //index in the ring
+	time_t time;                       //station time of the record
+	int    interval;                   //history interval in minutes
+	double temperature_in;             //in the units of the config
+	double temperature_out;
+	double dewpoint;
+	int    humidity_in;                //%
+	int    humidity_out;
+	double windspeed;
+	double winddir_degrees;
+	double windchill;
+	double rain;                       //rain total
+	double pressure;                   //relative pressure
+};
+
+struct history_sink;
+
+/* What a kind of sink does. write stores the rows in order and returns
+ * how many are stored for good (acknowledged). last_time may be NULL.
+ * rollup opens the store of the ROLLUP buckets next to the rows, NULL
+ * if this kind of sink keeps none. */
+struct sink_ops
+{
+	const char *type;
+	int  (*open)(struct history_sink *sink, struct config_type *config);
+	int  (*last_time)(struct history_sink *sink, time_t *last);
+	int  (*write)(struct history_sink *sink, struct history_row *rows, int count);
+	void (*close)(struct history_sink *sink);
+	int  (*rollup)(struct history_sink *sink, struct rollup_store *store);
+};
+
+struct history_sink
+{
+	const struct sink_ops *ops;
+	char   target[256];                //file name or table name
+	char   cursorname[300];            //cursor file of the sink
+	struct history_cursor cursor;      //last record acknowledged
+	struct history_row *queue;         //rows waiting to be written
+	int    queue_size;
+	int    queued;
+	int    written;                    //rows acknowledged this sync
+	int    failed;                     //1 when the sink gave up this sync
+	int    log_index;                  //lines per entry of the index of a text log
+	struct rollup_store rollup;        //handle NULL without rollups
+	void   *handle;                    //open file or database connection
+};
+
+extern const struct sink_ops sink_text;
+extern const struct sink_ops sink_csv;
+extern const struct sink_ops sink_store;
+#ifdef WITH_SQLITE
+extern const struct sink_ops sink_sqlite;
+#endif
+#ifdef WITH_MYSQL
+extern const struct sink_ops sink_mysql;
+#endif
+#ifdef WITH_PGSQL
+extern const struct sink_ops sink_pgsql;
+#endif
+
+extern const char *sink_directions[16];
+
+int sink_open(struct history_sink *sink, sinkdata *def,
+              struct config_type *config);
+
+void sink_close(struct history_sink *sink);
+
+int history_sync(WEATHERSTATION ws2300, struct config_type *config,
+                 struct history_sink *sinks, int count);
+
+#endif /* _INCLUDE_SINK2300_H_ */
@@ -0,0 +1,386 @@
+/*  open2300 - sinkmysql2300.c
+ *
+ *  Version 1.11
+ *
+ *  MySQL history sink of histsync2300 and mysqlhistlog2300. The target
+ *  is the table, laid out as in mysql2300.sql (without the rain_1h,
+ *  rain_24h, tendency and forecast columns the history does not have).
+ *  The connection is set with the MYSQL_ config keys.
+ *
+ *  The rows go in with server side prepared statements of up to
+ *  MYSQL_BATCH_ROWS rows each, the values bound in binary form, and
+ *  every write is one transaction. The connection and statements are
+ *  kept while the sink is open and made again when the server has gone
+ *  away, so histsync2300 -i keeps one connection for days.
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#include <mysql.h>
+#include "sink2300.h"
+
+#define MYSQL_BATCH_ROWS 16        // rows of the largest INSERT
+#define MYSQL_COLUMNS    12        // values of one row
+
+/* The values of one row, where the bindings point */
+struct mysql_values
+{
+	MYSQL_TIME datetime;
+	double temperature_in;
+	double temperature_out;
+	double dewpoint;
+	int    humidity_in;
+	int    humidity_out;
+	double windspeed;
+	double winddir_degrees;
+	char   direction[4];
+	unsigned long direction_length;
+	double windchill;
+	double rain;
+	double pressure;
+};
+
+struct mysql_sink
+{
+	MYSQL *mysql;
+	char host[50];
+	char user[25];
+	char passwd[25];
+	char database[30];
+	int  port;
+	MYSQL_STMT *insert[MYSQL_BATCH_ROWS + 1];   // INSERT of n rows, made when needed
+	MYSQL_BIND bind[MYSQL_BATCH_ROWS * MYSQL_COLUMNS];
+	struct mysql_values values[MYSQL_BATCH_ROWS];
+};
+
+
+/********************************************************************
+ * mysql_sink_bind points the bindings at the values of the rows.
+ * They never move, so a statement is bound once when it is prepared.
+ ********************************************************************/
+static void mysql_sink_bind(struct mysql_sink *s)
+{
+	struct mysql_values *v;
+	MYSQL_BIND *b;
+	int r;
+
+	memset(s->bind, 0, sizeof(s->bind));
+
+	for (r = 0; r < MYSQL_BATCH_ROWS; r++)
+	{
+		v = &s->values[r];
+		b = &s->bind[r * MYSQL_COLUMNS];
+
+		b[0].buffer_type = MYSQL_TYPE_DATETIME;
+		b[0].buffer = &v->datetime;
+		b[1].buffer_type = MYSQL_TYPE_DOUBLE;
+		b[1].buffer = &v->temperature_in;
+		b[2].buffer_type = MYSQL_TYPE_DOUBLE;
+		b[2].buffer = &v->temperature_out;
+		b[3].buffer_type = MYSQL_TYPE_DOUBLE;
+		b[3].buffer = &v->dewpoint;
+		b[4].buffer_type = MYSQL_TYPE_LONG;
+		b[4].buffer = &v->humidity_in;
+		b[5].buffer_type = MYSQL_TYPE_LONG;
+		b[5].buffer = &v->humidity_out;
+		b[6].buffer_type = MYSQL_TYPE_DOUBLE;
+		b[6].buffer = &v->windspeed;
+		b[7].buffer_type = MYSQL_TYPE_DOUBLE;
+		b[7].buffer = &v->winddir_degrees;
+		b[8].buffer_type = MYSQL_TYPE_STRING;
+		b[8].buffer = v->direction;
+		b[8].buffer_length = sizeof(v->direction);
+		b[8].length = &v->direction_length;
+		b[9].buffer_type = MYSQL_TYPE_DOUBLE;
+		b[9].buffer = &v->windchill;
+		b[10].buffer_type = MYSQL_TYPE_DOUBLE;
+		b[10].buffer = &v->rain;
+		b[11].buffer_type = MYSQL_TYPE_DOUBLE;
+		b[11].buffer = &v->pressure;
+	}
+}
+
+
+/********************************************************************
+ * mysql_sink_disconnect closes the statements and the connection
+ ********************************************************************/
+static void mysql_sink_disconnect(struct mysql_sink *s)
+{
+	int n;
+
+	for (n = 1; n <= MYSQL_BATCH_ROWS; n++)
+	{
+		if (s->insert[n] != NULL)
+			mysql_stmt_close(s->insert[n]);
+		s->insert[n] = NULL;
+	}
+
+	if (s->mysql != NULL)
+		mysql_close(s->mysql);
+	s->mysql = NULL;
+}
+
+
+/********************************************************************
+ * mysql_sink_connect (re)connects to the server. The statements are
+ * prepared again as they are needed.
+ *
+ * Returns: 0 on success and -1 if fail
+ ********************************************************************/
+static int mysql_sink_connect(struct mysql_sink *s)
+{
+	mysql_sink_disconnect(s);
+
+	if ((s->mysql = mysql_init(NULL)) == NULL)
+	{
+		fprintf(stderr, "Cannot initialize MySQL\n");
+		return -1;
+	}
+
+	if (mysql_real_connect(s->mysql, s->host, s->user, s->passwd, s->database,
+	                       s->port, NULL, 0) == NULL)
+	{
+		fprintf(stderr, "%d: %s \n", mysql_errno(s->mysql), mysql_error(s->mysql));
+		mysql_sink_disconnect(s);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * mysql_sink_statement returns the INSERT of n rows, preparing it
+ * the first time. INSERT IGNORE passes over records already stored
+ * like the error 1062 mysqlhistlog2300 always ignored.
+ *
+ * Returns: the statement or NULL if it cannot be prepared
+ ********************************************************************/
+static MYSQL_STMT *mysql_sink_statement(struct history_sink *sink, int n)
+{
+	struct mysql_sink *s = sink->handle;
+	MYSQL_STMT *statement;
+	char query[256 + MYSQL_BATCH_ROWS * 30];
+	int length, i;
+
+	if (s->insert[n] != NULL)
+		return s->insert[n];
+
+	length = snprintf(query, sizeof(query),
+	                  "INSERT IGNORE INTO %s(datetime, temp_in, temp_out, dewpoint, "
+	                  "rel_hum_in, rel_hum_out, wind_speed, wind_angle, "
+	                  "wind_direction, wind_chill, rain_total, rel_pressure) VALUES ",
+	                  sink->target);
+
+	for (i = 0; i < n; i++)
+		length += snprintf(query + length, sizeof(query) - length,
+		                   "%s(?,?,?,?,?,?,?,?,?,?,?,?)", i ? "," : "");
+
+	if ((statement = mysql_stmt_init(s->mysql)) == NULL)
+	{
+		fprintf(stderr, "Cannot prepare statement. %d: %s \n",
+		        mysql_errno(s->mysql), mysql_error(s->mysql));
+		return NULL;
+	}
+
+	if (mysql_stmt_prepare(statement, query, length) != 0 ||
+	    mysql_stmt_bind_param(statement, s->bind) != 0)
+	{
+		fprintf(stderr, "Cannot prepare statement. %d: %s \nStatement was : %s\n",
+		        mysql_stmt_errno(statement), mysql_stmt_error(statement), query);
+		mysql_stmt_close(statement);
+		return NULL;
+	}
+
+	s->insert[n] = statement;
+
+	return statement;
+}
+
+
+static int mysql_sink_open(struct history_sink *sink, struct config_type *config)
+{
+	struct mysql_sink *s;
+
+	if ((s = calloc(1, sizeof(struct mysql_sink))) == NULL)
+		return -1;
+
+	strcpy(s->host, config->mysql_host);
+	strcpy(s->user, config->mysql_user);
+	strcpy(s->passwd, config->mysql_passwd);
+	strcpy(s->database, config->mysql_database);
+	s->port = config->mysql_port;
+
+	mysql_sink_bind(s);
+
+	if (mysql_sink_connect(s) < 0)
+	{
+		free(s);
+		return -1;
+	}
+
+	sink->handle = s;
+
+	return 0;
+}
+
+
+static int mysql_sink_last_time(struct history_sink *sink, time_t *last)
+{
+	struct mysql_sink *s = sink->handle;
+	MYSQL_RES *result;
+	MYSQL_ROW row;
+	struct tm time_tm;
+	char query[512];
+	int found = 0;
+
+	*last = 0;
+
+	snprintf(query, sizeof(query), "SELECT MAX(datetime) FROM %s", sink->target);
+
+	if (mysql_query(s->mysql, query) != 0 ||
+	    (result = mysql_store_result(s->mysql)) == NULL)
+		return 0;
+
+	memset(&time_tm, 0, sizeof(time_tm));
+	if ((row = mysql_fetch_row(result)) != NULL && row[0] != NULL &&
+	    sscanf(row[0], "%4d-%2d-%2d %2d:%2d", &time_tm.tm_year, &time_tm.tm_mon,
+	           &time_tm.tm_mday, &time_tm.tm_hour, &time_tm.tm_min) == 5)
+	{
+		time_tm.tm_year -= 1900;
+		time_tm.tm_mon -= 1;
+		time_tm.tm_isdst = -1;
+		*last = mktime(&time_tm);
+		found = 1;
+	}
+
+	mysql_free_result(result);
+
+	return found;
+}
+
+
+/********************************************************************
+ * mysql_sink_insert stores n rows already in the values with one
+ * execute of the n row INSERT
+ *
+ * Returns: 0 on success and -1 if fail
+ ********************************************************************/
+static int mysql_sink_insert(struct history_sink *sink, int n)
+{
+	MYSQL_STMT *statement;
+
+	if ((statement = mysql_sink_statement(sink, n)) == NULL)
+		return -1;
+
+	if (mysql_stmt_execute(statement) != 0)
+	{
+		fprintf(stderr, "Could not insert rows. %d: %s \n",
+		        mysql_stmt_errno(statement), mysql_stmt_error(statement));
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * mysql_sink_write stores the rows in one transaction, so it is all
+ * or nothing on a transactional table. Records with a humidity over
+ * 99 are skipped like mysqlhistlog2300 always did.
+ ********************************************************************/
+static int mysql_sink_write(struct history_sink *sink, struct history_row *rows,
+                            int count)
+{
+	struct mysql_sink *s = sink->handle;
+	struct mysql_values *v;
+	struct tm *time_tm;
+	char datestring[50];
+	int i, n = 0;
+
+	// A connection that timed out between syncs is made again
+	if ((s->mysql == NULL || mysql_ping(s->mysql) != 0) && mysql_sink_connect(s) < 0)
+		return 0;
+
+	if (mysql_query(s->mysql, "START TRANSACTION") != 0)
+	{
+		fprintf(stderr, "%d: %s \n", mysql_errno(s->mysql), mysql_error(s->mysql));
+		return 0;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		time_tm = localtime(&rows[i].time);
+
+		if (rows[i].humidity_out >= 100)
+		{
+			strftime(datestring, sizeof(datestring), "%Y-%m-%d %H:%M:%S", time_tm);
+			fprintf(stderr, "Humidity is %d. Dataset for %s skipped.\n",
+			        rows[i].humidity_out, datestring);
+			continue;
+		}
+
+		v = &s->values[n++];
+		memset(&v->datetime, 0, sizeof(v->datetime));
+		v->datetime.year = time_tm->tm_year + 1900;
+		v->datetime.month = time_tm->tm_mon + 1;
+		v->datetime.day = time_tm->tm_mday;
+		v->datetime.hour = time_tm->tm_hour;
+		v->datetime.minute = time_tm->tm_min;
+		v->datetime.second = time_tm->tm_sec;
+		v->datetime.time_type = MYSQL_TIMESTAMP_DATETIME;
+		v->temperature_in = rows[i].temperature_in;
+		v->temperature_out = rows[i].temperature_out;
+		v->dewpoint = rows[i].dewpoint;
+		v->humidity_in = rows[i].humidity_in;
+		v->humidity_out = rows[i].humidity_out;
+		v->windspeed = rows[i].windspeed;
+		v->winddir_degrees = rows[i].winddir_degrees;
+		strcpy(v->direction, sink_directions[(int)(rows[i].winddir_degrees / 22.5)]);
+		v->direction_length = strlen(v->direction);
+		v->windchill = rows[i].windchill;
+		v->rain = rows[i].rain;
+		v->pressure = rows[i].pressure;
+
+		if (n == MYSQL_BATCH_ROWS)
+		{
+			if (mysql_sink_insert(sink, n) < 0)
+				break;
+			n = 0;
+		}
+	}
+
+	if (i == count && n > 0 && mysql_sink_insert(sink, n) < 0)
+		i = -1;
+
+	if (i != count)
+	{
+		mysql_rollback(s->mysql);
+		return 0;
+	}
+
+	if (mysql_commit(s->mysql) != 0)
+	{
+		fprintf(stderr, "%d: %s \n", mysql_errno(s->mysql), mysql_error(s->mysql));
+		return 0;
+	}
+
+	return count;
+}
+
+
+static void mysql_sink_close(struct history_sink *sink)
+{
+	struct mysql_sink *s = sink->handle;
+
+	mysql_sink_disconnect(s);
+	free(s);
+}
+
+
+const struct sink_ops sink_mysql =
+{
+	"mysql", mysql_sink_open, mysql_sink_last_time, mysql_sink_write,
+	mysql_sink_close, NULL
+};
@@ -0,0 +1,223 @@
+/*  open2300 - sinkpgsql2300.c
+ *
+ *  Version 1.11
+ *
+ *  PostgreSQL history sink of histsync2300. The target is the table,
+ *  with the columns
+ *    station, timestamp, temp_in, temp_out, dewpoint, rel_hum_in,
+ *    rel_hum_out, wind_speed, wind_angle, wind_direction, wind_chill,
+ *    rain_total, rel_pressure
+ *  The connection and station are set with PGSQL_CONNECT and
+ *  PGSQL_STATION.
+ *
+ *  The rows of a write are streamed with one COPY FROM STDIN, which is
+ *  one statement and so all or nothing. The connection is kept while
+ *  the sink is open and reset when it has been lost.
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#include <libpq-fe.h>
+#include "sink2300.h"
+
+struct pgsql_sink
+{
+	PGconn *conn;
+	char station[25];
+	char copy_station[50];             // escaped for COPY
+};
+
+
+/********************************************************************
+ * pgsql_copy_escape copies a string to a COPY text field, escaping
+ * the backslash, tab and line breaks
+ ********************************************************************/
+static void pgsql_copy_escape(char *field, int size, const char *text)
+{
+	int n = 0;
+
+	for (; *text != '\0' && n < size - 2; text++)
+	{
+		if (*text == '\\' || *text == '\t' || *text == '\n' || *text == '\r')
+		{
+			field[n++] = '\\';
+			field[n++] = *text == '\t' ? 't' : *text == '\n' ? 'n' :
+			             *text == '\r' ? 'r' : '\\';
+		}
+		else
+		{
+			field[n++] = *text;
+		}
+	}
+
+	field[n] = '\0';
+}
+
+
+static int pgsql_open(struct history_sink *sink, struct config_type *config)
+{
+	struct pgsql_sink *s;
+
+	if ((s = calloc(1, sizeof(struct pgsql_sink))) == NULL)
+		return -1;
+
+	s->conn = PQconnectdb(config->pgsql_connect);
+
+	if (PQstatus(s->conn) == CONNECTION_BAD)
+	{
+		fprintf(stderr, "Connection to PgSQL failed:\n%s\n", config->pgsql_connect);
+		fprintf(stderr, "%s", PQerrorMessage(s->conn));
+		PQfinish(s->conn);
+		free(s);
+		return -1;
+	}
+
+	strcpy(s->station, config->pgsql_station);
+	pgsql_copy_escape(s->copy_station, sizeof(s->copy_station), s->station);
+	sink->handle = s;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * pgsql_command runs a statement that returns no rows and checks
+ * that it ends in the status expected
+ *
+ * Returns: 0 on success and -1 if fail
+ ********************************************************************/
+static int pgsql_command(struct pgsql_sink *s, char *query, ExecStatusType expect)
+{
+	PGresult *res;
+	int ok;
+
+	res = PQexec(s->conn, query);
+	ok = PQresultStatus(res) == expect;
+	if (!ok)
+		fprintf(stderr, "PgSQL error. %s:\n%s\n", PQresultErrorMessage(res), query);
+	PQclear(res);
+
+	return ok ? 0 : -1;
+}
+
+
+static int pgsql_last_time(struct history_sink *sink, time_t *last)
+{
+	struct pgsql_sink *s = sink->handle;
+	const char *station = s->station;
+	struct tm time_tm;
+	PGresult *res;
+	char query[512];
+	int found = 0;
+
+	*last = 0;
+
+	snprintf(query, sizeof(query),
+	         "SELECT to_char(max(timestamp), 'YYYY-MM-DD HH24:MI') FROM %s "
+	         "WHERE station = $1", sink->target);
+
+	res = PQexecParams(s->conn, query, 1, NULL, &station, NULL, NULL, 0);
+
+	memset(&time_tm, 0, sizeof(time_tm));
+	if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) == 1 &&
+	    !PQgetisnull(res, 0, 0) &&
+	    sscanf(PQgetvalue(res, 0, 0), "%4d-%2d-%2d %2d:%2d", &time_tm.tm_year,
+	           &time_tm.tm_mon, &time_tm.tm_mday, &time_tm.tm_hour,
+	           &time_tm.tm_min) == 5)
+	{
+		time_tm.tm_year -= 1900;
+		time_tm.tm_mon -= 1;
+		time_tm.tm_isdst = -1;
+		*last = mktime(&time_tm);
+		found = 1;
+	}
+
+	PQclear(res);
+
+	return found;
+}
+
+
+/********************************************************************
+ * pgsql_write streams the rows with one COPY, so it is all or nothing
+ ********************************************************************/
+static int pgsql_write(struct history_sink *sink, struct history_row *rows,
+                       int count)
+{
+	struct pgsql_sink *s = sink->handle;
+	PGresult *res;
+	char datestring[50];
+	char line[256];
+	char query[512];
+	int i, length, ok;
+
+	// A connection lost since the last write is made again
+	if (PQstatus(s->conn) != CONNECTION_OK)
+	{
+		PQreset(s->conn);
+		if (PQstatus(s->conn) != CONNECTION_OK)
+		{
+			fprintf(stderr, "%s", PQerrorMessage(s->conn));
+			return 0;
+		}
+	}
+
+	snprintf(query, sizeof(query),
+	         "COPY %s (station, timestamp, temp_in, temp_out, dewpoint, "
+	         "rel_hum_in, rel_hum_out, wind_speed, wind_angle, wind_direction, "
+	         "wind_chill, rain_total, rel_pressure) FROM STDIN", sink->target);
+
+	if (pgsql_command(s, query, PGRES_COPY_IN) < 0)
+		return 0;
+
+	for (i = 0; i < count; i++)
+	{
+		strftime(datestring, sizeof(datestring), "%Y-%m-%d %H:%M:%S",
+		         localtime(&rows[i].time));
+
+		length = snprintf(line, sizeof(line),
+		                  "%s\t%s\t%.1f\t%.1f\t%.1f\t%d\t%d\t%.1f\t%.1f\t%s\t%.1f\t%.2f\t%.3f\n",
+		                  s->copy_station, datestring, rows[i].temperature_in,
+		                  rows[i].temperature_out, rows[i].dewpoint,
+		                  rows[i].humidity_in, rows[i].humidity_out,
+		                  rows[i].windspeed, rows[i].winddir_degrees,
+		                  sink_directions[(int)(rows[i].winddir_degrees / 22.5)],
+		                  rows[i].windchill, rows[i].rain, rows[i].pressure);
+
+		if (PQputCopyData(s->conn, line, length) != 1)
+			break;
+	}
+
+	// An aborted COPY is rolled back by the server
+	PQputCopyEnd(s->conn, i < count ? "write failed" : NULL);
+
+	ok = 1;
+	while ((res = PQgetResult(s->conn)) != NULL)
+	{
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		{
+			fprintf(stderr, "PgSQL error. %s:\n%s\n", PQresultErrorMessage(res), query);
+			ok = 0;
+		}
+		PQclear(res);
+	}
+
+	return ok && i == count ? count : 0;
+}
+
+
+static void pgsql_close(struct history_sink *sink)
+{
+	struct pgsql_sink *s = sink->handle;
+
+	PQfinish(s->conn);
+	free(s);
+}
+
+
+const struct sink_ops sink_pgsql =
+{
+	"pgsql", pgsql_open, pgsql_last_time, pgsql_write, pgsql_close,
+	NULL
+};
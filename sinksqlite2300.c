@@ -0,0 +1,189 @@
+/*  open2300 - sinksqlite2300.c
+ *
+ *  Version 1.11
+ *
+ *  SQLite history sink of histsync2300. The target is the database
+ *  file, the rows go into the weather_history table of
+ *  sqlitehistlog2300.sql, their ROLLUP buckets into weather_rollup.
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#include <sqlite3.h>
+#include "sink2300.h"
+
+struct sqlite_sink
+{
+	sqlite3 *db;
+	sqlite3_stmt *insert;
+};
+
+
+/********************************************************************
+ * sqlite_pragma sets a PRAGMA of the config file, unless it is empty
+ *
+ * Returns: 0 on success and -1 if fail
+ ********************************************************************/
+static int sqlite_pragma(sqlite3 *db, const char *pragma, const char *value)
+{
+	char query[100];
+
+	if (value[0] == '\0')
+		return 0;
+
+	snprintf(query, sizeof(query), "PRAGMA %s=%s", pragma, value);
+
+	return sqlite3_exec(db, query, NULL, NULL, NULL) == SQLITE_OK ? 0 : -1;
+}
+
+
+static int sqlite_open(struct history_sink *sink, struct config_type *config)
+{
+	struct sqlite_sink *s;
+	char query[512];
+
+	if ((s = calloc(1, sizeof(struct sqlite_sink))) == NULL)
+		return -1;
+
+	snprintf(query, sizeof(query),
+	         "INSERT %sINTO weather_history (sys_datetime, ws_datetime, "
+	         "temperature_in, temperature_out, dewpoint, rel_humidity_in, "
+	         "rel_humidity_out, wind_speed, wind_angle, wind_direction, "
+	         "wind_chill, rain_total, rel_pressure) "
+	         "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+	         config->sqlite_ignore_duplicates ? "OR IGNORE " : "");
+
+	if (sqlite3_open(sink->target, &s->db) != SQLITE_OK ||
+	    sqlite_pragma(s->db, "journal_mode", config->sqlite_journal_mode) < 0 ||
+	    sqlite_pragma(s->db, "synchronous", config->sqlite_synchronous) < 0 ||
+	    sqlite3_prepare_v2(s->db, query, -1, &s->insert, NULL) != SQLITE_OK)
+	{
+		fprintf(stderr, "SQLite %s: %s\n", sink->target, sqlite3_errmsg(s->db));
+		sqlite3_close(s->db);
+		free(s);
+		return -1;
+	}
+
+	sink->handle = s;
+
+	return 0;
+}
+
+
+static int sqlite_last_time(struct history_sink *sink, time_t *last)
+{
+	struct sqlite_sink *s = sink->handle;
+	sqlite3_stmt *statement;
+	const unsigned char *text;
+	struct tm time_tm;
+	int found = 0;
+
+	*last = 0;
+
+	if (sqlite3_prepare_v2(s->db, "SELECT datetime(MAX(ws_datetime)) FROM weather_history",
+	                       -1, &statement, NULL) != SQLITE_OK)
+		return 0;
+
+	memset(&time_tm, 0, sizeof(time_tm));
+	if (sqlite3_step(statement) == SQLITE_ROW &&
+	    (text = sqlite3_column_text(statement, 0)) != NULL &&
+	    sscanf((const char *)text, "%4d-%2d-%2d %2d:%2d", &time_tm.tm_year,
+	           &time_tm.tm_mon, &time_tm.tm_mday, &time_tm.tm_hour,
+	           &time_tm.tm_min) == 5)
+	{
+		time_tm.tm_year -= 1900;
+		time_tm.tm_mon -= 1;
+		time_tm.tm_isdst = -1;
+		*last = mktime(&time_tm);
+		found = 1;
+	}
+
+	sqlite3_finalize(statement);
+
+	return found;
+}
+
+
+/********************************************************************
+ * sqlite_write stores the rows in one transaction, so it is all or
+ * nothing
+ ********************************************************************/
+static int sqlite_write(struct history_sink *sink, struct history_row *rows,
+                        int count)
+{
+	struct sqlite_sink *s = sink->handle;
+	sqlite3_stmt *st = s->insert;
+	char sys_datetime[20], ws_datetime[20];
+	time_t now = time(NULL);
+	int i, rc = SQLITE_DONE;
+
+	strftime(sys_datetime, sizeof(sys_datetime), "%Y-%m-%d %H:%M:%S",
+	         localtime(&now));
+
+	if (sqlite3_exec(s->db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)
+	{
+		fprintf(stderr, "SQLite %s: %s\n", sink->target, sqlite3_errmsg(s->db));
+		return 0;
+	}
+
+	for (i = 0; i < count && rc == SQLITE_DONE; i++)
+	{
+		strftime(ws_datetime, sizeof(ws_datetime), "%Y-%m-%d %H:%M:%S",
+		         localtime(&rows[i].time));
+
+		sqlite3_bind_text(st, 1, sys_datetime, -1, SQLITE_STATIC);
+		sqlite3_bind_text(st, 2, ws_datetime, -1, SQLITE_STATIC);
+		sqlite3_bind_double(st, 3, rows[i].temperature_in);
+		sqlite3_bind_double(st, 4, rows[i].temperature_out);
+		sqlite3_bind_double(st, 5, rows[i].dewpoint);
+		sqlite3_bind_int(st, 6, rows[i].humidity_in);
+		sqlite3_bind_int(st, 7, rows[i].humidity_out);
+		sqlite3_bind_double(st, 8, rows[i].windspeed);
+		sqlite3_bind_double(st, 9, rows[i].winddir_degrees);
+		sqlite3_bind_text(st, 10, sink_directions[(int)(rows[i].winddir_degrees / 22.5)],
+		                  -1, SQLITE_STATIC);
+		sqlite3_bind_double(st, 11, rows[i].windchill);
+		sqlite3_bind_double(st, 12, rows[i].rain);
+		sqlite3_bind_double(st, 13, rows[i].pressure);
+
+		rc = sqlite3_step(st);
+		sqlite3_reset(st);
+	}
+
+	if (rc != SQLITE_DONE ||
+	    sqlite3_exec(s->db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+	{
+		fprintf(stderr, "SQLite %s: %s\n", sink->target, sqlite3_errmsg(s->db));
+		sqlite3_exec(s->db, "ROLLBACK", NULL, NULL, NULL);
+		return 0;
+	}
+
+	return count;
+}
+
+
+/* The rollups go into the table weather_rollup of the same database */
+static int sqlite_rollup(struct history_sink *sink, struct rollup_store *store)
+{
+	struct sqlite_sink *s = sink->handle;
+
+	return rollup_open_sqlite(store, s->db);
+}
+
+
+static void sqlite_close(struct history_sink *sink)
+{
+	struct sqlite_sink *s = sink->handle;
+
+	sqlite3_finalize(s->insert);
+	sqlite3_close(s->db);
+	free(s);
+}
+
+
+const struct sink_ops sink_sqlite =
+{
+	"sqlite", sqlite_open, sqlite_last_time, sqlite_write, sqlite_close,
+	sqlite_rollup
+};
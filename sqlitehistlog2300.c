@@ -49,6 +49,7 @@
 
 #include <sqlite3.h>
 #include "rw2300.h"
+#include "rollup2300.h"
 
 /* Forked from the modified sqlitelog2300.c source */
 /********************************************************************
@@ -88,6 +89,17 @@ struct state
  * that is built */
 #define QUERY_BUF_SIZE 4096
 
+/* The columns of weather_history in the order of columns[] in main */
+enum history_column
+{
+	COL_SYS_DATETIME, COL_WS_DATETIME, COL_TEMPERATURE_IN, COL_TEMPERATURE_OUT,
+	COL_DEWPOINT, COL_REL_HUMIDITY_IN, COL_REL_HUMIDITY_OUT, COL_WIND_SPEED,
+	COL_WIND_ANGLE, COL_WIND_DIRECTION, COL_WIND_CHILL, COL_RAIN_TOTAL,
+	COL_REL_PRESSURE, COLUMNS
+};
+
+void state_finish(struct state* state);
+
 /* Forked from the modified sqlitelog2300.c source */
 /********************************************************************
  * state_init initializes a state struct
@@ -125,41 +137,53 @@ void state_init(struct state* state, const char *db_path, char *query)
 
 /* New procedure */
 /********************************************************************
- * state_reinit reinitializes a state struct
+ * state_insert stores the values bound to the prepared statement and
+ * resets it for the next row. The statement is prepared only once.
  *
- * Input:	Pointer to state structure to initialize
- * 		    Null terminated string that contains the actual query.
+ * Input:	Pointer to state structure with the bound statement
  *
- * Output:	Initialized state structure
+ * Output:	Program exit if the row cannot be stored
  *
  * Returns: void
  *
  ********************************************************************/
-void state_reinit(struct state* state, char *query)
+void state_insert(struct state* state)
 {
 	int rc;
-	// Puts binded values to database
+
 	rc = sqlite3_step(state->statement);
+	sqlite3_reset(state->statement);
 	if (rc != SQLITE_DONE) 
 	{
-		fprintf(stderr, "\nUnable to execute query (%s): %s\n\n", query, sqlite3_errmsg(state->db));
-		sqlite3_close(state->db);
-		exit(EXIT_FAILURE);
-	}
-	rc = sqlite3_finalize(state->statement);
-	if (rc != SQLITE_OK) {
-		fprintf(stderr, "\nUnable to execute query (%s): %s\n\n", query, sqlite3_errmsg(state->db));
-		sqlite3_close(state->db);
+		fprintf(stderr, "\nUnable to execute query (%s): %s\n\n", sqlite3_sql(state->statement), sqlite3_errmsg(state->db));
+		state_finish(state);
 		exit(EXIT_FAILURE);
 	}
+}
 
-	/* Prepare the query again  */
-	int nByte = -1;
-	rc = sqlite3_prepare_v2(state->db, query, nByte, &state->statement, NULL);
-	if(rc != SQLITE_OK) 
+
+/* New procedure */
+/********************************************************************
+ * state_exec runs a statement without values like BEGIN, COMMIT or
+ * a PRAGMA
+ *
+ * Input:	Pointer to state structure with the open database
+ *			Null terminated string that contains the statement
+ *
+ * Output:	Program exit if the statement fails
+ *
+ * Returns: void
+ *
+ ********************************************************************/
+void state_exec(struct state* state, const char *sql)
+{
+	char *msg = NULL;
+
+	if (sqlite3_exec(state->db, sql, NULL, NULL, &msg) != SQLITE_OK)
 	{
-		fprintf(stderr, "\nUnable to prepare query (%s): %s\n\n", query, sqlite3_errmsg(state->db));
-		sqlite3_close(state->db);
+		fprintf(stderr, "\nUnable to execute query (%s): %s\n\n", sql, msg);
+		sqlite3_free(msg);
+		state_finish(state);
 		exit(EXIT_FAILURE);
 	}
 }
@@ -255,7 +279,8 @@ int main(int argc, char *argv[])
 	struct timestamp time_last;
 	time_t time_lastlog, time_lastrecord;
 	struct tm time_lastlog_tm, time_lastrecord_tm;
-	int current_record, next_record, lastlog_record, new_records;
+	int current_record, lastlog_record, new_records;
+	static struct history_raw records[HISTORY_RECORDS];
 	double temperature_in;
 	double temperature_out;
 	double dewpoint;
@@ -287,30 +312,35 @@ int main(int argc, char *argv[])
 		NULL
 	};
 
+	int param[COLUMNS];          // parameter index of each column
+	char name[40];
+	char pragma[100];
 	int i, rc;
-	time_t rt;
+	time_t rt, start;
 	struct tm * wst;
 	char rtstring[50];
 	char * select_stmt = "SELECT datetime(MAX(ws_datetime)) FROM weather_history";
 	char insert_stmt[QUERY_BUF_SIZE + 1] = ""; /* +1 for trailing NUL */
 	struct state s;
+	struct rollup_store rollup;
+	struct rollup_observation observation;
 	const char * ws_localtime_sync = "lct";
 	const char * ws_utctime_sync = "utc";
 	char tempchar[] = "0";
-	unsigned char data[6], tmpdata[6];
+	unsigned char data[7], tmpdata[7];  // six digits and the NUL of snprintf
 	unsigned char command[25];
 	const int ws_time_addr = 0x0200;
 	const int ws_date_addr = 0x024D;
 	const int ws_datetime_addr = 0x023B;
 	char * tmpstr;
-	bool ws_datetime_sync = FALSE;
+	bool ws_datetime_sync = false;
 	
 	// Check the running parameters
 	switch (argc) 
 	{
 		case   4:
 			if ((strncmp(argv[3],ws_localtime_sync,strlen(argv[3])) == 0) || (strncmp(argv[3],ws_utctime_sync,strlen(argv[3])) == 0))
-			ws_datetime_sync = TRUE;
+			ws_datetime_sync = true;
 			else 
 			{
 				print_usage();
@@ -325,7 +355,7 @@ int main(int argc, char *argv[])
 			else
 			{
 				if ((strncmp(argv[2],ws_localtime_sync,strlen(argv[2])) == 0) || (strncmp(argv[2],ws_utctime_sync,strlen(argv[2])) == 0)) 
-				ws_datetime_sync = TRUE;
+				ws_datetime_sync = true;
 			}
 			break;
 		case   2:
@@ -342,12 +372,14 @@ int main(int argc, char *argv[])
 
 	// Setup WS23XX serial port
 	ws2300 = open_weatherstation(config.serial_device_name);
+	configure_weatherstation(ws2300, &config);
 
 /*
 	if ( (strncmp(argv[argc-2],ws_localtime_sync,strlen(argv[argc-2])) == 0) || (strncmp(argv[argc-2],ws_utctime_sync,strlen(argv[argc-2])) == 0) ||
 	     (strncmp(argv[argc-1],ws_localtime_sync,strlen(argv[argc-1])) == 0) || (strncmp(argv[argc-1],ws_utctime_sync,strlen(argv[argc-1])) == 0)    ) 
 */
 	time(&rt);
+	start = rt;
 	if ( ws_datetime_sync )
 	// Sync WS23XX date & time before reading the history
 	{
@@ -359,7 +391,7 @@ int main(int argc, char *argv[])
 		//printf ("%s\n", datestring); // this command line is only for testing !!!
 		wst->tm_year += 1900;
 		wst->tm_mon++;
-		sprintf( (char*) data, "%02d%02d%02d", (int)(wst->tm_year % 100), wst->tm_mon, wst->tm_mday);
+		snprintf( (char*) data, sizeof(data), "%02u%02u%02u", (unsigned)wst->tm_year % 100, (unsigned)wst->tm_mon % 100, (unsigned)wst->tm_mday % 100);
 		sprintf( (char*) tmpdata, "%c%c%c%c%c%c", data[ 5 ], data[ 4 ], data[ 3 ], data[ 2 ], data[ 1 ], data[ 0 ]);
 		// printf("%s\n",data); // this command line is only for testing !!!
 		for (i=0;i<6;i++)
@@ -390,7 +422,7 @@ int main(int argc, char *argv[])
 		check_maxretries( i, "error syncing date - data writing error");
 
 		// Convert time
-		sprintf( (char*) data, "%02d%02d%02d", wst->tm_hour, wst->tm_min, wst->tm_sec );
+		snprintf( (char*) data, sizeof(data), "%02u%02u%02u", (unsigned)wst->tm_hour % 100, (unsigned)wst->tm_min % 100, (unsigned)wst->tm_sec % 100);
 		sprintf( (char*) tmpdata, "%c%c%c%c%c%c", data[ 5 ], data[ 4 ], data[ 3 ], data[ 2 ], data[ 1 ], data[ 0 ]);
 		// printf("%s\n",data); // this command line is only for testing !!!
 		for (i=0;i<6;i++)
@@ -508,7 +540,10 @@ int main(int argc, char *argv[])
 	// Ensure there's always a NUL char at the end of the buffer.
 	// strncat won't override this char as its beyond QUERY_BUF_SIZE
 	insert_stmt[QUERY_BUF_SIZE] = '\0';
-	strncat(insert_stmt, "INSERT INTO weather_history (", QUERY_BUF_SIZE);
+	if (config.sqlite_ignore_duplicates)
+		strncat(insert_stmt, "INSERT OR IGNORE INTO weather_history (", QUERY_BUF_SIZE);
+	else
+		strncat(insert_stmt, "INSERT INTO weather_history (", QUERY_BUF_SIZE);
 	for(i = 0; columns[i] != NULL; i++) {
 		  strncat(insert_stmt, columns[i], QUERY_BUF_SIZE);
 		  if(columns[i + 1] != NULL) strncat(insert_stmt, ", ", QUERY_BUF_SIZE);
@@ -524,6 +559,25 @@ int main(int argc, char *argv[])
 	// Open SQLite database file for new record(s) insertion
 	state_init(&s, argv[1], insert_stmt);
 
+	// Journal and sync settings of the config file, if any
+	if (config.sqlite_journal_mode[0] != '\0')
+	{
+		snprintf(pragma, sizeof(pragma), "PRAGMA journal_mode=%s", config.sqlite_journal_mode);
+		state_exec(&s, pragma);
+	}
+	if (config.sqlite_synchronous[0] != '\0')
+	{
+		snprintf(pragma, sizeof(pragma), "PRAGMA synchronous=%s", config.sqlite_synchronous);
+		state_exec(&s, pragma);
+	}
+
+	// The statement is prepared once, so look up its parameters once
+	for (i = 0; i < COLUMNS; i++)
+	{
+		snprintf(name, sizeof(name), ":%s", columns[i]);
+		param[i] = sqlite3_bind_parameter_index(s.statement, name);
+	}
+
 	// Start reading the history from the WS23XX
 	current_record = read_history_info(ws2300, &interval, &countdown, &time_last, &no_records);
 	                           
@@ -562,11 +616,23 @@ int main(int argc, char *argv[])
 	strftime(rtstring, sizeof(rtstring), "%Y-%m-%d %H:%M:%S", localtime(&rt));
 	
 	// Run through the records read
+	if (read_history_bulk(ws2300, (lastlog_record + 1) % HISTORY_RECORDS,
+	                      new_records, records) != new_records)
+		read_error_exit();
+
+	// All records go in as one transaction, so one sync to disk. The
+	// rollups of the records are part of it.
+	state_exec(&s, "BEGIN");
+
+	if (config.rollup && rollup_open_sqlite(&rollup, s.db) < 0)
+	{
+		state_finish(&s);
+		exit(EXIT_FAILURE);
+	}
+
 	for (i = 1; i <= new_records; i++)
 	{
-		next_record = (i + lastlog_record) % 0xAF;
-		
-		read_history_record(ws2300, next_record, &config,
+		decode_history_record(&records[i - 1], &config,
 		                    &temperature_in,
 		                    &temperature_out,
 		                    &pressure,
@@ -580,86 +646,102 @@ int main(int argc, char *argv[])
 
 		// First DB (date) column -> "sys_datetime" 
 		// PROCESSING LOCAL SYSTEM DATE & TIME
-		rc = sqlite3_bind_text(s.statement, sqlite3_bind_parameter_index(s.statement, ":sys_datetime"), rtstring, -1, SQLITE_STATIC);
+		rc = sqlite3_bind_text(s.statement, param[COL_SYS_DATETIME], rtstring, -1, SQLITE_STATIC);
 		check_rc(&s, rc);
 
 		// Build the second DB (date) column -> "ws_datetime"
 		// HISTORY RECORD DATE & TIME STORED BY WEATHERSTATION 
 		time_lastrecord_tm.tm_min += interval;
-		mktime(&time_lastrecord_tm);                 //normalize time_lastlog_tm
+		observation.time = mktime(&time_lastrecord_tm);  //normalize time_lastlog_tm
 		strftime(datestring, sizeof(datestring), "%Y-%m-%d %H:%M:%S", &time_lastrecord_tm);
-		rc = sqlite3_bind_text(s.statement, sqlite3_bind_parameter_index(s.statement, ":ws_datetime"), datestring, -1, SQLITE_STATIC);
+		rc = sqlite3_bind_text(s.statement, param[COL_WS_DATETIME], datestring, -1, SQLITE_STATIC);
 		check_rc(&s, rc);
 
 		// INDOOR TEMPERATURE
-		rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":temperature_in"), temperature_in);
+		rc = sqlite3_bind_double(s.statement, param[COL_TEMPERATURE_IN], temperature_in);
 		check_rc(&s, rc);
 
 		// OUTDOOR TEMPERATURE
-		rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":temperature_out"), temperature_out);
+		rc = sqlite3_bind_double(s.statement, param[COL_TEMPERATURE_OUT], temperature_out);
 		check_rc(&s, rc);
 
 		// DEWPOINT
-		rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":dewpoint"), dewpoint);
+		rc = sqlite3_bind_double(s.statement, param[COL_DEWPOINT], dewpoint);
 		check_rc(&s, rc);
 
 		// RELATIVE HUMIDITY INDOOR
-		rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":rel_humidity_in"), humidity_in);
+		rc = sqlite3_bind_double(s.statement, param[COL_REL_HUMIDITY_IN], humidity_in);
 		check_rc(&s, rc);
 
 		// RELATIVE HUMIDITY OUTDOOR
-		rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":rel_humidity_out"), humidity_out);
+		rc = sqlite3_bind_double(s.statement, param[COL_REL_HUMIDITY_OUT], humidity_out);
 		check_rc(&s, rc);
 
 		// READ WIND SPEED
-		rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":wind_speed"), windspeed);
+		rc = sqlite3_bind_double(s.statement, param[COL_WIND_SPEED], windspeed);
 		check_rc(&s, rc);
 
 		// WIND DEGREE
-		rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":wind_angle"), winddir_degrees);
+		rc = sqlite3_bind_double(s.statement, param[COL_WIND_ANGLE], winddir_degrees);
 		check_rc(&s, rc);
 
 		// WIND DIRECTION
-		rc = sqlite3_bind_text(s.statement, sqlite3_bind_parameter_index(s.statement, ":wind_direction"), directions[(int)(winddir_degrees/22.5)], -1, SQLITE_STATIC);
+		rc = sqlite3_bind_text(s.statement, param[COL_WIND_DIRECTION], directions[(int)(winddir_degrees/22.5)], -1, SQLITE_STATIC);
 		check_rc(&s, rc);
 		
 		// WINDCHILL
-		rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":wind_chill"), windchill);
+		rc = sqlite3_bind_double(s.statement, param[COL_WIND_CHILL], windchill);
 		check_rc(&s, rc);
 
 		// RAIN TOTAL
-		rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":rain_total"), rain);
+		rc = sqlite3_bind_double(s.statement, param[COL_RAIN_TOTAL], rain);
 		check_rc(&s, rc);
 
 		// RELATIVE PRESSURE
-		rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":rel_pressure"), pressure + pressure_term);
+		rc = sqlite3_bind_double(s.statement, param[COL_REL_PRESSURE], pressure + pressure_term);
 		check_rc(&s, rc);
 
-		/* Post values and reinit the query */
-		if ( i != new_records ) 
-		state_reinit(&s, insert_stmt);
-		else 
+		/* Post values and reset the query for the next record */
+		state_insert(&s);
+
+		// Only a record stored, not one ignored as a duplicate
+		if (config.rollup && sqlite3_changes(s.db) > 0)
 		{
-			rc = sqlite3_step(s.statement);
-			if (rc != SQLITE_DONE) 
+			observation.value[ROLLUP_TEMPERATURE_IN] = temperature_in;
+			observation.value[ROLLUP_TEMPERATURE_OUT] = temperature_out;
+			observation.value[ROLLUP_DEWPOINT] = dewpoint;
+			observation.value[ROLLUP_HUMIDITY_IN] = humidity_in;
+			observation.value[ROLLUP_HUMIDITY_OUT] = humidity_out;
+			observation.value[ROLLUP_WINDSPEED] = windspeed;
+			observation.value[ROLLUP_WINDCHILL] = windchill;
+			observation.value[ROLLUP_PRESSURE] = pressure + pressure_term;
+			observation.rain_total = rain;
+
+			if (rollup_add(&rollup, &observation) < 0)
 			{
-				fprintf(stderr, "\nUnable to execute query (%s): %s\n\n", sqlite3_sql(s.statement), sqlite3_errmsg(s.db));
-				sqlite3_close(s.db);
+				fprintf(stderr, "\nUnable to store the rollups: %s\n\n", sqlite3_errmsg(s.db));
+				rollup_close(&rollup);
+				state_finish(&s);
 				exit(EXIT_FAILURE);
 			}
-		}		
+		}
 	}
+
+	if (config.rollup)
+		rollup_close(&rollup);
+	state_exec(&s, "COMMIT");
+
 	// Goodbye and Goodnight
 	state_finish(&s);
 	close_weatherstation(ws2300);
 
 	// Convert the beginning of the execution
-	strftime(datestring, sizeof(datestring), "%Y-%m-%d %H:%M:%S", wst);
+	strftime(datestring, sizeof(datestring), "%Y-%m-%d %H:%M:%S", localtime(&start));
 	// We print the following summary row to the standard error output because if the program is started by the CRON 
 	// this message will appear in the CRON log file, if CRON started with the "-L"  option
-	if (wst_datetime_sync )
-	fprintf(stderr, "\nSQLitehistlog2300 - %s, %d record(s) has written into \"%s\" SQLite database file with time (%s) synchronization in %.1f second(s)\n\n", datestring, new_records, argv[1], argv[argc-1], difftime(time(NULL),mktime(wst)));
+	if (ws_datetime_sync)
+	fprintf(stderr, "\nSQLitehistlog2300 - %s, %d record(s) has written into \"%s\" SQLite database file with time (%s) synchronization in %.1f second(s)\n\n", datestring, new_records, argv[1], argv[argc-1], difftime(time(NULL),start));
 	else
-	fprintf(stderr, "\nSQLitehistlog2300 - %s, %d record(s) has written into \"%s\" SQLite database file in %.1f second(s)\n\n", datestring, new_records, argv[1], difftime(time(NULL),mktime(wst)));
+	fprintf(stderr, "\nSQLitehistlog2300 - %s, %d record(s) has written into \"%s\" SQLite database file in %.1f second(s)\n\n", datestring, new_records, argv[1], difftime(time(NULL),start));
 	return(EXIT_SUCCESS);
 } 
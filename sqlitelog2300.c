@@ -20,6 +20,7 @@
 
 #include <sqlite3.h>
 #include "rw2300.h"
+#include "rollup2300.h"
 
 /********************************************************************
  * print_usage prints a short user guide
@@ -78,6 +79,7 @@ void state_init(struct state* state, struct config_type *config, const char *db_
 
 	/* Connect to the weather station */
 	state->station = open_weatherstation(config->serial_device_name);
+	configure_weatherstation(state->station, config);
 
 	/* Connect to the database */
 	rc = sqlite3_open(db_path, &state->db);
@@ -167,6 +169,30 @@ void check_rc(struct state* state, int rc)
 	}
 }
 
+/********************************************************************
+ * state_rollup adds the observation to the hourly, daily and monthly
+ * rollups in the table weather_rollup (rollupsqlite2300.c)
+ *
+ * Input:	Pointer to state structure with the open database
+ *			The values stored
+ *
+ * Returns: 0 on success and -1 on error
+ *
+ ********************************************************************/
+int state_rollup(struct state* state, struct rollup_observation *observation)
+{
+	struct rollup_store rollup;
+	int rc;
+
+	if(rollup_open_sqlite(&rollup, state->db) < 0)
+		return -1;
+
+	rc = rollup_add(&rollup, observation) < 0 ? -1 : 0;
+	rollup_close(&rollup);
+
+	return rc;
+}
+
 /********** MAIN PROGRAM ************************************************
  *
  * This program reads current weather data from a WS2300
@@ -216,6 +242,7 @@ int main(int argc, char *argv[])
 
 	time_t rt;
 	char rtstring[50];
+	struct rollup_observation observation;
 
 	/* Read the configuration */
 	if(argc >= 3) {
@@ -235,6 +262,8 @@ int main(int argc, char *argv[])
         /* Inserted by SziroG   
 	   CURRENT LOCAL DATE & TIME */
 	time(&rt);
+	rollup_observation_clear(&observation);
+	observation.time = rt;
 	strftime(rtstring, sizeof(rtstring), "%Y-%m-%d %H:%M:%S", localtime(&rt));
 	rc = sqlite3_bind_text(s.statement, sqlite3_bind_parameter_index(s.statement, ":datetime"), rtstring, -1, SQLITE_STATIC);
 	check_rc(&s, rc);
@@ -243,27 +272,33 @@ int main(int argc, char *argv[])
 
 	/* INDOOR TEMPERATURE */
 	/* TODO: add contraints to values and error out if invalid E.g. temp over 60 */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":temperature_in"), temperature_indoor(s.station, config.temperature_conv));
+	observation.value[ROLLUP_TEMPERATURE_IN] = temperature_indoor(s.station, config.temperature_conv);
+	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":temperature_in"), observation.value[ROLLUP_TEMPERATURE_IN]);
 	check_rc(&s, rc);
 
 	/* OUTDOOR TEMPERATURE */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":temperature_out"), temperature_outdoor(s.station, config.temperature_conv));
+	observation.value[ROLLUP_TEMPERATURE_OUT] = temperature_outdoor(s.station, config.temperature_conv);
+	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":temperature_out"), observation.value[ROLLUP_TEMPERATURE_OUT]);
 	check_rc(&s, rc);
 
 	/* READ DEWPOINT */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":dewpoint"), dewpoint(s.station, config.temperature_conv));
+	observation.value[ROLLUP_DEWPOINT] = dewpoint(s.station, config.temperature_conv);
+	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":dewpoint"), observation.value[ROLLUP_DEWPOINT]);
 	check_rc(&s, rc);
 
 	/* READ RELATIVE HUMIDITY INDOOR */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":rel_humidity_in"), humidity_indoor(s.station));
+	observation.value[ROLLUP_HUMIDITY_IN] = humidity_indoor(s.station);
+	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":rel_humidity_in"), observation.value[ROLLUP_HUMIDITY_IN]);
 	check_rc(&s, rc);
 
 	/* READ RELATIVE HUMIDITY OUTDOOR */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":rel_humidity_out"), humidity_outdoor(s.station));
+	observation.value[ROLLUP_HUMIDITY_OUT] = humidity_outdoor(s.station);
+	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":rel_humidity_out"), observation.value[ROLLUP_HUMIDITY_OUT]);
 	check_rc(&s, rc);
 
 	/* READ WIND SPEED AND DIRECTION */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":wind_speed"), wind_all(s.station, config.wind_speed_conv_factor, &winddir_index, winddir));
+	observation.value[ROLLUP_WINDSPEED] = wind_all(s.station, config.wind_speed_conv_factor, &winddir_index, winddir);
+	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":wind_speed"), observation.value[ROLLUP_WINDSPEED]);
 	check_rc(&s, rc);
 
 	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":wind_angle"), winddir[0]);
@@ -273,7 +308,8 @@ int main(int argc, char *argv[])
 	check_rc(&s, rc);
 
 	/* READ WINDCHILL */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":wind_chill"), windchill(s.station, config.temperature_conv));
+	observation.value[ROLLUP_WINDCHILL] = windchill(s.station, config.temperature_conv);
+	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":wind_chill"), observation.value[ROLLUP_WINDCHILL]);
 	check_rc(&s, rc);
 
 	/* READ RAIN 1H */
@@ -285,11 +321,13 @@ int main(int argc, char *argv[])
 	check_rc(&s, rc);
 
 	/* READ RAIN TOTAL */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":rain_total"), rain_total(s.station, config.rain_conv_factor));
+	observation.rain_total = rain_total(s.station, config.rain_conv_factor);
+	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":rain_total"), observation.rain_total);
 	check_rc(&s, rc);
 
 	/* READ RELATIVE PRESSURE */
-	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":rel_pressure"), rel_pressure(s.station, config.pressure_conv_factor));
+	observation.value[ROLLUP_PRESSURE] = rel_pressure(s.station, config.pressure_conv_factor);
+	rc = sqlite3_bind_double(s.statement, sqlite3_bind_parameter_index(s.statement, ":rel_pressure"), observation.value[ROLLUP_PRESSURE]);
 	check_rc(&s, rc);
 
 	/* READ TENDENCY AND FORECAST */
@@ -299,7 +337,14 @@ int main(int argc, char *argv[])
 	rc = sqlite3_bind_text(s.statement, sqlite3_bind_parameter_index(s.statement, ":forecast"), forecast, -1, SQLITE_STATIC);
 	check_rc(&s, rc);
 
-	/* Run the query */
+	/* Run the query, with the rollups in the same transaction */
+	if(config.rollup && sqlite3_exec(s.db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)
+	{
+		fprintf(stderr, "\nError starting transaction: %s\n", sqlite3_errmsg(s.db));
+		state_finish(&s);
+		exit(EXIT_FAILURE);
+	}
+
 	rc = sqlite3_step(s.statement);
 	if(rc != SQLITE_DONE)
 	{
@@ -308,6 +353,17 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	if(config.rollup)
+	{
+		if(state_rollup(&s, &observation) < 0 ||
+		   sqlite3_exec(s.db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+		{
+			fprintf(stderr, "\nError storing rollups: %s\n", sqlite3_errmsg(s.db));
+			state_finish(&s);
+			exit(EXIT_FAILURE);
+		}
+	}
+
 	state_finish(&s);
 	return(EXIT_SUCCESS);
 }
@@ -0,0 +1,1102 @@
+/*  open2300 - store2300.c
+ *
+ *  Columnar time series store of the observations of log2300 and the
+ *  history records.
+ *
+ *  A store is two files. The store file itself is a header followed by
+ *  chunks that are never changed once written. Each chunk holds up to
+ *  STORE_CHUNK_ROWS rows of one UTC day, column by column:
+ *  - the times as delta of delta, mostly a single 0 bit a row
+ *  - each double as the change from the one before: as an integer when
+ *    the column has few decimals (all values of the station do), else
+ *    XOR encoded. A value that did not change is a 0 bit.
+ *  - each small integer (humidity, wind direction, tendency, forecast)
+ *    bit packed in the width its range in the chunk needs
+ *  and starts with a header with its times and the min and max of every
+ *  column, so a reader skips the chunks outside a time range without
+ *  decoding them. The file is meant to be mapped.
+ *
+ *  The rows of the day that is not complete yet are kept uncompressed
+ *  in the file store.tail, which also records how many bytes of the
+ *  store file are complete. A chunk is appended and flushed to disk
+ *  before the new tail is put in place. A reader goes by the tail, so
+ *  after a crash in between it sees the old tail and not the chunk;
+ *  the next store_append finds the chunk and drops its rows from the
+ *  tail.
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#include "store2300.h"
+
+#define STREAMS   (1 + STORE_DOUBLES + STORE_CODES)
+#define NAME_SIZE 300
+
+/* Start of a .tail file */
+struct store_tail_header
+{
+	char     magic[8];
+	int64_t  sealed_size;              //bytes of complete chunks in the store file
+	int64_t  sealed_last;              //time of the last row in a chunk
+	uint32_t rows;                     //rows following
+	uint32_t reserved;
+};
+
+/* A row of a .tail file */
+struct store_tail_row
+{
+	int64_t  time;
+	double   value[STORE_DOUBLES];
+	int32_t  code[STORE_CODES];
+	int32_t  reserved;
+};
+
+struct bit_writer
+{
+	unsigned char *data;
+	uint32_t bits;
+};
+
+struct bit_reader
+{
+	const unsigned char *data;
+	uint32_t bits;
+	uint32_t position;
+};
+
+#define DECIMAL_SCALES 4
+static const double decimal_scale[DECIMAL_SCALES] = { 1, 10, 100, 1000 };
+
+const char *store_tendencies[3] = { "Steady", "Rising", "Falling" };
+const char *store_forecasts[3] = { "Rainy", "Cloudy", "Sunny" };
+
+
+/********************************************************************
+ * store_row_clear marks every value of a row as not known
+ ********************************************************************/
+void store_row_clear(struct store_row *row)
+{
+	int i;
+
+	for (i = 0; i < STORE_DOUBLES; i++)
+		row->value[i] = NAN;
+	for (i = 0; i < STORE_CODES; i++)
+		row->code[i] = STORE_NONE;
+}
+
+
+/********************************************************************
+ * store_code_index finds a text like the tendency among its values
+ *
+ * Returns: the index or STORE_NONE
+ ********************************************************************/
+int store_code_index(const char *text, const char *values[], int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (strcmp(text, values[i]) == 0)
+			return i;
+	}
+
+	return STORE_NONE;
+}
+
+
+/********************************************************************
+ * put_bits appends the count low bits of value, most significant
+ * first. The buffer must be zeroed.
+ ********************************************************************/
+static void put_bits(struct bit_writer *w, uint64_t value, int count)
+{
+	int room, take;
+
+	while (count > 0)
+	{
+		room = 8 - (w->bits & 7);
+		take = count < room ? count : room;
+		w->data[w->bits >> 3] |= ((value >> (count - take)) & ((1U << take) - 1))
+		                         << (room - take);
+		w->bits += take;
+		count -= take;
+	}
+}
+
+
+/********************************************************************
+ * get_bits reads count bits written by put_bits. Reading past the end
+ * of the stream gives zeros.
+ ********************************************************************/
+static uint64_t get_bits(struct bit_reader *r, int count)
+{
+	uint64_t value = 0;
+	int room, take;
+
+	while (count > 0)
+	{
+		if (r->position >= r->bits)
+			return value << count;
+
+		room = 8 - (r->position & 7);
+		take = count < room ? count : room;
+		value = (value << take) |
+		        ((r->data[r->position >> 3] >> (room - take)) & ((1U << take) - 1));
+		r->position += take;
+		count -= take;
+	}
+
+	return value;
+}
+
+
+/********************************************************************
+ * checksum of the streams of a chunk (FNV-1a)
+ ********************************************************************/
+static uint32_t stream_checksum(const unsigned char *data, long length)
+{
+	uint32_t hash = 2166136261U;
+	long i;
+
+	for (i = 0; i < length; i++)
+		hash = (hash ^ data[i]) * 16777619U;
+
+	return hash;
+}
+
+
+/********************************************************************
+ * encode_times writes the times after the first as delta of delta
+ * in classes of 1, 9, 12, 16 and 36 bits
+ ********************************************************************/
+static void encode_times(struct bit_writer *w, struct store_row *rows, int count)
+{
+	int64_t delta, previous_delta = 0, dod;
+	int i;
+
+	for (i = 1; i < count; i++)
+	{
+		delta = (int64_t)rows[i].time - rows[i - 1].time;
+		dod = delta - previous_delta;
+		previous_delta = delta;
+
+		if (dod == 0)
+			put_bits(w, 0, 1);
+		else if (dod >= -63 && dod <= 64)
+		{
+			put_bits(w, 2, 2);
+			put_bits(w, dod + 63, 7);
+		}
+		else if (dod >= -255 && dod <= 256)
+		{
+			put_bits(w, 6, 3);
+			put_bits(w, dod + 255, 9);
+		}
+		else if (dod >= -2047 && dod <= 2048)
+		{
+			put_bits(w, 14, 4);
+			put_bits(w, dod + 2047, 12);
+		}
+		else
+		{
+			put_bits(w, 15, 4);
+			put_bits(w, (uint32_t)(int32_t)dod, 32);
+		}
+	}
+}
+
+
+static void decode_times(struct bit_reader *r, int64_t first,
+                         struct store_row *rows, int count)
+{
+	int64_t delta = 0, dod;
+	int i;
+
+	if (count > 0)
+		rows[0].time = first;
+
+	for (i = 1; i < count; i++)
+	{
+		if (get_bits(r, 1) == 0)
+			dod = 0;
+		else if (get_bits(r, 1) == 0)
+			dod = (int64_t)get_bits(r, 7) - 63;
+		else if (get_bits(r, 1) == 0)
+			dod = (int64_t)get_bits(r, 9) - 255;
+		else if (get_bits(r, 1) == 0)
+			dod = (int64_t)get_bits(r, 12) - 2047;
+		else
+			dod = (int32_t)(uint32_t)get_bits(r, 32);
+
+		delta += dod;
+		rows[i].time = rows[i - 1].time + delta;
+	}
+}
+
+
+/********************************************************************
+ * decimal_places finds the fewest decimals, up to 3, that give back
+ * every value of a double column exactly when it is stored as an
+ * integer. The values of the station and of the logs have 1 to 3.
+ *
+ * Returns: the decimals or -1 if the column needs the XOR encoding
+ ********************************************************************/
+static int decimal_places(struct store_row *rows, int count, int column)
+{
+	double value, back;
+	int decimals, i;
+
+	for (decimals = 0; decimals < DECIMAL_SCALES; decimals++)
+	{
+		for (i = 0; i < count; i++)
+		{
+			value = rows[i].value[column];
+			if (isnan(value) || fabs(value) * decimal_scale[decimals] >= 4503599627370496.0)
+				return -1;
+
+			back = (double)llround(value * decimal_scale[decimals]) / decimal_scale[decimals];
+			if (memcmp(&back, &value, sizeof(value)) != 0)
+				break;
+		}
+
+		if (i == count)
+			return decimals;
+	}
+
+	return -1;
+}
+
+
+/********************************************************************
+ * encode_doubles writes one double column.
+ *
+ * A column of values with few decimals is stored as integers: the
+ * first in 64 bits, then the change from the one before in classes
+ * of 1, 6, 11, 20 and 68 bits.
+ *
+ * Any other column is XOR encoded. A value equal to the one before
+ * is a 0 bit, else the changed bits are written in the window of
+ * leading and trailing zeros of the last change if they fit or else
+ * with a new window.
+ *
+ * The stream starts with 3 bits: 0 for XOR, else 1 + the decimals.
+ ********************************************************************/
+static void encode_doubles(struct bit_writer *w, struct store_row *rows,
+                           int count, int column)
+{
+	uint64_t previous, value, xor;
+	int64_t integer, last, delta;
+	int leading = -1, trailing = 0;
+	int decimals, lz, tz, i;
+
+	decimals = decimal_places(rows, count, column);
+	put_bits(w, decimals + 1, 3);
+
+	if (decimals >= 0)
+	{
+		last = llround(rows[0].value[column] * decimal_scale[decimals]);
+		put_bits(w, (uint64_t)last, 64);
+
+		for (i = 1; i < count; i++)
+		{
+			integer = llround(rows[i].value[column] * decimal_scale[decimals]);
+			delta = integer - last;
+			last = integer;
+
+			if (delta == 0)
+				put_bits(w, 0, 1);
+			else if (delta >= -8 && delta <= 7)
+			{
+				put_bits(w, 2, 2);
+				put_bits(w, delta + 8, 4);
+			}
+			else if (delta >= -128 && delta <= 127)
+			{
+				put_bits(w, 6, 3);
+				put_bits(w, delta + 128, 8);
+			}
+			else if (delta >= -32768 && delta <= 32767)
+			{
+				put_bits(w, 14, 4);
+				put_bits(w, delta + 32768, 16);
+			}
+			else
+			{
+				put_bits(w, 15, 4);
+				put_bits(w, (uint64_t)delta, 64);
+			}
+		}
+
+		return;
+	}
+
+	memcpy(&previous, &rows[0].value[column], sizeof(previous));
+	put_bits(w, previous, 64);
+
+	for (i = 1; i < count; i++)
+	{
+		memcpy(&value, &rows[i].value[column], sizeof(value));
+		xor = value ^ previous;
+		previous = value;
+
+		if (xor == 0)
+		{
+			put_bits(w, 0, 1);
+			continue;
+		}
+
+		lz = __builtin_clzll(xor);
+		tz = __builtin_ctzll(xor);
+		if (lz > 31)
+			lz = 31;
+
+		if (leading >= 0 && lz >= leading && tz >= trailing)
+		{
+			put_bits(w, 2, 2);
+			put_bits(w, xor >> trailing, 64 - leading - trailing);
+		}
+		else
+		{
+			put_bits(w, 3, 2);
+			put_bits(w, lz, 5);
+			put_bits(w, 64 - lz - tz - 1, 6);
+			put_bits(w, xor >> tz, 64 - lz - tz);
+			leading = lz;
+			trailing = tz;
+		}
+	}
+}
+
+
+static void decode_doubles(struct bit_reader *r, struct store_row *rows,
+                           int count, int column)
+{
+	uint64_t value, xor;
+	int64_t integer;
+	double scale;
+	int leading = 0, trailing = 0;
+	int decimals, i;
+
+	decimals = (int)get_bits(r, 3) - 1;
+
+	if (decimals >= 0 && decimals < DECIMAL_SCALES)
+	{
+		scale = decimal_scale[decimals];
+		integer = (int64_t)get_bits(r, 64);
+		rows[0].value[column] = (double)integer / scale;
+
+		for (i = 1; i < count; i++)
+		{
+			if (get_bits(r, 1) == 0)
+				;
+			else if (get_bits(r, 1) == 0)
+				integer += (int64_t)get_bits(r, 4) - 8;
+			else if (get_bits(r, 1) == 0)
+				integer += (int64_t)get_bits(r, 8) - 128;
+			else if (get_bits(r, 1) == 0)
+				integer += (int64_t)get_bits(r, 16) - 32768;
+			else
+				integer += (int64_t)get_bits(r, 64);
+
+			rows[i].value[column] = (double)integer / scale;
+		}
+
+		return;
+	}
+
+	value = get_bits(r, 64);
+	memcpy(&rows[0].value[column], &value, sizeof(value));
+
+	for (i = 1; i < count; i++)
+	{
+		if (get_bits(r, 1) != 0)
+		{
+			if (get_bits(r, 1) != 0)
+			{
+				leading = get_bits(r, 5);
+				trailing = 64 - leading - (get_bits(r, 6) + 1);
+			}
+
+			xor = get_bits(r, 64 - leading - trailing) << trailing;
+			value ^= xor;
+		}
+
+		memcpy(&rows[i].value[column], &value, sizeof(value));
+	}
+}
+
+
+/********************************************************************
+ * code_width is the bits a code of the chunk takes: enough for its
+ * range above code_min and the all ones of a code not known
+ ********************************************************************/
+static int code_width(struct store_chunk *chunk, int code)
+{
+	uint64_t range;
+	int width = 1;
+
+	if (chunk->code_min[code] == STORE_NONE)
+		return 0;
+
+	range = (int64_t)chunk->code_max[code] - chunk->code_min[code];
+	while (((uint64_t)1 << width) - 1 <= range)
+		width++;
+
+	return width;
+}
+
+
+/********************************************************************
+ * encode_chunk builds the chunk of rows of one day
+ *
+ * Returns: the chunk, to be freed, or NULL if out of memory
+ ********************************************************************/
+static struct store_chunk *encode_chunk(struct store_row *rows, int count)
+{
+	struct store_chunk *chunk;
+	struct bit_writer w;
+	unsigned char *streams;
+	long bound;
+	int s, i, code, width;
+
+	// Room for the worst case of every stream
+	bound = sizeof(struct store_chunk) + 8 +
+	        ((long)count * 36 + 8) / 8 +
+	        STORE_DOUBLES * ((long)count * 77 + 3 + 64 + 8) / 8 +
+	        STORE_CODES * ((long)count * 33 + 8) / 8;
+
+	if ((chunk = calloc(1, bound)) == NULL)
+		return NULL;
+
+	chunk->magic = STORE_CHUNK_MAGIC;
+	chunk->rows = count;
+	chunk->time_first = rows[0].time;
+	chunk->time_last = rows[count - 1].time;
+
+	// The index: min and max of every column
+	for (s = 0; s < STORE_DOUBLES; s++)
+	{
+		chunk->min[s] = chunk->max[s] = NAN;
+		for (i = 0; i < count; i++)
+		{
+			if (isnan(rows[i].value[s]))
+				continue;
+			if (isnan(chunk->min[s]) || rows[i].value[s] < chunk->min[s])
+				chunk->min[s] = rows[i].value[s];
+			if (isnan(chunk->max[s]) || rows[i].value[s] > chunk->max[s])
+				chunk->max[s] = rows[i].value[s];
+		}
+	}
+
+	for (s = 0; s < STORE_CODES; s++)
+	{
+		chunk->code_min[s] = chunk->code_max[s] = STORE_NONE;
+		for (i = 0; i < count; i++)
+		{
+			code = rows[i].code[s];
+			if (code < 0)
+				continue;
+			if (chunk->code_min[s] == STORE_NONE || code < chunk->code_min[s])
+				chunk->code_min[s] = code;
+			if (chunk->code_max[s] == STORE_NONE || code > chunk->code_max[s])
+				chunk->code_max[s] = code;
+		}
+	}
+
+	streams = (unsigned char *)chunk;
+	w.data = streams + sizeof(struct store_chunk);
+	w.bits = 0;
+
+	for (s = 0; s < STREAMS; s++)
+	{
+		// Every stream starts on a byte
+		w.bits = (w.bits + 7) & ~7U;
+		chunk->offset[s] = sizeof(struct store_chunk) + w.bits / 8;
+
+		if (s == 0)
+			encode_times(&w, rows, count);
+		else if (s <= STORE_DOUBLES)
+			encode_doubles(&w, rows, count, s - 1);
+		else
+		{
+			// Codes above the chunk's minimum in as few bits as it takes
+			code = s - 1 - STORE_DOUBLES;
+			width = code_width(chunk, code);
+			for (i = 0; i < count && width > 0; i++)
+			{
+				if (rows[i].code[code] < 0)
+					put_bits(&w, ((uint64_t)1 << width) - 1, width);
+				else
+					put_bits(&w, rows[i].code[code] - chunk->code_min[code], width);
+			}
+		}
+
+		chunk->bits[s] = w.bits - (chunk->offset[s] - sizeof(struct store_chunk)) * 8;
+	}
+
+	chunk->size = (sizeof(struct store_chunk) + (w.bits + 7) / 8 + 7) & ~7U;
+	chunk->checksum = stream_checksum(streams + sizeof(struct store_chunk),
+	                                  chunk->size - sizeof(struct store_chunk));
+
+	return chunk;
+}
+
+
+/********************************************************************
+ * store_decode_chunk
+ * Decode the rows of a chunk, the time and the columns asked for.
+ * The other values of the rows are marked not known.
+ *
+ * Input:  chunk - as returned by store_next_chunk
+ *         columns - STORE_COLUMN_DOUBLE() and STORE_COLUMN_CODE() bits
+ *
+ * Output: rows - chunk->rows of them
+ *
+ * Returns: number of rows
+ *
+ ********************************************************************/
+int store_decode_chunk(struct store_chunk *chunk, unsigned int columns,
+                       struct store_row *rows)
+{
+	struct bit_reader r;
+	uint64_t value, none;
+	int count = chunk->rows;
+	int s, i, code, width;
+
+	for (i = 0; i < count; i++)
+		store_row_clear(&rows[i]);
+
+	for (s = 0; s < STREAMS; s++)
+	{
+		if (s > 0 && !(columns & (1U << (s - 1))))
+			continue;
+
+		r.data = (unsigned char *)chunk + chunk->offset[s];
+		r.bits = chunk->bits[s];
+		r.position = 0;
+
+		if (s == 0)
+			decode_times(&r, chunk->time_first, rows, count);
+		else if (s <= STORE_DOUBLES)
+			decode_doubles(&r, rows, count, s - 1);
+		else
+		{
+			code = s - 1 - STORE_DOUBLES;
+			width = code_width(chunk, code);
+			none = ((uint64_t)1 << width) - 1;
+			for (i = 0; i < count && width > 0; i++)
+			{
+				value = get_bits(&r, width);
+				if (value != none)
+					rows[i].code[code] = chunk->code_min[code] + (int)value;
+			}
+		}
+	}
+
+	return count;
+}
+
+
+/********************************************************************
+ * valid_chunk checks that a chunk at offset lies within size bytes
+ * and, if check is set, that its streams are intact
+ ********************************************************************/
+static struct store_chunk *valid_chunk(unsigned char *map, long size,
+                                       long offset, int check)
+{
+	struct store_chunk *chunk = (struct store_chunk *)(map + offset);
+
+	if (offset + (long)sizeof(struct store_chunk) > size ||
+	    chunk->magic != STORE_CHUNK_MAGIC || chunk->rows == 0 ||
+	    chunk->size < sizeof(struct store_chunk) || (chunk->size & 7) != 0 ||
+	    offset + (long)chunk->size > size)
+		return NULL;
+
+	if (check && chunk->checksum !=
+	    stream_checksum(map + offset + sizeof(struct store_chunk),
+	                    chunk->size - sizeof(struct store_chunk)))
+		return NULL;
+
+	return chunk;
+}
+
+
+/********************************************************************
+ * walk_chunks finds where the complete chunks of a store file end,
+ * starting from a known good offset
+ *
+ * Output: last - time of the last row of the last chunk, unchanged if
+ *                there is no chunk after offset
+ *
+ * Returns: offset after the last complete chunk
+ ********************************************************************/
+static long walk_chunks(unsigned char *map, long size, long offset, int64_t *last)
+{
+	struct store_chunk *chunk;
+
+	while ((chunk = valid_chunk(map, size, offset, 1)) != NULL &&
+	       chunk->time_first > *last)
+	{
+		*last = chunk->time_last;
+		offset += chunk->size;
+	}
+
+	return offset;
+}
+
+
+/********************************************************************
+ * read_tail reads a .tail file
+ *
+ * Output: header - the header, zeroed if there is no tail file
+ *         rows - the rows, at most STORE_CHUNK_ROWS
+ *
+ * Returns: 1 if the tail file was read, 0 if there is none and -1 if
+ *          it is not a tail file
+ ********************************************************************/
+static int read_tail(char *name, struct store_tail_header *header,
+                     struct store_row *rows)
+{
+	struct store_tail_row row;
+	FILE *file;
+	unsigned int i;
+	int j;
+
+	memset(header, 0, sizeof(*header));
+
+	if ((file = fopen(name, "rb")) == NULL)
+		return 0;
+
+	if (fread(header, sizeof(*header), 1, file) != 1 ||
+	    memcmp(header->magic, STORE_TAIL_MAGIC, 8) != 0)
+	{
+		fclose(file);
+		return -1;
+	}
+
+	if (header->rows > STORE_CHUNK_ROWS)
+		header->rows = STORE_CHUNK_ROWS;
+
+	for (i = 0; i < header->rows && fread(&row, sizeof(row), 1, file) == 1; i++)
+	{
+		rows[i].time = row.time;
+		memcpy(rows[i].value, row.value, sizeof(row.value));
+		for (j = 0; j < STORE_CODES; j++)
+			rows[i].code[j] = row.code[j];
+	}
+
+	// Rows after a short write are not there
+	header->rows = i;
+	fclose(file);
+
+	return 1;
+}
+
+
+/********************************************************************
+ * write_tail_rows writes rows in the form of a .tail file
+ *
+ * Returns: 0 on success and -1 if fail
+ ********************************************************************/
+static int write_tail_rows(FILE *file, struct store_row *rows, int count)
+{
+	struct store_tail_row row;
+	int i, j;
+
+	for (i = 0; i < count; i++)
+	{
+		memset(&row, 0, sizeof(row));
+		row.time = rows[i].time;
+		memcpy(row.value, rows[i].value, sizeof(row.value));
+		for (j = 0; j < STORE_CODES; j++)
+			row.code[j] = rows[i].code[j];
+
+		if (fwrite(&row, sizeof(row), 1, file) != 1)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * save_tail puts a new tail file in place
+ *
+ * Returns: 0 on success and -1 if fail
+ ********************************************************************/
+static int save_tail(char *name, struct store_tail_header *header,
+                     struct store_row *rows)
+{
+	char tempname[NAME_SIZE + 4];
+	FILE *file;
+	int ok;
+
+	snprintf(tempname, sizeof(tempname), "%s.new", name);
+
+	if ((file = fopen(tempname, "wb")) == NULL)
+		return -1;
+
+	ok = fwrite(header, sizeof(*header), 1, file) == 1 &&
+	     write_tail_rows(file, rows, header->rows) == 0;
+
+	if (fclose(file) != 0 || !ok || replace_file(tempname, name) < 0)
+	{
+		remove(tempname);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * open_store_file opens a store file for appending, creating it with
+ * its header, and finds where its complete chunks end
+ *
+ * Output: tail - sealed_size and sealed_last brought up to date with
+ *                the store file
+ *
+ * Returns: the open file or NULL
+ ********************************************************************/
+static FILE *open_store_file(char *path, struct store_tail_header *tail)
+{
+	struct store_file_header header;
+	unsigned char *map;
+	long size, start;
+	FILE *file;
+
+	if ((file = fopen(path, "r+b")) == NULL)
+	{
+		if ((file = fopen(path, "w+b")) == NULL)
+			return NULL;
+
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, STORE_MAGIC, 8);
+		header.byte_order = STORE_BYTE_ORDER;
+		header.doubles = STORE_DOUBLES;
+		header.codes = STORE_CODES;
+
+		if (fwrite(&header, sizeof(header), 1, file) != 1 || flush_file(file) < 0)
+		{
+			fclose(file);
+			return NULL;
+		}
+
+		tail->sealed_size = sizeof(header);
+		tail->sealed_last = 0;
+
+		return file;
+	}
+
+	if ((map = map_file(path, &size)) == NULL || size < (long)sizeof(header) ||
+	    memcmp(map, STORE_MAGIC, 8) != 0 ||
+	    ((struct store_file_header *)map)->byte_order != STORE_BYTE_ORDER ||
+	    ((struct store_file_header *)map)->doubles != STORE_DOUBLES ||
+	    ((struct store_file_header *)map)->codes != STORE_CODES)
+	{
+		fprintf(stderr, "%s is not a store of this version and machine\n", path);
+		unmap_file(map, size);
+		fclose(file);
+		return NULL;
+	}
+
+	// Chunks written after the tail, by a writer that died before it
+	// replaced the tail, are kept. A torn chunk is written over.
+	if (tail->sealed_size >= (long)sizeof(header) && tail->sealed_size <= size)
+		start = tail->sealed_size;
+	else
+	{
+		start = sizeof(header);
+		tail->sealed_last = 0;
+	}
+
+	tail->sealed_size = walk_chunks(map, size, start, &tail->sealed_last);
+	unmap_file(map, size);
+
+	return file;
+}
+
+
+/********************************************************************
+ * store_append
+ * Append rows to a store. Rows not newer than the last row stored are
+ * skipped, the store is append only. A UTC day of rows, or
+ * STORE_CHUNK_ROWS of them, becomes a chunk when the next day starts.
+ *
+ * Input:  path - the store file, created if needed
+ *         rows - in order of time
+ *         count - number of rows
+ *
+ * Returns: number of rows stored, -1 on error
+ *
+ ********************************************************************/
+int store_append(char *path, struct store_row *rows, int count)
+{
+	static struct store_row tail_rows[STORE_CHUNK_ROWS];
+	struct store_tail_header tail;
+	struct store_chunk *chunk;
+	char tailname[NAME_SIZE];
+	FILE *file, *tailfile;
+	int64_t last;
+	int rewrite = 0, old_rows, appended = 0;
+	int i, j;
+
+	snprintf(tailname, sizeof(tailname), "%s.tail", path);
+
+	if (read_tail(tailname, &tail, tail_rows) < 0)
+	{
+		fprintf(stderr, "%s is not a store tail\n", tailname);
+		return -1;
+	}
+
+	if ((file = open_store_file(path, &tail)) == NULL)
+		return -1;
+
+	// Tail rows that a chunk already has
+	for (i = j = 0; i < (int)tail.rows; i++)
+	{
+		if (tail_rows[i].time > tail.sealed_last)
+			tail_rows[j++] = tail_rows[i];
+	}
+	if (j != (int)tail.rows)
+		rewrite = 1;
+	tail.rows = j;
+	old_rows = j;
+
+	last = tail.rows > 0 ? tail_rows[tail.rows - 1].time : tail.sealed_last;
+
+	for (i = 0; i < count; i++)
+	{
+		if (rows[i].time <= last)
+			continue;
+
+		// A new day or a full tail closes the chunk
+		if (tail.rows > 0 &&
+		    (tail.rows == STORE_CHUNK_ROWS ||
+		     rows[i].time / STORE_CHUNK_TIME != tail_rows[0].time / STORE_CHUNK_TIME))
+		{
+			if ((chunk = encode_chunk(tail_rows, tail.rows)) == NULL ||
+			    fseek(file, tail.sealed_size, SEEK_SET) != 0 ||
+			    fwrite(chunk, chunk->size, 1, file) != 1 ||
+			    flush_file(file) < 0)
+			{
+				fprintf(stderr, "Cannot write chunk to %s\n", path);
+				free(chunk);
+				fclose(file);
+				return -1;
+			}
+
+			tail.sealed_size += chunk->size;
+			tail.sealed_last = chunk->time_last;
+			tail.rows = 0;
+			old_rows = 0;
+			rewrite = 1;
+			free(chunk);
+		}
+
+		tail_rows[tail.rows++] = rows[i];
+		last = rows[i].time;
+		appended++;
+	}
+
+	fclose(file);
+
+	if (!rewrite && appended == 0)
+		return 0;
+
+	memcpy(tail.magic, STORE_TAIL_MAGIC, 8);
+
+	if (!rewrite)
+	{
+		// Only new rows: they are added to the tail file in place and
+		// then counted in its header
+		if ((tailfile = fopen(tailname, "r+b")) == NULL)
+			rewrite = 1;
+		else
+		{
+			if (fseek(tailfile, sizeof(tail) + (long)old_rows * sizeof(struct store_tail_row),
+			          SEEK_SET) != 0 ||
+			    write_tail_rows(tailfile, tail_rows + old_rows, tail.rows - old_rows) < 0 ||
+			    flush_file(tailfile) < 0 ||
+			    fseek(tailfile, 0, SEEK_SET) != 0 ||
+			    fwrite(&tail, sizeof(tail), 1, tailfile) != 1)
+				appended = -1;
+
+			if (fclose(tailfile) != 0)
+				appended = -1;
+		}
+	}
+
+	if (rewrite && save_tail(tailname, &tail, tail_rows) < 0)
+		appended = -1;
+
+	if (appended < 0)
+		fprintf(stderr, "Cannot write file %s\n", tailname);
+
+	return appended;
+}
+
+
+/********************************************************************
+ * store_open
+ * Open a store for reading: map its complete chunks and read its tail.
+ *
+ * Input:  path - the store file
+ *
+ * Output: store - the open store
+ *
+ * Returns: 0 on success and -1 if there is no store
+ *
+ ********************************************************************/
+int store_open(struct store *store, char *path)
+{
+	struct store_tail_header tail;
+	struct store_file_header *header;
+	char tailname[NAME_SIZE];
+	int64_t last = 0;
+	int have_tail;
+
+	memset(store, 0, sizeof(*store));
+
+	snprintf(tailname, sizeof(tailname), "%s.tail", path);
+
+	if ((store->tail = malloc(STORE_CHUNK_ROWS * sizeof(struct store_row))) == NULL ||
+	    (have_tail = read_tail(tailname, &tail, store->tail)) < 0)
+	{
+		free(store->tail);
+		return -1;
+	}
+
+	store->map = map_file(path, &store->size);
+	header = (struct store_file_header *)store->map;
+
+	if (store->map == NULL || store->size < (long)sizeof(*header) ||
+	    memcmp(header->magic, STORE_MAGIC, 8) != 0 ||
+	    header->byte_order != STORE_BYTE_ORDER ||
+	    header->doubles != STORE_DOUBLES || header->codes != STORE_CODES)
+	{
+		unmap_file(store->map, store->size);
+		free(store->tail);
+		store->map = NULL;
+		store->tail = NULL;
+		return -1;
+	}
+
+	// The tail tells how much of the file is complete. A chunk after
+	// that is not there yet, its rows are still in the tail.
+	if (have_tail && tail.sealed_size >= (long)sizeof(*header) &&
+	    tail.sealed_size <= store->size)
+	{
+		store->size = tail.sealed_size;
+		store->tail_rows = tail.rows;
+	}
+	else
+	{
+		store->size = walk_chunks(store->map, store->size, sizeof(*header), &last);
+		store->tail_rows = 0;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * store_close closes a store opened by store_open
+ ********************************************************************/
+void store_close(struct store *store)
+{
+	unmap_file(store->map, store->size);
+	free(store->tail);
+	store->map = NULL;
+	store->tail = NULL;
+}
+
+
+/********************************************************************
+ * store_next_chunk
+ * Step through the chunks of a store. Start with offset 0.
+ *
+ * Returns: the next chunk, in the mapping, or NULL after the last
+ *
+ ********************************************************************/
+struct store_chunk *store_next_chunk(struct store *store, long *offset)
+{
+	struct store_chunk *chunk;
+
+	if (*offset < (long)sizeof(struct store_file_header))
+		*offset = sizeof(struct store_file_header);
+
+	if ((chunk = valid_chunk(store->map, store->size, *offset, 0)) == NULL)
+		return NULL;
+
+	*offset += chunk->size;
+
+	return chunk;
+}
+
+
+/********************************************************************
+ * store_scan
+ * Hand the rows from a time range to a function, oldest first. Only
+ * the chunks that overlap the range are decoded, and of those only
+ * the columns asked for.
+ *
+ * Input:  store - open store
+ *         from, to - the range, both included. to 0 means no end.
+ *         columns - STORE_COLUMN_DOUBLE() and STORE_COLUMN_CODE() bits
+ *         found - called for every row, returns nonzero to stop
+ *         arg - passed to found
+ *
+ * Returns: number of rows handed over, -1 if out of memory
+ *
+ ********************************************************************/
+int store_scan(struct store *store, time_t from, time_t to, unsigned int columns,
+               int (*found)(struct store_row *row, void *arg), void *arg)
+{
+	struct store_row *rows;
+	struct store_chunk *chunk;
+	long offset = 0;
+	int count = 0;
+	int i, n;
+
+	if (to == 0)
+		to = (time_t)INT64_MAX;
+
+	// Rows of the caller, so several threads can scan at once
+	if ((rows = malloc(STORE_CHUNK_ROWS * sizeof(*rows))) == NULL)
+		return -1;
+
+	while ((chunk = store_next_chunk(store, &offset)) != NULL)
+	{
+		if (chunk->time_last < from || chunk->time_first > to)
+			continue;
+
+		n = store_decode_chunk(chunk, columns, rows);
+
+		for (i = 0; i < n; i++)
+		{
+			if (rows[i].time < from || rows[i].time > to)
+				continue;
+			count++;
+			if (found(&rows[i], arg))
+			{
+				free(rows);
+				return count;
+			}
+		}
+	}
+
+	free(rows);
+
+	for (i = 0; i < store->tail_rows; i++)
+	{
+		if (store->tail[i].time < from || store->tail[i].time > to)
+			continue;
+		count++;
+		if (found(&store->tail[i], arg))
+			return count;
+	}
+
+	return count;
+}
@@ -0,0 +1,107 @@
+/* open2300 - store2300.h
+ * Include file for the columnar time series store of the observations
+ * version 1.11
+ */
+
+#ifndef _INCLUDE_STORE2300_H_
+#define _INCLUDE_STORE2300_H_
+
+#include <stdint.h>
+#include "rw2300.h"
+
+#define STORE_MAGIC       "O2300TS1"   // first bytes of a store file
+#define STORE_TAIL_MAGIC  "O2300TT1"   // first bytes of its .tail file
+#define STORE_CHUNK_MAGIC 0x4B4E4843   // "CHNK" in a chunk header
+#define STORE_BYTE_ORDER  0x01020304   // the file is in the byte order of its writer
+#define STORE_CHUNK_ROWS  4096         // rows of a chunk at most
+#define STORE_CHUNK_TIME  86400        // a chunk holds one UTC day at most
+#define STORE_NONE        -1           // code not known
+
+/* The values of a row. A double not known is NaN. */
+enum store_double
+{
+	STORE_TEMPERATURE_IN, STORE_TEMPERATURE_OUT, STORE_DEWPOINT,
+	STORE_WINDSPEED, STORE_WIND_ANGLE, STORE_WINDCHILL, STORE_RAIN_1H,
+	STORE_RAIN_24H, STORE_RAIN_TOTAL, STORE_PRESSURE, STORE_DOUBLES
+};
+
+/* Small integers, bit packed. A code not known is STORE_NONE. */
+enum store_code
+{
+	STORE_HUMIDITY_IN, STORE_HUMIDITY_OUT, STORE_WIND_DIRECTION,
+	STORE_TENDENCY, STORE_FORECAST, STORE_CODES
+};
+
+/* Column numbers for store_scan, the time is always decoded */
+#define STORE_COLUMN_DOUBLE(d)  (1U << (d))
+#define STORE_COLUMN_CODE(c)    (1U << (STORE_DOUBLES + (c)))
+#define STORE_ALL_COLUMNS       ((1U << (STORE_DOUBLES + STORE_CODES)) - 1)
+
+struct store_row
+{
+	time_t time;
+	double value[STORE_DOUBLES];
+	int    code[STORE_CODES];
+};
+
+/* Start of a store file */
+struct store_file_header
+{
+	char     magic[8];
+	uint32_t byte_order;
+	uint32_t doubles;                  //STORE_DOUBLES of the writer
+	uint32_t codes;                    //STORE_CODES of the writer
+	uint32_t reserved[11];
+};
+
+/* Start of every chunk of a store file, followed by the column streams.
+ * It is the index of the chunk: a scan skips a chunk by its times and
+ * a min/max query needs no more than this. */
+struct store_chunk
+{
+	uint32_t magic;
+	uint32_t rows;
+	uint32_t size;                     //bytes with this header, a multiple of 8
+	uint32_t checksum;                 //FNV-1a of the streams
+	int64_t  time_first;
+	int64_t  time_last;
+	double   min[STORE_DOUBLES];       //NaN when no value is known
+	double   max[STORE_DOUBLES];
+	int32_t  code_min[STORE_CODES];    //STORE_NONE when no code is known
+	int32_t  code_max[STORE_CODES];
+	uint32_t offset[1 + STORE_DOUBLES + STORE_CODES];  //of each stream, time first
+	uint32_t bits[1 + STORE_DOUBLES + STORE_CODES];    //length of each stream
+};
+
+/* A store opened for reading. The chunks are mapped, the rows not yet
+ * in a chunk (the tail) are read into memory. */
+struct store
+{
+	unsigned char *map;
+	long   size;                       //bytes of chunks mapped
+	struct store_row *tail;
+	int    tail_rows;
+};
+
+int store_append(char *path, struct store_row *rows, int count);
+
+int store_open(struct store *store, char *path);
+
+void store_close(struct store *store);
+
+struct store_chunk *store_next_chunk(struct store *store, long *offset);
+
+int store_decode_chunk(struct store_chunk *chunk, unsigned int columns,
+                       struct store_row *rows);
+
+int store_scan(struct store *store, time_t from, time_t to, unsigned int columns,
+               int (*found)(struct store_row *row, void *arg), void *arg);
+
+void store_row_clear(struct store_row *row);
+
+int store_code_index(const char *text, const char *values[], int count);
+
+extern const char *store_tendencies[3];
+extern const char *store_forecasts[3];
+
+#endif /* _INCLUDE_STORE2300_H_ */
@@ -0,0 +1,293 @@
+/*  open2300 - storeutil2300.c
+ *
+ *  Version 1.11
+ *
+ *  Show, dump and fill a columnar store of store2300.c
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#include "store2300.h"
+
+#define IMPORT_ROWS 4096
+
+static const char *directions[16] = {"N","NNE","NE","ENE","E","ESE","SE","SSE",
+                                     "S","SSW","SW","WSW","W","WNW","NW","NNW"};
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("storeutil2300 - Show, dump and fill a store of log2300 readings or\n");
+	printf("history records (see LOG_STORE and the store history sink).\n");
+	printf("Version %s (C)2003-2006 Kenneth Lavrsen.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("storeutil2300 info store_filename\n");
+	printf("storeutil2300 dump store_filename [from [to]]\n");
+	printf("storeutil2300 import store_filename log_filename\n\n");
+	printf("dump writes the rows in the log format of log2300 or histlog2300.\n");
+	printf("from and to are local times YYYYMMDDhhmm[ss], both included.\n");
+	printf("import reads a log2300 or histlog2300 log file. Lines not newer\n");
+	printf("than the last row of the store are skipped.\n");
+	exit(0);
+}
+
+
+/********************************************************************
+ * parse_time reads a local time YYYYMMDDhhmm[ss]
+ *
+ * Returns: the time or -1
+ ********************************************************************/
+time_t parse_time(const char *text)
+{
+	struct tm time_tm;
+
+	memset(&time_tm, 0, sizeof(time_tm));
+	if (sscanf(text, "%4d%2d%2d%2d%2d%2d", &time_tm.tm_year, &time_tm.tm_mon,
+	           &time_tm.tm_mday, &time_tm.tm_hour, &time_tm.tm_min,
+	           &time_tm.tm_sec) < 5)
+		return -1;
+
+	time_tm.tm_year -= 1900;
+	time_tm.tm_mon -= 1;
+	time_tm.tm_isdst = -1;
+
+	return mktime(&time_tm);
+}
+
+
+/********************************************************************
+ * info lists the chunks of a store with their index
+ ********************************************************************/
+void info(char *path)
+{
+	struct store store;
+	struct store_chunk *chunk;
+	char first[30], last[30];
+	long offset = 0, rows = 0;
+	int chunks = 0;
+	time_t t;
+
+	if (store_open(&store, path) < 0)
+	{
+		fprintf(stderr, "Cannot open store %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("chunk  rows  bytes  first               last                "
+	       "temp out min/max  pressure min/max\n");
+
+	while ((chunk = store_next_chunk(&store, &offset)) != NULL)
+	{
+		t = chunk->time_first;
+		strftime(first, sizeof(first), "%Y-%m-%d %H:%M:%S", localtime(&t));
+		t = chunk->time_last;
+		strftime(last, sizeof(last), "%Y-%m-%d %H:%M:%S", localtime(&t));
+
+		printf("%5d %5u %6u  %s %s %6.1f %6.1f  %8.3f %8.3f\n", chunks,
+		       chunk->rows, chunk->size, first, last,
+		       chunk->min[STORE_TEMPERATURE_OUT], chunk->max[STORE_TEMPERATURE_OUT],
+		       chunk->min[STORE_PRESSURE], chunk->max[STORE_PRESSURE]);
+
+		rows += chunk->rows;
+		chunks++;
+	}
+
+	printf("%d chunks of %ld rows in %ld bytes, %d rows in the tail\n",
+	       chunks, rows, store.size, store.tail_rows);
+
+	store_close(&store);
+}
+
+
+/********************************************************************
+ * dump_row writes a row like log2300 did if it has the rain of the
+ * last hour, else like histlog2300
+ ********************************************************************/
+int dump_row(struct store_row *row, void *arg)
+{
+	char datestring[50];
+	int direction;
+
+	strftime(datestring, sizeof(datestring), "%Y%m%d%H%M%S %Y-%b-%d %H:%M:%S",
+	         localtime(&row->time));
+
+	direction = row->code[STORE_WIND_DIRECTION];
+
+	printf("%s %.1f %.1f %.1f %d %d %.1f %.1f %s %.1f ", datestring,
+	       row->value[STORE_TEMPERATURE_IN], row->value[STORE_TEMPERATURE_OUT],
+	       row->value[STORE_DEWPOINT], row->code[STORE_HUMIDITY_IN],
+	       row->code[STORE_HUMIDITY_OUT], row->value[STORE_WINDSPEED],
+	       row->value[STORE_WIND_ANGLE],
+	       direction >= 0 && direction < 16 ? directions[direction] : "-",
+	       row->value[STORE_WINDCHILL]);
+
+	if (isnan(row->value[STORE_RAIN_1H]))
+	{
+		printf("%.2f %.3f \n", row->value[STORE_RAIN_TOTAL],
+		       row->value[STORE_PRESSURE]);
+		return 0;
+	}
+
+	printf("%.2f %.2f %.2f %.3f %s %s \n", row->value[STORE_RAIN_1H],
+	       row->value[STORE_RAIN_24H], row->value[STORE_RAIN_TOTAL],
+	       row->value[STORE_PRESSURE],
+	       row->code[STORE_TENDENCY] >= 0 ? store_tendencies[row->code[STORE_TENDENCY]] : "-",
+	       row->code[STORE_FORECAST] >= 0 ? store_forecasts[row->code[STORE_FORECAST]] : "-");
+
+	return 0;
+}
+
+
+/********************************************************************
+ * parse_line reads a line of log2300 (18 fields) or histlog2300
+ * (14 fields)
+ *
+ * Returns: 1 if the line was read, 0 if it is not a log line
+ ********************************************************************/
+int parse_line(char *line, struct store_row *row)
+{
+	char *field[20];
+	int fields = 0;
+	char *p;
+
+	for (p = strtok(line, " \t\r\n"); p != NULL && fields < 20;
+	     p = strtok(NULL, " \t\r\n"))
+		field[fields++] = p;
+
+	if (fields != 14 && fields != 18)
+		return 0;
+
+	store_row_clear(row);
+
+	if ((row->time = parse_time(field[0])) == -1)
+		return 0;
+
+	row->value[STORE_TEMPERATURE_IN] = atof(field[3]);
+	row->value[STORE_TEMPERATURE_OUT] = atof(field[4]);
+	row->value[STORE_DEWPOINT] = atof(field[5]);
+	row->code[STORE_HUMIDITY_IN] = atoi(field[6]);
+	row->code[STORE_HUMIDITY_OUT] = atoi(field[7]);
+	row->value[STORE_WINDSPEED] = atof(field[8]);
+	row->value[STORE_WIND_ANGLE] = atof(field[9]);
+	row->code[STORE_WIND_DIRECTION] = store_code_index(field[10], directions, 16);
+	row->value[STORE_WINDCHILL] = atof(field[11]);
+
+	if (fields == 14)
+	{
+		row->value[STORE_RAIN_TOTAL] = atof(field[12]);
+		row->value[STORE_PRESSURE] = atof(field[13]);
+		return 1;
+	}
+
+	row->value[STORE_RAIN_1H] = atof(field[12]);
+	row->value[STORE_RAIN_24H] = atof(field[13]);
+	row->value[STORE_RAIN_TOTAL] = atof(field[14]);
+	row->value[STORE_PRESSURE] = atof(field[15]);
+	row->code[STORE_TENDENCY] = store_code_index(field[16], store_tendencies, 3);
+	row->code[STORE_FORECAST] = store_code_index(field[17], store_forecasts, 3);
+
+	return 1;
+}
+
+
+/********************************************************************
+ * import appends the lines of a log file to a store
+ ********************************************************************/
+void import(char *path, char *logname)
+{
+	static struct store_row rows[IMPORT_ROWS];
+	char line[1024];
+	FILE *fileptr;
+	int lines = 0, count = 0, stored = 0, n;
+
+	if ((fileptr = fopen(logname, "r")) == NULL)
+	{
+		fprintf(stderr, "Cannot open file %s\n", logname);
+		exit(EXIT_FAILURE);
+	}
+
+	while (fgets(line, sizeof(line), fileptr) != NULL)
+	{
+		lines++;
+
+		if (parse_line(line, &rows[count]))
+			count++;
+
+		if (count == IMPORT_ROWS)
+		{
+			if ((n = store_append(path, rows, count)) < 0)
+				exit(EXIT_FAILURE);
+			stored += n;
+			count = 0;
+		}
+	}
+
+	fclose(fileptr);
+
+	if (count > 0)
+	{
+		if ((n = store_append(path, rows, count)) < 0)
+			exit(EXIT_FAILURE);
+		stored += n;
+	}
+
+	printf("%d lines read, %d rows stored\n", lines, stored);
+}
+
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * storeutil2300 info|dump|import store_filename ...
+ *
+ * Just run the program without parameters for usage.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	struct store store;
+	time_t from = 0, to = 0;
+
+	if (argc < 3)
+		print_usage();
+
+	if (strcmp(argv[1], "info") == 0 && argc == 3)
+		info(argv[2]);
+	else if (strcmp(argv[1], "import") == 0 && argc == 4)
+		import(argv[2], argv[3]);
+	else if (strcmp(argv[1], "dump") == 0 && argc <= 5)
+	{
+		if ((argc > 3 && (from = parse_time(argv[3])) == -1) ||
+		    (argc > 4 && (to = parse_time(argv[4])) == -1))
+			print_usage();
+
+		if (store_open(&store, argv[2]) < 0)
+		{
+			fprintf(stderr, "Cannot open store %s\n", argv[2]);
+			exit(EXIT_FAILURE);
+		}
+
+		if (store_scan(&store, from, to, STORE_ALL_COLUMNS, dump_row, NULL) < 0)
+		{
+			fprintf(stderr, "Cannot read store %s\n", argv[2]);
+			store_close(&store);
+			exit(EXIT_FAILURE);
+		}
+		store_close(&store);
+	}
+	else
+		print_usage();
+
+	return(0);
+}
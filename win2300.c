@@ -15,6 +15,37 @@
 
 #include "rw2300.h"
 
+#define READ_WAIT_MS  175    // longest ReadFile wait for the first byte
+#define BURST_WAIT_MS 50     // the same while the answer to a burst is read
+
+
+/********************************************************************
+ * set_read_wait sets how long one ReadFile waits for the first byte
+ * when nothing is buffered
+ *
+ * Returns: 0 on success and -1 if fail
+ ********************************************************************/
+static int set_read_wait(WEATHERSTATION ws, DWORD milliseconds)
+{
+	COMMTIMEOUTS commtimeouts;
+
+	if (!GetCommTimeouts(ws, &commtimeouts))
+		return -1;
+
+	commtimeouts.ReadTotalTimeoutConstant = milliseconds;
+
+	return SetCommTimeouts(ws, &commtimeouts) ? 0 : -1;
+}
+
+
+/********************************************************************
+ * flush_input discards everything received so far
+ ********************************************************************/
+static void flush_input(WEATHERSTATION ws)
+{
+	PurgeComm(ws, PURGE_RXCLEAR);
+}
+
 /********************************************************************
  * open_weatherstation, Windows version
  *
@@ -78,7 +109,7 @@ WEATHERSTATION open_weatherstation (char *device)
 
 	commtimeouts.ReadIntervalTimeout = MAXDWORD;
 	commtimeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
-	commtimeouts.ReadTotalTimeoutConstant = 175;
+	commtimeouts.ReadTotalTimeoutConstant = READ_WAIT_MS;
 	commtimeouts.WriteTotalTimeoutConstant = 0;
 	commtimeouts.WriteTotalTimeoutMultiplier = 0;
 
@@ -102,6 +133,7 @@ WEATHERSTATION open_weatherstation (char *device)
  ********************************************************************/
 void close_weatherstation (WEATHERSTATION ws)
 {
+	release_link_state(ws);
 	CloseHandle (ws);
 	return;
 }
@@ -118,12 +150,14 @@ void reset_06(WEATHERSTATION serdevice)
 {
 	unsigned char command = 0x06;
 	unsigned char answer;
+	int timeout = get_link_timeout(serdevice, TIMEOUT_RESET);
 	int i;
 
 	for (i = 0; i < 100; i++)
 	{
 
-		PurgeComm(serdevice, PURGE_RXCLEAR);
+		// Discard any garbage in the input buffer
+		flush_input(serdevice);
 
 		write_device(serdevice, &command, 1);
 
@@ -134,14 +168,12 @@ void reset_06(WEATHERSTATION serdevice)
 		// until all data is exhausted, if we got a two back at all, we
 		// consider it a success
 		
-		while (1 == read_device(serdevice, &answer, 1))
+		while (1 == read_device_timeout(serdevice, &answer, 1, timeout))
 		{
 			if (answer == 2)
 			{
-
-				// clear anything that might come after the response
-				PurgeComm(serdevice, PURGE_RXCLEAR);
-
+				// drop any further 2's so they do not look like acks
+				flush_input(serdevice);
 				return;
 			}
 		}
@@ -177,6 +209,77 @@ int read_device(WEATHERSTATION serdevice, unsigned char *buffer, int size)
 	return (int) dwRead;
 }
 
+/********************************************************************
+ * read_device_timeout, Windows version
+ * Reads exactly size bytes unless the deadline passes first.
+ * Each ReadFile returns at once with what is buffered or waits
+ * up to READ_WAIT_MS for more, so the deadline may be overrun by
+ * that much.
+ *
+ * Inputs:  serdevice - opened file handle
+ *          buffer - pointer to the buffer to read into
+ *          size - number of bytes to read
+ *          timeout_ms - milliseconds before giving up
+ *
+ * Output:  *buffer - modified on success
+ * 
+ * Returns: number of bytes read, less than size on timeout
+ *          and -1 on a read error
+ *
+ ********************************************************************/
+int read_device_timeout(WEATHERSTATION serdevice, unsigned char *buffer,
+                        int size, int timeout_ms)
+{
+	DWORD start = GetTickCount();
+	DWORD dwRead;
+	int received = 0;
+
+	while (received < size)
+	{
+		dwRead = 0;
+		if (!ReadFile(serdevice, buffer + received, size - received,
+		              &dwRead, NULL))
+		{
+			return -1;
+		}
+
+		received += (int) dwRead;
+
+		if ((int)(GetTickCount() - start) >= timeout_ms)
+			break;
+	}
+
+	return received;
+}
+
+/********************************************************************
+ * read_device_burst, Windows version
+ * Reads the answer to a pipelined burst with ReadFile waiting at most
+ * BURST_WAIT_MS, so a short answer is found out soon after the
+ * deadline. The lock-step reads keep READ_WAIT_MS.
+ *
+ * Inputs:  as read_device_timeout
+ *
+ * Returns: number of bytes read, less than size on timeout
+ *          and -1 on a read error
+ *
+ ********************************************************************/
+int read_device_burst(WEATHERSTATION serdevice, unsigned char *buffer,
+                      int size, int timeout_ms)
+{
+	int received;
+
+	if (set_read_wait(serdevice, BURST_WAIT_MS) < 0)
+		return -1;
+
+	received = read_device_timeout(serdevice, buffer, size, timeout_ms);
+
+	if (set_read_wait(serdevice, READ_WAIT_MS) < 0)
+		return -1;
+
+	return received;
+}
+
 /********************************************************************
  * write_device WIN32 emulation of Linux write() 
  * Writes data to the handle
@@ -200,6 +303,99 @@ int write_device(WEATHERSTATION serdevice, unsigned char *buffer, int size)
 	return (int) dwWritten;
 }
 
+/********************************************************************
+ * replace_file - Windows version
+ * Puts a newly written file in place of another one so that readers
+ * see either the old or the complete new file.
+ *
+ * Inputs: from - the new file, closed
+ *         to - the file to replace
+ *
+ * Returns: 0 on success and -1 if fail.
+ *
+ ********************************************************************/
+int replace_file(char *from, char *to)
+{
+	if (!MoveFileEx(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+		return -1;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * flush_file - Windows version
+ * Writes what is buffered for a file and waits until it is on disk.
+ *
+ * Inputs: file - open for writing
+ *
+ * Returns: 0 on success and -1 if fail.
+ *
+ ********************************************************************/
+int flush_file(FILE *file)
+{
+	if (fflush(file) != 0 || _commit(_fileno(file)) != 0)
+		return -1;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * map_file - Windows version
+ * Reads a whole file into memory, which is all its readers need.
+ *
+ * Inputs: path - the file
+ *
+ * Output: size - bytes read
+ *
+ * Returns: pointer to the contents, NULL if the file is missing,
+ *          empty or cannot be read
+ *
+ ********************************************************************/
+void *map_file(char *path, long *size)
+{
+	FILE *file;
+	void *map;
+	long length;
+
+	if ((file = fopen(path, "rb")) == NULL)
+		return NULL;
+
+	fseek(file, 0, SEEK_END);
+	length = ftell(file);
+	rewind(file);
+
+	if (length <= 0 || (map = malloc(length)) == NULL)
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	if (fread(map, 1, length, file) != (size_t)length)
+	{
+		free(map);
+		fclose(file);
+		return NULL;
+	}
+
+	fclose(file);
+	*size = length;
+
+	return map;
+}
+
+
+/********************************************************************
+ * unmap_file - Windows version
+ * Releases the contents read by map_file.
+ ********************************************************************/
+void unmap_file(void *map, long size)
+{
+	free(map);
+}
+
+
 /********************************************************************
  * sleep_short - Windows version
  * 
@@ -226,6 +422,43 @@ void sleep_long(int seconds)
 	Sleep(seconds*1000);
 }
 
+/********************************************************************
+ * set_daemon_socket - Windows version
+ * ws2300d needs Unix domain sockets so the Windows programs always
+ * open the serial port themselves.
+ *
+ * Inputs: path of the Unix socket (ignored)
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void set_daemon_socket(char *path)
+{
+	return;
+}
+
+/********************************************************************
+ * publish_snapshot, read_publication and open_publication - Windows
+ * version. Snapshots are published by ws2300d which is Linux only.
+ *
+ * Returns: -1 (not available)
+ *
+ ********************************************************************/
+int publish_snapshot(char *path, struct ws_snapshot *snap)
+{
+	return -1;
+}
+
+int read_publication(char *path, struct ws_snapshot *snap)
+{
+	return -1;
+}
+
+int open_publication(char *path, int max_age, WEATHERSTATION *ws)
+{
+	return -1;
+}
+
 /********************************************************************
  * http_request_url - Windows version
  * 
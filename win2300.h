@@ -6,6 +6,7 @@
 
 #include <windows.h>
 #include <winsock.h>
+#include <io.h>
 
 #define STRINGIZE(x) #x
 
@@ -0,0 +1,619 @@
+/*  open2300 - ws2300d.c
+ *
+ *  Version 1.11
+ *
+ *  Daemon that keeps the WS2300 serial port open and serves it to
+ *  the other open2300 programs over a Unix domain socket
+ *
+ *  Copyright 2003-2006, Kenneth Lavrsen
+ *  This program is published under the GNU General Public license
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/un.h>
+#include "rw2300.h"
+
+#define MAXCLIENTS 16
+
+struct client
+{
+	int fd;                          // -1 for a free slot
+	int length;
+	char buffer[DAEMON_LINE];
+};
+
+static struct client clients[MAXCLIENTS];
+static struct ws_snapshot latest;    // result of the last poll
+static unsigned long polls, poll_errors;
+static volatile sig_atomic_t stop;
+
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+	printf("\n");
+	printf("ws2300d - Keep the WS-2300 serial port open and serve it to the\n");
+	printf("other open2300 programs through the socket set by DAEMON_SOCKET.\n");
+	printf("Version %s (C)2003-2006 Kenneth Lavrsen.\n", VERSION);
+	printf("This program is released under the GNU General Public License (GPL)\n\n");
+	printf("Usage:\n");
+	printf("Run in the background:   ws2300d config_filename\n");
+	printf("Run in the foreground:   ws2300d -f config_filename\n");
+	exit(0);
+}
+
+
+/********************************************************************
+ * stop_handler ends the main loop on SIGTERM and SIGINT
+ ********************************************************************/
+void stop_handler(int signum)
+{
+	stop = 1;
+}
+
+
+/********************************************************************
+ * send_line writes a whole line to a client. A client that went
+ * away is dropped the next time its socket is read.
+ ********************************************************************/
+void send_line(int fd, char *line)
+{
+	int length = strlen(line);
+	int written = 0;
+	int ret;
+
+	while (written < length)
+	{
+		ret = send(fd, line + written, length - written, MSG_NOSIGNAL);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return;
+		written += ret;
+	}
+}
+
+
+/********************************************************************
+ * patch_wind replaces a wind record the station marks invalid by the
+ * last valid one of the wind sampler, so clients never have to wait
+ * for a new wind reading. 'nibble' holds 'nibbles' nibbles read at
+ * 'address'. Nothing is done unless they hold the validity nibbles
+ * at the start of the record at 0x527.
+ ********************************************************************/
+void patch_wind(WEATHERSTATION ws2300, unsigned char *nibble, int address,
+                int nibbles)
+{
+	unsigned char data[6];
+	unsigned char *n = nibble + 0x527 - address;
+	int i;
+
+	if (address > 0x527 || address + nibbles < 0x527 + 5)
+		return;
+
+	if (n[0] == 0 && n[1] == 0 &&
+	    !(n[2] == 0xF && n[3] == 0xF && (n[4] == 0 || n[4] == 1)))
+		return;
+
+	if (wind_last_valid(ws2300, data) == 0)
+		return;
+
+	for (i = 0; i < 12 && 0x527 + i < address + nibbles; i++)
+		n[i] = (i & 1) ? data[i / 2] >> 4 : data[i / 2] & 0xF;
+}
+
+
+/********************************************************************
+ * poll_station reads all current values and min/max records into
+ * the snapshot served by READINGS and publishes it if a publish file
+ * is configured. With the memory cache on only what is no longer
+ * fresh costs serial traffic.
+ ********************************************************************/
+void poll_station(WEATHERSTATION ws2300, char *publish_file)
+{
+	polls++;
+
+	if (snapshot_take(ws2300, &latest) < 0)
+	{
+		poll_errors++;
+		fprintf(stderr, "ws2300d: reading the station failed\n");
+		return;
+	}
+
+	patch_wind(ws2300, latest.nibble, 0, WS2300_MEMSIZE);
+
+	if (publish_file[0] && publish_snapshot(publish_file, &latest) < 0)
+		fprintf(stderr, "ws2300d: cannot publish to %s\n", publish_file);
+}
+
+
+/********************************************************************
+ * answer_read handles "READ aaaa n"
+ ********************************************************************/
+void answer_read(WEATHERSTATION ws2300, int fd, int address, int number)
+{
+	unsigned char data[MAXREADBYTES];
+	unsigned char nibble[2 * MAXREADBYTES];
+	unsigned char command[25];
+	char line[DAEMON_LINE];
+	int i;
+
+	if (address < 0 || address > 0x1FFF || number < 1 || number > MAXREADBYTES)
+	{
+		send_line(fd, "ERR bad address or count\n");
+		return;
+	}
+
+	if (read_safe(ws2300, address, number, data, command) != number)
+	{
+		send_line(fd, "ERR read failed\n");
+		return;
+	}
+
+	for (i = 0; i < 2 * number; i++)
+		nibble[i] = (i & 1) ? data[i / 2] >> 4 : data[i / 2] & 0xF;
+	patch_wind(ws2300, nibble, address, 2 * number);
+
+	strcpy(line, "OK ");
+	for (i = 0; i < number; i++)
+		sprintf(line + 3 + 2 * i, "%02X", nibble[2 * i] | nibble[2 * i + 1] << 4);
+	strcat(line, "\n");
+
+	send_line(fd, line);
+}
+
+
+/********************************************************************
+ * answer_write handles "WRITE aaaa n ee hhh..."
+ ********************************************************************/
+void answer_write(WEATHERSTATION ws2300, int fd, int address, int number,
+                  int encode_constant, char *hex)
+{
+	unsigned char data[80];
+	unsigned char command[85];
+	int i;
+
+	if (address < 0 || address > 0x1FFF || number < 1 || number > 80 ||
+	    (int)strspn(hex, "0123456789ABCDEFabcdef") < number ||
+	    (encode_constant != WRITENIB && encode_constant != SETBIT &&
+	     encode_constant != UNSETBIT))
+	{
+		send_line(fd, "ERR bad write request\n");
+		return;
+	}
+
+	for (i = 0; i < number; i++)
+		data[i] = (hex[i] <= '9') ? hex[i] - '0' : (hex[i] & 0xDF) - 'A' + 10;
+
+	if (write_safe(ws2300, address, number, encode_constant, data,
+	               command) != number)
+	{
+		send_line(fd, "ERR write failed\n");
+		return;
+	}
+
+	send_line(fd, "OK\n");
+}
+
+
+/********************************************************************
+ * answer_readings handles "READINGS" from the last poll. Nothing is
+ * read from the station.
+ ********************************************************************/
+void answer_readings(int fd)
+{
+	struct ws_readings r;
+	char line[DAEMON_LINE];
+
+	snapshot_readings(&latest, &r);
+
+	sprintf(line, "OK %lu\n", (unsigned long)r.taken);
+	send_line(fd, line);
+	sprintf(line, "temperature_indoor %.2f\ntemperature_outdoor %.2f\n"
+	              "dewpoint %.2f\nwindchill %.2f\n"
+	              "humidity_indoor %d\nhumidity_outdoor %d\n",
+	        r.temperature_indoor, r.temperature_outdoor,
+	        r.dewpoint, r.windchill, r.humidity_indoor, r.humidity_outdoor);
+	send_line(fd, line);
+	sprintf(line, "wind_speed %.1f\nwind_direction %.1f\n"
+	              "rain_1h %.2f\nrain_24h %.2f\nrain_total %.2f\n"
+	              "rel_pressure %.1f\nabs_pressure %.1f\n"
+	              "tendency %d\nforecast %d\n.\n",
+	        r.wind_speed, r.wind_direction[0],
+	        r.rain_1h, r.rain_24h, r.rain_total,
+	        r.rel_pressure, r.abs_pressure, r.tendency, r.forecast);
+	send_line(fd, line);
+}
+
+
+/********************************************************************
+ * answer_fields handles "FIELDS [name ...]". The fields, all of the
+ * field table if none are named, are read in one planned pass.
+ ********************************************************************/
+void answer_fields(WEATHERSTATION ws2300, int fd, char *names)
+{
+	static struct read_request requests[FIELD_COUNT];
+	static unsigned char data[FIELD_COUNT][32];
+	static int ids[FIELD_COUNT];
+	const struct field_descriptor *field;
+	unsigned char nibble[64];
+	char line[DAEMON_LINE];
+	char *name;
+	int count = 0;
+	int i, j;
+
+	for (name = strtok(names, " \t"); name; name = strtok(NULL, " \t"))
+	{
+		if (count == FIELD_COUNT || (ids[count] = find_field(name)) < 0)
+		{
+			sprintf(line, "ERR unknown field %.100s\n", name);
+			send_line(fd, line);
+			return;
+		}
+		count++;
+	}
+
+	if (count == 0)
+	{
+		for (i = 0; i < field_count; i++)
+			ids[i] = i;
+		count = field_count;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		requests[i].address = field_table[ids[i]].address;
+		requests[i].nibbles = field_table[ids[i]].nibbles;
+		requests[i].data = data[i];
+	}
+
+	if (read_planned(ws2300, requests, count, PLAN_EXECUTE) < 0)
+	{
+		send_line(fd, "ERR read failed\n");
+		return;
+	}
+
+	send_line(fd, "OK\n");
+
+	for (i = 0; i < count; i++)
+	{
+		field = &field_table[ids[i]];
+		for (j = 0; j < field->nibbles; j++)
+			nibble[j] = (j & 1) ? data[i][j / 2] >> 4 : data[i][j / 2] & 0xF;
+
+		sprintf(line, "%s %.10g %s\n", field->name,
+		        decode_field(nibble, field), field->unit);
+		send_line(fd, line);
+	}
+
+	send_line(fd, ".\n");
+}
+
+
+/********************************************************************
+ * answer_wind handles "WIND seconds" from the samples of the wind
+ * sampler. Speeds are in m/s, directions in degrees.
+ ********************************************************************/
+void answer_wind(WEATHERSTATION ws2300, int fd, int seconds)
+{
+	struct wind_summary wind;
+	char line[DAEMON_LINE];
+
+	if (seconds < 1 || wind_summary(ws2300, seconds, METERS_PER_SECOND,
+	                                &wind) < 0)
+	{
+		send_line(fd, "ERR no wind samples\n");
+		return;
+	}
+
+	sprintf(line, "OK %d %.1f %.1f %.2f %.1f %.1f %lu\n", wind.samples,
+	        wind.speed, wind.direction, wind.average, wind.gust,
+	        wind.mean_direction, (unsigned long)wind.last);
+	send_line(fd, line);
+}
+
+
+/********************************************************************
+ * answer_stats handles "STATS"
+ ********************************************************************/
+void answer_stats(WEATHERSTATION ws2300, int fd)
+{
+	struct link_stats link;
+	struct cache_stats cache;
+	char line[DAEMON_LINE];
+	int i, connected = 0;
+
+	get_link_stats(ws2300, &link);
+	get_cache_stats(ws2300, &cache);
+
+	for (i = 0; i < MAXCLIENTS; i++)
+		connected += (clients[i].fd >= 0);
+
+	sprintf(line, "OK polls %lu poll_errors %lu clients %d transactions %lu "
+	              "failures %lu resets_issued %lu resets_avoided %lu "
+	              "cache_hits %lu cache_misses %lu\n",
+	        polls, poll_errors, connected, link.transactions, link.failures,
+	        link.resets_issued, link.resets_avoided, cache.hits, cache.misses);
+	send_line(fd, line);
+}
+
+
+/********************************************************************
+ * answer_request carries out one request line of a client
+ ********************************************************************/
+void answer_request(WEATHERSTATION ws2300, int fd, char *request)
+{
+	int address, number, encode_constant, offset, seconds;
+
+	if (sscanf(request, "READ %x %d", &address, &number) == 2)
+		answer_read(ws2300, fd, address, number);
+	else if (sscanf(request, "WRITE %x %d %x %n", &address, &number,
+	                &encode_constant, &offset) == 3)
+		answer_write(ws2300, fd, address, number, encode_constant,
+		             request + offset);
+	else if (strcmp(request, "READINGS") == 0)
+		answer_readings(fd);
+	else if (strncmp(request, "FIELDS", 6) == 0 &&
+	         (request[6] == '\0' || request[6] == ' '))
+		answer_fields(ws2300, fd, request + 6);
+	else if (strcmp(request, "STATS") == 0)
+		answer_stats(ws2300, fd);
+	else if (sscanf(request, "WIND %d", &seconds) == 1)
+		answer_wind(ws2300, fd, seconds);
+	else
+		send_line(fd, "ERR unknown request\n");
+}
+
+
+/********************************************************************
+ * serve_client reads what a client sent and answers every complete
+ * line. Returns 0 when the client has gone away.
+ ********************************************************************/
+int serve_client(WEATHERSTATION ws2300, struct client *client)
+{
+	char *end;
+	int ret;
+
+	ret = read(client->fd, client->buffer + client->length,
+	           sizeof(client->buffer) - 1 - client->length);
+	if (ret < 0 && (errno == EINTR || errno == EAGAIN))
+		return 1;
+	if (ret <= 0)
+		return 0;
+
+	client->length += ret;
+	client->buffer[client->length] = '\0';
+
+	while ((end = strchr(client->buffer, '\n')) != NULL)
+	{
+		*end = '\0';
+		if (end > client->buffer && end[-1] == '\r')
+			end[-1] = '\0';
+
+		answer_request(ws2300, client->fd, client->buffer);
+
+		client->length -= end + 1 - client->buffer;
+		memmove(client->buffer, end + 1, client->length + 1);
+	}
+
+	// A line longer than any request is garbage
+	if (client->length == sizeof(client->buffer) - 1)
+		return 0;
+
+	return 1;
+}
+
+
+/********************************************************************
+ * open_socket creates the listening socket. A socket file left
+ * behind by a daemon that died is removed first.
+ ********************************************************************/
+int open_socket(char *path)
+{
+	struct sockaddr_un address;
+	int fd;
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	{
+		perror("ws2300d: socket");
+		exit(EXIT_FAILURE);
+	}
+
+	if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0)
+	{
+		printf("ws2300d is already running on %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+	    listen(fd, MAXCLIENTS) < 0)
+	{
+		perror("ws2300d: cannot listen on socket");
+		exit(EXIT_FAILURE);
+	}
+
+	return fd;
+}
+
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * ws2300d opens the serial port once, turns on the memory cache and
+ * polls the station every DAEMON_POLL seconds. Clients connect to
+ * DAEMON_SOCKET and send one request per line:
+ *
+ *   READ aaaa n              read n bytes (max 15) at nibble aaaa (hex)
+ *   WRITE aaaa n ee hhh...   write_data of n nibbles, ee = 42/12/32
+ *   READINGS                 current values of the last poll
+ *   FIELDS [name ...]        fields of the memory map, all if none named
+ *   STATS                    poll, link and cache counters
+ *   WIND seconds             wind over the last seconds from the sampler
+ *
+ * READ, WRITE and WIND answer one line "OK ..." or "ERR reason". WIND
+ * answers "OK samples speed direction average gust mean_direction
+ * time_of_last_sample". READINGS
+ * and FIELDS answer "OK", one "name value" line each and a line
+ * with a single "." at the end.
+ *
+ * The other programs use the same config file. open_weatherstation
+ * connects to DAEMON_SOCKET when the daemon is running, so they need
+ * no change and no longer fight over the serial port lock.
+ *
+ * Between polls the wind record is sampled every WIND_SAMPLE_INTERVAL
+ * seconds. Clients get the last valid wind record whenever the
+ * station marks the current one invalid, and wind_summary gives
+ * them averages and gusts without resetting the wind min/max.
+ *
+ * With PUBLISH_FILE set every poll is also published there through
+ * shared memory (see read_publication) for readers like fetch2300
+ * that must answer at once.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	WEATHERSTATION ws2300;
+	struct config_type config;
+	struct pollfd fds[MAXCLIENTS + 1];
+	struct client *slot[MAXCLIENTS + 1];
+	char socket_path[sizeof(config.daemon_socket)];
+	int foreground = 0;
+	int listener, fd, nfds, timeout;
+	time_t next_poll = 0, next_wind = 0, now;
+	int i;
+
+	if (argc > 1 && strcmp(argv[1], "-f") == 0)
+	{
+		foreground = 1;
+		argc--;
+		argv++;
+	}
+
+	if (argc > 2 || (argc == 2 && argv[1][0] == '-'))
+		print_usage();
+
+	get_configuration(&config, argv[1]);
+
+	if (config.daemon_socket[0] == '\0')
+	{
+		printf("No DAEMON_SOCKET in the config file\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (config.daemon_poll < 1)
+		config.daemon_poll = 1;
+
+	strcpy(socket_path, config.daemon_socket);
+	listener = open_socket(socket_path);
+
+	// The daemon itself is the one program that opens the port
+	set_daemon_socket(NULL);
+	config.cache = 1;
+
+	ws2300 = open_weatherstation(config.serial_device_name);
+	configure_weatherstation(ws2300, &config);
+	wind_sampler_enable(ws2300, 1);
+
+	if (!foreground && daemon(0, 0) < 0)
+	{
+		perror("ws2300d: daemon");
+		exit(EXIT_FAILURE);
+	}
+
+	signal(SIGTERM, stop_handler);
+	signal(SIGINT, stop_handler);
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 0; i < MAXCLIENTS; i++)
+		clients[i].fd = -1;
+
+	while (!stop)
+	{
+		now = time(NULL);
+		if (now >= next_poll)
+		{
+			poll_station(ws2300, config.publish_file);
+			next_poll = time(NULL) + config.daemon_poll;
+			now = time(NULL);
+		}
+
+		if (now >= next_wind)
+		{
+			wind_sample(ws2300);
+			next_wind = time(NULL) + WIND_SAMPLE_INTERVAL;
+			now = time(NULL);
+		}
+
+		fds[0].fd = listener;
+		fds[0].events = POLLIN;
+		nfds = 1;
+		for (i = 0; i < MAXCLIENTS; i++)
+		{
+			if (clients[i].fd < 0)
+				continue;
+			fds[nfds].fd = clients[i].fd;
+			fds[nfds].events = POLLIN;
+			slot[nfds++] = &clients[i];
+		}
+
+		timeout = (next_wind < next_poll ? next_wind : next_poll) - now;
+		if (poll(fds, nfds, (timeout > 0 ? timeout : 0) * 1000) <= 0)
+			continue;
+
+		for (i = 1; i < nfds; i++)
+		{
+			if (fds[i].revents && !serve_client(ws2300, slot[i]))
+			{
+				close(slot[i]->fd);
+				slot[i]->fd = -1;
+			}
+		}
+
+		if (fds[0].revents & POLLIN)
+		{
+			if ((fd = accept(listener, NULL, NULL)) < 0)
+				continue;
+
+			for (i = 0; i < MAXCLIENTS && clients[i].fd >= 0; i++)
+				;
+
+			if (i == MAXCLIENTS)
+			{
+				send_line(fd, "ERR too many clients\n");
+				close(fd);
+				continue;
+			}
+
+			clients[i].fd = fd;
+			clients[i].length = 0;
+		}
+	}
+
+	for (i = 0; i < MAXCLIENTS; i++)
+	{
+		if (clients[i].fd >= 0)
+			close(clients[i].fd);
+	}
+
+	close(listener);
+	unlink(socket_path);
+	close_weatherstation(ws2300);
+
+	return(0);
+}
@@ -9,9 +9,11 @@
  */
 
 #define DEBUG 0  // wu2300 stops writing to standard out if setting this to 0
-#define GUST  1  // report wind gust information (resets wind min/max)
+#define GUST  1  // report wind gust information (resets wind min/max
+                 // unless ws2300d samples the wind)
 
 #include "rw2300.h"
+#include "out2300.h"
 
 /********** MAIN PROGRAM ************************************************
  *
@@ -27,97 +29,119 @@ int main(int argc, char *argv[])
 {
 	WEATHERSTATION ws2300;
 	struct config_type config;
-	char urlline[3000] = "";
-	char tempstring[1000] = "";
-	char datestring[50];        //used to hold the date stamp for the log file
+	char urldata[1000];         //the HTTP request
+	struct out_buffer url;
 	double tempfloat;
+	struct wind_summary wind;
+	int sampled = 0;
 	time_t basictime;
 
 	get_configuration(&config, argv[1]);
 
 	ws2300 = open_weatherstation(config.serial_device_name);
+	configure_weatherstation(ws2300, &config);
 
 
 	/* START WITH URL, ID AND PASSWORD */
 
-	sprintf(urlline, "GET %s?ID=%s&PASSWORD=%s", WEATHER_UNDERGROUND_PATH,
-	        config.weather_underground_id,config.weather_underground_password);
+	out_init(&url, urldata, sizeof(urldata));
+	out_text(&url, "GET " WEATHER_UNDERGROUND_PATH "?ID=");
+	out_text(&url, config.weather_underground_id);
+	out_text(&url, "&PASSWORD=");
+	out_text(&url, config.weather_underground_password);
 
 	/* GET DATE AND TIME FOR URL */
 	
 	time(&basictime);
 	basictime = basictime - atof(config.timezone) * 60 * 60;
-	strftime(datestring,sizeof(datestring),"&dateutc=%Y-%m-%d+%H%%3A%M%%3A%S",
-	         localtime(&basictime));
-	strcat(urlline, datestring);
+	out_time(&url, "&dateutc=%Y-%m-%d+%H%%3A%M%%3A%S", basictime);
 
 
 	/* READ TEMPERATURE OUTDOOR - deg F for Weather Underground */
 
-	sprintf(tempstring, "&tempf=%.2f", temperature_outdoor(ws2300, FAHRENHEIT) );
-	strcat(urlline, tempstring);
+	out_text(&url, "&tempf=");
+	out_fixed(&url, temperature_outdoor(ws2300, FAHRENHEIT), 2);
 
 
 	/* READ DEWPOINT - deg F for Weather Underground*/
 	
-	sprintf(tempstring, "&dewptf=%.2f", dewpoint(ws2300, FAHRENHEIT) );
-	strcat(urlline, tempstring);
+	out_text(&url, "&dewptf=");
+	out_fixed(&url, dewpoint(ws2300, FAHRENHEIT), 2);
 
 
 	/* READ RELATIVE HUMIDITY OUTDOOR */
 
-	sprintf(tempstring, "&humidity=%d", humidity_outdoor(ws2300) );
-	strcat(urlline, tempstring);
+	out_text(&url, "&humidity=");
+	out_int(&url, humidity_outdoor(ws2300));
 
 
 	/* READ WIND SPEED AND DIRECTION - miles/hour for Weather Underground */
 
-	sprintf(tempstring, "&windspeedmph=%.2f", wind_current(ws2300, MILES_PER_HOUR, &tempfloat) );
-	strcat(urlline, tempstring);
-	sprintf(tempstring,"&winddir=%.1f", tempfloat);
-	strcat(urlline, tempstring);
+	out_text(&url, "&windspeedmph=");
+	out_fixed(&url, wind_current(ws2300, MILES_PER_HOUR, &tempfloat), 2);
+	out_text(&url, "&winddir=");
+	out_fixed(&url, tempfloat, 1);
 
 
 	/* READ WIND GUST - miles/hour for Weather Underground */
 
-	if (GUST)
+	/* With ws2300d running the gust and 2 minute averages come from its */
+	/* wind samples, otherwise from the wind maximum of the station      */
+
+	if (GUST && wind_summary(ws2300, 600, MILES_PER_HOUR, &wind) > 0)
+	{
+		out_text(&url, "&windgustmph_10m=");
+		out_fixed(&url, wind.gust, 2);
+
+		if (wind_summary(ws2300, 120, MILES_PER_HOUR, &wind) > 0)
+		{
+			sampled = 1;
+			out_text(&url, "&windgustmph=");
+			out_fixed(&url, wind.gust, 2);
+			out_text(&url, "&windspdmph_avg2m=");
+			out_fixed(&url, wind.average, 2);
+			out_text(&url, "&winddir_avg2m=");
+			out_fixed(&url, wind.mean_direction, 1);
+		}
+	}
+
+	/* Without samples of the last 2 minutes the gust is the maximum */
+	/* of the station, which is reset below for the next report      */
+
+	if (GUST && !sampled)
 	{
-		sprintf(tempstring, "&windgustmph=%.2f",
-		        wind_minmax(ws2300, MILES_PER_HOUR, NULL, NULL, NULL, NULL));
-		strcat(urlline, tempstring);
+		out_text(&url, "&windgustmph=");
+		out_fixed(&url, wind_minmax(ws2300, MILES_PER_HOUR, NULL, NULL, NULL, NULL), 2);
 	}
 
 
 	/* READ RAIN 1H - inches for Weather Underground */
 	
-	sprintf(tempstring, "&rainin=%.2f", rain_1h(ws2300, INCHES) );
-	strcat(urlline, tempstring);
+	out_text(&url, "&rainin=");
+	out_fixed(&url, rain_1h(ws2300, INCHES), 2);
 
 
 	/* READ RAIN 24H - inches for Weather Underground */
 
-	sprintf(tempstring, "&dailyrainin=%.2f", rain_24h(ws2300, INCHES) );
-	strcat(urlline, tempstring);
+	out_text(&url, "&dailyrainin=");
+	out_fixed(&url, rain_24h(ws2300, INCHES), 2);
 
 
 	/* READ RELATIVE PRESSURE - Inches of Hg for Weather Underground */
 
-	sprintf(tempstring, "&baromin=%.3f", rel_pressure(ws2300, INCHES_HG) );
-	strcat(urlline, tempstring);
+	out_text(&url, "&baromin=");
+	out_fixed(&url, rel_pressure(ws2300, INCHES_HG), 3);
 
 
 	/* ADD SOFTWARE TYPE AND ACTION */
-	sprintf(tempstring, "&softwaretype=open2300-%s&action=updateraw", VERSION);
-	strcat(urlline, tempstring);
+	out_text(&url, "&softwaretype=open2300-" VERSION "&action=updateraw");
 	
-	sprintf(tempstring, " HTTP/1.0\r\nUser-Agent: open2300/%s\r\nAccept: */*\r\n"
-	                   "Host: %s\r\nConnection: Keep-Alive\r\n\r\n",
-	        VERSION, WEATHER_UNDERGROUND_BASEURL);
-	strcat(urlline, tempstring);
+	out_text(&url, " HTTP/1.0\r\nUser-Agent: open2300/" VERSION "\r\nAccept: */*\r\n"
+	               "Host: " WEATHER_UNDERGROUND_BASEURL "\r\nConnection: Keep-Alive\r\n\r\n");
 
 
 	/* Reset minimum and maximum wind readings if reporting gusts */
-	if (GUST)
+	if (GUST && !sampled)
 	{
 		wind_reset(ws2300, RESET_MIN + RESET_MAX);
 	}
@@ -128,13 +152,19 @@ int main(int argc, char *argv[])
 
 	close_weatherstation(ws2300);
 
+	if (url.overflow)
+	{
+		fprintf(stderr, "wu2300: the request is too long\n");
+		exit(EXIT_FAILURE);
+	}
+
 	if (DEBUG)
 	{
-		printf("%s\n",urlline);
+		printf("%s\n",url.data);
 	}
 	else
 	{
-		http_request_url(urlline);
+		http_request_url(url.data);
 	}
 	
 	return(0);
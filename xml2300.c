@@ -19,6 +19,36 @@
  */
 
 #include "rw2300.h"
+#include "out2300.h"
+
+/* Memory windows read by the functions used below. They are fetched
+ * with as few transactions as possible before the functions are called
+ * and those then answer from the prefetched data.
+ */
+static struct read_request regions[] =
+{
+	{0x346,  4, NULL},    // temperature indoor
+	{0x34B, 30, NULL},    // temperature indoor min/max
+	{0x373,  4, NULL},    // temperature outdoor
+	{0x378, 30, NULL},    // temperature outdoor min/max
+	{0x3CE,  4, NULL},    // dewpoint
+	{0x3D3, 30, NULL},    // dewpoint min/max
+	{0x3FB, 26, NULL},    // humidity indoor with min/max
+	{0x419, 26, NULL},    // humidity outdoor with min/max
+	{0x527, 12, NULL},    // wind speed and directions
+	{0x4EE, 30, NULL},    // wind min/max
+	{0x3A0,  4, NULL},    // windchill
+	{0x3A5, 30, NULL},    // windchill min/max
+	{0x4B4, 22, NULL},    // rain 1h with max
+	{0x497, 22, NULL},    // rain 24h with max
+	{0x4D2, 16, NULL},    // rain total with time
+	{0x5E2,  6, NULL},    // relative pressure
+	{0x600, 26, NULL},    // relative pressure min/max
+	{0x61E, 20, NULL},    // pressure min/max times
+	{0x26B,  2, NULL}     // tendency and forecast
+};
+
+#define REGIONS (sizeof(regions) / sizeof(regions[0]))
 
 /********************************************************************
  * print_usage prints a short user guide
@@ -42,6 +72,92 @@ void print_usage(void)
 	exit(0);
 }
 
+/********************************************************************
+ * out_element appends the element <tag>value</tag> on a line
+ *
+ * Input:   indent - tabs before the element
+ *          tag - name of the element
+ *          value - its value, with decimals decimals
+ *
+ * Output:  out - the line appended
+ *
+ ********************************************************************/
+static void out_element(struct out_buffer *out, const char *indent,
+                        const char *tag, double value, int decimals)
+{
+	out_text(out, indent);
+	out_char(out, '<');
+	out_text(out, tag);
+	out_char(out, '>');
+	out_fixed(out, value, decimals);
+	out_text(out, "</");
+	out_text(out, tag);
+	out_text(out, ">\n");
+}
+
+
+/********************************************************************
+ * out_stamp appends the elements <which>Time hh:mm and <which>Date
+ * yyyy-mm-dd of a min, max or reset
+ *
+ * Input:   indent - tabs before the elements
+ *          which - "Min", "Max" or ""
+ *          time - the time stamp
+ *
+ * Output:  out - the lines appended
+ *
+ ********************************************************************/
+static void out_stamp(struct out_buffer *out, const char *indent,
+                      const char *which, struct timestamp *time)
+{
+	out_text(out, indent);
+	out_char(out, '<');
+	out_text(out, which);
+	out_text(out, "Time>");
+	out_int_zero(out, time->hour, 2);
+	out_char(out, ':');
+	out_int_zero(out, time->minute, 2);
+	out_text(out, "</");
+	out_text(out, which);
+	out_text(out, "Time>\n");
+
+	out_text(out, indent);
+	out_char(out, '<');
+	out_text(out, which);
+	out_text(out, "Date>");
+	out_int_zero(out, time->year, 4);
+	out_char(out, '-');
+	out_int_zero(out, time->month, 2);
+	out_char(out, '-');
+	out_int_zero(out, time->day, 2);
+	out_text(out, "</");
+	out_text(out, which);
+	out_text(out, "Date>\n");
+}
+
+
+/********************************************************************
+ * out_minmax appends the elements Min, Max, MinTime, MinDate, MaxTime
+ * and MaxDate
+ *
+ * Input:   indent - tabs before the elements
+ *          min, max - the min and max
+ *          decimals - decimals of min and max
+ *          time_min, time_max - when they were recorded
+ *
+ * Output:  out - the lines appended
+ *
+ ********************************************************************/
+static void out_minmax(struct out_buffer *out, const char *indent,
+                       double min, double max, int decimals,
+                       struct timestamp *time_min, struct timestamp *time_max)
+{
+	out_element(out, indent, "Min", min, decimals);
+	out_element(out, indent, "Max", max, decimals);
+	out_stamp(out, indent, "Min", time_min);
+	out_stamp(out, indent, "Max", time_max);
+}
+
 /********** MAIN PROGRAM ************************************************
  *
  * This program reads all current and min/max data from a WS2300
@@ -56,9 +172,11 @@ void print_usage(void)
 int main(int argc, char *argv[])
 {
 	WEATHERSTATION ws2300;
-	char datestring[50];        //used to hold the date stamp for the log file
+	char outdata[8192];         //the XML file, written at once at the end
+	struct out_buffer out;
 	const char *directions[]= {"N","NNE","NE","ENE","E","ESE","SE","SSE",
 	                           "S","SSW","SW","WSW","W","WNW","NW","NNW"};
+	const char *dirtags[] = {"Dir0","Dir1","Dir2","Dir3","Dir4","Dir5"};
 	double winddir[6];
 	char tendency[15];
 	char forecast[15];
@@ -67,8 +185,8 @@ int main(int argc, char *argv[])
 	int tempint, tempint_min, tempint_max;
 	struct timestamp time_min, time_max;
 	time_t basictime;
-	//char datestring[100];		//used to hold the date stamp for the log file
 	FILE *fileptr;
+	int i;
 
 	if (argc < 2 || argc > 3)
 	{
@@ -86,283 +204,172 @@ int main(int argc, char *argv[])
 	
 
 	ws2300 = open_weatherstation(config.serial_device_name);
+	configure_weatherstation(ws2300, &config);
+
+	/* FETCH ALL MEMORY WINDOWS IN AS FEW READS AS POSSIBLE */
+
+	read_planned(ws2300, regions, REGIONS, PLAN_PREFETCH);
+
 
 	/* XML header */
 
-	fprintf(fileptr, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
-			"<ws2300 version=\"1.0\">\n");
+	out_init(&out, outdata, sizeof(outdata));
+	out_text(&out, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+	               "<ws2300 version=\"1.0\">\n");
 
 	/* GET DATE AND TIME FOR LOG FILE, PLACE BEFORE ALL DATA IN LOG LINE */
 
 	/* <date>, <time> */
 	
 	time(&basictime);
-	strftime(datestring, sizeof(datestring), "\t<Date>%Y-%m-%d</Date>\n"
-			 "\t<Time>%H:%M:%S</Time>\n", localtime(&basictime));
-			 
-	fprintf(fileptr, datestring);
+	out_time(&out, "\t<Date>%Y-%m-%d</Date>\n"
+	               "\t<Time>%H:%M:%S</Time>\n", basictime);
 
 
 	/* <temperature> <indoor> */
 	
-	fprintf(fileptr, "\t<Temperature>\n" "\t\t<Indoor>\n");
-	fprintf(fileptr, "\t\t\t<Value>%.1f</Value>\n",
-		temperature_indoor(ws2300, config.temperature_conv));
+	out_text(&out, "\t<Temperature>\n" "\t\t<Indoor>\n");
+	out_element(&out, "\t\t\t", "Value",
+	            temperature_indoor(ws2300, config.temperature_conv), 1);
 
 	temperature_indoor_minmax(ws2300, config.temperature_conv, &tempfloat_min,
 		                      &tempfloat_max, &time_min, &time_max);
+	out_minmax(&out, "\t\t\t", tempfloat_min, tempfloat_max, 1, &time_min, &time_max);
 
-	fprintf(fileptr, "\t\t\t<Min>%.1f</Min>\n", tempfloat_min);
-	fprintf(fileptr, "\t\t\t<Max>%.1f</Max>\n", tempfloat_max);
-
-	fprintf(fileptr, "\t\t\t<MinTime>%02d:%02d</MinTime>\n"
-			"\t\t\t<MinDate>%04d-%02d-%02d</MinDate>\n",
-			time_min.hour, time_min.minute, time_min.year,
-			time_min.month, time_min.day);
-
-	fprintf(fileptr, "\t\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
-
-	fprintf(fileptr, "\t\t</Indoor>\n" "\t\t<Outdoor>\n");
+	out_text(&out, "\t\t</Indoor>\n" "\t\t<Outdoor>\n");
 
 
 	/* <temperature> <outdoor> */
 
-	fprintf(fileptr, "\t\t\t<Value>%.1f</Value>\n",
-			temperature_outdoor(ws2300, config.temperature_conv));
+	out_element(&out, "\t\t\t", "Value",
+	            temperature_outdoor(ws2300, config.temperature_conv), 1);
 	
 	temperature_outdoor_minmax(ws2300, config.temperature_conv, &tempfloat_min,
 	                          &tempfloat_max, &time_min, &time_max);
+	out_minmax(&out, "\t\t\t", tempfloat_min, tempfloat_max, 1, &time_min, &time_max);
 
-	fprintf(fileptr, "\t\t\t<Min>%.1f</Min>\n", tempfloat_min);
-	fprintf(fileptr, "\t\t\t<Max>%.1f</Max>\n", tempfloat_max);
-
-
-	fprintf(fileptr, "\t\t\t<MinTime>%02d:%02d</MinTime>\n"
-			"\t\t\t<MinDate>%04d-%02d-%02d</MinDate>\n",
-			time_min.hour, time_min.minute, time_min.year,
-			time_min.month, time_min.day);
-
-	fprintf(fileptr, "\t\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
-
-	fprintf(fileptr, "\t\t</Outdoor>\n" "\t</Temperature>\n");
+	out_text(&out, "\t\t</Outdoor>\n" "\t</Temperature>\n");
 
 
 	/* <indoor> <humidity> */
 
-	fprintf(fileptr, "\t<Humidity>\n" "\t\t<Indoor>\n");
+	out_text(&out, "\t<Humidity>\n" "\t\t<Indoor>\n");
 
-	fprintf(fileptr, "\t\t\t<Value>%d</Value>\n",
-			humidity_indoor_all(ws2300, &tempint_min, &tempint_max,
-			                    &time_min, &time_max));
+	out_element(&out, "\t\t\t", "Value",
+	            humidity_indoor_all(ws2300, &tempint_min, &tempint_max,
+	                                &time_min, &time_max), 0);
+	out_minmax(&out, "\t\t\t", tempint_min, tempint_max, 0, &time_min, &time_max);
 
-	fprintf(fileptr, "\t\t\t<Min>%d</Min>\n", tempint_min);
-	fprintf(fileptr, "\t\t\t<Max>%d</Max>\n", tempint_max);
-
-	fprintf(fileptr, "\t\t\t<MinTime>%02d:%02d</MinTime>\n"
-			"\t\t\t<MinDate>%04d-%02d-%02d</MinDate>\n",
-			time_min.hour, time_min.minute, time_min.year,
-			time_min.month, time_min.day);
-
-	fprintf(fileptr, "\t\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
-
-	fprintf(fileptr, "\t\t</Indoor>\n" "\t\t<Outdoor>\n");
+	out_text(&out, "\t\t</Indoor>\n" "\t\t<Outdoor>\n");
 	
 
 	/* <outdoor> <humidity> */
 
-	fprintf(fileptr, "\t\t\t<Value>%d</Value>\n",
-			humidity_outdoor_all(ws2300, &tempint_min, &tempint_max,
-			                    &time_min, &time_max));
-
-	fprintf(fileptr, "\t\t\t<Min>%d</Min>\n", tempint_min);
-	fprintf(fileptr, "\t\t\t<Max>%d</Max>\n", tempint_max);
+	out_element(&out, "\t\t\t", "Value",
+	            humidity_outdoor_all(ws2300, &tempint_min, &tempint_max,
+	                                 &time_min, &time_max), 0);
+	out_minmax(&out, "\t\t\t", tempint_min, tempint_max, 0, &time_min, &time_max);
 
-	fprintf(fileptr, "\t\t\t<MinTime>%02d:%02d</MinTime>\n"
-			"\t\t\t<MinDate>%04d-%02d-%02d</MinDate>\n",
-			time_min.hour, time_min.minute, time_min.year,
-			time_min.month, time_min.day);
-
-	fprintf(fileptr, "\t\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
-
-	fprintf(fileptr, "\t\t</Outdoor>\n" "\t</Humidity>\n" "\t<Dewpoint>\n");
+	out_text(&out, "\t\t</Outdoor>\n" "\t</Humidity>\n" "\t<Dewpoint>\n");
 
 	/* <Dewpoint> */
 
-	fprintf(fileptr, "\t\t<Value>%.1f</Value>\n",
-	        dewpoint(ws2300, config.temperature_conv));
+	out_element(&out, "\t\t", "Value", dewpoint(ws2300, config.temperature_conv), 1);
 
 	dewpoint_minmax(ws2300, config.temperature_conv, &tempfloat_min,
 	               &tempfloat_max, &time_min, &time_max);
-	                           
-	fprintf(fileptr, "\t\t<Min>%.1f</Min>\n", tempfloat_min);
-	fprintf(fileptr, "\t\t<Max>%.1f</Max>\n", tempfloat_max);
-
-	fprintf(fileptr, "\t\t<MinTime>%02d:%02d</MinTime>\n"
-			"\t\t<MinDate>%04d-%02d-%02d</MinDate>\n",
-			time_min.hour, time_min.minute, time_min.year,
-			time_min.month, time_min.day);
-
-	fprintf(fileptr, "\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
+	out_minmax(&out, "\t\t", tempfloat_min, tempfloat_max, 1, &time_min, &time_max);
 
-	fprintf(fileptr, "\t</Dewpoint>\n" "\t<Wind>\n");
+	out_text(&out, "\t</Dewpoint>\n" "\t<Wind>\n");
 	
 
 	/* <Wind> */
 
-	fprintf(fileptr, "\t\t<Value>%.1f</Value>\n",
-		   wind_all(ws2300, config.wind_speed_conv_factor, &tempint, winddir));
-
-	fprintf(fileptr, "\t\t<Direction>\n");
-	fprintf(fileptr, "\t\t\t<Text>%s</Text>\n"
-			"\t\t\t<Dir0>%0.1f</Dir0>\n"
-			"\t\t\t<Dir1>%0.1f</Dir1>\n"
-			"\t\t\t<Dir2>%0.1f</Dir2>\n"
-			"\t\t\t<Dir3>%0.1f</Dir3>\n"
-			"\t\t\t<Dir4>%0.1f</Dir4>\n"
-			"\t\t\t<Dir5>%0.1f</Dir5>\n"
-			"\t\t</Direction>\n",
-			directions[tempint],
-			winddir[0], winddir[1], winddir[2],
-			winddir[3], winddir[4], winddir[5]);
+	out_element(&out, "\t\t", "Value",
+	            wind_all(ws2300, config.wind_speed_conv_factor, &tempint, winddir), 1);
+
+	out_text(&out, "\t\t<Direction>\n" "\t\t\t<Text>");
+	out_text(&out, directions[tempint]);
+	out_text(&out, "</Text>\n");
+	for (i = 0; i < 6; i++)
+		out_element(&out, "\t\t\t", dirtags[i], winddir[i], 1);
+	out_text(&out, "\t\t</Direction>\n");
 
 	//Get Windspeed min/max
 	wind_minmax(ws2300, config.wind_speed_conv_factor, &tempfloat_min,
 	            &tempfloat_max, &time_min, &time_max);
-	
-	fprintf(fileptr, "\t\t<Min>%.1f</Min>\n", tempfloat_min);
-	fprintf(fileptr, "\t\t<Max>%.1f</Max>\n", tempfloat_max);
-
-	fprintf(fileptr, "\t\t<MinTime>%02d:%02d</MinTime>\n"
-			"\t\t<MinDate>%04d-%02d-%02d</MinDate>\n",
-			time_min.hour, time_min.minute, time_min.year,
-			time_min.month, time_min.day);
-
-	fprintf(fileptr, "\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
+	out_minmax(&out, "\t\t", tempfloat_min, tempfloat_max, 1, &time_min, &time_max);
 
-	fprintf(fileptr, "\t</Wind>\n" "\t<Windchill>\n");
+	out_text(&out, "\t</Wind>\n" "\t<Windchill>\n");
 	
 	
 	/* <Windchill> */
 
-	fprintf(fileptr, "\t\t<Value>%.1f</Value>\n",
-	        windchill(ws2300, config.temperature_conv));
+	out_element(&out, "\t\t", "Value", windchill(ws2300, config.temperature_conv), 1);
 	
 	windchill_minmax(ws2300, config.temperature_conv, &tempfloat_min,
 	                 &tempfloat_max, &time_min, &time_max);
+	out_minmax(&out, "\t\t", tempfloat_min, tempfloat_max, 1, &time_min, &time_max);
 
-	fprintf(fileptr, "\t\t<Min>%.1f</Min>\n",tempfloat_min);
-	fprintf(fileptr, "\t\t<Max>%.1f</Max>\n",tempfloat_max);
-
-	fprintf(fileptr, "\t\t<MinTime>%02d:%02d</MinTime>\n"
-			"\t\t<MinDate>%04d-%02d-%02d</MinDate>\n",
-			time_min.hour, time_min.minute, time_min.year,
-			time_min.month, time_min.day);
-
-	fprintf(fileptr, "\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
-
-	fprintf(fileptr, "\t</Windchill>\n" "\t<Rain>\n" "\t\t<OneHour>\n");
+	out_text(&out, "\t</Windchill>\n" "\t<Rain>\n" "\t\t<OneHour>\n");
 
 
 	/* <Rain> <OneHour> */
 
-	fprintf(fileptr, "\t\t\t<Value>%.2f</Value>\n",
-	        rain_1h_all(ws2300, config.rain_conv_factor,
-	                    &tempfloat_max, &time_max));
-
-	fprintf(fileptr, "\t\t\t<Max>%.2f</Max>\n", tempfloat_max);
+	out_element(&out, "\t\t\t", "Value",
+	            rain_1h_all(ws2300, config.rain_conv_factor,
+	                        &tempfloat_max, &time_max), 2);
+	out_element(&out, "\t\t\t", "Max", tempfloat_max, 2);
+	out_stamp(&out, "\t\t\t", "Max", &time_max);
 
-	fprintf(fileptr, "\t\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
-
-	fprintf(fileptr, "\t\t</OneHour>\n" "\t\t<TwentyFourHour>\n");
+	out_text(&out, "\t\t</OneHour>\n" "\t\t<TwentyFourHour>\n");
 	
 	
 	/* <Rain> <TwentyFourHour> */
 
-	fprintf(fileptr, "\t\t\t<Value>%.2f</Value>\n",
-			rain_24h_all(ws2300, config.rain_conv_factor,
-			             &tempfloat_max, &time_max));
-
-	fprintf(fileptr, "\t\t\t<Max>%.2f</Max>\n", tempfloat_max);
+	out_element(&out, "\t\t\t", "Value",
+	            rain_24h_all(ws2300, config.rain_conv_factor,
+	                         &tempfloat_max, &time_max), 2);
+	out_element(&out, "\t\t\t", "Max", tempfloat_max, 2);
+	out_stamp(&out, "\t\t\t", "Max", &time_max);
 
-	fprintf(fileptr, "\t\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
-
-	fprintf(fileptr, "\t\t</TwentyFourHour>\n" "\t\t<Total>\n");
+	out_text(&out, "\t\t</TwentyFourHour>\n" "\t\t<Total>\n");
 	
 	
 	/* <Rain> <Total> */
 
-	fprintf(fileptr, "\t\t\t<Value>%.2f</Value>\n",
-	        rain_total_all(ws2300, config.rain_conv_factor, &time_max));
-
-	fprintf(fileptr, "\t\t\t<Time>%02d:%02d</Time>\n"
-			"\t\t\t<Date>%04d-%02d-%02d</Date>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
+	out_element(&out, "\t\t\t", "Value",
+	            rain_total_all(ws2300, config.rain_conv_factor, &time_max), 2);
+	out_stamp(&out, "\t\t\t", "", &time_max);
 
-	fprintf(fileptr, "\t\t</Total>\n" "\t</Rain>\n" "\t<Pressure>\n");
+	out_text(&out, "\t\t</Total>\n" "\t</Rain>\n" "\t<Pressure>\n");
 	
 
 	/* <Pressure> */
 
-	fprintf(fileptr, "\t\t<Value>%.3f</Value>\n",
-	        rel_pressure(ws2300, config.pressure_conv_factor));
+	out_element(&out, "\t\t", "Value",
+	            rel_pressure(ws2300, config.pressure_conv_factor), 3);
 
 	rel_pressure_minmax(ws2300, config.pressure_conv_factor, &tempfloat_min,
 	                    &tempfloat_max, &time_min, &time_max);
-
-	fprintf(fileptr, "\t\t<Min>%.3f</Min>\n", tempfloat_min);
-	fprintf(fileptr, "\t\t<Max>%.3f</Max>\n", tempfloat_max);
-
-	fprintf(fileptr, "\t\t<MinTime>%02d:%02d</MinTime>\n"
-			"\t\t<MinDate>%04d-%02d-%02d</MinDate>\n",
-			time_min.hour, time_min.minute, time_min.year,
-			time_min.month, time_min.day);
-
-	fprintf(fileptr, "\t\t<MaxTime>%02d:%02d</MaxTime>\n"
-			"\t\t<MaxDate>%04d-%02d-%02d</MaxDate>\n",
-			time_max.hour, time_max.minute, time_max.year,
-	        time_max.month, time_max.day);
+	out_minmax(&out, "\t\t", tempfloat_min, tempfloat_max, 3, &time_min, &time_max);
 			
 
 	/* <Tendency> <Forecast> */
 	
 	tendency_forecast(ws2300, tendency, forecast);
 
-	fprintf(fileptr, "\t\t<Tendency>%s</Tendency>\n"
-			"\t</Pressure>\n"
-			"\t<Forecast>%s</Forecast>\n", tendency, forecast);
+	out_text(&out, "\t\t<Tendency>");
+	out_text(&out, tendency);
+	out_text(&out, "</Tendency>\n" "\t</Pressure>\n" "\t<Forecast>");
+	out_text(&out, forecast);
+	out_text(&out, "</Forecast>\n");
 
 
-	fprintf(fileptr, "</ws2300>\n");
+	out_text(&out, "</ws2300>\n");
 
-	fflush(fileptr);
+	if (out_write(&out, fileptr) < 0 || fflush(fileptr) != 0)
+		printf("Cannot write file %s\n", argv[1]);
 	fclose(fileptr);
 
 	close_weatherstation(ws2300);